@@ -14,13 +14,74 @@ LIBS+=$(STD_LIB)\libopengl32.a
 
 SOURCES += \
     main.cpp \
+    asset_loader.cpp \
+    benchmarks.cpp \
     bitmap_image.cpp \
-    object.cpp
+    block_encoder.cpp \
+    bvh.cpp \
+    cone_step_map.cpp \
+    frame_profiler.cpp \
+    frustum_culler.cpp \
+    light_clusterer.cpp \
+    frame_statistics.cpp \
+    mapped_file.cpp \
+    mesh_cache.cpp \
+    mesh_optimizer.cpp \
+    mesh_simplifier.cpp \
+    mip_generator.cpp \
+    mip_texture.cpp \
+    object.cpp \
+    packed_mesh.cpp \
+    program_cache.cpp \
+    render_state.cpp \
+    resolution_controller.cpp \
+    scene_target.cpp \
+    software_rasterizer.cpp \
+    tangent_space.cpp \
+    texture_cache.cpp \
+    texture_feedback.cpp \
+    thread_pool.cpp \
+    tile_file.cpp \
+    uniform_ring.cpp \
+    virtual_texture.cpp
 
 HEADERS += \
+    asset_loader.h \
+    benchmarks.h \
     bitmap_image.h \
-    object.h
+    block_encoder.h \
+    bvh.h \
+    cone_step_map.h \
+    frame_profiler.h \
+    frustum_culler.h \
+    light_clusterer.h \
+    frame_statistics.h \
+    mapped_file.h \
+    mesh_cache.h \
+    mesh_optimizer.h \
+    mesh_simplifier.h \
+    mip_generator.h \
+    mip_texture.h \
+    object.h \
+    packed_mesh.h \
+    program_cache.h \
+    render_state.h \
+    resolution_controller.h \
+    scene_target.h \
+    simd.h \
+    software_rasterizer.h \
+    tangent_space.h \
+    texture_cache.h \
+    texture_feedback.h \
+    thread_pool.h \
+    tile_file.h \
+    triple_buffer.h \
+    uniform_ring.h \
+    virtual_texture.h
 
 DISTFILES += \
+    feedback.fs \
     main.fs \
-    main.vs
+    main.vs \
+    post.fs \
+    post.vs
@@ -0,0 +1,82 @@
+#include "asset_loader.h"
+#include "mesh_cache.h"
+#include "texture_cache.h"
+
+#include <algorithm>
+#include <memory>
+
+asset_loader::asset_loader(unsigned threadCount)
+    : m_start(std::chrono::steady_clock::now())
+    , m_threads(1, std::this_thread::get_id())
+    , m_pool(std::max(threadCount == 0 ? thread_pool::hardware_threads() : threadCount, 1u) + 1)
+{
+}
+
+std::future< packed_mesh > asset_loader::load_mesh(const char* fileName)
+{
+    auto promise = std::make_shared< std::promise< packed_mesh > >();
+    std::string name(fileName);
+    m_pool.submit([this, promise, name]() {
+        // The span is added before the asset is handed over, so it is in the timeline once the asset is received.
+        double begin = now();
+        try {
+            packed_mesh asset = mesh_cache::load(name.c_str());
+            add_span(name, "load", begin, now());
+            promise->set_value(std::move(asset));
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return promise->get_future();
+}
+
+std::future< mip_texture > asset_loader::load_texture(const char* fileName, texture_usage usage, bool compressed)
+{
+    auto promise = std::make_shared< std::promise< mip_texture > >();
+    std::string name(fileName);
+    m_pool.submit([this, promise, name, usage, compressed]() {
+        // The span is added before the asset is handed over, so it is in the timeline once the asset is received.
+        double begin = now();
+        try {
+            mip_texture asset = texture_cache::load(name.c_str(), usage, compressed);
+            add_span(name, "load", begin, now());
+            promise->set_value(std::move(asset));
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    });
+    return promise->get_future();
+}
+
+double asset_loader::now() const
+{
+    return std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - m_start).count();
+}
+
+void asset_loader::add_span(const std::string& name, const char* phase, double begin, double end)
+{
+    std::lock_guard< std::mutex > lock(m_mutex);
+    m_spans.push_back({ name, phase, thread_number(), begin, end });
+}
+
+std::vector< asset_span > asset_loader::timeline() const
+{
+    std::vector< asset_span > result;
+    {
+        std::lock_guard< std::mutex > lock(m_mutex);
+        result = m_spans;
+    }
+    std::stable_sort(result.begin(), result.end(), [](const asset_span& a, const asset_span& b) { return a.begin < b.begin; });
+    return result;
+}
+
+unsigned asset_loader::thread_number()
+{
+    std::thread::id id = std::this_thread::get_id();
+    auto found = std::find(m_threads.begin(), m_threads.end(), id);
+    if (found != m_threads.end()) {
+        return unsigned(found - m_threads.begin());
+    }
+    m_threads.push_back(id);
+    return unsigned(m_threads.size() - 1);
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "packed_mesh.h"
+#include "mip_texture.h"
+#include "thread_pool.h"
+
+#include <vector>
+#include <string>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <chrono>
+
+/**
+ * A span of the startup timeline.
+ */
+struct asset_span
+{
+    /**
+     * Asset or step name.
+     */
+    std::string name;
+    /**
+     * What was done: "load" on a worker, "wait" and "upload" on the main thread, or any name given to add_span().
+     */
+    std::string phase;
+    /**
+     * Thread the span ran on: 0 is the thread that created the loader, workers are numbered from 1.
+     */
+    unsigned thread;
+    /**
+     * Start of the span in milliseconds since the loader was created.
+     */
+    double begin;
+    /**
+     * End of the span in milliseconds since the loader was created.
+     */
+    double end;
+};
+
+/**
+ * Loads meshes and textures on worker threads while the main thread creates the window and the GL context.
+ * Each load returns a future, the main thread takes the asset from it only when it is about to upload it.
+ * The loads go through mesh_cache and texture_cache, so a warm start only maps the cache files.
+ *
+ * The loader also records a startup timeline: spans of the loads, of the waits for them and of any other steps
+ * the main thread reports, so time to the first frame can be broken down.
+ */
+class asset_loader
+{
+public:
+    /**
+     * Constructor. Start worker threads and the timeline clock.
+     * @param threadCount Number of worker threads, 0 means one per hardware core. There is always at least one worker,
+     *                    so loads never run on the calling thread.
+     */
+    asset_loader(unsigned threadCount = 0);
+    /**
+     * Start loading a mesh, see mesh_cache::load().
+     * @param fileName The .obj file. The name is copied.
+     * @return Future of the mesh.
+     */
+    std::future< packed_mesh > load_mesh(const char* fileName);
+    /**
+     * Start loading a texture, see texture_cache::load().
+     * @param fileName The .bmp file. The name is copied.
+     * @param usage How the texture is used.
+     * @param compressed Compress the levels into blocks.
+     * @return Future of the texture.
+     */
+    std::future< mip_texture > load_texture(const char* fileName, texture_usage usage, bool compressed);
+    /**
+     * Take an asset from its future, blocking until it is loaded. The time spent blocked is added as a "wait" span.
+     * @param name Asset name for the timeline.
+     * @param asset Future returned by one of the load functions.
+     * @return The asset.
+     */
+    template< typename T >
+    T wait(const char* name, std::future< T >& asset)
+    {
+        double begin = now();
+        T result = asset.get();
+        add_span(name, "wait", begin, now());
+        return result;
+    }
+    /**
+     * Return time since the loader was created.
+     * @return Time in milliseconds.
+     */
+    double now() const;
+    /**
+     * Add a span to the timeline. Can be called from any thread.
+     * @param name Asset or step name.
+     * @param phase What was done.
+     * @param begin Start returned by now().
+     * @param end End returned by now().
+     */
+    void add_span(const std::string& name, const char* phase, double begin, double end);
+    /**
+     * Return spans recorded so far, sorted by start time.
+     * @return Spans.
+     */
+    std::vector< asset_span > timeline() const;
+
+private:
+    asset_loader(const asset_loader&) = delete;
+    asset_loader& operator=(const asset_loader&) = delete;
+
+    /**
+     * Return number of the calling thread for the timeline.
+     * Must be called with m_mutex locked.
+     * @return Thread number.
+     */
+    unsigned thread_number();
+
+    /**
+     * Start of the timeline.
+     */
+    std::chrono::steady_clock::time_point m_start;
+    /**
+     * Mutex that protects the spans and the thread list.
+     */
+    mutable std::mutex m_mutex;
+    /**
+     * Recorded spans.
+     */
+    std::vector< asset_span > m_spans;
+    /**
+     * Threads seen so far, the index is the thread number.
+     */
+    std::vector< std::thread::id > m_threads;
+    /**
+     * Worker threads. Declared last, so queued loads finish before the timeline is destroyed.
+     */
+    thread_pool m_pool;
+};
@@ -0,0 +1,313 @@
+#include "benchmarks.h"
+#include "bitmap_image.h"
+#include "block_encoder.h"
+#include "bvh.h"
+#include "mip_texture.h"
+#include "object.h"
+#include "tangent_space.h"
+#include "thread_pool.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+constexpr size_t benchmarks::TANGENT_TRIANGLES;
+constexpr int benchmarks::TANGENT_PASSES;
+constexpr int benchmarks::RAY_SPHERES[2];
+constexpr int benchmarks::RAY_RESOLUTION;
+constexpr int benchmarks::RAY_PASSES;
+constexpr int benchmarks::ENCODE_PASSES;
+constexpr int benchmarks::LIGHT_COUNTS[6];
+constexpr int benchmarks::LIGHT_PASSES;
+
+int benchmarks::run_tangents()
+{
+    object box("box.obj");
+    size_t boxPoints = box.vertexes().size();
+    if (boxPoints < 3) {
+        std::cout << "Cannot read a 3D model from the file!" << std::endl;
+        return 1;
+    }
+    size_t pointCount = TANGENT_TRIANGLES * 3;
+    std::vector< glm::vec3 > positions(pointCount);
+    std::vector< glm::vec2 > uvs(pointCount);
+    std::vector< glm::vec3 > normals(pointCount);
+    for (size_t i = 0; i < pointCount; i++) {
+        size_t copy = i / boxPoints;
+        float scale = 1.0f + float(copy % 97) / 97.0f;
+        positions[i] = box.vertexes()[i % boxPoints] * scale + glm::vec3(float(copy % 1024), float(copy / 1024), 0.0f);
+        uvs[i] = box.uvs()[i % boxPoints] * scale;
+        normals[i] = box.normals()[i % boxPoints];
+    }
+
+    std::vector< glm::vec3 > scalarTangents(pointCount);
+    std::vector< glm::vec3 > scalarBitangents(pointCount);
+    std::vector< glm::vec3 > tangents(pointCount);
+    std::vector< glm::vec3 > bitangents(pointCount);
+    double scalarTime = 0.0;
+    double simdTime = 0.0;
+    for (int pass = 0; pass < TANGENT_PASSES; pass++) {
+        auto begin = std::chrono::steady_clock::now();
+        compute_tangents_scalar(positions.data(), uvs.data(), normals.data(), TANGENT_TRIANGLES, scalarTangents.data(),
+                                scalarBitangents.data());
+        auto middle = std::chrono::steady_clock::now();
+        tangent_space::compute_points(positions.data(), uvs.data(), normals.data(), TANGENT_TRIANGLES, tangents.data(),
+                                      bitangents.data());
+        auto end = std::chrono::steady_clock::now();
+        double scalar = std::chrono::duration< double, std::milli >(middle - begin).count();
+        double simd = std::chrono::duration< double, std::milli >(end - middle).count();
+        scalarTime = pass == 0 ? scalar : std::min(scalarTime, scalar);
+        simdTime = pass == 0 ? simd : std::min(simdTime, simd);
+    }
+    // Degenerate triangles are the only ones expected to differ, the scalar loop gives them infinite or NaN vectors.
+    size_t differences = 0;
+    for (size_t i = 0; i < pointCount; i++) {
+        differences += memcmp(&tangents[i], &scalarTangents[i], sizeof(glm::vec3)) != 0
+                    || memcmp(&bitangents[i], &scalarBitangents[i], sizeof(glm::vec3)) != 0;
+    }
+
+    double triangles = double(TANGENT_TRIANGLES) / 1000.0;
+    std::cout << "Tangent space, " << TANGENT_TRIANGLES << " triangles, " << simd_float::WIDTH
+              << " lanes, fastest of " << TANGENT_PASSES << " passes:" << std::endl;
+    std::cout << "  scalar loop:    " << scalarTime << " ms, " << triangles / scalarTime << " Mtri/s" << std::endl;
+    std::cout << "  compute_points: " << simdTime << " ms, " << triangles / simdTime << " Mtri/s, "
+              << scalarTime / simdTime << "x" << std::endl;
+    std::cout << "  Points that differ: " << differences << std::endl;
+    return 0;
+}
+
+int benchmarks::run_rays()
+{
+    const size_t rayCount = size_t(RAY_RESOLUTION) * RAY_RESOLUTION;
+    std::vector< ray > primaryRays(rayCount);
+    std::vector< ray > scatteredRays(rayCount);
+    for (int y = 0; y < RAY_RESOLUTION; y++) {
+        for (int x = 0; x < RAY_RESOLUTION; x++) {
+            float u = (float(x) + 0.5f) / RAY_RESOLUTION * 0.6f - 0.3f;
+            float v = (float(y) + 0.5f) / RAY_RESOLUTION * 0.6f - 0.3f;
+            primaryRays[size_t(y) * RAY_RESOLUTION + size_t(x)] = ray{ glm::vec3(0.0f, 0.0f, -4.0f), glm::vec3(u, v, 1.0f), 100.0f };
+        }
+    }
+    for (size_t i = 0; i < rayCount; i++) {
+        // Low discrepancy points and directions, like the lights of update_lights().
+        glm::vec3 origin(std::fmod(i * 0.6180340f, 1.0f), std::fmod(i * 0.7548777f, 1.0f), std::fmod(i * 0.5698403f, 1.0f));
+        glm::vec3 direction(std::fmod(i * 0.3819660f, 1.0f), std::fmod(i * 0.4142136f, 1.0f), std::fmod(i * 0.7320508f, 1.0f));
+        scatteredRays[i] = ray{ origin - glm::vec3(0.5f), direction * 2.0f - glm::vec3(1.0f), 100.0f };
+    }
+    std::vector< ray_hit > hits(rayCount);
+    std::vector< ray_hit > packetHits(rayCount);
+    std::cout << "Ray queries, " << thread_pool::hardware_threads() << " threads to build, one thread to trace, "
+              << bvh::PACKET_SIZE << " rays per packet, fastest of " << RAY_PASSES << " passes:" << std::endl;
+    size_t totalMismatches = 0;
+    for (int quads : RAY_SPHERES) {
+        std::vector< glm::vec3 > positions;
+        std::vector< uint32_t > indices;
+        make_bumpy_sphere(quads, positions, indices);
+        auto buildBegin = std::chrono::steady_clock::now();
+        bvh tree(positions, indices, 0);
+        double buildTime = std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - buildBegin).count();
+
+        double singleTime = 0.0;
+        double packetTime = 0.0;
+        double scatteredTime = 0.0;
+        double occludedTime = 0.0;
+        size_t occluded = 0;
+        for (int pass = 0; pass < RAY_PASSES; pass++) {
+            auto begin = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < rayCount; i++) {
+                tree.intersect(primaryRays[i], hits[i]);
+            }
+            auto singleEnd = std::chrono::steady_clock::now();
+            tree.intersect(primaryRays.data(), rayCount, packetHits.data());
+            auto packetEnd = std::chrono::steady_clock::now();
+            ray_hit hit;
+            for (size_t i = 0; i < rayCount; i++) {
+                tree.intersect(scatteredRays[i], hit);
+            }
+            auto scatteredEnd = std::chrono::steady_clock::now();
+            occluded = 0;
+            for (size_t i = 0; i < rayCount; i++) {
+                occluded += tree.occluded(scatteredRays[i]);
+            }
+            auto occludedEnd = std::chrono::steady_clock::now();
+            double times[4] = { std::chrono::duration< double >(singleEnd - begin).count(),
+                                std::chrono::duration< double >(packetEnd - singleEnd).count(),
+                                std::chrono::duration< double >(scatteredEnd - packetEnd).count(),
+                                std::chrono::duration< double >(occludedEnd - scatteredEnd).count() };
+            singleTime = pass == 0 ? times[0] : std::min(singleTime, times[0]);
+            packetTime = pass == 0 ? times[1] : std::min(packetTime, times[1]);
+            scatteredTime = pass == 0 ? times[2] : std::min(scatteredTime, times[2]);
+            occludedTime = pass == 0 ? times[3] : std::min(occludedTime, times[3]);
+        }
+        size_t hitCount = 0;
+        size_t mismatches = 0;
+        for (size_t i = 0; i < rayCount; i++) {
+            hitCount += hits[i].triangle != bvh::NO_TRIANGLE;
+            // Rays through a shared edge hit both triangles at the same distance, either one may be reported.
+            // Both paths use the same arithmetic, so the distances must be equal.
+            mismatches += (hits[i].triangle == bvh::NO_TRIANGLE) != (packetHits[i].triangle == bvh::NO_TRIANGLE)
+                       || hits[i].distance != packetHits[i].distance;
+        }
+        totalMismatches += mismatches;
+
+        double millions = double(rayCount) / 1e6;
+        std::cout << "  " << tree.triangle_count() << " triangles: build " << buildTime << " ms, " << tree.node_count() << " nodes" << std::endl;
+        std::cout << "    primary rays, " << hitCount << " hits: single " << millions / singleTime << " Mrays/s, packets "
+                  << millions / packetTime << " Mrays/s, " << mismatches << " packet mismatches" << std::endl;
+        std::cout << "    scattered rays, " << occluded << " occluded: closest hit " << millions / scatteredTime << " Mrays/s, any hit "
+                  << millions / occludedTime << " Mrays/s" << std::endl;
+    }
+    if (totalMismatches != 0) {
+        std::cout << "Packets and single rays found different hits!" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int benchmarks::run_encoding()
+{
+    struct encode_source
+    {
+        const char* fileName;
+        texture_usage usage;
+    };
+    const encode_source SOURCES[] = { { "texture.bmp", TEXTURE_COLOR }, { "normal.bmp", TEXTURE_NORMAL },
+                                      { "displacement.bmp", TEXTURE_DISPLACEMENT } };
+    const char* FORMAT_NAMES[] = { "BGR8", "BC1", "BC4", "BC5" };
+    std::vector< unsigned > threadCounts(1, 1);
+    if (thread_pool::hardware_threads() > 1) {
+        threadCounts.push_back(thread_pool::hardware_threads());
+    }
+    std::cout << "Block compression, all mip levels, fastest of " << ENCODE_PASSES << " passes:" << std::endl;
+    for (const encode_source& source : SOURCES) {
+        bitmap_image image(source.fileName);
+        if (!image.pixels()) {
+            std::cout << "Cannot read " << source.fileName << "!" << std::endl;
+            return 1;
+        }
+        mip_texture uncompressed(image, source.usage);
+        double texels = 0.0;
+        for (const mip_level& level : uncompressed.levels()) {
+            texels += double(level.width) * level.height;
+        }
+        // Levels are built again before each pass, only the compression is timed.
+        for (unsigned threads : threadCounts) {
+            double time = 0.0;
+            compression_error error = {};
+            for (int pass = 0; pass < ENCODE_PASSES; pass++) {
+                mip_texture texture(image, source.usage);
+                auto begin = std::chrono::steady_clock::now();
+                texture.compress(threads);
+                double passTime = std::chrono::duration< double >(std::chrono::steady_clock::now() - begin).count();
+                time = pass == 0 ? passTime : std::min(time, passTime);
+                error = texture.error();
+            }
+            std::cout << "  " << std::setw(16) << std::left << source.fileName << std::right << " "
+                      << FORMAT_NAMES[mip_texture::compressed_format(source.usage)] << ", " << threads << " threads: "
+                      << time * 1000.0 << " ms, " << texels / time / 1e6 << " Mtexels/s, PSNR " << error.psnr << " dB" << std::endl;
+        }
+        if (source.usage != TEXTURE_DISPLACEMENT) {
+            continue;
+        }
+        // Depth is in R.
+        std::vector< uint8_t > blocks;
+        for (unsigned threads : threadCounts) {
+            thread_pool pool(threads);
+            double time = 0.0;
+            double squaredError = 0.0;
+            for (int pass = 0; pass < ENCODE_PASSES; pass++) {
+                auto begin = std::chrono::steady_clock::now();
+                double passError = 0.0;
+                for (size_t i = 0; i < uncompressed.levels().size(); i++) {
+                    const mip_level& level = uncompressed.levels()[i];
+                    blocks.resize(mip_texture::level_size(TEXTURE_FORMAT_BC4, level.width, level.height));
+                    passError += block_encoder::encode_bc4(pool, uncompressed.level_data(i), mip_texture::row_size(level.width), level.width,
+                                                           level.height, 2, blocks.data(), block_encoder::BC4_BLOCK_SIZE);
+                }
+                double passTime = std::chrono::duration< double >(std::chrono::steady_clock::now() - begin).count();
+                time = pass == 0 ? passTime : std::min(time, passTime);
+                squaredError = passError;
+            }
+            double rmse = std::sqrt(squaredError / texels);
+            std::cout << "  " << std::setw(16) << std::left << source.fileName << std::right << " BC4 depth, " << threads << " threads: "
+                      << time * 1000.0 << " ms, " << texels / time / 1e6 << " Mtexels/s, PSNR " << 20.0 * std::log10(255.0 / rmse)
+                      << " dB" << std::endl;
+        }
+    }
+    return 0;
+}
+
+int benchmarks::run_light_binning(light_clusterer& clusterer, const glm::mat4& cameraMatrix, double timeStep,
+                                  const std::function< void(float time, int count, std::vector< point_light >& lights) >& animate)
+{
+    std::vector< point_light > lights;
+    size_t clusterCount = size_t(light_clusterer::GRID_X) * light_clusterer::GRID_Y * light_clusterer::GRID_Z;
+    std::cout << "Light binning, " << clusterCount << " clusters, " << thread_pool::hardware_threads() << " threads:" << std::endl;
+    for (int count : LIGHT_COUNTS) {
+        cluster_statistics before = clusterer.statistics();
+        double updateTime = 0.0;
+        for (int pass = 0; pass < LIGHT_PASSES; pass++) {
+            auto updateBegin = std::chrono::steady_clock::now();
+            animate(float(pass * timeStep) / 2, count, lights);
+            updateTime += std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - updateBegin).count();
+            clusterer.bin(cameraMatrix, lights);
+        }
+        const cluster_statistics& after = clusterer.statistics();
+        std::cout << "  " << std::setw(6) << count << " lights: binning " << (after.milliseconds - before.milliseconds) / LIGHT_PASSES
+                  << " ms, animation " << updateTime / LIGHT_PASSES << " ms, "
+                  << double(after.indices - before.indices) / LIGHT_PASSES / clusterCount << " lights per cluster" << std::endl;
+    }
+    return 0;
+}
+
+void benchmarks::compute_tangents_scalar(const glm::vec3* positions, const glm::vec2* uvs, const glm::vec3* normals, size_t triangleCount,
+                                         glm::vec3* tangents, glm::vec3* bitangents)
+{
+    for (size_t i = 0; i < triangleCount * 3; i += 3) {
+        glm::vec3 deltaPos1 = positions[i + 1] - positions[i];
+        glm::vec3 deltaPos2 = positions[i + 2] - positions[i];
+        glm::vec2 deltaUV1 = uvs[i + 1] - uvs[i];
+        glm::vec2 deltaUV2 = uvs[i + 2] - uvs[i];
+        float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
+        glm::vec3 tangent = glm::normalize((deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r);
+        glm::vec3 bitangent = glm::normalize((deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x) * r);
+        for (size_t j = 0; j < 3; j++) {
+            tangents[i + j] = tangent;
+            bitangents[i + j] = bitangent;
+        }
+    }
+    for (size_t i = 0; i < triangleCount * 3; i++) {
+        const glm::vec3& n = normals[i];
+        glm::vec3& t = tangents[i];
+        t = glm::normalize(t - n * glm::dot(n, t));
+        if (glm::dot(glm::cross(n, t), bitangents[i]) < 0.0f) {
+            t = t * -1.0f;
+        }
+    }
+}
+
+void benchmarks::make_bumpy_sphere(int quads, std::vector< glm::vec3 >& positions, std::vector< uint32_t >& indices)
+{
+    positions.clear();
+    indices.clear();
+    for (int i = 0; i <= quads; i++) {
+        for (int j = 0; j <= quads; j++) {
+            float theta = 3.14159265f * float(i) / float(quads);
+            float phi = 6.2831853f * float(j) / float(quads);
+            float radius = 1.0f + 0.05f * std::sin(13.0f * theta) * std::cos(7.0f * phi);
+            positions.push_back(glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)) * radius);
+        }
+    }
+    for (int i = 0; i < quads; i++) {
+        for (int j = 0; j < quads; j++) {
+            uint32_t a = uint32_t(i * (quads + 1) + j);
+            uint32_t b = a + 1;
+            uint32_t c = a + uint32_t(quads) + 1;
+            uint32_t d = c + 1;
+            indices.insert(indices.end(), { a, c, b, b, c, d });
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "light_clusterer.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <glm/glm.hpp>
+
+/**
+ * Benchmarks of the CPU parts of the renderer that are run from the command line instead of drawing.
+ * Each one prints its measurements and returns the exit code of the program.
+ */
+class benchmarks
+{
+public:
+    /**
+     * Measure tangent_space::compute_points() against the scalar loop it replaced on one thread and print the fastest pass.
+     * The triangles are copies of box.obj, each moved and scaled a bit so their values differ.
+     * @return Exit code.
+     */
+    static int run_tangents();
+    /**
+     * Measure building the ray query hierarchy and tracing rays through it on bumpy spheres, and print Mrays/s.
+     * Primary rays of a camera in front of the sphere are traced one by one and in packets, rays from points inside
+     * the sphere in scattered directions are traced one by one. Packets must find hits at the same distances as single rays.
+     * @return Exit code, 1 if any packet hit differs from the single ray one.
+     */
+    static int run_rays();
+    /**
+     * Measure mip_texture::compress() on the textures of the scene and print the throughput and the error per format.
+     * Each texture is compressed on one thread and on all threads. BC4 is not used by any texture, so it is measured
+     * with block_encoder on the depth of the displacement texture.
+     * @return Exit code.
+     */
+    static int run_encoding();
+    /**
+     * Measure the light binning for several light counts and print the time per pass.
+     * @param clusterer Light clusterer with the projection of the view.
+     * @param cameraMatrix Matrix from world space to camera space.
+     * @param timeStep Animation time step between passes.
+     * @param animate Function that places the given number of lights at the given time, as the render loop does.
+     * @return Exit code.
+     */
+    static int run_light_binning(light_clusterer& clusterer, const glm::mat4& cameraMatrix, double timeStep,
+                                 const std::function< void(float time, int count, std::vector< point_light >& lights) >& animate);
+
+private:
+    /**
+     * Number of triangles and number of passes of the tangent space benchmark, the fastest pass is reported.
+     */
+    constexpr static size_t TANGENT_TRIANGLES = size_t(1) << 20;
+    constexpr static int TANGENT_PASSES = 5;
+    /**
+     * Quads per side of the displaced spheres the ray benchmark traces, 2 triangles per quad.
+     */
+    constexpr static int RAY_SPHERES[2] = { 60, 700 };
+    /**
+     * Width and height of the grid of primary rays, the same number of incoherent rays is traced.
+     */
+    constexpr static int RAY_RESOLUTION = 1024;
+    /**
+     * Number of passes of the ray benchmark, the fastest pass is reported.
+     */
+    constexpr static int RAY_PASSES = 3;
+    /**
+     * Number of passes of the encoding benchmark per texture and thread count, the fastest pass is reported.
+     */
+    constexpr static int ENCODE_PASSES = 3;
+    /**
+     * Light counts and number of passes per count of the binning benchmark.
+     */
+    constexpr static int LIGHT_COUNTS[6] = { 64, 256, 1024, 4096, 16384, 65536 };
+    constexpr static int LIGHT_PASSES = 100;
+
+    /**
+     * Calculate tangents and bitangents of non-indexed triangles the way object did before tangent_space, for comparison.
+     * The first pass solves each triangle, the second one orthogonalizes the tangent of each point.
+     * @param positions Point positions, 3 per triangle.
+     * @param uvs Point texture coordinates, 3 per triangle.
+     * @param normals Point normals, 3 per triangle.
+     * @param triangleCount Number of triangles.
+     * @param tangents Receives 3 tangents per triangle.
+     * @param bitangents Receives 3 bitangents per triangle.
+     */
+    static void compute_tangents_scalar(const glm::vec3* positions, const glm::vec2* uvs, const glm::vec3* normals, size_t triangleCount,
+                                        glm::vec3* tangents, glm::vec3* bitangents);
+    /**
+     * Make a unit sphere with bumps, so rays hit it at all angles and the hierarchy has to adapt to the surface.
+     * @param quads Number of quads along the latitude and the longitude.
+     * @param positions Receives vertex positions.
+     * @param indices Receives vertex indices, 2 triangles per quad.
+     */
+    static void make_bumpy_sphere(int quads, std::vector< glm::vec3 >& positions, std::vector< uint32_t >& indices);
+};
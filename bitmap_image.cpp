@@ -3,63 +3,93 @@
 #include <fstream>
 
 bitmap_image::bitmap_image(const char* fileName)
-    : m_width(0)
+    : m_file(fileName)
+    , m_pixels(nullptr)
+    , m_stride(0)
+    , m_bytesPerPixel(0)
+    , m_topDown(false)
+    , m_width(0)
     , m_height(0)
 {
-    // Open the file.
-    std::ifstream ifs(fileName);
-    if (!ifs) {
+    // Check that the file is big enough to hold the headers.
+    const char* header = m_file.data();
+    if (!header || m_file.size() < FILE_HEADER_SIZE + INFO_HEADER_SIZE) {
         return;
     }
-    // Read BMP header.
-    char header[HEADER_SIZE];
-    ifs.read(header, HEADER_SIZE);
-    if (!ifs) {
+    // Verify header signature.
+    if (header[0] != HEADER_SIGNATURE_1 || header[1] != HEADER_SIGNATURE_2) {
         return;
     }
-    // Verify header signature.
-    if (header[0] != HEADER_SIGNATURE_1 || header[1] != HEADER_SIGNATURE_2){
+    // Older BITMAPCOREHEADER files have a different layout, newer headers only add fields at the end.
+    if (read_uint32(header + INFO_SIZE_OFFSET) < INFO_HEADER_SIZE) {
         return;
     }
     // Read bitmap metadata.
-    int dataSize = *(int32_t*)(&header[DATA_SIZE_OFFSET]);
-    m_width = *(int32_t*)(&header[WIDTH_OFFSET]);
-    m_height = *(int32_t*)(&header[HEIGHT_OFFSET]);
-    if (m_width == 0 || m_height == 0) {
-        m_width = 0;
-        m_height = 0;
+    int32_t width = int32_t(read_uint32(header + WIDTH_OFFSET));
+    int32_t height = int32_t(read_uint32(header + HEIGHT_OFFSET));
+    uint16_t bitCount = read_uint16(header + BIT_COUNT_OFFSET);
+    uint32_t compression = read_uint32(header + COMPRESSION_OFFSET);
+    if (width <= 0 || height == 0 || height == INT32_MIN || read_uint16(header + PLANES_OFFSET) != 1) {
         return;
     }
-    // Read bitmap data.
-    int dataPointer = *(int32_t*)(&header[DATA_POINTER_OFFSET]);
-    // If size of pointer are zero we should use default values.
-    if (dataSize == 0) {
-        // Derive from the image size.
-        dataSize = m_width * m_height * BYTES_PER_PIXEL;
-    }
-    if (dataPointer == 0){
-        // By default data starts right after header.
-        dataPointer = HEADER_SIZE;
+    if (bitCount == 24 && compression == COMPRESSION_RGB) {
+        m_bytesPerPixel = 3;
+    } else if (bitCount == 32 && compression == COMPRESSION_RGB) {
+        m_bytesPerPixel = 4;
+    } else if (bitCount == 32 && compression == COMPRESSION_BITFIELDS) {
+        // Only the default BGRA byte order can be used without conversion.
+        if (m_file.size() < MASKS_OFFSET + 12
+            || read_uint32(header + MASKS_OFFSET) != 0x00FF0000
+            || read_uint32(header + MASKS_OFFSET + 4) != 0x0000FF00
+            || read_uint32(header + MASKS_OFFSET + 8) != 0x000000FF) {
+            return;
+        }
+        m_bytesPerPixel = 4;
+    } else {
+        return;
     }
-    // Read bitmap data.
-    m_data.resize(dataSize);
-    ifs.read(&m_data[0], dataSize);
-    if (!ifs.good() && !ifs.eof()) {
-        m_data.clear();
+    // Rows are padded to a multiple of 4 bytes.
+    m_topDown = height < 0;
+    m_width = width;
+    m_height = m_topDown ? -height : height;
+    m_stride = (size_t(m_width) * size_t(m_bytesPerPixel) + 3) / 4 * 4;
+    // Pixels start at the data pointer, which can leave a gap after the headers.
+    size_t dataPointer = read_uint32(header + DATA_POINTER_OFFSET);
+    if (dataPointer < FILE_HEADER_SIZE + INFO_HEADER_SIZE || dataPointer > m_file.size()
+        || (m_file.size() - dataPointer) / m_stride < size_t(m_height)) {
+        m_stride = 0;
+        m_bytesPerPixel = 0;
+        m_topDown = false;
         m_width = 0;
         m_height = 0;
+        return;
     }
+    m_pixels = reinterpret_cast< const uint8_t* >(header + dataPointer);
+}
+
+const uint8_t* bitmap_image::pixels() const
+{
+    return m_pixels;
+}
+
+const uint8_t* bitmap_image::row(int y) const
+{
+    return m_pixels + size_t(m_topDown ? m_height - 1 - y : y) * m_stride;
+}
+
+size_t bitmap_image::stride() const
+{
+    return m_stride;
 }
 
-bitmap_image::~bitmap_image()
+int bitmap_image::bytes_per_pixel() const
 {
-    m_width = 0;
-    m_height = 0;
+    return m_bytesPerPixel;
 }
 
-const std::vector< char >& bitmap_image::data() const
+bool bitmap_image::top_down() const
 {
-    return m_data;
+    return m_topDown;
 }
 
 int bitmap_image::width() const
@@ -71,3 +101,53 @@ int bitmap_image::height() const
 {
     return m_height;
 }
+
+bool bitmap_image::save(const char* fileName, int width, int height, const uint8_t* pixels)
+{
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+    size_t stride = (size_t(width) * 3 + 3) / 4 * 4;
+    size_t dataSize = stride * size_t(height);
+    // Fill BITMAPFILEHEADER and BITMAPINFOHEADER, fields that are not set stay zero.
+    char header[FILE_HEADER_SIZE + INFO_HEADER_SIZE] = {};
+    header[0] = HEADER_SIGNATURE_1;
+    header[1] = HEADER_SIGNATURE_2;
+    write_uint32(header + FILE_SIZE_OFFSET, uint32_t(sizeof(header) + dataSize));
+    write_uint32(header + DATA_POINTER_OFFSET, uint32_t(sizeof(header)));
+    write_uint32(header + INFO_SIZE_OFFSET, uint32_t(INFO_HEADER_SIZE));
+    write_uint32(header + WIDTH_OFFSET, uint32_t(width));
+    write_uint32(header + HEIGHT_OFFSET, uint32_t(height));
+    write_uint16(header + PLANES_OFFSET, 1);
+    write_uint16(header + BIT_COUNT_OFFSET, 24);
+    write_uint32(header + COMPRESSION_OFFSET, COMPRESSION_RGB);
+    write_uint32(header + IMAGE_SIZE_OFFSET, uint32_t(dataSize));
+    std::ofstream ofs(fileName, std::ios::binary | std::ios::trunc);
+    ofs.write(header, sizeof(header));
+    ofs.write(reinterpret_cast< const char* >(pixels), dataSize);
+    return bool(ofs);
+}
+
+uint32_t bitmap_image::read_uint32(const char* p)
+{
+    const uint8_t* bytes = reinterpret_cast< const uint8_t* >(p);
+    return uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8 | uint32_t(bytes[2]) << 16 | uint32_t(bytes[3]) << 24;
+}
+
+uint16_t bitmap_image::read_uint16(const char* p)
+{
+    const uint8_t* bytes = reinterpret_cast< const uint8_t* >(p);
+    return uint16_t(bytes[0] | bytes[1] << 8);
+}
+
+void bitmap_image::write_uint32(char* p, uint32_t value)
+{
+    write_uint16(p, uint16_t(value));
+    write_uint16(p + 2, uint16_t(value >> 16));
+}
+
+void bitmap_image::write_uint16(char* p, uint16_t value)
+{
+    p[0] = char(value & 0xFF);
+    p[1] = char(value >> 8);
+}
@@ -1,29 +1,54 @@
 #pragma once
 
-#include <vector>
+#include "mapped_file.h"
+
+#include <cstddef>
 #include <cstdint>
 
 /**
  * Helper class to read bitmap data from a *.bmp file.
+ * The file is memory mapped and pixels are read in place, rows keep the padding they have in the file.
+ * Supported formats are uncompressed 24-bit BGR and 32-bit BGRA (BI_RGB or BI_BITFIELDS with the default masks),
+ * stored bottom-up or top-down.
  */
 class bitmap_image
 {
 public:
     /**
      * Read a *.bmp file and extract bitmap data.
-     * @param fileName
+     * If the file cannot be read or has an unsupported format, the image is empty.
+     * @param fileName File to read.
      */
     bitmap_image(const char* fileName);
     /**
-     * Destructor.
+     * Return the first pixel row in the order of the file.
+     * Pixels are stored as B, G, R (and A for 32-bit images) bytes.
+     * @return Pointer to the pixel data or nullptr if the image is empty.
+     */
+    const uint8_t* pixels() const;
+    /**
+     * Return a row of pixels counted from the bottom of the image, the order OpenGL expects.
+     * @param y Row number, 0 is the bottom row.
+     * @return Pointer to the first pixel of the row.
      */
-    ~bitmap_image();
+    const uint8_t* row(int y) const;
     /**
-     * Return the bitmap data.
-     * Each pixel is represented by 3 bytes.
-     * @return Bitmap data.
+     * Return the distance between rows in bytes.
+     * Rows are padded to 4 bytes, which matches GL_UNPACK_ALIGNMENT of 4.
+     * @return Row stride in bytes.
      */
-    const std::vector< char >& data() const;
+    size_t stride() const;
+    /**
+     * Return size of one pixel in bytes.
+     * @return 3 for BGR images, 4 for BGRA images, 0 if the image is empty.
+     */
+    int bytes_per_pixel() const;
+    /**
+     * Return true if the first row in the file is the top row of the image.
+     * OpenGL expects the bottom row first, so such images cannot be uploaded as one block.
+     * @return True if rows are stored from top to bottom.
+     */
+    bool top_down() const;
     /**
      * Return width of the bitmap in pixels.
      * @return Width of the bitmap in pixels.
@@ -34,12 +59,27 @@ public:
      * @return Height of the bitmap in pixels.
      */
     int height() const;
+    /**
+     * Write 24-bit BGR pixels to a *.bmp file.
+     * Rows go from the bottom of the image to the top and are padded to 4 bytes,
+     * which is what glReadPixels returns with GL_BGR and GL_PACK_ALIGNMENT of 4.
+     * @param fileName File to write.
+     * @param width Width in pixels.
+     * @param height Height in pixels.
+     * @param pixels Pixel rows.
+     * @return True if the file is written.
+     */
+    static bool save(const char* fileName, int width, int height, const uint8_t* pixels);
 
 private:
     /**
-     * Size of the BMP header in bytes.
+     * Size of the file header in bytes.
+     */
+    constexpr static size_t FILE_HEADER_SIZE = 14;
+    /**
+     * Size of the smallest supported info header (BITMAPINFOHEADER) in bytes.
      */
-    constexpr static int HEADER_SIZE = 54;
+    constexpr static size_t INFO_HEADER_SIZE = 40;
     /**
      * First byte of the header signature.
      */
@@ -49,30 +89,99 @@ private:
      */
     constexpr static int HEADER_SIGNATURE_2 = 'M';
     /**
-     * BMP uses 3 bytes per pixel: R, G and B.
+     * Offset in the header for 4-bytes file size.
      */
-    constexpr static int BYTES_PER_PIXEL = 3;
+    constexpr static size_t FILE_SIZE_OFFSET = 0x02;
     /**
-     * Offset in the header for 4-bytes data size value.
+     * Offset in the header for 4-bytes data pointer.
      */
-    constexpr static int DATA_SIZE_OFFSET = 0x22;
+    constexpr static size_t DATA_POINTER_OFFSET = 0x0A;
     /**
-     * Offset in the header for 4-bytes data pointer.
+     * Offset in the header for 4-bytes info header size.
      */
-    constexpr static int DATA_POINTER_OFFSET = 0x0A;
+    constexpr static size_t INFO_SIZE_OFFSET = 0x0E;
     /**
      * Offset in the header for 4-bytes width value.
      */
-    constexpr static int WIDTH_OFFSET = 0x12;
+    constexpr static size_t WIDTH_OFFSET = 0x12;
+    /**
+     * Offset in the header for 4-bytes height value. Negative height means a top-down image.
+     */
+    constexpr static size_t HEIGHT_OFFSET = 0x16;
+    /**
+     * Offset in the header for 2-bytes number of color planes.
+     */
+    constexpr static size_t PLANES_OFFSET = 0x1A;
+    /**
+     * Offset in the header for 2-bytes number of bits per pixel.
+     */
+    constexpr static size_t BIT_COUNT_OFFSET = 0x1C;
+    /**
+     * Offset in the header for 4-bytes compression method.
+     */
+    constexpr static size_t COMPRESSION_OFFSET = 0x1E;
+    /**
+     * Offset in the header for 4-bytes size of the pixel data.
+     */
+    constexpr static size_t IMAGE_SIZE_OFFSET = 0x22;
+    /**
+     * Offset in the header for the red, green and blue 4-bytes channel masks of BI_BITFIELDS images.
+     */
+    constexpr static size_t MASKS_OFFSET = 0x36;
+    /**
+     * Uncompressed pixels.
+     */
+    constexpr static uint32_t COMPRESSION_RGB = 0;
+    /**
+     * Uncompressed pixels with channel masks.
+     */
+    constexpr static uint32_t COMPRESSION_BITFIELDS = 3;
+
+    /**
+     * Read a little-endian 4-bytes value.
+     * @param p Pointer to the value.
+     * @return Value.
+     */
+    static uint32_t read_uint32(const char* p);
+    /**
+     * Read a little-endian 2-bytes value.
+     * @param p Pointer to the value.
+     * @return Value.
+     */
+    static uint16_t read_uint16(const char* p);
+    /**
+     * Write a little-endian 4-bytes value.
+     * @param p Pointer to the value.
+     * @param value Value.
+     */
+    static void write_uint32(char* p, uint32_t value);
     /**
-     * Offset in the header for 4-bytes height value.
+     * Write a little-endian 2-bytes value.
+     * @param p Pointer to the value.
+     * @param value Value.
      */
-    constexpr static int HEIGHT_OFFSET = 0x16;
+    static void write_uint16(char* p, uint16_t value);
 
     /**
-     * Bitmap data array.
+     * Mapped file content.
+     */
+    mapped_file m_file;
+    /**
+     * First pixel row in the order of the file.
+     */
+    const uint8_t* m_pixels;
+    /**
+     * Row stride in bytes.
+     */
+    size_t m_stride;
+    /**
+     * Size of one pixel in bytes.
+     */
+    int m_bytesPerPixel;
+    /**
+     * Rows are stored from top to bottom.
      */
-    std::vector< char > m_data;
+    bool m_topDown;
     /**
      * Bitmap width in pixels.
      */
@@ -0,0 +1,320 @@
+#include "block_encoder.h"
+#include "thread_pool.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+double block_encoder::encode_bc1(thread_pool& pool, const uint8_t* texels, size_t stride, uint32_t width, uint32_t height, uint8_t* blocks)
+{
+    uint32_t blocksX = block_count(width);
+    uint32_t blocksY = block_count(height);
+    // Errors are summed per row of blocks and then in the row order, so the sum does not depend on the threads.
+    std::vector< double > rowErrors(blocksY, 0.0);
+    pool.parallel_for(blocksY, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            for (uint32_t x = 0; x < blocksX; x++) {
+                block_texels block;
+                int inside = load_block(texels, stride, width, height, x, uint32_t(y), block);
+                rowErrors[y] += encode_bc1_block(block, inside, blocks + (y * blocksX + x) * BC1_BLOCK_SIZE);
+            }
+        }
+    });
+    double error = 0.0;
+    for (double rowError : rowErrors) {
+        error += rowError;
+    }
+    return error;
+}
+
+double block_encoder::encode_bc4(thread_pool& pool, const uint8_t* texels, size_t stride, uint32_t width, uint32_t height, int channel,
+                                 uint8_t* blocks, size_t blockStride)
+{
+    uint32_t blocksX = block_count(width);
+    uint32_t blocksY = block_count(height);
+    std::vector< double > rowErrors(blocksY, 0.0);
+    pool.parallel_for(blocksY, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            for (uint32_t x = 0; x < blocksX; x++) {
+                block_texels block;
+                int inside = load_block(texels, stride, width, height, x, uint32_t(y), block);
+                rowErrors[y] += encode_bc4_block(block.values[channel], inside, blocks + (y * blocksX + x) * blockStride);
+            }
+        }
+    });
+    double error = 0.0;
+    for (double rowError : rowErrors) {
+        error += rowError;
+    }
+    return error;
+}
+
+double block_encoder::encode_bc5(thread_pool& pool, const uint8_t* texels, size_t stride, uint32_t width, uint32_t height, uint8_t* blocks)
+{
+    // A BC5 block is a BC4 block of the red channel followed by a BC4 block of the green channel.
+    double error = encode_bc4(pool, texels, stride, width, height, 2, blocks, BC5_BLOCK_SIZE);
+    error += encode_bc4(pool, texels, stride, width, height, 1, blocks + BC4_BLOCK_SIZE, BC5_BLOCK_SIZE);
+    return error;
+}
+
+uint32_t block_encoder::block_count(uint32_t size)
+{
+    return (size + 3) / 4;
+}
+
+int block_encoder::load_block(const uint8_t* texels, size_t stride, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY,
+                              block_texels& result)
+{
+    int inside = 0;
+    for (uint32_t j = 0; j < 4; j++) {
+        uint32_t y = std::min(blockY * 4 + j, height - 1);
+        for (uint32_t i = 0; i < 4; i++) {
+            uint32_t x = std::min(blockX * 4 + i, width - 1);
+            const uint8_t* texel = texels + y * stride + x * 3;
+            for (int c = 0; c < 3; c++) {
+                result.values[c][j * 4 + i] = texel[c];
+            }
+            if (blockX * 4 + i < width && blockY * 4 + j < height) {
+                inside |= 1 << (j * 4 + i);
+            }
+        }
+    }
+    return inside;
+}
+
+double block_encoder::encode_bc1_block(const block_texels& block, int inside, uint8_t* result)
+{
+    // Find the mean and the covariance of the colors.
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < 16; i++) {
+            mean[c] += block.values[c][i];
+        }
+        mean[c] /= 16.0f;
+    }
+    float covariance[3][3] = {};
+    for (int i = 0; i < 16; i++) {
+        float d[3] = { block.values[0][i] - mean[0], block.values[1][i] - mean[1], block.values[2][i] - mean[2] };
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) {
+                covariance[a][b] += d[a] * d[b];
+            }
+        }
+    }
+    // Find the principal axis with power iterations.
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[3];
+        for (int a = 0; a < 3; a++) {
+            next[a] = covariance[a][0] * axis[0] + covariance[a][1] * axis[1] + covariance[a][2] * axis[2];
+        }
+        float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length == 0.0f) {
+            break;
+        }
+        for (int a = 0; a < 3; a++) {
+            axis[a] = next[a] / length;
+        }
+    }
+    // Take the extreme projections as endpoints and move them inside a bit, so the extremes are not overweighted.
+    float minimum = 0.0f;
+    float maximum = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        float projection = 0.0f;
+        for (int c = 0; c < 3; c++) {
+            projection += (block.values[c][i] - mean[c]) * axis[c];
+        }
+        minimum = std::min(minimum, projection);
+        maximum = std::max(maximum, projection);
+    }
+    float inset = (maximum - minimum) / 16.0f;
+    float endpoints[2][3];
+    for (int c = 0; c < 3; c++) {
+        endpoints[0][c] = mean[c] + axis[c] * (maximum - inset);
+        endpoints[1][c] = mean[c] + axis[c] * (minimum + inset);
+    }
+    // Fit the block to the endpoints, then refit the endpoints to the chosen indices by least squares.
+    uint16_t best[2] = { 0, 0 };
+    int bestIndices[16] = {};
+    float bestError = 0.0f;
+    for (int pass = 0; pass < 2; pass++) {
+        uint16_t packed[2] = { pack_565(endpoints[0]), pack_565(endpoints[1]) };
+        // The first endpoint must be greater, otherwise the block is decoded with 3 colors and transparency.
+        if (packed[0] < packed[1]) {
+            std::swap(packed[0], packed[1]);
+        }
+        float palette[4][3];
+        unpack_565(packed[0], palette[0]);
+        unpack_565(packed[1], palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+        int indices[16];
+        float error = choose_bc1_indices(block, palette, indices);
+        if (packed[0] == packed[1]) {
+            // Equal endpoints only have one color, and index 0 is valid in both modes.
+            std::fill(indices, indices + 16, 0);
+        }
+        if (pass == 0 || error < bestError) {
+            best[0] = packed[0];
+            best[1] = packed[1];
+            std::copy(indices, indices + 16, bestIndices);
+            bestError = error;
+        }
+        if (pass == 1 || packed[0] == packed[1]) {
+            break;
+        }
+        // Each texel is a mix of the endpoints with a known weight, solve for the endpoints.
+        const float WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0.0f;
+        float ab = 0.0f;
+        float bb = 0.0f;
+        float ax[3] = { 0.0f, 0.0f, 0.0f };
+        float bx[3] = { 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; i++) {
+            float alpha = WEIGHTS[indices[i]];
+            float beta = 1.0f - alpha;
+            aa += alpha * alpha;
+            ab += alpha * beta;
+            bb += beta * beta;
+            for (int c = 0; c < 3; c++) {
+                ax[c] += alpha * block.values[c][i];
+                bx[c] += beta * block.values[c][i];
+            }
+        }
+        float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f) {
+            break;
+        }
+        for (int c = 0; c < 3; c++) {
+            endpoints[0][c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+            endpoints[1][c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+        }
+    }
+    // Write the block: endpoints and 2 bits per texel, the first texel in the lowest bits.
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++) {
+        bits |= uint32_t(bestIndices[i]) << (i * 2);
+    }
+    result[0] = uint8_t(best[0]);
+    result[1] = uint8_t(best[0] >> 8);
+    result[2] = uint8_t(best[1]);
+    result[3] = uint8_t(best[1] >> 8);
+    for (int i = 0; i < 4; i++) {
+        result[4 + i] = uint8_t(bits >> (i * 8));
+    }
+    // Measure the error of the texels inside the image.
+    float palette[4][3];
+    unpack_565(best[0], palette[0]);
+    unpack_565(best[1], palette[1]);
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+        palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+    }
+    double error = 0.0;
+    for (int i = 0; i < 16; i++) {
+        if (inside & (1 << i)) {
+            for (int c = 0; c < 3; c++) {
+                double d = double(palette[bestIndices[i]][c]) - block.values[c][i];
+                error += d * d;
+            }
+        }
+    }
+    return error;
+}
+
+float block_encoder::choose_bc1_indices(const block_texels& block, const float palette[4][3], int* indices)
+{
+    const simd_float MAX = simd_broadcast(3.4e38f);
+    float error = 0.0f;
+    for (int first = 0; first < 16; first += simd_float::WIDTH) {
+        simd_float b = simd_load(&block.values[0][first]);
+        simd_float g = simd_load(&block.values[1][first]);
+        simd_float r = simd_load(&block.values[2][first]);
+        simd_float bestDistance = MAX;
+        simd_float bestIndex = simd_broadcast(0.0f);
+        for (int k = 0; k < 4; k++) {
+            simd_float db = b - simd_broadcast(palette[k][0]);
+            simd_float dg = g - simd_broadcast(palette[k][1]);
+            simd_float dr = r - simd_broadcast(palette[k][2]);
+            simd_float distance = db * db + dg * dg + dr * dr;
+            simd_mask closer = distance < bestDistance;
+            bestDistance = simd_select(closer, distance, bestDistance);
+            bestIndex = simd_select(closer, simd_broadcast(float(k)), bestIndex);
+        }
+        float distances[simd_float::WIDTH];
+        float chosen[simd_float::WIDTH];
+        simd_store(distances, bestDistance);
+        simd_store(chosen, bestIndex);
+        for (int lane = 0; lane < simd_float::WIDTH; lane++) {
+            indices[first + lane] = int(chosen[lane]);
+            error += distances[lane];
+        }
+    }
+    return error;
+}
+
+double block_encoder::encode_bc4_block(const float* values, int inside, uint8_t* result)
+{
+    float minimum = values[0];
+    float maximum = values[0];
+    for (int i = 1; i < 16; i++) {
+        minimum = std::min(minimum, values[i]);
+        maximum = std::max(maximum, values[i]);
+    }
+    // With the first endpoint greater than the second one, the block has 8 values evenly spread between them.
+    // Value k / 7 of the way from the second endpoint to the first one has index 1 for k = 0, 0 for k = 7 and 8 - k otherwise.
+    uint8_t high = uint8_t(maximum);
+    uint8_t low = uint8_t(minimum);
+    float steps[16];
+    if (high == low) {
+        std::fill(steps, steps + 16, 7.0f);
+    } else {
+        const simd_float ZERO = simd_broadcast(0.0f);
+        const simd_float SEVEN = simd_broadcast(7.0f);
+        simd_float scale = simd_broadcast(7.0f / float(high - low));
+        simd_float base = simd_broadcast(float(low));
+        for (int first = 0; first < 16; first += simd_float::WIDTH) {
+            simd_float step = simd_round((simd_load(values + first) - base) * scale);
+            simd_store(steps + first, simd_min(simd_max(step, ZERO), SEVEN));
+        }
+    }
+    // Write the block: endpoints and 3 bits per texel, the first texel in the lowest bits.
+    uint64_t bits = 0;
+    double error = 0.0;
+    for (int i = 0; i < 16; i++) {
+        int k = int(steps[i]);
+        uint64_t index = k == 7 ? 0 : (k == 0 ? 1 : uint64_t(8 - k));
+        bits |= index << (i * 3);
+        if (inside & (1 << i)) {
+            double d = (k * double(high) + (7 - k) * double(low)) / 7.0 - values[i];
+            error += d * d;
+        }
+    }
+    result[0] = high;
+    result[1] = low;
+    for (int i = 0; i < 6; i++) {
+        result[2 + i] = uint8_t(bits >> (i * 8));
+    }
+    return error;
+}
+
+uint16_t block_encoder::pack_565(const float* color)
+{
+    int b = int(std::round(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f));
+    int g = int(std::round(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f));
+    int r = int(std::round(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f));
+    return uint16_t(r << 11 | g << 5 | b);
+}
+
+void block_encoder::unpack_565(uint16_t packed, float* color)
+{
+    int b = packed & 0x1F;
+    int g = (packed >> 5) & 0x3F;
+    int r = packed >> 11;
+    color[0] = float(b << 3 | b >> 2);
+    color[1] = float(g << 2 | g >> 4);
+    color[2] = float(r << 3 | r >> 2);
+}
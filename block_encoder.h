@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class thread_pool;
+
+/**
+ * Helper class to compress images into 4x4 texel blocks of the BC1, BC4 and BC5 formats.
+ * See https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression
+ *
+ * BC1 stores RGB in 8 bytes per block: two RGB565 endpoints and 2-bit indices into the 4 colors between them.
+ * Endpoints are found along the principal axis of the block colors and refined once by least squares.
+ * BC4 stores one channel in 8 bytes per block: two 8-bit endpoints and 3-bit indices into the 8 values between them.
+ * BC5 is two BC4 blocks, for the red and the green channel.
+ *
+ * Each block is encoded with the 16 texels in lanes of simd_float, rows of blocks are split between threads.
+ * Blocks that cross the right or the bottom edge of the image repeat the last texels.
+ */
+class block_encoder
+{
+public:
+    /**
+     * Size of a BC1 block in bytes.
+     */
+    constexpr static size_t BC1_BLOCK_SIZE = 8;
+    /**
+     * Size of a BC4 block in bytes.
+     */
+    constexpr static size_t BC4_BLOCK_SIZE = 8;
+    /**
+     * Size of a BC5 block in bytes.
+     */
+    constexpr static size_t BC5_BLOCK_SIZE = 16;
+
+    /**
+     * Encode an image of B, G, R texels into BC1 blocks.
+     * @param pool Threads to encode with.
+     * @param texels Texels, 3 bytes each.
+     * @param stride Distance between rows in bytes.
+     * @param width Width in texels.
+     * @param height Height in texels.
+     * @param blocks Receives blocks row by row.
+     * @return Sum of squared errors of the R, G and B values of the decoded image.
+     */
+    static double encode_bc1(thread_pool& pool, const uint8_t* texels, size_t stride, uint32_t width, uint32_t height, uint8_t* blocks);
+    /**
+     * Encode one channel of an image of B, G, R texels into BC4 blocks.
+     * @param pool Threads to encode with.
+     * @param texels Texels, 3 bytes each.
+     * @param stride Distance between rows in bytes.
+     * @param width Width in texels.
+     * @param height Height in texels.
+     * @param channel Channel to encode: 0 for B, 1 for G, 2 for R.
+     * @param blocks Receives blocks row by row.
+     * @param blockStride Distance between blocks in bytes.
+     * @return Sum of squared errors of the decoded values.
+     */
+    static double encode_bc4(thread_pool& pool, const uint8_t* texels, size_t stride, uint32_t width, uint32_t height, int channel,
+                             uint8_t* blocks, size_t blockStride = BC4_BLOCK_SIZE);
+    /**
+     * Encode the R and G channels of an image of B, G, R texels into BC5 blocks.
+     * @param pool Threads to encode with.
+     * @param texels Texels, 3 bytes each.
+     * @param stride Distance between rows in bytes.
+     * @param width Width in texels.
+     * @param height Height in texels.
+     * @param blocks Receives blocks row by row.
+     * @return Sum of squared errors of the decoded R and G values.
+     */
+    static double encode_bc5(thread_pool& pool, const uint8_t* texels, size_t stride, uint32_t width, uint32_t height, uint8_t* blocks);
+    /**
+     * Return number of blocks along a side of an image.
+     * @param size Width or height in texels.
+     * @return Number of blocks.
+     */
+    static uint32_t block_count(uint32_t size);
+
+private:
+    /**
+     * Texels of one block as structures of arrays.
+     */
+    struct block_texels
+    {
+        float values[3][16];
+    };
+
+    /**
+     * Copy a block of texels, repeating the last row and column at the edges.
+     * @param texels Texels.
+     * @param stride Distance between rows in bytes.
+     * @param width Width in texels.
+     * @param height Height in texels.
+     * @param blockX Column of the block.
+     * @param blockY Row of the block.
+     * @param result Receives B, G and R values.
+     * @return Mask of texels inside the image, bit i for texel i.
+     */
+    static int load_block(const uint8_t* texels, size_t stride, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY,
+                          block_texels& result);
+    /**
+     * Encode one BC1 block.
+     * @param block Texels of the block.
+     * @param inside Mask of texels inside the image.
+     * @param result Receives 8 bytes.
+     * @return Sum of squared errors of the texels inside the image.
+     */
+    static double encode_bc1_block(const block_texels& block, int inside, uint8_t* result);
+    /**
+     * Choose the nearest of 4 colors for each texel of a block.
+     * @param block Texels of the block.
+     * @param palette Colors as B, G, R values.
+     * @param indices Receives indices of the colors.
+     * @return Sum of squared errors of all texels.
+     */
+    static float choose_bc1_indices(const block_texels& block, const float palette[4][3], int* indices);
+    /**
+     * Encode one channel of a block as a BC4 block.
+     * @param values 16 values of the channel.
+     * @param inside Mask of texels inside the image.
+     * @param result Receives 8 bytes.
+     * @return Sum of squared errors of the texels inside the image.
+     */
+    static double encode_bc4_block(const float* values, int inside, uint8_t* result);
+    /**
+     * Quantize a color to RGB565.
+     * @param color B, G, R values.
+     * @return Packed color.
+     */
+    static uint16_t pack_565(const float* color);
+    /**
+     * Expand an RGB565 color to 8-bit values.
+     * @param packed Packed color.
+     * @param color Receives B, G, R values.
+     */
+    static void unpack_565(uint16_t packed, float* color);
+};
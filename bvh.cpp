@@ -0,0 +1,576 @@
+#include "bvh.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+
+namespace
+{
+
+/**
+ * Rays of a packet stored as structures of arrays, one lane per ray.
+ */
+struct packet
+{
+    simd_float origin[3];
+    simd_float inverse[3];
+    simd_float direction[3];
+    simd_float distance;
+};
+
+/**
+ * Dot product for the intersection tests. Single rays and packets use the same simd_fma() operations,
+ * so a ray gets the same hit in both whatever the compiler contracts, also with FMA instructions.
+ * @param a First vector.
+ * @param b Second vector.
+ * @return Dot product.
+ */
+float fused_dot(const glm::vec3& a, const glm::vec3& b)
+{
+    return simd_fma(a.z, b.z, simd_fma(a.y, b.y, a.x * b.x));
+}
+
+/**
+ * Dot product of vectors of each lane, the same operations as the single ray version.
+ * @param a First vectors, 3 components.
+ * @param b Second vectors, 3 components.
+ * @return Dot products.
+ */
+simd_float fused_dot(const simd_float* a, const simd_float* b)
+{
+    return simd_fma(a[2], b[2], simd_fma(a[1], b[1], a[0] * b[0]));
+}
+
+/**
+ * Cross product for the intersection tests, with simd_fma() like fused_dot().
+ * @param a First vector.
+ * @param b Second vector.
+ * @return Cross product.
+ */
+glm::vec3 fused_cross(const glm::vec3& a, const glm::vec3& b)
+{
+    return glm::vec3(simd_fma(a.y, b.z, -(b.y * a.z)), simd_fma(a.z, b.x, -(b.z * a.x)), simd_fma(a.x, b.y, -(b.x * a.y)));
+}
+
+/**
+ * Cross product of vectors of each lane, the same operations as the single ray version.
+ * @param a First vectors, 3 components.
+ * @param b Second vectors, 3 components.
+ * @param result Receives the cross products, 3 components.
+ */
+void fused_cross(const simd_float* a, const simd_float* b, simd_float* result)
+{
+    result[0] = simd_fma(a[1], b[2], -(b[1] * a[2]));
+    result[1] = simd_fma(a[2], b[0], -(b[2] * a[0]));
+    result[2] = simd_fma(a[0], b[1], -(b[0] * a[1]));
+}
+
+}
+
+bvh::bvh(const object& obj, unsigned threadCount)
+{
+    // Use triangles of the full mesh. Levels of detail follow it in the index array.
+    const std::vector< glm::vec3 >& positions = obj.vertexes();
+    const std::vector< uint32_t >& indices = obj.indices();
+    size_t triangleCount = indices.empty() ? positions.size() / 3 : size_t(obj.lods().empty() ? indices.size() : obj.lods()[0].indexCount) / 3;
+    build(positions.data(), indices.empty() ? nullptr : indices.data(), triangleCount, threadCount);
+}
+
+bvh::bvh(const std::vector< glm::vec3 >& positions, const std::vector< uint32_t >& indices, unsigned threadCount)
+{
+    size_t triangleCount = (indices.empty() ? positions.size() : indices.size()) / 3;
+    build(positions.data(), indices.empty() ? nullptr : indices.data(), triangleCount, threadCount);
+}
+
+void bvh::build(const glm::vec3* positions, const uint32_t* indices, size_t triangleCount, unsigned threadCount)
+{
+    if (triangleCount == 0) {
+        return;
+    }
+    thread_pool pool(threadCount);
+    std::vector< triangle_data > triangles(triangleCount);
+    build_data data;
+    data.triangleBounds.resize(triangleCount);
+    data.centroids.resize(triangleCount);
+    data.order.resize(triangleCount);
+    pool.parallel_for(triangleCount, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const glm::vec3& a = positions[indices ? indices[i * 3] : i * 3];
+            const glm::vec3& b = positions[indices ? indices[i * 3 + 1] : i * 3 + 1];
+            const glm::vec3& c = positions[indices ? indices[i * 3 + 2] : i * 3 + 2];
+            triangles[i].vertex = a;
+            triangles[i].edge1 = b - a;
+            triangles[i].edge2 = c - a;
+            data.triangleBounds[i].minimum = glm::min(a, glm::min(b, c));
+            data.triangleBounds[i].maximum = glm::max(a, glm::max(b, c));
+            data.centroids[i] = (data.triangleBounds[i].minimum + data.triangleBounds[i].maximum) * 0.5f;
+            data.order[i] = uint32_t(i);
+        }
+    });
+    // Split large nodes on this thread with parallel binning until all remaining nodes are small enough
+    // to become subtrees. Children of a node are always added as a pair.
+    m_nodes.resize(1);
+    std::vector< build_task > pending(1, build_task{ 0, 0, uint32_t(triangleCount), 0 });
+    std::vector< build_task > subtrees;
+    while (!pending.empty()) {
+        build_task task = pending.back();
+        pending.pop_back();
+        if (task.end - task.begin <= SUBTREE_SIZE) {
+            subtrees.push_back(task);
+            continue;
+        }
+        node result;
+        uint32_t middle;
+        if (split(data, task, &pool, result, middle)) {
+            result.offset = uint32_t(m_nodes.size());
+            result.count = 0;
+            m_nodes.resize(m_nodes.size() + 2);
+            pending.push_back(build_task{ result.offset + 1, middle, task.end, task.depth + 1 });
+            pending.push_back(build_task{ result.offset, task.begin, middle, task.depth + 1 });
+        } else {
+            make_leaf(result, task);
+        }
+        m_nodes[task.node] = result;
+    }
+    // Build the subtrees in parallel, the largest ones first. Each subtree only reorders its own range
+    // of triangles and gets its own node array, so the result does not depend on the scheduling.
+    std::sort(subtrees.begin(), subtrees.end(), [](const build_task& a, const build_task& b) {
+        return a.end - a.begin != b.end - b.begin ? a.end - a.begin > b.end - b.begin : a.node < b.node;
+    });
+    std::vector< std::vector< node > > subtreeNodes(subtrees.size());
+    std::atomic< size_t > next(0);
+    pool.parallel_for(pool.size(), [&](size_t, size_t) {
+        for (size_t i = next++; i < subtrees.size(); i = next++) {
+            build_subtree(data, subtrees[i], subtreeNodes[i]);
+        }
+    });
+    // Attach the subtrees: the root replaces the placeholder node, the others are appended.
+    for (size_t i = 0; i < subtrees.size(); i++) {
+        const std::vector< node >& nodes = subtreeNodes[i];
+        uint32_t base = uint32_t(m_nodes.size()) - 1;
+        for (size_t j = 0; j < nodes.size(); j++) {
+            node n = nodes[j];
+            if (n.count == 0) {
+                n.offset += base;
+            }
+            if (j == 0) {
+                m_nodes[subtrees[i].node] = n;
+            } else {
+                m_nodes.push_back(n);
+            }
+        }
+    }
+    // Store triangles in the order of leaves, so a leaf reads one contiguous range.
+    m_triangles.resize(triangleCount);
+    pool.parallel_for(triangleCount, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            m_triangles[i] = triangles[data.order[i]];
+        }
+    });
+    m_triangleIds = std::move(data.order);
+}
+
+bool bvh::intersect(const ray& r, ray_hit& hit) const
+{
+    return trace(r, hit, false);
+}
+
+bool bvh::occluded(const ray& r) const
+{
+    ray_hit hit;
+    return trace(r, hit, true);
+}
+
+void bvh::intersect_packet(const ray* rays, ray_hit* hits) const
+{
+    float values[10][PACKET_SIZE];
+    for (int lane = 0; lane < PACKET_SIZE; lane++) {
+        for (int c = 0; c < 3; c++) {
+            values[c][lane] = rays[lane].origin[c];
+            values[3 + c][lane] = 1.0f / rays[lane].direction[c];
+            values[6 + c][lane] = rays[lane].direction[c];
+        }
+        values[9][lane] = rays[lane].maxDistance;
+        hits[lane].distance = rays[lane].maxDistance;
+        hits[lane].triangle = NO_TRIANGLE;
+        hits[lane].u = 0.0f;
+        hits[lane].v = 0.0f;
+    }
+    if (m_nodes.empty()) {
+        return;
+    }
+    packet p;
+    for (int c = 0; c < 3; c++) {
+        p.origin[c] = simd_load(values[c]);
+        p.inverse[c] = simd_load(values[3 + c]);
+        p.direction[c] = simd_load(values[6 + c]);
+    }
+    p.distance = simd_load(values[9]);
+    const simd_float ZERO = simd_broadcast(0.0f);
+    const simd_float ONE = simd_broadcast(1.0f);
+    // Visit nodes front to back for the first ray, the packet is expected to be coherent.
+    // Every popped node is tested against all rays and skipped if none of them hits its box.
+    uint32_t stack[MAX_DEPTH * 2 + 2];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const node& current = m_nodes[stack[--stackSize]];
+        simd_float nearest = ZERO;
+        simd_float farthest = p.distance;
+        for (int c = 0; c < 3; c++) {
+            simd_float t0 = (simd_broadcast(current.minimum[c]) - p.origin[c]) * p.inverse[c];
+            simd_float t1 = (simd_broadcast(current.maximum[c]) - p.origin[c]) * p.inverse[c];
+            nearest = simd_max(nearest, simd_min(t0, t1));
+            farthest = simd_min(farthest, simd_max(t0, t1));
+        }
+        if (!simd_any(nearest <= farthest)) {
+            continue;
+        }
+        if (current.count == 0) {
+            const node& left = m_nodes[current.offset];
+            const node& right = m_nodes[current.offset + 1];
+            float order = 0.0f;
+            for (int c = 0; c < 3; c++) {
+                order += (left.minimum[c] + left.maximum[c] - right.minimum[c] - right.maximum[c]) * rays[0].direction[c];
+            }
+            // Push the far child first to visit the near one next.
+            stack[stackSize++] = order > 0.0f ? current.offset : current.offset + 1;
+            stack[stackSize++] = order > 0.0f ? current.offset + 1 : current.offset;
+            continue;
+        }
+        // Test the rays against each triangle of the leaf (Moller-Trumbore).
+        for (uint32_t i = current.offset; i < current.offset + current.count; i++) {
+            const triangle_data& triangle = m_triangles[i];
+            simd_float e1[3] = { simd_broadcast(triangle.edge1.x), simd_broadcast(triangle.edge1.y), simd_broadcast(triangle.edge1.z) };
+            simd_float e2[3] = { simd_broadcast(triangle.edge2.x), simd_broadcast(triangle.edge2.y), simd_broadcast(triangle.edge2.z) };
+            simd_float s[3];
+            for (int c = 0; c < 3; c++) {
+                s[c] = p.origin[c] - simd_broadcast(triangle.vertex[c]);
+            }
+            simd_float pv[3];
+            fused_cross(p.direction, e2, pv);
+            simd_float inverse = ONE / fused_dot(e1, pv);
+            simd_float u = fused_dot(s, pv) * inverse;
+            simd_float q[3];
+            fused_cross(s, e1, q);
+            simd_float v = fused_dot(p.direction, q) * inverse;
+            simd_float t = fused_dot(e2, q) * inverse;
+            // A zero determinant gives NaN values that fail all the comparisons.
+            simd_mask valid = (u >= ZERO) & (v >= ZERO) & (u + v <= ONE) & (t >= ZERO) & (t < p.distance);
+            int bits = simd_bits(valid);
+            if (!bits) {
+                continue;
+            }
+            p.distance = simd_select(valid, t, p.distance);
+            float tValues[PACKET_SIZE];
+            float uValues[PACKET_SIZE];
+            float vValues[PACKET_SIZE];
+            simd_store(tValues, t);
+            simd_store(uValues, u);
+            simd_store(vValues, v);
+            for (int lane = 0; lane < PACKET_SIZE; lane++) {
+                if (bits & (1 << lane)) {
+                    hits[lane].distance = tValues[lane];
+                    hits[lane].triangle = m_triangleIds[i];
+                    hits[lane].u = uValues[lane];
+                    hits[lane].v = vValues[lane];
+                }
+            }
+        }
+    }
+}
+
+void bvh::intersect(const ray* rays, size_t count, ray_hit* hits) const
+{
+    size_t i = 0;
+    for (; i + PACKET_SIZE <= count; i += PACKET_SIZE) {
+        intersect_packet(rays + i, hits + i);
+    }
+    // Trace the rest of the rays one by one.
+    for (; i < count; i++) {
+        intersect(rays[i], hits[i]);
+    }
+}
+
+size_t bvh::node_count() const
+{
+    return m_nodes.size();
+}
+
+size_t bvh::triangle_count() const
+{
+    return m_triangles.size();
+}
+
+bool bvh::split(build_data& data, const build_task& task, thread_pool* pool, node& result, uint32_t& middle)
+{
+    const float INF = std::numeric_limits< float >::infinity();
+    const bounds EMPTY = { glm::vec3(INF), glm::vec3(-INF) };
+    // Large nodes are split into blocks that are processed in parallel and merged in the block order.
+    size_t blockCount = pool ? BINNING_BLOCKS : 1;
+    auto forEachBlock = [&](const std::function< void(size_t block, uint32_t begin, uint32_t end) >& body) {
+        auto run = [&](size_t first, size_t last) {
+            for (size_t block = first; block < last; block++) {
+                uint32_t count = task.end - task.begin;
+                body(block, task.begin + uint32_t(count * block / blockCount), task.begin + uint32_t(count * (block + 1) / blockCount));
+            }
+        };
+        if (pool) {
+            pool->parallel_for(blockCount, run);
+        } else {
+            run(0, blockCount);
+        }
+    };
+    // Calculate bounds of the triangles and of their centroids.
+    std::vector< bounds > boxes(blockCount * 2, EMPTY);
+    forEachBlock([&](size_t block, uint32_t begin, uint32_t end) {
+        bounds box = EMPTY;
+        bounds centroidBox = EMPTY;
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t triangle = data.order[i];
+            box.minimum = glm::min(box.minimum, data.triangleBounds[triangle].minimum);
+            box.maximum = glm::max(box.maximum, data.triangleBounds[triangle].maximum);
+            centroidBox.minimum = glm::min(centroidBox.minimum, data.centroids[triangle]);
+            centroidBox.maximum = glm::max(centroidBox.maximum, data.centroids[triangle]);
+        }
+        boxes[block * 2] = box;
+        boxes[block * 2 + 1] = centroidBox;
+    });
+    bounds box = EMPTY;
+    bounds centroidBox = EMPTY;
+    for (size_t block = 0; block < blockCount; block++) {
+        box.minimum = glm::min(box.minimum, boxes[block * 2].minimum);
+        box.maximum = glm::max(box.maximum, boxes[block * 2].maximum);
+        centroidBox.minimum = glm::min(centroidBox.minimum, boxes[block * 2 + 1].minimum);
+        centroidBox.maximum = glm::max(centroidBox.maximum, boxes[block * 2 + 1].maximum);
+    }
+    for (int c = 0; c < 3; c++) {
+        result.minimum[c] = box.minimum[c];
+        result.maximum[c] = box.maximum[c];
+    }
+    uint32_t count = task.end - task.begin;
+    if (count <= MAX_LEAF_SIZE || task.depth >= MAX_DEPTH) {
+        return false;
+    }
+    // Distribute centroids into bins along each axis. Axes where all centroids are equal are not split.
+    float scale[3];
+    for (int c = 0; c < 3; c++) {
+        float extent = centroidBox.maximum[c] - centroidBox.minimum[c];
+        scale[c] = extent > 0.0f ? BIN_COUNT * 0.9999f / extent : 0.0f;
+    }
+    auto binIndex = [&](const glm::vec3& centroid, int axis) {
+        int index = int((centroid[axis] - centroidBox.minimum[axis]) * scale[axis]);
+        return std::min(std::max(index, 0), BIN_COUNT - 1);
+    };
+    const bin EMPTY_BIN = { EMPTY, 0 };
+    std::vector< bin > bins(blockCount * 3 * BIN_COUNT, EMPTY_BIN);
+    forEachBlock([&](size_t block, uint32_t begin, uint32_t end) {
+        bin* blockBins = &bins[block * 3 * BIN_COUNT];
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t triangle = data.order[i];
+            for (int axis = 0; axis < 3; axis++) {
+                bin& b = blockBins[axis * BIN_COUNT + binIndex(data.centroids[triangle], axis)];
+                b.box.minimum = glm::min(b.box.minimum, data.triangleBounds[triangle].minimum);
+                b.box.maximum = glm::max(b.box.maximum, data.triangleBounds[triangle].maximum);
+                b.count++;
+            }
+        }
+    });
+    for (size_t block = 1; block < blockCount; block++) {
+        for (int i = 0; i < 3 * BIN_COUNT; i++) {
+            bin& b = bins[i];
+            const bin& other = bins[block * 3 * BIN_COUNT + i];
+            b.box.minimum = glm::min(b.box.minimum, other.box.minimum);
+            b.box.maximum = glm::max(b.box.maximum, other.box.maximum);
+            b.count += other.count;
+        }
+    }
+    // Evaluate the surface area heuristic for the planes between the bins.
+    // Costs are not divided by the area of the node, so flat nodes are compared correctly.
+    float nodeArea = half_area(box);
+    float bestCost = float(count) * nodeArea;
+    int bestAxis = -1;
+    int bestBin = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        if (scale[axis] == 0.0f) {
+            continue;
+        }
+        const bin* axisBins = &bins[axis * BIN_COUNT];
+        float rightCost[BIN_COUNT];
+        bounds right = EMPTY;
+        uint32_t rightCount = 0;
+        for (int i = BIN_COUNT - 1; i > 0; i--) {
+            right.minimum = glm::min(right.minimum, axisBins[i].box.minimum);
+            right.maximum = glm::max(right.maximum, axisBins[i].box.maximum);
+            rightCount += axisBins[i].count;
+            rightCost[i] = rightCount ? half_area(right) * float(rightCount) : -1.0f;
+        }
+        bounds left = EMPTY;
+        uint32_t leftCount = 0;
+        for (int i = 0; i < BIN_COUNT - 1; i++) {
+            left.minimum = glm::min(left.minimum, axisBins[i].box.minimum);
+            left.maximum = glm::max(left.maximum, axisBins[i].box.maximum);
+            leftCount += axisBins[i].count;
+            if (leftCount == 0 || rightCost[i + 1] < 0.0f) {
+                continue;
+            }
+            float cost = TRAVERSAL_COST * nodeArea + half_area(left) * float(leftCount) + rightCost[i + 1];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = i;
+            }
+        }
+    }
+    if (bestAxis < 0) {
+        return false;
+    }
+    uint32_t* first = data.order.data() + task.begin;
+    uint32_t* last = data.order.data() + task.end;
+    middle = uint32_t(std::partition(first, last, [&](uint32_t triangle) {
+        return binIndex(data.centroids[triangle], bestAxis) <= bestBin;
+    }) - data.order.data());
+    return true;
+}
+
+void bvh::build_subtree(build_data& data, const build_task& task, std::vector< node >& nodes)
+{
+    nodes.resize(1);
+    std::vector< build_task > pending(1, build_task{ 0, task.begin, task.end, task.depth });
+    while (!pending.empty()) {
+        build_task current = pending.back();
+        pending.pop_back();
+        node result;
+        uint32_t middle;
+        if (split(data, current, nullptr, result, middle)) {
+            result.offset = uint32_t(nodes.size());
+            result.count = 0;
+            nodes.resize(nodes.size() + 2);
+            pending.push_back(build_task{ result.offset + 1, middle, current.end, current.depth + 1 });
+            pending.push_back(build_task{ result.offset, current.begin, middle, current.depth + 1 });
+        } else {
+            make_leaf(result, current);
+        }
+        nodes[current.node] = result;
+    }
+}
+
+void bvh::make_leaf(node& result, const build_task& task)
+{
+    result.offset = task.begin;
+    result.count = task.end - task.begin;
+}
+
+float bvh::half_area(const bounds& box)
+{
+    glm::vec3 size = box.maximum - box.minimum;
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+bool bvh::intersect_leaf(const node& leaf, const glm::vec3& origin, const glm::vec3& direction, ray_hit& hit, bool any) const
+{
+    bool found = false;
+    for (uint32_t i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+        // Moller-Trumbore intersection test.
+        const triangle_data& triangle = m_triangles[i];
+        glm::vec3 p = fused_cross(direction, triangle.edge2);
+        float determinant = fused_dot(triangle.edge1, p);
+        if (determinant == 0.0f) {
+            continue;
+        }
+        float inverse = 1.0f / determinant;
+        glm::vec3 s = origin - triangle.vertex;
+        float u = fused_dot(s, p) * inverse;
+        if (!(u >= 0.0f && u <= 1.0f)) {
+            continue;
+        }
+        glm::vec3 q = fused_cross(s, triangle.edge1);
+        float v = fused_dot(direction, q) * inverse;
+        if (!(v >= 0.0f && u + v <= 1.0f)) {
+            continue;
+        }
+        float t = fused_dot(triangle.edge2, q) * inverse;
+        if (t >= 0.0f && t < hit.distance) {
+            hit.distance = t;
+            hit.triangle = m_triangleIds[i];
+            hit.u = u;
+            hit.v = v;
+            found = true;
+            if (any) {
+                return true;
+            }
+        }
+    }
+    return found;
+}
+
+bool bvh::trace(const ray& r, ray_hit& hit, bool any) const
+{
+    hit.distance = r.maxDistance;
+    hit.triangle = NO_TRIANGLE;
+    hit.u = 0.0f;
+    hit.v = 0.0f;
+    if (m_nodes.empty()) {
+        return false;
+    }
+    glm::vec3 inverse = 1.0f / r.direction;
+    // The sign of the direction tells which side of a box the ray enters on each axis.
+    bool negative[3] = { inverse.x < 0.0f, inverse.y < 0.0f, inverse.z < 0.0f };
+    // Return the distance where the ray enters a box or infinity if it misses the box.
+    auto enter = [&](const node& n) {
+        float nearest = 0.0f;
+        float farthest = hit.distance;
+        for (int c = 0; c < 3; c++) {
+            float t0 = ((negative[c] ? n.maximum[c] : n.minimum[c]) - r.origin[c]) * inverse[c];
+            float t1 = ((negative[c] ? n.minimum[c] : n.maximum[c]) - r.origin[c]) * inverse[c];
+            nearest = t0 > nearest ? t0 : nearest;
+            farthest = t1 < farthest ? t1 : farthest;
+        }
+        return nearest <= farthest ? nearest : std::numeric_limits< float >::infinity();
+    };
+    const float INF = std::numeric_limits< float >::infinity();
+    if (enter(m_nodes[0]) == INF) {
+        return false;
+    }
+    // Nodes on the stack are stored with their entry distances, so the ones behind a closer hit are skipped.
+    uint32_t stack[MAX_DEPTH * 2 + 2];
+    float stackDistance[MAX_DEPTH * 2 + 2];
+    int stackSize = 0;
+    uint32_t current = 0;
+    bool found = false;
+    for (;;) {
+        const node& n = m_nodes[current];
+        if (n.count == 0) {
+            float leftDistance = enter(m_nodes[n.offset]);
+            float rightDistance = enter(m_nodes[n.offset + 1]);
+            if (leftDistance != INF && rightDistance != INF) {
+                // Visit the nearer child first.
+                bool leftFirst = leftDistance <= rightDistance;
+                stack[stackSize] = leftFirst ? n.offset + 1 : n.offset;
+                stackDistance[stackSize] = leftFirst ? rightDistance : leftDistance;
+                stackSize++;
+                current = leftFirst ? n.offset : n.offset + 1;
+                continue;
+            }
+            if (leftDistance != INF || rightDistance != INF) {
+                current = leftDistance != INF ? n.offset : n.offset + 1;
+                continue;
+            }
+        } else if (intersect_leaf(n, r.origin, r.direction, hit, any)) {
+            found = true;
+            if (any) {
+                return true;
+            }
+        }
+        // Take the next node that is still in front of the closest hit.
+        do {
+            if (stackSize == 0) {
+                return found;
+            }
+            stackSize--;
+        } while (stackDistance[stackSize] > hit.distance);
+        current = stack[stackSize];
+    }
+}
@@ -0,0 +1,292 @@
+#pragma once
+
+#include "object.h"
+#include "simd.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+class thread_pool;
+
+/**
+ * Ray for queries against a bvh.
+ */
+struct ray
+{
+    glm::vec3 origin;
+    /**
+     * Direction, does not have to be normalized. Distances are measured in its lengths.
+     */
+    glm::vec3 direction;
+    /**
+     * Intersections further than this distance are ignored.
+     */
+    float maxDistance;
+};
+
+/**
+ * Result of a ray query.
+ */
+struct ray_hit
+{
+    /**
+     * Distance to the intersection in ray direction lengths.
+     */
+    float distance;
+    /**
+     * Number of the hit triangle in the object or NO_TRIANGLE if nothing is hit.
+     */
+    uint32_t triangle;
+    /**
+     * Barycentric coordinates of the intersection: weights of the second and the third triangle vertices.
+     */
+    float u;
+    float v;
+};
+
+/**
+ * Bounding volume hierarchy over triangles of an object for ray queries like picking and occlusion tests.
+ *
+ * The tree is built with the surface area heuristic evaluated on BIN_COUNT bins per axis.
+ * Large nodes near the root bin their triangles in parallel, then the subtrees below are built in parallel.
+ * The result does not depend on the number of threads.
+ * Nodes are flattened into one array, children of a node are stored next to each other,
+ * so both child boxes are tested with one cache line.
+ *
+ * Rays can be traced one by one or in packets of PACKET_SIZE rays (8 with AVX2, 4 with SSE2) that share the traversal.
+ * Packets are faster for coherent rays, like rays of neighbouring pixels.
+ */
+class bvh
+{
+public:
+    /**
+     * Number of rays traced together by intersect_packet().
+     */
+    constexpr static int PACKET_SIZE = simd_float::WIDTH;
+    /**
+     * Triangle number of a missed ray.
+     */
+    constexpr static uint32_t NO_TRIANGLE = UINT32_MAX;
+
+    /**
+     * Constructor. Build the hierarchy over the triangles of the object.
+     * For an indexed object only the full mesh is used, without levels of detail.
+     * @param obj Object.
+     * @param threadCount Number of threads to build with, 0 means one thread per hardware core.
+     */
+    bvh(const object& obj, unsigned threadCount = 1);
+    /**
+     * Constructor. Build the hierarchy over triangles given by arrays.
+     * @param positions Vertex positions, 3 per triangle if there are no indices.
+     * @param indices Vertex indices, 3 per triangle. Empty for non-indexed triangles.
+     * @param threadCount Number of threads to build with, 0 means one thread per hardware core.
+     */
+    bvh(const std::vector< glm::vec3 >& positions, const std::vector< uint32_t >& indices, unsigned threadCount = 1);
+    /**
+     * Find the closest intersection of a ray with the triangles.
+     * @param r Ray.
+     * @param hit Receives the closest intersection.
+     * @return True if the ray hits a triangle.
+     */
+    bool intersect(const ray& r, ray_hit& hit) const;
+    /**
+     * Check if a ray hits any triangle. Faster than intersect() because it stops at the first hit.
+     * @param r Ray.
+     * @return True if the ray hits a triangle.
+     */
+    bool occluded(const ray& r) const;
+    /**
+     * Find the closest intersections of a packet of rays.
+     * @param rays PACKET_SIZE rays.
+     * @param hits Receives PACKET_SIZE intersections.
+     */
+    void intersect_packet(const ray* rays, ray_hit* hits) const;
+    /**
+     * Find the closest intersections of any number of rays, traced in packets.
+     * @param rays Rays.
+     * @param count Number of rays.
+     * @param hits Receives an intersection per ray.
+     */
+    void intersect(const ray* rays, size_t count, ray_hit* hits) const;
+    /**
+     * Return number of nodes.
+     * @return Number of nodes.
+     */
+    size_t node_count() const;
+    /**
+     * Return number of triangles.
+     * @return Number of triangles.
+     */
+    size_t triangle_count() const;
+
+private:
+    /**
+     * Number of bins per axis to evaluate splits on.
+     */
+    constexpr static int BIN_COUNT = 16;
+    /**
+     * Leaves are split until they have at most this number of triangles, unless the split does not pay off.
+     */
+    constexpr static uint32_t MAX_LEAF_SIZE = 4;
+    /**
+     * Cost of testing a node relative to testing a triangle.
+     */
+    constexpr static float TRAVERSAL_COST = 1.0f;
+    /**
+     * Nodes with more triangles are split on the calling thread with parallel binning,
+     * smaller ones become subtrees built in parallel.
+     */
+    constexpr static uint32_t SUBTREE_SIZE = 1 << 16;
+    /**
+     * Number of blocks the triangles of a large node are split into for parallel binning.
+     */
+    constexpr static size_t BINNING_BLOCKS = 64;
+    /**
+     * Maximal depth of the tree. Deeper nodes are made leaves.
+     */
+    constexpr static int MAX_DEPTH = 64;
+
+    /**
+     * Axis-aligned bounding box.
+     */
+    struct bounds
+    {
+        glm::vec3 minimum;
+        glm::vec3 maximum;
+    };
+
+    /**
+     * Node of the flattened tree.
+     */
+    struct node
+    {
+        /**
+         * Bounding box of the node.
+         */
+        float minimum[3];
+        /**
+         * Index of the left child for inner nodes, the right child follows it.
+         * Index of the first triangle for leaves.
+         */
+        uint32_t offset;
+        float maximum[3];
+        /**
+         * Number of triangles of a leaf, 0 for inner nodes.
+         */
+        uint32_t count;
+    };
+
+    /**
+     * Triangle prepared for the intersection test.
+     */
+    struct triangle_data
+    {
+        glm::vec3 vertex;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+    };
+
+    /**
+     * Range of triangles to build a node of.
+     */
+    struct build_task
+    {
+        uint32_t node;
+        uint32_t begin;
+        uint32_t end;
+        int depth;
+    };
+
+    /**
+     * Triangle data used while building.
+     */
+    struct build_data
+    {
+        std::vector< bounds > triangleBounds;
+        std::vector< glm::vec3 > centroids;
+        /**
+         * Triangle numbers in the order of leaves.
+         */
+        std::vector< uint32_t > order;
+    };
+
+    /**
+     * Number of triangles and the box of a bin.
+     */
+    struct bin
+    {
+        bounds box;
+        uint32_t count;
+    };
+
+    /**
+     * Build the hierarchy.
+     * @param positions Vertex positions.
+     * @param indices Vertex indices, 3 per triangle, or nullptr if each triangle is given by 3 consecutive positions.
+     * @param triangleCount Number of triangles.
+     * @param threadCount Number of threads to build with, 0 means one thread per hardware core.
+     */
+    void build(const glm::vec3* positions, const uint32_t* indices, size_t triangleCount, unsigned threadCount);
+    /**
+     * Fill a node with bounds of its triangles and split them if it pays off.
+     * @param data Build data, triangles of the node are reordered.
+     * @param task Triangles of the node.
+     * @param pool Threads to bin the triangles with or nullptr to bin on the calling thread.
+     * @param result Node to fill. Only the bounds are set.
+     * @param middle Receives the first triangle of the right child.
+     * @return True if the node is split, false if it must be a leaf.
+     */
+    static bool split(build_data& data, const build_task& task, thread_pool* pool, node& result, uint32_t& middle);
+    /**
+     * Build a subtree on the calling thread.
+     * @param data Build data.
+     * @param task Triangles of the subtree.
+     * @param nodes Receives nodes of the subtree, the root first. Child offsets are relative to the subtree.
+     */
+    static void build_subtree(build_data& data, const build_task& task, std::vector< node >& nodes);
+    /**
+     * Turn a node into a leaf.
+     * @param result Node.
+     * @param task Triangles of the node.
+     */
+    static void make_leaf(node& result, const build_task& task);
+    /**
+     * Return a half of the surface area of a box.
+     * @param box Box.
+     * @return Area.
+     */
+    static float half_area(const bounds& box);
+    /**
+     * Test a ray against the triangles of a leaf.
+     * @param leaf Leaf node.
+     * @param origin Ray origin.
+     * @param direction Ray direction.
+     * @param hit Closest hit so far, updated by closer hits.
+     * @param any Stop at the first hit.
+     * @return True if a closer hit is found.
+     */
+    bool intersect_leaf(const node& leaf, const glm::vec3& origin, const glm::vec3& direction, ray_hit& hit, bool any) const;
+    /**
+     * Trace a single ray.
+     * @param r Ray.
+     * @param hit Receives the hit.
+     * @param any Stop at the first hit.
+     * @return True if the ray hits a triangle.
+     */
+    bool trace(const ray& r, ray_hit& hit, bool any) const;
+
+    /**
+     * Nodes of the tree, the root first.
+     */
+    std::vector< node > m_nodes;
+    /**
+     * Triangles in the order of leaves.
+     */
+    std::vector< triangle_data > m_triangles;
+    /**
+     * Number of each triangle in the object, in the order of leaves.
+     */
+    std::vector< uint32_t > m_triangleIds;
+};
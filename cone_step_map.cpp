@@ -0,0 +1,122 @@
+#include "cone_step_map.h"
+#include "thread_pool.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+
+constexpr float cone_step_map::MAX_RATIO;
+constexpr int cone_step_map::MIN_STEPS;
+constexpr int cone_step_map::MAX_STEPS;
+constexpr int cone_step_map::SEARCH_STEPS;
+constexpr float cone_step_map::SURFACE_EPSILON;
+
+namespace
+{
+
+/**
+ * Texel of the window around the apex.
+ */
+struct window_offset
+{
+    int x;
+    int y;
+    /**
+     * Distance to the apex in texture coordinates.
+     */
+    float distance;
+};
+
+}
+
+std::vector< float > cone_step_map::build(thread_pool& pool, const std::vector< float >& depth, int width, int height)
+{
+    // Texels farther than MAX_RATIO cannot narrow a cone below MAX_RATIO, depth differences are at most 1.
+    int radiusX = int(std::ceil(MAX_RATIO * width));
+    int radiusY = int(std::ceil(MAX_RATIO * height));
+    std::vector< window_offset > window;
+    for (int y = -radiusY; y <= radiusY; y++) {
+        for (int x = -radiusX; x <= radiusX; x++) {
+            float distance = std::sqrt(float(x) * x / (float(width) * width) + float(y) * y / (float(height) * height));
+            if ((x != 0 || y != 0) && distance < MAX_RATIO) {
+                window.push_back({ x, y, distance });
+            }
+        }
+    }
+
+    // Copy the depth and its gradient in texels into planes with a border of the window radius.
+    // Rows are padded to whole SIMD batches. Border texels are deeper than any apex, so they never narrow a cone.
+    int rowWidth = (width + simd_float::WIDTH - 1) / simd_float::WIDTH * simd_float::WIDTH;
+    int paddedWidth = rowWidth + 2 * radiusX;
+    int paddedHeight = height + 2 * radiusY;
+    std::vector< float > paddedDepth(size_t(paddedWidth) * paddedHeight, 2.0f);
+    std::vector< float > gradientX(paddedDepth.size(), 0.0f);
+    std::vector< float > gradientY(paddedDepth.size(), 0.0f);
+    auto at = [&](int x, int y) {
+        return depth[size_t(std::min(std::max(y, 0), height - 1)) * width + std::min(std::max(x, 0), width - 1)];
+    };
+    for (int y = 0; y < height; y++) {
+        size_t row = size_t(y + radiusY) * paddedWidth + radiusX;
+        for (int x = 0; x < width; x++) {
+            paddedDepth[row + x] = at(x, y);
+            gradientX[row + x] = (at(x + 1, y) - at(x - 1, y)) * 0.5f;
+            gradientY[row + x] = (at(x, y + 1) - at(x, y - 1)) * 0.5f;
+        }
+    }
+
+    // Narrow the cone of each apex by the window texels where a ray towards the apex leaves the surface.
+    // Along the line from texel q to apex p the ray descends by depth(p) - depth(q), the surface by -dot(gradient(q), q - p).
+    std::vector< float > result(size_t(width) * height);
+    pool.parallel_for(size_t(height), [&](size_t begin, size_t end) {
+        const simd_float ONE = simd_broadcast(1.0f);
+        const simd_float ZERO = simd_broadcast(0.0f);
+        const simd_float LIMIT = simd_broadcast(MAX_RATIO);
+        std::vector< float > best(rowWidth);
+        for (size_t y = begin; y < end; y++) {
+            std::fill(best.begin(), best.end(), MAX_RATIO);
+            const float* apex = paddedDepth.data() + (y + radiusY) * paddedWidth + radiusX;
+            for (const window_offset& offset : window) {
+                size_t row = (y + radiusY + offset.y) * paddedWidth + radiusX + offset.x;
+                const float* texel = paddedDepth.data() + row;
+                const float* texelGradientX = gradientX.data() + row;
+                const float* texelGradientY = gradientY.data() + row;
+                simd_float offsetX = simd_broadcast(float(offset.x));
+                simd_float offsetY = simd_broadcast(float(offset.y));
+                simd_float distance = simd_broadcast(offset.distance);
+                for (int x = 0; x < rowWidth; x += simd_float::WIDTH) {
+                    simd_float difference = simd_load(apex + x) - simd_load(texel + x);
+                    simd_float surfaceDescent = ZERO - (simd_load(texelGradientX + x) * offsetX + simd_load(texelGradientY + x) * offsetY);
+                    simd_mask leaving = (difference > ZERO) & (surfaceDescent > difference);
+                    simd_float ratio = simd_select(leaving, distance / simd_select(leaving, difference, ONE), LIMIT);
+                    simd_store(&best[x], simd_min(simd_load(&best[x]), ratio));
+                }
+            }
+            float* target = result.data() + y * width;
+            for (int x = 0; x < width; x++) {
+                target[x] = std::sqrt(best[x] / MAX_RATIO);
+            }
+        }
+    });
+    return result;
+}
+
+float cone_step_map::decode(float value)
+{
+    return value * value * MAX_RATIO;
+}
+
+std::string cone_step_map::shader_defines()
+{
+    // Enough digits for GLSL to parse back the same floats, always with a decimal point.
+    std::ostringstream defines;
+    defines << std::showpoint << std::setprecision(std::numeric_limits< float >::max_digits10);
+    defines << "#define HEIGHT_SCALE " << MAX_RATIO << "\n";
+    defines << "#define MIN_CONE_STEPS " << MIN_STEPS << "\n";
+    defines << "#define MAX_CONE_STEPS " << MAX_STEPS << "\n";
+    defines << "#define SEARCH_STEPS " << SEARCH_STEPS << "\n";
+    defines << "#define SURFACE_EPSILON " << SURFACE_EPSILON << "\n";
+    return defines.str();
+}
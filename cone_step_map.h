@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+class thread_pool;
+
+/**
+ * Builder of relaxed cone step maps for parallax mapping.
+ *
+ * A ray above a point of the depth map can step to the side of a cone whose apex is the surface under the ray.
+ * The relaxed cone of a texel is the widest cone in which no ray towards the apex leaves the surface again after
+ * entering it, so a step may go below the surface but never past a whole bump. The shader then refines the last
+ * step with a short binary search. Texels where a ray leaves the surface are found from the depth gradient: the
+ * surface there gets deeper towards the apex faster than the ray from the texel to the apex descends.
+ *
+ * Rays of main.fs move at most MAX_RATIO in texture coordinates per unit of depth, so cones wider than that are
+ * clamped and only texels within that distance of the apex are tested. Each texel is compared to every texel in its
+ * window, simd_float::WIDTH texels of a row at once, rows run on a thread pool.
+ *
+ * Ratios are stored as sqrt(ratio / MAX_RATIO), which keeps precision for the narrow cones at the walls.
+ */
+class cone_step_map
+{
+public:
+    /**
+     * Largest cone ratio in texture coordinates per unit of depth, also the depth of the parallax map.
+     */
+    constexpr static float MAX_RATIO = 0.07f;
+    /**
+     * Number of cone steps for a view along the normal and at a grazing angle.
+     */
+    constexpr static int MIN_STEPS = 8;
+    constexpr static int MAX_STEPS = 16;
+    /**
+     * Number of binary search steps that refine the last cone step.
+     */
+    constexpr static int SEARCH_STEPS = 3;
+    /**
+     * The ray has reached the surface when it is less than this above it.
+     */
+    constexpr static float SURFACE_EPSILON = 0.004f;
+
+    /**
+     * Build the cone ratios of a depth map.
+     * @param pool Threads to build with.
+     * @param depth Plane of depth values in [0, 1], 0 is the top of the surface.
+     * @param width Width of the plane.
+     * @param height Height of the plane.
+     * @return Plane of encoded cone ratios in [0, 1].
+     */
+    static std::vector< float > build(thread_pool& pool, const std::vector< float >& depth, int width, int height);
+    /**
+     * Convert an encoded value back to a cone ratio.
+     * @param value Encoded value.
+     * @return Cone ratio in texture coordinates per unit of depth.
+     */
+    static float decode(float value);
+    /**
+     * Return the stepping parameters as #define lines for the shaders, so that main.fs and the software rasterizer
+     * march the same way: HEIGHT_SCALE, MIN_CONE_STEPS, MAX_CONE_STEPS, SEARCH_STEPS and SURFACE_EPSILON.
+     * @return Preprocessor definitions, one per line.
+     */
+    static std::string shader_defines();
+};
@@ -0,0 +1,28 @@
+#version 330 core
+
+in vec2 UV;
+
+// Tile and level of the virtual texture that the fragment samples, see texture_feedback.
+// Column, row and level in R, G and B, A is 1 for pixels with a surface.
+out vec4 FeedbackColor;
+
+// xy - size of the virtual texture in texels, z - number of levels, w - 1 if the texture is used.
+uniform vec4 virtualTextureSize;
+// Moves the level back to the one of the scene, the feedback pass is drawn at a lower resolution.
+uniform float feedbackLodBias;
+
+void main()
+{
+    // Texels of a tile without the border. Must match tile_file::TILE_SIZE.
+    const float TILE_SIZE = 128.0;
+
+    // Select the level the same way as the scene does.
+    vec2 texels = clamp(UV, 0.0, 1.0) * virtualTextureSize.xy;
+    float lod = log2(max(length(dFdx(texels)), length(dFdy(texels)))) + feedbackLodBias;
+    float level = clamp(floor(lod), 0.0, virtualTextureSize.z - 1.0);
+
+    // Levels round their size up, so the last tile of a row may be narrower than the others.
+    float levelTileSize = TILE_SIZE * exp2(level);
+    vec2 tile = min(floor(texels / levelTileSize), ceil(virtualTextureSize.xy / levelTileSize) - 1.0);
+    FeedbackColor = vec4(tile, level, 255.0) / 255.0;
+}
@@ -0,0 +1,279 @@
+#include "frame_profiler.h"
+
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+
+constexpr size_t frame_profiler::QUERY_LATENCY;
+constexpr size_t frame_profiler::TRACE_FRAMES;
+
+frame_profiler::frame_profiler()
+    : m_start(std::chrono::steady_clock::now())
+    , m_queries(QUERY_LATENCY * MAX_ZONES, 0)
+    , m_frames(TRACE_FRAMES)
+    , m_frameCount(0)
+    , m_depth(0)
+{
+    glGenQueries(GLsizei(m_queries.size()), m_queries.data());
+}
+
+void frame_profiler::destroy()
+{
+    // Wait for the results of the last frames, so they have GPU times in the summary and the trace.
+    size_t pending = size_t(std::min< uint64_t >(m_frameCount, QUERY_LATENCY));
+    if (pending > 0) {
+        glFinish();
+    }
+    for (uint64_t frame = m_frameCount - pending; frame < m_frameCount; frame++) {
+        resolve(m_frames[frame % TRACE_FRAMES]);
+    }
+    glDeleteQueries(GLsizei(m_queries.size()), m_queries.data());
+    std::fill(m_queries.begin(), m_queries.end(), 0);
+}
+
+void frame_profiler::begin_frame()
+{
+    // The queries of this frame were last used QUERY_LATENCY frames ago, take their results before reusing them.
+    if (m_frameCount >= QUERY_LATENCY) {
+        resolve(m_frames[(m_frameCount - QUERY_LATENCY) % TRACE_FRAMES]);
+    }
+    frame_record& frame = m_frames[m_frameCount % TRACE_FRAMES];
+    frame.number = m_frameCount;
+    frame.begin = now();
+    frame.end = frame.begin;
+    frame.calls = 0;
+    frame.skipped = 0;
+    frame.uploadBytes = 0;
+    frame.zoneCount = 0;
+    m_depth = 0;
+}
+
+void frame_profiler::end_frame()
+{
+    m_frames[m_frameCount % TRACE_FRAMES].end = now();
+    m_frameCount++;
+}
+
+void frame_profiler::begin_zone(const char* name)
+{
+    frame_record& frame = m_frames[m_frameCount % TRACE_FRAMES];
+    if (m_depth < MAX_ZONES) {
+        size_t index = frame.zoneCount < MAX_ZONES ? frame.zoneCount++ : MAX_ZONES;
+        if (index < MAX_ZONES) {
+            double time = now();
+            frame.zones[index] = { name, m_depth, time, time, -1.0 };
+            if (m_depth == 0) {
+                glBeginQuery(GL_TIME_ELAPSED, m_queries[(m_frameCount % QUERY_LATENCY) * MAX_ZONES + index]);
+            }
+        }
+        m_openZones[m_depth] = index;
+    }
+    m_depth++;
+}
+
+void frame_profiler::end_zone()
+{
+    if (m_depth == 0) {
+        return;
+    }
+    m_depth--;
+    if (m_depth < MAX_ZONES && m_openZones[m_depth] < MAX_ZONES) {
+        zone_record& zone = m_frames[m_frameCount % TRACE_FRAMES].zones[m_openZones[m_depth]];
+        if (zone.depth == 0) {
+            glEndQuery(GL_TIME_ELAPSED);
+        }
+        zone.end = now();
+    }
+}
+
+void frame_profiler::add_calls(unsigned count)
+{
+    m_frames[m_frameCount % TRACE_FRAMES].calls += count;
+}
+
+void frame_profiler::add_skipped(unsigned count)
+{
+    m_frames[m_frameCount % TRACE_FRAMES].skipped += count;
+}
+
+void frame_profiler::add_upload(size_t bytes)
+{
+    m_frames[m_frameCount % TRACE_FRAMES].uploadBytes += bytes;
+}
+
+bool frame_profiler::write_trace(const char* fileName) const
+{
+    std::ofstream ofs(fileName, std::ios::trunc);
+    if (!ofs) {
+        return false;
+    }
+    ofs << std::fixed << std::setprecision(3);
+    ofs << "{\"traceEvents\":[\n";
+    ofs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+    ofs << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+    size_t count;
+    size_t first = recorded(count);
+    for (size_t i = 0; i < count; i++) {
+        const frame_record& frame = m_frames[(first + i) % TRACE_FRAMES];
+        ofs << ",\n{\"name\":\"frame " << frame.number << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << frame.begin
+            << ",\"dur\":" << frame.end - frame.begin << "}";
+        ofs << ",\n{\"name\":\"GL\",\"ph\":\"C\",\"pid\":1,\"ts\":" << frame.begin
+            << ",\"args\":{\"calls\":" << frame.calls << ",\"skipped\":" << frame.skipped << ",\"bytes\":" << frame.uploadBytes << "}}";
+        for (size_t j = 0; j < frame.zoneCount; j++) {
+            // Zone names are identifiers given by the code, they are not escaped.
+            const zone_record& zone = frame.zones[j];
+            ofs << ",\n{\"name\":\"" << zone.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << zone.begin
+                << ",\"dur\":" << zone.end - zone.begin << "}";
+            if (zone.gpuTime >= 0.0) {
+                ofs << ",\n{\"name\":\"" << zone.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":" << zone.begin
+                    << ",\"dur\":" << zone.gpuTime << "}";
+            }
+        }
+    }
+    ofs << "\n]}\n";
+    return bool(ofs);
+}
+
+void frame_profiler::print_summary(std::ostream& os) const
+{
+    size_t count;
+    size_t first = recorded(count);
+    if (count == 0) {
+        return;
+    }
+    // Sum zone times by name, in the order the zones first appear.
+    struct zone_total
+    {
+        const char* name;
+        unsigned depth;
+        double cpu;
+        size_t cpuCount;
+        double gpu;
+        size_t gpuCount;
+    };
+    std::vector< zone_total > totals;
+    // Frame times fall into buckets that end at 1, 2, 4, ... 256 ms and the last one has no end.
+    const size_t BUCKET_COUNT = 10;
+    size_t cpuHistogram[BUCKET_COUNT] = {};
+    size_t gpuHistogram[BUCKET_COUNT] = {};
+    unsigned calls = 0;
+    unsigned skipped = 0;
+    uint64_t uploadBytes = 0;
+    auto bucket = [&](double milliseconds) {
+        size_t index = 0;
+        for (double end = 1.0; index + 1 < BUCKET_COUNT && milliseconds >= end; end *= 2.0) {
+            index++;
+        }
+        return index;
+    };
+    for (size_t i = 0; i < count; i++) {
+        const frame_record& frame = m_frames[(first + i) % TRACE_FRAMES];
+        double gpuFrame = 0.0;
+        bool gpuKnown = true;
+        for (size_t j = 0; j < frame.zoneCount; j++) {
+            const zone_record& zone = frame.zones[j];
+            auto found = std::find_if(totals.begin(), totals.end(), [&](const zone_total& total) {
+                return strcmp(total.name, zone.name) == 0 && total.depth == zone.depth;
+            });
+            if (found == totals.end()) {
+                totals.push_back({ zone.name, zone.depth, 0.0, 0, 0.0, 0 });
+                found = totals.end() - 1;
+            }
+            found->cpu += zone.end - zone.begin;
+            found->cpuCount++;
+            if (zone.gpuTime >= 0.0) {
+                found->gpu += zone.gpuTime;
+                found->gpuCount++;
+                gpuFrame += zone.gpuTime;
+            } else if (zone.depth == 0) {
+                gpuKnown = false;
+            }
+        }
+        cpuHistogram[bucket((frame.end - frame.begin) / 1000.0)]++;
+        if (gpuKnown) {
+            gpuHistogram[bucket(gpuFrame / 1000.0)]++;
+        }
+        calls += frame.calls;
+        skipped += frame.skipped;
+        uploadBytes += frame.uploadBytes;
+    }
+    std::ios::fmtflags flags = os.flags();
+    std::streamsize precision = os.precision();
+    os << std::fixed << std::setprecision(3);
+    os << "Profile of the last " << count << " frames, " << double(calls) / count << " GL calls, "
+       << double(skipped) / count << " redundant GL calls skipped and " << double(uploadBytes) / count
+       << " bytes uploaded per frame" << std::endl;
+    os << "  zone                    CPU ms     GPU ms" << std::endl;
+    for (const zone_total& total : totals) {
+        os << "  " << std::string(total.depth * 2, ' ') << std::left << std::setw(20 - total.depth * 2) << total.name << std::right
+           << std::setw(10) << total.cpu / total.cpuCount / 1000.0;
+        if (total.gpuCount > 0) {
+            os << std::setw(11) << total.gpu / total.gpuCount / 1000.0;
+        } else {
+            os << std::setw(11) << "-";
+        }
+        os << std::endl;
+    }
+    os << "  frame time ms         CPU frames GPU frames" << std::endl;
+    double begin = 0.0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        double end = double(1u << i);
+        os << "  " << std::setprecision(0) << std::setw(5) << begin << " - ";
+        if (i + 1 < BUCKET_COUNT) {
+            os << std::left << std::setw(10) << end << std::right;
+        } else {
+            os << std::left << std::setw(10) << "" << std::right;
+        }
+        os << std::setw(10) << cpuHistogram[i] << std::setw(11) << gpuHistogram[i] << std::endl;
+        begin = end;
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+frame_profiler::scope::scope(frame_profiler& profiler, const char* name)
+    : m_profiler(profiler)
+{
+    m_profiler.begin_zone(name);
+}
+
+frame_profiler::scope::~scope()
+{
+    m_profiler.end_zone();
+}
+
+double frame_profiler::now() const
+{
+    return std::chrono::duration< double, std::micro >(std::chrono::steady_clock::now() - m_start).count();
+}
+
+void frame_profiler::resolve(frame_record& record)
+{
+    size_t slot = size_t(record.number % QUERY_LATENCY);
+    for (size_t i = 0; i < record.zoneCount; i++) {
+        zone_record& zone = record.zones[i];
+        if (zone.depth != 0) {
+            continue;
+        }
+        GLuint query = m_queries[slot * MAX_ZONES + i];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+            // The work cannot take longer than the time since it was submitted. Results beyond that are driver errors,
+            // e.g. Mesa llvmpipe returns the time since boot for the first query of a context.
+            double gpuTime = double(nanoseconds) / 1000.0;
+            if (gpuTime <= now() - zone.begin) {
+                zone.gpuTime = gpuTime;
+            }
+        }
+    }
+}
+
+size_t frame_profiler::recorded(size_t& count) const
+{
+    count = size_t(std::min< uint64_t >(m_frameCount, TRACE_FRAMES));
+    return size_t((m_frameCount - count) % TRACE_FRAMES);
+}
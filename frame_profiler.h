@@ -0,0 +1,204 @@
+#pragma once
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <vector>
+#include <ostream>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Per-frame instrumentation of the render loop.
+ * A frame is split into named zones. Each zone measures CPU time. Zones at the top level also measure GPU time
+ * with a GL_TIME_ELAPSED query, these queries cannot be nested.
+ * Query results are read QUERY_LATENCY frames later and only if they are available, so the GPU is never waited for.
+ * A frame whose results are still not available then has no GPU times.
+ *
+ * The profiler also counts GL calls, GL calls skipped as redundant and bytes uploaded per frame as reported by the caller.
+ * The last TRACE_FRAMES frames are kept in a ring. They can be written as a Chrome trace event file
+ * (chrome://tracing, https://ui.perfetto.dev) or summarized as average zone times and a histogram of frame times.
+ *
+ * Recording a frame does not allocate memory and costs two clock reads per zone plus the queries.
+ */
+class frame_profiler
+{
+public:
+    /**
+     * Number of frames between issuing queries and reading their results.
+     */
+    constexpr static size_t QUERY_LATENCY = 4;
+    /**
+     * Maximal number of zones per frame. Further zones are ignored.
+     */
+    constexpr static size_t MAX_ZONES = 16;
+    /**
+     * Number of last frames that are kept for the trace and the summary.
+     */
+    constexpr static size_t TRACE_FRAMES = 600;
+
+    /**
+     * Constructor. Create the queries, needs a current GL context.
+     */
+    frame_profiler();
+    /**
+     * Read the results of the last frames and delete the queries. Must be called while the GL context is current.
+     * Waits for the GPU to finish the last frames.
+     */
+    void destroy();
+    /**
+     * Start a frame.
+     */
+    void begin_frame();
+    /**
+     * Finish the frame started by begin_frame().
+     */
+    void end_frame();
+    /**
+     * Start a zone inside the current frame. Zones must be ended in the reverse order.
+     * @param name Zone name. Must stay valid while the profiler is used, e.g. a string literal.
+     */
+    void begin_zone(const char* name);
+    /**
+     * Finish the last started zone.
+     */
+    void end_zone();
+    /**
+     * Count GL calls of the current frame.
+     * @param count Number of calls.
+     */
+    void add_calls(unsigned count);
+    /**
+     * Count GL calls of the current frame that were not issued because they would not change the state.
+     * @param count Number of calls.
+     */
+    void add_skipped(unsigned count);
+    /**
+     * Count bytes uploaded to the GPU in the current frame.
+     * @param bytes Number of bytes.
+     */
+    void add_upload(size_t bytes);
+    /**
+     * Write the recorded frames as a Chrome trace event file.
+     * CPU zones go to the thread "CPU". GPU zones go to the thread "GPU" and start with their CPU zones,
+     * since elapsed time queries do not tell when the GPU started the work.
+     * @param fileName File to write.
+     * @return True if the file is written.
+     */
+    bool write_trace(const char* fileName) const;
+    /**
+     * Print average CPU and GPU time of each zone and a histogram of frame times over the recorded frames.
+     * @param os Stream to print to.
+     */
+    void print_summary(std::ostream& os) const;
+
+    /**
+     * Helper that measures a zone for its lifetime.
+     */
+    class scope
+    {
+    public:
+        /**
+         * Constructor. Start a zone.
+         * @param profiler Profiler.
+         * @param name Zone name, see begin_zone().
+         */
+        scope(frame_profiler& profiler, const char* name);
+        /**
+         * Destructor. Finish the zone.
+         */
+        ~scope();
+
+    private:
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+        /**
+         * Profiler the zone belongs to.
+         */
+        frame_profiler& m_profiler;
+    };
+
+private:
+    frame_profiler(const frame_profiler&) = delete;
+    frame_profiler& operator=(const frame_profiler&) = delete;
+
+    /**
+     * Measurement of one zone.
+     */
+    struct zone_record
+    {
+        const char* name;
+        /**
+         * Nesting level, 0 for zones directly in the frame.
+         */
+        unsigned depth;
+        /**
+         * CPU start and end in microseconds since the profiler was created.
+         */
+        double begin;
+        double end;
+        /**
+         * GPU time in microseconds, negative if it is not known.
+         */
+        double gpuTime;
+    };
+
+    /**
+     * Measurement of one frame.
+     */
+    struct frame_record
+    {
+        uint64_t number;
+        double begin;
+        double end;
+        unsigned calls;
+        unsigned skipped;
+        uint64_t uploadBytes;
+        size_t zoneCount;
+        zone_record zones[MAX_ZONES];
+    };
+
+    /**
+     * Return time since the profiler was created.
+     * @return Time in microseconds.
+     */
+    double now() const;
+    /**
+     * Read the query results of a frame recorded QUERY_LATENCY frames ago if they are available.
+     * @param record The frame.
+     */
+    void resolve(frame_record& record);
+    /**
+     * Return the recorded frames from the oldest one.
+     * @param count Receives the number of frames.
+     * @return Index of the oldest frame in the ring.
+     */
+    size_t recorded(size_t& count) const;
+
+    /**
+     * Start of the profiler time.
+     */
+    std::chrono::steady_clock::time_point m_start;
+    /**
+     * Queries: MAX_ZONES per frame for QUERY_LATENCY frames.
+     */
+    std::vector< GLuint > m_queries;
+    /**
+     * Ring of the last TRACE_FRAMES frames.
+     */
+    std::vector< frame_record > m_frames;
+    /**
+     * Number of finished frames.
+     */
+    uint64_t m_frameCount;
+    /**
+     * Zones of the current frame that are not ended yet, by nesting level. MAX_ZONES marks an ignored zone.
+     */
+    size_t m_openZones[MAX_ZONES];
+    /**
+     * Nesting level of the current zone, including ignored zones.
+     */
+    unsigned m_depth;
+};
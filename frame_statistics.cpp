@@ -0,0 +1,39 @@
+#include "frame_statistics.h"
+
+#include <algorithm>
+#include <cmath>
+
+void frame_statistics::add(double milliseconds)
+{
+    m_times.push_back(milliseconds);
+}
+
+size_t frame_statistics::count() const
+{
+    return m_times.size();
+}
+
+double frame_statistics::average() const
+{
+    if (m_times.empty()) {
+        return 0.0;
+    }
+    double sum = 0.0;
+    for (double time : m_times) {
+        sum += time;
+    }
+    return sum / m_times.size();
+}
+
+double frame_statistics::percentile(double percent) const
+{
+    if (m_times.empty()) {
+        return 0.0;
+    }
+    // The rank is the number of frames that must not exceed the value, at least one.
+    size_t rank = size_t(std::ceil(std::min(std::max(percent, 0.0), 100.0) / 100.0 * m_times.size()));
+    rank = std::max(rank, size_t(1));
+    std::vector< double > sorted(m_times);
+    std::nth_element(sorted.begin(), sorted.begin() + (rank - 1), sorted.end());
+    return sorted[rank - 1];
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * Collects frame times and reports their distribution.
+ */
+class frame_statistics
+{
+public:
+    /**
+     * Add time of one frame.
+     * @param milliseconds Frame time in milliseconds.
+     */
+    void add(double milliseconds);
+    /**
+     * Return number of frames.
+     * @return Number of frames.
+     */
+    size_t count() const;
+    /**
+     * Return average frame time.
+     * @return Average time in milliseconds, 0 if there are no frames.
+     */
+    double average() const;
+    /**
+     * Return the frame time that the given percentage of frames do not exceed, by the nearest rank method.
+     * @param percent Percentage of frames from 0 to 100.
+     * @return Frame time in milliseconds, 0 if there are no frames.
+     */
+    double percentile(double percent) const;
+
+private:
+    /**
+     * Frame times in the order they were added.
+     */
+    std::vector< double > m_times;
+};
@@ -0,0 +1,129 @@
+#include "frustum_culler.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <chrono>
+
+frustum_culler::frustum_culler(unsigned threadCount)
+    : m_count(0)
+    , m_statistics({ 0, 0, 0, 0.0 })
+    , m_pool(threadCount)
+{
+}
+
+void frustum_culler::clear()
+{
+    m_x.clear();
+    m_y.clear();
+    m_z.clear();
+    m_radius.clear();
+    m_count = 0;
+}
+
+void frustum_culler::add(const glm::vec3& center, float radius)
+{
+    // Grow the arrays by a whole SIMD batch, lanes past the last sphere are ignored by cull_range().
+    if (m_count % simd_float::WIDTH == 0) {
+        size_t size = m_count + simd_float::WIDTH;
+        m_x.resize(size, 0.0f);
+        m_y.resize(size, 0.0f);
+        m_z.resize(size, 0.0f);
+        m_radius.resize(size, 0.0f);
+    }
+    m_x[m_count] = center.x;
+    m_y[m_count] = center.y;
+    m_z[m_count] = center.z;
+    m_radius[m_count] = radius;
+    m_count++;
+}
+
+size_t frustum_culler::size() const
+{
+    return m_count;
+}
+
+const std::vector< uint32_t >& frustum_culler::cull(const glm::mat4& viewProjection)
+{
+    auto begin = std::chrono::steady_clock::now();
+    glm::vec4 planes[6];
+    extract_planes(viewProjection, planes);
+    size_t jobCount = (m_count + JOB_SIZE - 1) / JOB_SIZE;
+    m_scratch.resize(m_count);
+    m_jobVisible.resize(jobCount);
+    m_pool.parallel_for(jobCount, [&](size_t jobBegin, size_t jobEnd) {
+        for (size_t job = jobBegin; job < jobEnd; job++) {
+            m_jobVisible[job] = cull_range(planes, job * JOB_SIZE, std::min(m_count, (job + 1) * JOB_SIZE));
+        }
+    });
+    // Join the parts of the jobs in order.
+    m_visible.clear();
+    for (size_t job = 0; job < jobCount; job++) {
+        const uint32_t* part = m_scratch.data() + job * JOB_SIZE;
+        m_visible.insert(m_visible.end(), part, part + m_jobVisible[job]);
+    }
+    m_statistics.passes++;
+    m_statistics.tested += m_count;
+    m_statistics.visible += m_visible.size();
+    m_statistics.milliseconds += std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - begin).count();
+    return m_visible;
+}
+
+const cull_statistics& frustum_culler::statistics() const
+{
+    return m_statistics;
+}
+
+void frustum_culler::extract_planes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+    // Rows of the matrix, glm stores columns.
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+    // A clip space point is inside if -w <= x, y, z <= w, each side is the sum or the difference of two rows.
+    for (int i = 0; i < 3; i++) {
+        planes[i * 2] = rows[3] + rows[i];
+        planes[i * 2 + 1] = rows[3] - rows[i];
+    }
+    for (int i = 0; i < 6; i++) {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+}
+
+size_t frustum_culler::cull_range(const glm::vec4 planes[6], size_t begin, size_t end)
+{
+    simd_float planeValues[6][4];
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j < 4; j++) {
+            planeValues[i][j] = simd_broadcast(planes[i][j]);
+        }
+    }
+    const simd_float ZERO = simd_broadcast(0.0f);
+    uint32_t* visible = m_scratch.data() + begin;
+    size_t count = 0;
+    for (size_t i = begin; i < end; i += simd_float::WIDTH) {
+        simd_float x = simd_load(m_x.data() + i);
+        simd_float y = simd_load(m_y.data() + i);
+        simd_float z = simd_load(m_z.data() + i);
+        simd_float radius = simd_load(m_radius.data() + i);
+        // Distance of the centers to each plane plus the radius must not be negative.
+        simd_mask inside = planeValues[0][0] * x + planeValues[0][1] * y + planeValues[0][2] * z + planeValues[0][3] + radius >= ZERO;
+        for (int p = 1; p < 6; p++) {
+            inside = inside & (planeValues[p][0] * x + planeValues[p][1] * y + planeValues[p][2] * z + planeValues[p][3] + radius >= ZERO);
+        }
+        int bits = simd_bits(inside);
+        if (end - i < size_t(simd_float::WIDTH)) {
+            bits &= (1 << (end - i)) - 1;
+        }
+        // Write the visible lanes in order.
+        while (bits) {
+            int lane = 0;
+            while (!(bits & (1 << lane))) {
+                lane++;
+            }
+            bits &= bits - 1;
+            visible[count++] = uint32_t(i + lane);
+        }
+    }
+    return count;
+}
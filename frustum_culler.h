@@ -0,0 +1,128 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * Totals of the culling passes since the culler was created.
+ */
+struct cull_statistics
+{
+    /**
+     * Number of culling passes.
+     */
+    uint64_t passes;
+    /**
+     * Number of tested and visible spheres over all passes.
+     */
+    uint64_t tested;
+    uint64_t visible;
+    /**
+     * Time spent in the passes in milliseconds.
+     */
+    double milliseconds;
+};
+
+/**
+ * Frustum culling of many bounding spheres.
+ *
+ * Spheres are stored as structure of arrays, so simd_float::WIDTH spheres are tested against a plane with a few
+ * vector operations. A sphere is visible unless it is completely behind one of the six frustum planes.
+ * This keeps a few spheres near the frustum corners that are outside, which is fine for culling.
+ *
+ * The spheres are split into jobs of JOB_SIZE spheres that run on a thread pool. Each job writes the indices of its
+ * visible spheres to its own part of a scratch array, the parts are then joined in order. The visible list is
+ * therefore sorted and does not depend on the number of threads. A pass does not allocate memory once the visible
+ * list has grown to its largest size.
+ */
+class frustum_culler
+{
+public:
+    /**
+     * Number of spheres tested by one job, a multiple of simd_float::WIDTH.
+     */
+    constexpr static size_t JOB_SIZE = 4096;
+
+    /**
+     * Constructor.
+     * @param threadCount Number of threads to cull with, 0 means one thread per hardware core.
+     */
+    frustum_culler(unsigned threadCount = 0);
+    /**
+     * Remove all spheres.
+     */
+    void clear();
+    /**
+     * Add a sphere. Its index is the number of spheres added before it.
+     * @param center Center in world space.
+     * @param radius Radius.
+     */
+    void add(const glm::vec3& center, float radius);
+    /**
+     * Return the number of spheres.
+     * @return Number of spheres.
+     */
+    size_t size() const;
+    /**
+     * Find the spheres that are at least partly inside the view frustum.
+     * @param viewProjection Matrix from world space to clip space.
+     * @return Indices of the visible spheres in increasing order, valid until the next call.
+     */
+    const std::vector< uint32_t >& cull(const glm::mat4& viewProjection);
+    /**
+     * Return totals of all passes.
+     * @return Statistics.
+     */
+    const cull_statistics& statistics() const;
+
+private:
+    frustum_culler(const frustum_culler&) = delete;
+    frustum_culler& operator=(const frustum_culler&) = delete;
+
+    /**
+     * Extract the frustum planes from a view projection matrix (Gribb and Hartmann).
+     * A point p is inside a plane if dot(plane.xyz, p) + plane.w >= 0. The planes are normalized,
+     * so the value is the distance to the plane.
+     * @param viewProjection Matrix from world space to clip space.
+     * @param planes Receives the left, right, bottom, top, near and far planes.
+     */
+    static void extract_planes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+    /**
+     * Test spheres [begin, end) and write the indices of the visible ones to the scratch array from begin.
+     * @param planes Frustum planes.
+     * @param begin First sphere, a multiple of simd_float::WIDTH.
+     * @param end End of the range.
+     * @return Number of visible spheres.
+     */
+    size_t cull_range(const glm::vec4 planes[6], size_t begin, size_t end);
+
+    /**
+     * Sphere centers and radii. Each array is padded to a multiple of simd_float::WIDTH.
+     */
+    std::vector< float > m_x;
+    std::vector< float > m_y;
+    std::vector< float > m_z;
+    std::vector< float > m_radius;
+    /**
+     * Number of spheres.
+     */
+    size_t m_count;
+    /**
+     * Visible indices of each job at the offset of its first sphere.
+     */
+    std::vector< uint32_t > m_scratch;
+    /**
+     * Number of visible spheres of each job.
+     */
+    std::vector< size_t > m_jobVisible;
+    /**
+     * Result of the last pass.
+     */
+    std::vector< uint32_t > m_visible;
+    cull_statistics m_statistics;
+    thread_pool m_pool;
+};
@@ -0,0 +1,236 @@
+#include "light_clusterer.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+constexpr size_t light_clusterer::MAX_LIGHTS;
+
+void light_clusterer::sphere_list::clear()
+{
+    count = 0;
+}
+
+void light_clusterer::sphere_list::push(float centerX, float centerY, float centerDepth, float sphereRadius, uint16_t lightNumber)
+{
+    // Grow the arrays by a whole SIMD batch, lanes past the last sphere are ignored by overlap().
+    if (count == x.size()) {
+        size_t size = count + simd_float::WIDTH;
+        x.resize(size, 0.0f);
+        y.resize(size, 0.0f);
+        depth.resize(size, 0.0f);
+        radius.resize(size, 0.0f);
+        light.resize(size, 0);
+    }
+    x[count] = centerX;
+    y[count] = centerY;
+    depth[count] = centerDepth;
+    radius[count] = sphereRadius;
+    light[count] = lightNumber;
+    count++;
+}
+
+void light_clusterer::sphere_list::push(const sphere_list& source, size_t index)
+{
+    push(source.x[index], source.y[index], source.depth[index], source.radius[index], source.light[index]);
+}
+
+light_clusterer::light_clusterer(unsigned threadCount)
+    : m_tanX(0.0f)
+    , m_tanY(0.0f)
+    , m_nearPlane(0.0f)
+    , m_farPlane(0.0f)
+    , m_slices(GRID_Z)
+    , m_clusters(size_t(GRID_X) * GRID_Y * GRID_Z * 2, 0)
+    , m_indices(1, 0)
+    , m_lightData(2, glm::vec4(0.0f))
+    , m_statistics({ 0, 0, 0, 0.0 })
+    , m_pool(threadCount)
+{
+    m_lights.count = 0;
+    for (slice_scratch& slice : m_slices) {
+        slice.slice.count = 0;
+        slice.row.count = 0;
+    }
+}
+
+void light_clusterer::set_projection(float fieldOfView, float aspectRatio, float nearPlane, float farPlane)
+{
+    float tanY = std::tan(fieldOfView / 2);
+    float tanX = tanY * aspectRatio;
+    if (tanX == m_tanX && tanY == m_tanY && nearPlane == m_nearPlane && farPlane == m_farPlane) {
+        return;
+    }
+    m_tanX = tanX;
+    m_tanY = tanY;
+    m_nearPlane = nearPlane;
+    m_farPlane = farPlane;
+
+    m_sliceBoxes.clear();
+    m_rowBoxes.clear();
+    m_clusterBoxes.clear();
+    for (int z = 0; z < GRID_Z; z++) {
+        // The inner slice bounds follow slice_mapping(), the outer ones reach to the clip planes.
+        float depth0 = z == 0 ? nearPlane : SLICE_NEAR * std::pow(SLICE_FAR / SLICE_NEAR, float(z) / GRID_Z);
+        float depth1 = z == GRID_Z - 1 ? farPlane : SLICE_NEAR * std::pow(SLICE_FAR / SLICE_NEAR, float(z + 1) / GRID_Z);
+        m_sliceBoxes.push_back(frustum_box(-1.0f, 1.0f, -1.0f, 1.0f, depth0, depth1));
+        for (int y = 0; y < GRID_Y; y++) {
+            float y0 = -1.0f + 2.0f * y / GRID_Y;
+            float y1 = -1.0f + 2.0f * (y + 1) / GRID_Y;
+            m_rowBoxes.push_back(frustum_box(-1.0f, 1.0f, y0, y1, depth0, depth1));
+            for (int x = 0; x < GRID_X; x++) {
+                float x0 = -1.0f + 2.0f * x / GRID_X;
+                float x1 = -1.0f + 2.0f * (x + 1) / GRID_X;
+                m_clusterBoxes.push_back(frustum_box(x0, x1, y0, y1, depth0, depth1));
+            }
+        }
+    }
+}
+
+void light_clusterer::bin(const glm::mat4& cameraMatrix, const std::vector< point_light >& lights)
+{
+    auto begin = std::chrono::steady_clock::now();
+    size_t lightCount = std::min(lights.size(), MAX_LIGHTS);
+
+    // Move the lights to view space, with the depth positive in front of the camera.
+    m_lights.clear();
+    m_lightData.resize(std::max< size_t >(lightCount * 2, 2));
+    for (size_t i = 0; i < lightCount; i++) {
+        glm::vec3 position = glm::vec3(cameraMatrix * glm::vec4(lights[i].position, 1.0f));
+        m_lights.push(position.x, position.y, -position.z, lights[i].radius, uint16_t(i));
+        m_lightData[i * 2] = glm::vec4(position, lights[i].radius);
+        m_lightData[i * 2 + 1] = glm::vec4(lights[i].color, 0.0f);
+    }
+
+    m_pool.parallel_for(size_t(GRID_Z), [&](size_t sliceBegin, size_t sliceEnd) {
+        for (size_t slice = sliceBegin; slice < sliceEnd; slice++) {
+            bin_slice(int(slice));
+        }
+    });
+
+    // Join the index lists of the slices in order and point the clusters into them.
+    m_indices.clear();
+    for (int z = 0; z < GRID_Z; z++) {
+        const slice_scratch& slice = m_slices[z];
+        uint32_t offset = uint32_t(m_indices.size());
+        for (int i = 0; i < GRID_X * GRID_Y; i++) {
+            size_t cluster = size_t(z) * GRID_X * GRID_Y + i;
+            m_clusters[cluster * 2] = offset;
+            m_clusters[cluster * 2 + 1] = slice.counts[i];
+            offset += slice.counts[i];
+        }
+        m_indices.insert(m_indices.end(), slice.indices.begin(), slice.indices.end());
+    }
+    m_statistics.indices += m_indices.size();
+    if (m_indices.empty()) {
+        m_indices.push_back(0);
+    }
+    m_statistics.passes++;
+    m_statistics.lights += lightCount;
+    m_statistics.milliseconds += std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - begin).count();
+}
+
+const std::vector< uint32_t >& light_clusterer::clusters() const
+{
+    return m_clusters;
+}
+
+const std::vector< uint16_t >& light_clusterer::indices() const
+{
+    return m_indices;
+}
+
+const std::vector< glm::vec4 >& light_clusterer::light_data() const
+{
+    return m_lightData;
+}
+
+glm::vec2 light_clusterer::slice_mapping() const
+{
+    // slice = GRID_Z * log(depth / SLICE_NEAR) / log(SLICE_FAR / SLICE_NEAR)
+    float scale = GRID_Z / std::log(SLICE_FAR / SLICE_NEAR);
+    return glm::vec2(scale, -std::log(SLICE_NEAR) * scale);
+}
+
+const cluster_statistics& light_clusterer::statistics() const
+{
+    return m_statistics;
+}
+
+template < typename Visit >
+void light_clusterer::overlap(const sphere_list& spheres, const cluster_box& box, Visit visit)
+{
+    const simd_float ZERO = simd_broadcast(0.0f);
+    simd_float centerX = simd_broadcast(box.center.x);
+    simd_float centerY = simd_broadcast(box.center.y);
+    simd_float centerDepth = simd_broadcast(box.center.z);
+    simd_float extentX = simd_broadcast(box.extent.x);
+    simd_float extentY = simd_broadcast(box.extent.y);
+    simd_float extentDepth = simd_broadcast(box.extent.z);
+    for (size_t i = 0; i < spheres.count; i += simd_float::WIDTH) {
+        // Distance from the center of the sphere to the nearest point of the box must not exceed the radius.
+        simd_float dx = simd_max(simd_abs(simd_load(spheres.x.data() + i) - centerX) - extentX, ZERO);
+        simd_float dy = simd_max(simd_abs(simd_load(spheres.y.data() + i) - centerY) - extentY, ZERO);
+        simd_float dz = simd_max(simd_abs(simd_load(spheres.depth.data() + i) - centerDepth) - extentDepth, ZERO);
+        simd_float radius = simd_load(spheres.radius.data() + i);
+        int bits = simd_bits(dx * dx + dy * dy + dz * dz <= radius * radius);
+        if (spheres.count - i < size_t(simd_float::WIDTH)) {
+            bits &= (1 << (spheres.count - i)) - 1;
+        }
+        while (bits) {
+            int lane = 0;
+            while (!(bits & (1 << lane))) {
+                lane++;
+            }
+            bits &= bits - 1;
+            visit(i + lane);
+        }
+    }
+}
+
+light_clusterer::cluster_box light_clusterer::frustum_box(float x0, float x1, float y0, float y1, float depth0, float depth1) const
+{
+    // The part of the frustum is bounded by its 8 corners.
+    glm::vec3 low(0.0f);
+    glm::vec3 high(0.0f);
+    bool first = true;
+    for (float depth : { depth0, depth1 }) {
+        for (float x : { x0, x1 }) {
+            for (float y : { y0, y1 }) {
+                glm::vec3 corner(x * m_tanX * depth, y * m_tanY * depth, depth);
+                low = first ? corner : glm::min(low, corner);
+                high = first ? corner : glm::max(high, corner);
+                first = false;
+            }
+        }
+    }
+    return { (low + high) * 0.5f, (high - low) * 0.5f };
+}
+
+void light_clusterer::bin_slice(int slice)
+{
+    slice_scratch& scratch = m_slices[slice];
+    scratch.indices.clear();
+    std::fill(scratch.counts, scratch.counts + GRID_X * GRID_Y, 0);
+    scratch.slice.clear();
+    overlap(m_lights, m_sliceBoxes[slice], [&](size_t i) { scratch.slice.push(m_lights, i); });
+    if (scratch.slice.count == 0) {
+        return;
+    }
+    for (int y = 0; y < GRID_Y; y++) {
+        scratch.row.clear();
+        overlap(scratch.slice, m_rowBoxes[size_t(slice) * GRID_Y + y], [&](size_t i) { scratch.row.push(scratch.slice, i); });
+        if (scratch.row.count == 0) {
+            continue;
+        }
+        for (int x = 0; x < GRID_X; x++) {
+            size_t cluster = (size_t(slice) * GRID_Y + y) * GRID_X + x;
+            uint32_t& count = scratch.counts[y * GRID_X + x];
+            overlap(scratch.row, m_clusterBoxes[cluster], [&](size_t i) {
+                scratch.indices.push_back(scratch.row.light[i]);
+                count++;
+            });
+        }
+    }
+}
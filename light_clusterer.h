@@ -0,0 +1,237 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * Point light with a limited range.
+ */
+struct point_light
+{
+    glm::vec3 position;
+    /**
+     * Distance at which the light fades to zero.
+     */
+    float radius;
+    glm::vec3 color;
+};
+
+/**
+ * Totals of the binning passes since the clusterer was created.
+ */
+struct cluster_statistics
+{
+    /**
+     * Number of binning passes.
+     */
+    uint64_t passes;
+    /**
+     * Number of binned lights and of light indices written over all passes.
+     */
+    uint64_t lights;
+    uint64_t indices;
+    /**
+     * Time spent in the passes in milliseconds.
+     */
+    double milliseconds;
+};
+
+/**
+ * Assignment of point lights to the clusters of the view frustum for clustered forward shading.
+ *
+ * The frustum is split into GRID_X x GRID_Y tiles on the screen and GRID_Z slices in depth. Slices grow exponentially
+ * from SLICE_NEAR to SLICE_FAR, the first one reaches to the near plane and the last one to the far plane.
+ * A fragment finds its cluster from its window position and its depth, and shades only the lights of the cluster.
+ *
+ * Each cluster is bounded by a box in view space. Lights are tested against the boxes as spheres, narrowing down
+ * level by level: the lights that touch a slice, then a row of the slice, then each cluster of the row. The lights
+ * that pass a level are copied into a structure of arrays, so each level tests simd_float::WIDTH lights at once.
+ * Slices are binned in parallel on a thread pool, each into its own index list. The lists are then joined in order,
+ * so the result does not depend on the number of threads. A pass does not allocate memory once the lists have grown
+ * to their largest size.
+ *
+ * The results are laid out for buffer textures:
+ * - clusters: an offset into the index list and a light count per cluster, slice by slice, row by row;
+ * - indices: light numbers of all clusters;
+ * - light data: two vec4 per light, the view space position with the radius and the color.
+ */
+class light_clusterer
+{
+public:
+    /**
+     * Cluster grid size. Must match the constants of main.fs.
+     */
+    constexpr static int GRID_X = 16;
+    constexpr static int GRID_Y = 16;
+    constexpr static int GRID_Z = 24;
+    /**
+     * Depth range in view space that the slices are spread over.
+     */
+    constexpr static float SLICE_NEAR = 1.0f;
+    constexpr static float SLICE_FAR = 30.0f;
+    /**
+     * Largest number of lights, indices are 16-bit.
+     */
+    constexpr static size_t MAX_LIGHTS = 65536;
+
+    /**
+     * Constructor.
+     * @param threadCount Number of threads to bin with, 0 means one thread per hardware core.
+     */
+    light_clusterer(unsigned threadCount = 0);
+    /**
+     * Set the perspective projection, the cluster boxes are rebuilt if it has changed.
+     * @param fieldOfView Vertical field of view in radians.
+     * @param aspectRatio Width divided by height.
+     * @param nearPlane Distance to the near plane.
+     * @param farPlane Distance to the far plane.
+     */
+    void set_projection(float fieldOfView, float aspectRatio, float nearPlane, float farPlane);
+    /**
+     * Assign lights to the clusters.
+     * @param cameraMatrix Matrix from world space to view space.
+     * @param lights Lights in world space, at most MAX_LIGHTS.
+     */
+    void bin(const glm::mat4& cameraMatrix, const std::vector< point_light >& lights);
+    /**
+     * Return the offset and the count of each cluster.
+     * @return Two values per cluster.
+     */
+    const std::vector< uint32_t >& clusters() const;
+    /**
+     * Return the light numbers of all clusters.
+     * @return Indices, at least one so the buffer is never empty.
+     */
+    const std::vector< uint16_t >& indices() const;
+    /**
+     * Return the lights in view space.
+     * @return Two vectors per light: position and radius, color. At least two so the buffer is never empty.
+     */
+    const std::vector< glm::vec4 >& light_data() const;
+    /**
+     * Return the scale and the bias that map the log of the view depth to the slice number.
+     * @return Slice scale and bias.
+     */
+    glm::vec2 slice_mapping() const;
+    /**
+     * Return totals of all passes.
+     * @return Statistics.
+     */
+    const cluster_statistics& statistics() const;
+
+private:
+    light_clusterer(const light_clusterer&) = delete;
+    light_clusterer& operator=(const light_clusterer&) = delete;
+
+    /**
+     * Axis aligned box in view space, depth is positive in front of the camera.
+     */
+    struct cluster_box
+    {
+        glm::vec3 center;
+        glm::vec3 extent;
+    };
+
+    /**
+     * Spheres as structure of arrays. Arrays are padded to a multiple of simd_float::WIDTH.
+     */
+    struct sphere_list
+    {
+        std::vector< float > x;
+        std::vector< float > y;
+        std::vector< float > depth;
+        std::vector< float > radius;
+        /**
+         * Light number of each sphere.
+         */
+        std::vector< uint16_t > light;
+        size_t count;
+
+        /**
+         * Remove all spheres, keep the memory.
+         */
+        void clear();
+        /**
+         * Append a sphere.
+         * @param centerX X of the center in view space.
+         * @param centerY Y of the center in view space.
+         * @param centerDepth Depth of the center in view space.
+         * @param sphereRadius Radius.
+         * @param lightNumber Light number.
+         */
+        void push(float centerX, float centerY, float centerDepth, float sphereRadius, uint16_t lightNumber);
+        /**
+         * Append a sphere of another list.
+         * @param source List to copy from.
+         * @param index Sphere of the source list.
+         */
+        void push(const sphere_list& source, size_t index);
+    };
+
+    /**
+     * Work memory of one slice.
+     */
+    struct slice_scratch
+    {
+        sphere_list slice;
+        sphere_list row;
+        /**
+         * Light numbers of the clusters of the slice and the count per cluster.
+         */
+        std::vector< uint16_t > indices;
+        uint32_t counts[GRID_X * GRID_Y];
+    };
+
+    /**
+     * Test spheres against a box.
+     * @param spheres Spheres.
+     * @param box Box.
+     * @param visit Called with the number of each sphere that touches the box, in order.
+     */
+    template < typename Visit >
+    static void overlap(const sphere_list& spheres, const cluster_box& box, Visit visit);
+    /**
+     * Build the box around a part of the frustum.
+     * @param x0 Left edge in normalized device coordinates.
+     * @param x1 Right edge in normalized device coordinates.
+     * @param y0 Bottom edge in normalized device coordinates.
+     * @param y1 Top edge in normalized device coordinates.
+     * @param depth0 Near depth.
+     * @param depth1 Far depth.
+     * @return Box in view space.
+     */
+    cluster_box frustum_box(float x0, float x1, float y0, float y1, float depth0, float depth1) const;
+    /**
+     * Assign the lights of a slice to its clusters.
+     * @param slice Slice number.
+     */
+    void bin_slice(int slice);
+
+    /**
+     * Projection the boxes are built for.
+     */
+    float m_tanX;
+    float m_tanY;
+    float m_nearPlane;
+    float m_farPlane;
+    /**
+     * Boxes of the slices, of the rows of each slice and of each cluster.
+     */
+    std::vector< cluster_box > m_sliceBoxes;
+    std::vector< cluster_box > m_rowBoxes;
+    std::vector< cluster_box > m_clusterBoxes;
+    /**
+     * Lights of the current pass in view space.
+     */
+    sphere_list m_lights;
+    std::vector< slice_scratch > m_slices;
+    std::vector< uint32_t > m_clusters;
+    std::vector< uint16_t > m_indices;
+    std::vector< glm::vec4 > m_lightData;
+    cluster_statistics m_statistics;
+    thread_pool m_pool;
+};
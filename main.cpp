@@ -1,7 +1,39 @@
-#include "object.h"
+#include "asset_loader.h"
+#include "benchmarks.h"
 #include "bitmap_image.h"
+#include "cone_step_map.h"
+#include "texture_cache.h"
+#include "frame_statistics.h"
+#include "frame_profiler.h"
+#include "frustum_culler.h"
+#include "light_clusterer.h"
+#include "program_cache.h"
+#include "render_state.h"
+#include "resolution_controller.h"
+#include "scene_target.h"
+#include "software_rasterizer.h"
+#include "texture_feedback.h"
+#include "triple_buffer.h"
+#include "uniform_ring.h"
+#include "virtual_texture.h"
 
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 #define GLEW_STATIC
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -17,10 +49,254 @@ const int WINDOW_WIDTH = 800;
  */
 const int WINDOW_HEIGHT = 800;
 /**
- * If the shader compilation fails, the error message will be printed out.
- * The constant defines maximal size of the error message buffer.
+ * Maximal error of a level of detail on the screen in pixels.
+ * Coarser levels are drawn as long as their error stays below it.
  */
-const int ERROR_BUFFER_SIZE = 2048;
+const float LOD_PIXEL_ERROR = 1.0f;
+/**
+ * Number of samples per pixel for antialiasing if not set on the command line.
+ */
+const int DEFAULT_MSAA_SAMPLES = 4;
+/**
+ * Smallest fraction of the output width and height the dynamic resolution renders the scene at.
+ */
+const float MIN_RENDER_SCALE = 0.5f;
+/**
+ * Number of frames between reports of the frame time and the resolution while the dynamic resolution is on.
+ */
+const int RESOLUTION_REPORT_FRAMES = 60;
+/**
+ * Animation time step of a frame in the headless mode in seconds.
+ */
+const double FIXED_TIMESTEP = 1.0 / 60.0;
+/**
+ * Number of frames drawn in the headless mode if not set on the command line.
+ */
+const int DEFAULT_HEADLESS_FRAMES = 300;
+/**
+ * Smallest PSNR in dB of a software frame against the GL frame it is compared to, see --compare.
+ */
+const double MIN_COMPARE_PSNR = 38.0;
+/**
+ * Pixels with a channel off by more than COMPARE_OUTLIER_ERROR are outliers, at most MAX_COMPARE_OUTLIERS of all
+ * pixels may be. The largest error itself is not limited: the GL frame is multisampled, so silhouettes differ a lot.
+ */
+const int COMPARE_OUTLIER_ERROR = 16;
+const double MAX_COMPARE_OUTLIERS = 0.005;
+/**
+ * Camera position, the camera looks along the z axis.
+ */
+const glm::vec3 CAMERA_POSITION(0.0f, 0.0f, -7.0f);
+/**
+ * Light position.
+ */
+const glm::vec3 LIGHT_POSITION(0.0f, 0.0f, -10.0f);
+/**
+ * Camera position given to the shaders for the view direction of the parallax mapping.
+ */
+const glm::vec3 SHADER_CAMERA_POSITION(0.0f, 0.0f, -10.0f);
+/**
+ * Vertical field of view in degrees.
+ */
+const float FIELD_OF_VIEW = 30.0f;
+/**
+ * Distance to the near and the far clip plane.
+ */
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+/**
+ * Background color.
+ */
+const glm::vec3 BACKGROUND_COLOR(0.8f, 0.8f, 0.8f);
+/**
+ * Side of the square in the plane z = 0 that the instances of the stress mode are placed in.
+ * It fills the view of the camera.
+ */
+const float INSTANCE_GRID_EXTENT = 3.6f;
+/**
+ * Scale of an instance relative to its grid cell. The box spans 2 units, so rotated instances barely touch.
+ */
+const float INSTANCE_CELL_SCALE = 0.28f;
+/**
+ * Uniform buffer binding points of the frameUniforms and objectUniforms blocks of the shaders.
+ */
+const GLuint FRAME_UNIFORMS_BINDING = 0;
+const GLuint OBJECT_UNIFORMS_BINDING = 1;
+/**
+ * Texture units of the buffer textures of the clustered point lights.
+ */
+const GLuint CLUSTER_TEXTURE_UNIT = 3;
+const GLuint LIGHT_INDEX_TEXTURE_UNIT = 4;
+const GLuint LIGHT_TEXTURE_UNIT = 5;
+/**
+ * Bytes of uniform values a frame writes into the uniform ring, with room for padding each block to the offset alignment.
+ */
+const size_t UNIFORM_RING_FRAME_SIZE = 2048;
+/**
+ * Texture units of the page table and the tile cache of the virtual texture.
+ */
+const GLuint PAGE_TABLE_TEXTURE_UNIT = 6;
+const GLuint TILE_CACHE_TEXTURE_UNIT = 7;
+/**
+ * Default number of tiles in the cache of the virtual texture and of tiles written into it per frame.
+ */
+const int DEFAULT_TILE_CACHE_SLOTS = 64;
+const int DEFAULT_TILE_UPLOAD_BUDGET = 4;
+/**
+ * Point lights circle around the y axis between these distances, up to LIGHT_HEIGHT above and below the origin.
+ */
+const float LIGHT_ORBIT_MIN = 1.2f;
+const float LIGHT_ORBIT_MAX = 3.0f;
+const float LIGHT_HEIGHT = 2.0f;
+/**
+ * Average number of point lights that reach a point between the orbits. The radius of the lights shrinks as lights
+ * are added, so the shading cost per pixel stays about the same and more lights mostly cost binning and upload.
+ */
+const float LIGHT_OVERLAP = 8.0f;
+/**
+ * Largest radius of a point light.
+ */
+const float LIGHT_MAX_RADIUS = 3.0f;
+/**
+ * Brightness of a point light, the main light has 1.
+ */
+const float LIGHT_INTENSITY = 0.3f;
+
+/**
+ * Options given on the command line.
+ */
+struct run_options
+{
+    /**
+     * Draw into an off-screen framebuffer without showing a window, with a fixed time step, and report frame times.
+     */
+    bool headless;
+    /**
+     * Number of frames to draw in the headless mode.
+     */
+    int frames;
+    /**
+     * Size of the window or of the off-screen framebuffer.
+     */
+    int width;
+    int height;
+    /**
+     * The headless mode writes the last frame to this .bmp file if it is not empty.
+     */
+    std::string dumpFile;
+    /**
+     * The software mode compares the last frame with this .bmp file if it is not empty, e.g. a frame written by
+     * --dump in the GL mode, and fails if they differ more than MIN_COMPARE_PSNR and MAX_COMPARE_OUTLIERS allow.
+     */
+    std::string compareFile;
+    /**
+     * Profile of the last frames is written to this Chrome trace file on exit if it is not empty.
+     */
+    std::string traceFile;
+    /**
+     * Draw with the CPU rasterizer instead of OpenGL, without a window and with the headless time step.
+     * Only a single instance is drawn.
+     */
+    bool software;
+    /**
+     * Number of instances of the mesh that are drawn, more than one is the instancing stress mode.
+     */
+    int instances;
+    /**
+     * Size of the instance grid relative to the view, instances of larger grids are partly out of view and culled.
+     */
+    float gridScale;
+    /**
+     * Number of samples per pixel of the scene, 0 or 1 disables multisampling.
+     */
+    int samples;
+    /**
+     * Smooth edges with FXAA after the scene is drawn.
+     */
+    bool fxaa;
+    /**
+     * Fraction of the output size the scene is drawn at, the initial one if the dynamic resolution is on.
+     */
+    float renderScale;
+    /**
+     * Frame time the dynamic resolution aims at in milliseconds, 0 keeps the resolution fixed.
+     */
+    double targetFrameTime;
+    /**
+     * Number of point lights besides the main light.
+     */
+    int lights;
+    /**
+     * Measure the light binning for several light counts instead of drawing.
+     */
+    bool lightBenchmark;
+    /**
+     * The color texture is streamed in tiles from this .bmp file if it is not empty.
+     */
+    std::string virtualTexture;
+    /**
+     * Number of tiles in the cache of the virtual texture and largest number of tiles written into it per frame.
+     */
+    int tileCacheSlots;
+    int tileUploadBudget;
+    /**
+     * Write the uniform ring through a persistent mapping if the driver supports it, otherwise orphan its storage.
+     */
+    bool persistentMapping;
+};
+
+/**
+ * Off-screen framebuffer the headless mode presents frames into instead of a window.
+ */
+struct offscreen_target
+{
+    GLuint framebuffer;
+    GLuint colorBuffer;
+};
+
+/**
+ * Content of the frameUniforms block in the std140 layout, values that are the same for all objects of a frame.
+ */
+struct frame_uniforms
+{
+    glm::mat4 cameraMatrix;
+    glm::mat4 projectionMatrix;
+    /**
+     * Vectors are padded to 4 components, since std140 aligns 3 components to 16 bytes.
+     */
+    glm::vec4 lightPosition;
+    glm::vec4 cameraPosition;
+    /**
+     * xy - clusters per pixel, z and w - scale and bias from the log of the depth to the slice, see light_clusterer.
+     */
+    glm::vec4 clusterScale;
+};
+
+/**
+ * Content of the objectUniforms block in the std140 layout, values of the drawn object.
+ */
+struct object_uniforms
+{
+    glm::mat4 modelMatrix;
+    glm::vec4 positionOffset;
+    glm::vec4 positionScale;
+};
+
+/**
+ * Transform of one instance in the instance buffer, matches the instance attributes of main.vs.
+ * It takes 32 bytes instead of 64 bytes of a matrix.
+ */
+struct instance_transform
+{
+    /**
+     * Rotation quaternion, xyz is the vector part and w the scalar part.
+     */
+    glm::vec4 rotation;
+    /**
+     * xyz - position, w - uniform scale.
+     */
+    glm::vec4 positionScale;
+};
 
 /**
  * Structure attached to the window object.
@@ -45,16 +321,793 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     windowStruct->height = height;
 }
 
-int main()
+/**
+ * Select the coarsest level of detail whose error is not visible on the screen.
+ * The error of each level is projected to the screen at the nearest point of the mesh bounding sphere.
+ * @param mesh Mesh with levels of detail.
+ * @param distance Distance from the camera to the center of the mesh.
+ * @param fieldOfView Vertical field of view in radians.
+ * @param viewportHeight Height of the viewport in pixels.
+ * @return Index of the level of detail.
+ */
+size_t select_lod(const packed_mesh& mesh, float distance, float fieldOfView, int viewportHeight)
+{
+    // Calculate the size of one object unit on the screen.
+    float radius = glm::length(mesh.position_scale()) * 0.5f;
+    float nearest = std::max(distance - radius, 0.001f);
+    float pixelsPerUnit = viewportHeight / (2.0f * nearest * std::tan(fieldOfView / 2));
+    // Levels are sorted from the finest to the coarsest one and their errors grow.
+    size_t level = 0;
+    for (size_t i = 1; i < mesh.lods().size(); i++) {
+        if (mesh.lods()[i].error * pixelsPerUnit <= LOD_PIXEL_ERROR) {
+            level = i;
+        }
+    }
+    return level;
+}
+
+/**
+ * Return the model matrix of the object: rotations around the y and the x axis with different speed.
+ * @param time Animation time.
+ * @return Model matrix.
+ */
+glm::mat4 scene_model_matrix(float time)
+{
+    glm::mat4 modelMatrix = glm::mat4(1.0f);
+    modelMatrix *= glm::rotate(glm::mat4(1.0f), time, glm::vec3(0, 1, 0));
+    modelMatrix *= glm::rotate(glm::mat4(1.0f), time / 2, glm::vec3(1, 0, 0));
+    return modelMatrix;
+}
+
+/**
+ * Return the camera matrix.
+ * @return Matrix from world space to camera space.
+ */
+glm::mat4 scene_camera_matrix()
+{
+    glm::mat4 cameraMatrix = glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0));
+    return glm::translate(cameraMatrix, -CAMERA_POSITION);
+}
+
+/**
+ * Return the scale of the instances.
+ * @param count Number of instances.
+ * @param gridScale Size of the grid relative to the view.
+ * @return Uniform scale, 1 for a single instance.
+ */
+float instance_scale(int count, float gridScale)
+{
+    if (count == 1) {
+        return 1.0f;
+    }
+    int side = int(std::ceil(std::sqrt(float(count))));
+    return INSTANCE_GRID_EXTENT * gridScale / side * INSTANCE_CELL_SCALE;
+}
+
+/**
+ * Return the position of an instance. Instances fill a square grid in the plane z = 0 row by row.
+ * @param index Instance number.
+ * @param count Number of instances.
+ * @param gridScale Size of the grid relative to the view.
+ * @return Position, the origin for a single instance.
+ */
+glm::vec3 instance_position(int index, int count, float gridScale)
+{
+    if (count == 1) {
+        return glm::vec3(0.0f);
+    }
+    int side = int(std::ceil(std::sqrt(float(count))));
+    float extent = INSTANCE_GRID_EXTENT * gridScale;
+    float cell = extent / side;
+    return glm::vec3(-extent * 0.5f + cell * (index % side + 0.5f), extent * 0.5f - cell * (index / side + 0.5f), 0.0f);
+}
+
+/**
+ * Write transforms of the given instances at the given time.
+ * Each instance spins around its own axis with its own speed.
+ * A single instance keeps the identity transform, so the scene is the same as without instancing.
+ * @param time Animation time in seconds.
+ * @param count Number of instances.
+ * @param gridScale Size of the grid relative to the view.
+ * @param indices Numbers of the instances to write.
+ * @param instances Receives a transform per index.
+ */
+void update_instances(float time, int count, float gridScale, const std::vector< uint32_t >& indices, instance_transform* instances)
+{
+    float scale = instance_scale(count, gridScale);
+    for (size_t i = 0; i < indices.size(); i++) {
+        int index = int(indices[i]);
+        if (count == 1) {
+            instances[i].rotation = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        } else {
+            // Spread the rotation axes evenly over the sphere with the golden angle spiral.
+            float z = 1.0f - 2.0f * (index + 0.5f) / count;
+            float r = std::sqrt(1.0f - z * z);
+            float phi = index * 2.39996323f;
+            glm::vec3 axis(r * std::cos(phi), r * std::sin(phi), z);
+            float angle = time * (1.0f + 0.25f * (index % 5));
+            instances[i].rotation = glm::vec4(axis * std::sin(angle * 0.5f), std::cos(angle * 0.5f));
+        }
+        instances[i].positionScale = glm::vec4(instance_position(index, count, gridScale), scale);
+    }
+}
+
+/**
+ * Write the point lights at the given time.
+ * Lights circle around the y axis on orbits spread by low-discrepancy sequences, so every run has the same lights.
+ * @param time Animation time in seconds.
+ * @param count Number of lights.
+ * @param lights Receives the lights.
+ */
+void update_lights(float time, int count, std::vector< point_light >& lights)
+{
+    // Choose the radius so that LIGHT_OVERLAP lights reach each point of the volume between the orbits.
+    float volume = 3.14159265f * (LIGHT_ORBIT_MAX * LIGHT_ORBIT_MAX - LIGHT_ORBIT_MIN * LIGHT_ORBIT_MIN) * 2.0f * LIGHT_HEIGHT;
+    float radius = std::min(std::cbrt(LIGHT_OVERLAP * volume / (count * 4.18879f)), LIGHT_MAX_RADIUS);
+    lights.resize(count);
+    for (int i = 0; i < count; i++) {
+        float u = std::fmod(i * 0.6180340f, 1.0f);
+        float v = std::fmod(i * 0.7548777f, 1.0f);
+        float w = std::fmod(i * 0.5698403f, 1.0f);
+        float hue = std::fmod(i * 0.3819660f, 1.0f);
+        // Lights at an even index circle the other way.
+        float orbit = std::sqrt(LIGHT_ORBIT_MIN * LIGHT_ORBIT_MIN + u * (LIGHT_ORBIT_MAX * LIGHT_ORBIT_MAX - LIGHT_ORBIT_MIN * LIGHT_ORBIT_MIN));
+        float speed = (0.3f + 0.7f * w) * (i % 2 ? 1.0f : -1.0f);
+        float angle = w * 6.2831853f + time * speed;
+        lights[i].position = glm::vec3(orbit * std::cos(angle), (v * 2.0f - 1.0f) * LIGHT_HEIGHT, orbit * std::sin(angle));
+        lights[i].radius = radius;
+        // Fully saturated color of the hue.
+        glm::vec3 color(std::fabs(hue * 6.0f - 3.0f) - 1.0f, 2.0f - std::fabs(hue * 6.0f - 2.0f), 2.0f - std::fabs(hue * 6.0f - 4.0f));
+        lights[i].color = glm::vec3(glm::clamp(color.x, 0.0f, 1.0f), glm::clamp(color.y, 0.0f, 1.0f), glm::clamp(color.z, 0.0f, 1.0f))
+                          * LIGHT_INTENSITY;
+    }
+}
+
+/**
+ * State of the scene at one animation time. The simulation thread produces it and the render thread draws it.
+ */
+struct scene_snapshot
+{
+    /**
+     * Number of the snapshot from 0 and its animation time.
+     */
+    uint64_t number;
+    float time;
+    /**
+     * When the simulation started the snapshot, the frame latency is measured from it.
+     */
+    std::chrono::steady_clock::time_point created;
+    glm::mat4 modelMatrix;
+    /**
+     * Transforms of all instances of the stress mode, empty with a single instance.
+     */
+    std::vector< instance_transform > instances;
+    std::vector< point_light > lights;
+};
+
+/**
+ * Counters of the simulation and the render thread. The simulation fields are only written by the simulation thread,
+ * the render fields only by the render thread.
+ */
+struct pipeline_statistics
+{
+    uint64_t snapshots;
+    double simulationMilliseconds;
+    /**
+     * Times the simulation waited for the render thread to take the last snapshot, and the time in milliseconds.
+     */
+    uint64_t simulationWaits;
+    double simulationWaitMilliseconds;
+    /**
+     * Times the render thread waited for a new snapshot, and the time in milliseconds.
+     */
+    uint64_t renderWaits;
+    double renderWaitMilliseconds;
+    /**
+     * Frames that drew the snapshot of the previous frame again.
+     */
+    uint64_t repeats;
+};
+
+/**
+ * Connection of the simulation thread and the render thread.
+ *
+ * Snapshots go through the lock-free triple buffer, so the render thread takes the latest one without waiting for
+ * a snapshot in progress. The simulation stays one snapshot ahead: it starts the next snapshot as soon as the render
+ * thread takes the last one, and the two run in parallel. The mutex and the condition only let a thread sleep while
+ * it waits for the other one, snapshots are never accessed under them.
+ */
+struct frame_pipeline
+{
+    triple_buffer< scene_snapshot > snapshots;
+    std::mutex mutex;
+    std::condition_variable condition;
+    /**
+     * Number of snapshots published by the simulation and taken by the render thread.
+     */
+    uint64_t published;
+    uint64_t taken;
+    bool stop;
+    pipeline_statistics statistics;
+};
+
+/**
+ * Main loop of the simulation thread: produce snapshots until the pipeline is stopped.
+ * The headless mode steps the animation time by FIXED_TIMESTEP per snapshot, so every run produces the same ones.
+ * @param options Command line options.
+ * @param pipeline Pipeline to publish the snapshots into.
+ */
+void run_simulation(const run_options& options, frame_pipeline& pipeline)
+{
+    std::vector< uint32_t > allInstances(options.instances > 1 ? options.instances : 0);
+    for (size_t i = 0; i < allInstances.size(); i++) {
+        allInstances[i] = uint32_t(i);
+    }
+    for (uint64_t number = 0;; number++) {
+        // Wait until the render thread has taken the last snapshot.
+        {
+            std::unique_lock< std::mutex > lock(pipeline.mutex);
+            if (!pipeline.stop && pipeline.taken < pipeline.published) {
+                auto begin = std::chrono::steady_clock::now();
+                pipeline.condition.wait(lock, [&]() { return pipeline.stop || pipeline.taken >= pipeline.published; });
+                pipeline.statistics.simulationWaits++;
+                pipeline.statistics.simulationWaitMilliseconds
+                    += std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - begin).count();
+            }
+            if (pipeline.stop) {
+                return;
+            }
+        }
+
+        // Fill the whole back snapshot, it holds an older one.
+        scene_snapshot& snapshot = pipeline.snapshots.back();
+        snapshot.created = std::chrono::steady_clock::now();
+        snapshot.number = number;
+        snapshot.time = float(options.headless ? number * FIXED_TIMESTEP : glfwGetTime()) / 2;
+        snapshot.modelMatrix = scene_model_matrix(snapshot.time);
+        snapshot.instances.resize(allInstances.size());
+        if (!allInstances.empty()) {
+            update_instances(snapshot.time * 2, options.instances, options.gridScale, allInstances, snapshot.instances.data());
+        }
+        update_lights(snapshot.time, options.lights, snapshot.lights);
+        pipeline.statistics.snapshots++;
+        pipeline.statistics.simulationMilliseconds
+            += std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - snapshot.created).count();
+
+        pipeline.snapshots.publish();
+        {
+            std::lock_guard< std::mutex > lock(pipeline.mutex);
+            pipeline.published++;
+        }
+        pipeline.condition.notify_all();
+    }
+}
+
+/**
+ * Take the latest snapshot for the frame on the render thread.
+ * The first frame and every frame of the headless mode wait for a new snapshot, other frames draw the last snapshot
+ * again if the simulation has not finished the next one.
+ * @param options Command line options.
+ * @param pipeline The pipeline.
+ * @return The snapshot.
+ */
+const scene_snapshot& take_snapshot(const run_options& options, frame_pipeline& pipeline)
+{
+    bool fresh = pipeline.snapshots.acquire();
+    if (!fresh && (options.headless || pipeline.taken == 0)) {
+        std::unique_lock< std::mutex > lock(pipeline.mutex);
+        auto begin = std::chrono::steady_clock::now();
+        pipeline.condition.wait(lock, [&]() { return pipeline.published > pipeline.taken; });
+        pipeline.statistics.renderWaits++;
+        pipeline.statistics.renderWaitMilliseconds
+            += std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - begin).count();
+        lock.unlock();
+        fresh = pipeline.snapshots.acquire();
+    }
+    if (fresh) {
+        {
+            std::lock_guard< std::mutex > lock(pipeline.mutex);
+            pipeline.taken++;
+        }
+        pipeline.condition.notify_all();
+    } else {
+        pipeline.statistics.repeats++;
+    }
+    return pipeline.snapshots.front();
+}
+
+/**
+ * Create a buffer and a buffer texture that reads it.
+ * @param format Format of the texels.
+ * @param buffer Receives the buffer.
+ * @return Buffer texture.
+ */
+GLuint create_buffer_texture(GLenum format, GLuint& buffer)
+{
+    // The name only becomes a buffer once it is bound, glTexBuffer does not accept it before.
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    return texture;
+}
+
+/**
+ * Upload data to a buffer with new storage, so frames that still read the old data are not waited for.
+ * @param state GL state cache.
+ * @param buffer Buffer.
+ * @param data Data.
+ * @param size Size in bytes.
+ */
+void upload_stream_buffer(render_state& state, GLuint buffer, const void* data, size_t size)
+{
+    void* mapped = state.map_array_buffer(buffer, size);
+    if (mapped) {
+        memcpy(mapped, data, size);
+    }
+    state.unmap_array_buffer();
+}
+
+/**
+ * Draw the instances of the mesh with the bound program and vertex array object, unless all of them are culled.
+ * @param state GL state cache.
+ * @param mesh The mesh.
+ * @param lod Level of detail.
+ * @param indexBuffer Element buffer, 0 if the mesh has no indices.
+ * @param indexType Type of the indices.
+ * @param instanceCount Number of instances.
+ */
+void draw_mesh(render_state& state, const packed_mesh& mesh, size_t lod, GLuint indexBuffer, GLenum indexType, size_t instanceCount)
+{
+    if (instanceCount == 0) {
+        return;
+    }
+    if (indexBuffer) {
+        // Each triangle is described by 3 indices in the element buffer.
+        // Levels of detail are ranges of the same element buffer.
+        const lod_level& level = mesh.lods()[lod];
+        glDrawElementsInstanced(GL_TRIANGLES, level.indexCount, indexType, (void*)(size_t(level.firstIndex) * mesh.index_size()),
+                                GLsizei(instanceCount));
+    } else {
+        glDrawArraysInstanced(GL_TRIANGLES, 0, mesh.vertex_count(), GLsizei(instanceCount));
+    }
+    state.count_calls(1);
+}
+
+/**
+ * Upload all mip levels of a texture to the bound 2D texture straight from its data.
+ * Rows of uncompressed levels are padded to 4 bytes, which is what GL_UNPACK_ALIGNMENT of 4 expects, so no copy is needed.
+ * Compressed levels are uploaded as they are, blocks are never padded.
+ * @param texture Texture to upload.
+ */
+void upload_mip_texture(const mip_texture& texture)
+{
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    for (size_t i = 0; i < texture.levels().size(); i++) {
+        const mip_level& level = texture.levels()[i];
+        switch (texture.format()) {
+        case TEXTURE_FORMAT_BC1:
+            glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), GL_COMPRESSED_RGB_S3TC_DXT1_EXT, level.width, level.height, 0,
+                                   GLsizei(level.size), texture.level_data(i));
+            break;
+        case TEXTURE_FORMAT_BC4:
+            glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), GL_COMPRESSED_RED_RGTC1, level.width, level.height, 0,
+                                   GLsizei(level.size), texture.level_data(i));
+            break;
+        case TEXTURE_FORMAT_BC5:
+            glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), GL_COMPRESSED_RG_RGTC2, level.width, level.height, 0,
+                                   GLsizei(level.size), texture.level_data(i));
+            break;
+        default:
+            glTexImage2D(GL_TEXTURE_2D, GLint(i), GL_RGB, level.width, level.height, 0, GL_BGR, GL_UNSIGNED_BYTE, texture.level_data(i));
+            break;
+        }
+    }
+    // Tell the driver that the chain is complete.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(texture.levels().size()) - 1);
+}
+
+/**
+ * Print the compression error of a texture if it is compressed.
+ * @param name Name of the texture.
+ * @param texture Texture.
+ */
+void print_compression_error(const char* name, const mip_texture& texture)
+{
+    if (texture.format() != TEXTURE_FORMAT_BGR8) {
+        std::cout << "Texture compression error: " << name << " RMSE " << texture.error().rmse
+                  << ", PSNR " << texture.error().psnr << " dB" << std::endl;
+    }
+}
+
+/**
+ * Take a texture from the loader and make sure the GPU can sample its format.
+ * Textures are loaded compressed before the GL context exists. If it turns out that the format is not supported,
+ * the texture is loaded again with uncompressed texels.
+ * @param loader Asset loader.
+ * @param fileName The .bmp file.
+ * @param usage How the texture is used.
+ * @param asset Future returned by the loader.
+ * @param compressionSupported Whether the GPU supports the compressed format of the usage.
+ * @return Texture.
+ */
+mip_texture receive_texture(asset_loader& loader, const char* fileName, texture_usage usage, std::future< mip_texture >& asset,
+                            bool compressionSupported)
+{
+    mip_texture texture = loader.wait(fileName, asset);
+    if (texture.format() != TEXTURE_FORMAT_BGR8 && !compressionSupported) {
+        double begin = loader.now();
+        texture = texture_cache::load(fileName, usage, false);
+        loader.add_span(fileName, "reload", begin, loader.now());
+    }
+    return texture;
+}
+
+/**
+ * Print the startup timeline.
+ * @param loader Asset loader that has recorded the timeline.
+ */
+void print_timeline(const asset_loader& loader)
+{
+    std::ios::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+    std::cout << "Startup timeline, ms:" << std::endl;
+    for (const asset_span& span : loader.timeline()) {
+        std::cout << "  " << std::fixed << std::setprecision(1) << std::setw(8) << span.begin << std::setw(8) << span.end
+                  << std::setw(8) << span.end - span.begin << "  thread " << span.thread << "  " << span.name << " " << span.phase
+                  << std::endl;
+    }
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+}
+
+/**
+ * Parse command line options.
+ * Supported options: --headless, --frames <count>, --size <width>x<height>, --dump <file.bmp>, --trace <file.json>,
+ * --software, --compare <file.bmp>, --instances <count>, --grid-scale <factor>, --msaa <samples>, --fxaa, --render-scale <factor>,
+ * --target-frame-time <ms>, --lights <count>, --light-benchmark, --virtual-texture <file.bmp>, --tile-cache <tiles>,
+ * --tile-budget <tiles>, --no-persistent-map.
+ * @param argc Number of arguments.
+ * @param argv Arguments.
+ * @param options Receives the options.
+ * @return False if the command line is not valid.
+ */
+bool parse_options(int argc, char** argv, run_options& options)
+{
+    options.headless = false;
+    options.frames = DEFAULT_HEADLESS_FRAMES;
+    options.width = WINDOW_WIDTH;
+    options.height = WINDOW_HEIGHT;
+    options.dumpFile.clear();
+    options.compareFile.clear();
+    options.traceFile.clear();
+    options.software = false;
+    options.instances = 1;
+    options.gridScale = 1.0f;
+    options.samples = DEFAULT_MSAA_SAMPLES;
+    options.fxaa = false;
+    options.renderScale = 1.0f;
+    options.targetFrameTime = 0.0;
+    options.lights = 0;
+    options.lightBenchmark = false;
+    options.virtualTexture.clear();
+    options.tileCacheSlots = DEFAULT_TILE_CACHE_SLOTS;
+    options.tileUploadBudget = DEFAULT_TILE_UPLOAD_BUDGET;
+    options.persistentMapping = true;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--headless") == 0) {
+            options.headless = true;
+        } else if (strcmp(argv[i], "--software") == 0) {
+            options.software = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            options.frames = atoi(argv[++i]);
+            if (options.frames <= 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--size") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--dump") == 0 && hasValue) {
+            options.dumpFile = argv[++i];
+        } else if (strcmp(argv[i], "--compare") == 0 && hasValue) {
+            options.compareFile = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && hasValue) {
+            options.traceFile = argv[++i];
+        } else if (strcmp(argv[i], "--instances") == 0 && hasValue) {
+            options.instances = atoi(argv[++i]);
+            if (options.instances <= 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--grid-scale") == 0 && hasValue) {
+            options.gridScale = float(atof(argv[++i]));
+            if (!(options.gridScale > 0.0f)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--msaa") == 0 && hasValue) {
+            options.samples = atoi(argv[++i]);
+            if (options.samples < 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--fxaa") == 0) {
+            options.fxaa = true;
+        } else if (strcmp(argv[i], "--render-scale") == 0 && hasValue) {
+            options.renderScale = float(atof(argv[++i]));
+            if (!(options.renderScale >= MIN_RENDER_SCALE && options.renderScale <= 1.0f)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--target-frame-time") == 0 && hasValue) {
+            options.targetFrameTime = atof(argv[++i]);
+            if (!(options.targetFrameTime > 0.0)) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--lights") == 0 && hasValue) {
+            options.lights = atoi(argv[++i]);
+            if (options.lights < 0 || size_t(options.lights) > light_clusterer::MAX_LIGHTS) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--light-benchmark") == 0) {
+            options.lightBenchmark = true;
+        } else if (strcmp(argv[i], "--virtual-texture") == 0 && hasValue) {
+            options.virtualTexture = argv[++i];
+        } else if (strcmp(argv[i], "--tile-cache") == 0 && hasValue) {
+            options.tileCacheSlots = atoi(argv[++i]);
+            if (options.tileCacheSlots <= 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--tile-budget") == 0 && hasValue) {
+            options.tileUploadBudget = atoi(argv[++i]);
+            if (options.tileUploadBudget <= 0) {
+                return false;
+            }
+        } else if (strcmp(argv[i], "--no-persistent-map") == 0) {
+            options.persistentMapping = false;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Create an off-screen framebuffer with a color buffer.
+ * The scene is drawn with its depth buffer and samples by scene_target, this framebuffer only takes the result.
+ * @param width Width in pixels.
+ * @param height Height in pixels.
+ * @param target Receives the framebuffer objects.
+ * @return True if the framebuffer is complete.
+ */
+bool create_offscreen_target(int width, int height, offscreen_target& target)
+{
+    glGenRenderbuffers(1, &target.colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenFramebuffers(1, &target.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.colorBuffer);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return complete;
+}
+
+/**
+ * Delete an off-screen framebuffer.
+ * @param target Framebuffer objects.
+ */
+void delete_offscreen_target(const offscreen_target& target)
+{
+    glDeleteFramebuffers(1, &target.framebuffer);
+    glDeleteRenderbuffers(1, &target.colorBuffer);
+}
+
+/**
+ * Write the last frame of an off-screen framebuffer to a .bmp file.
+ * @param target Framebuffer objects.
+ * @param width Width in pixels.
+ * @param height Height in pixels.
+ * @param fileName File to write.
+ * @return True if the file is written.
+ */
+bool dump_offscreen_target(const offscreen_target& target, int width, int height, const char* fileName)
+{
+    // Rows are padded to 4 bytes like in .bmp files.
+    std::vector< uint8_t > pixels((size_t(width) * 3 + 3) / 4 * 4 * size_t(height));
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_BGR, GL_UNSIGNED_BYTE, pixels.data());
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return bitmap_image::save(fileName, width, height, pixels.data());
+}
+
+/**
+ * Compare a frame with a reference frame and print the differences.
+ * @param fileName The reference .bmp file, e.g. written by --dump.
+ * @param width Width of the frame in pixels.
+ * @param height Height of the frame in pixels.
+ * @param pixels B, G, R bytes, rows from the bottom padded to 4 bytes.
+ * @return True if the frame is within MIN_COMPARE_PSNR and MAX_COMPARE_OUTLIERS of the reference.
+ */
+bool compare_frame(const char* fileName, int width, int height, const uint8_t* pixels)
 {
+    bitmap_image reference(fileName);
+    if (reference.width() != width || reference.height() != height) {
+        std::cout << "Cannot compare the frame with " << fileName << ", it is missing or has another size!" << std::endl;
+        return false;
+    }
+    size_t rowSize = mip_texture::row_size(uint32_t(width));
+    double squaredError = 0.0;
+    int maxError = 0;
+    size_t outliers = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = pixels + y * rowSize;
+        const uint8_t* referenceRow = reference.row(y);
+        for (int x = 0; x < width; x++) {
+            int pixelError = 0;
+            for (int c = 0; c < 3; c++) {
+                int error = std::abs(int(row[x * 3 + c]) - int(referenceRow[x * reference.bytes_per_pixel() + c]));
+                squaredError += double(error) * error;
+                pixelError = std::max(pixelError, error);
+            }
+            maxError = std::max(maxError, pixelError);
+            outliers += pixelError > COMPARE_OUTLIER_ERROR ? 1 : 0;
+        }
+    }
+    double meanSquaredError = squaredError / (3.0 * width * height);
+    double psnr = meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) : std::numeric_limits< double >::infinity();
+    double outlierShare = double(outliers) / (double(width) * height);
+    std::cout << "Comparison with " << fileName << ": PSNR " << psnr << " dB (at least " << MIN_COMPARE_PSNR
+              << "), largest channel error " << maxError << ", " << outlierShare * 100.0 << "% of the pixels off by more than "
+              << COMPARE_OUTLIER_ERROR << " (at most " << MAX_COMPARE_OUTLIERS * 100.0 << "%)" << std::endl;
+    return psnr >= MIN_COMPARE_PSNR && outlierShare <= MAX_COMPARE_OUTLIERS;
+}
+
+/**
+ * Draw the frames of the headless mode with the CPU rasterizer, report frame times, write the last frame and compare
+ * it with a reference frame.
+ * @param options Command line options.
+ * @param loader Asset loader.
+ * @param meshAsset Mesh being loaded.
+ * @param imageAsset Uncompressed color texture being loaded.
+ * @param normalAsset Uncompressed normal texture being loaded.
+ * @param displacementAsset Uncompressed displacement texture being loaded.
+ * @return Exit code.
+ */
+int render_software(const run_options& options, asset_loader& loader, std::future< packed_mesh >& meshAsset,
+                    std::future< mip_texture >& imageAsset, std::future< mip_texture >& normalAsset,
+                    std::future< mip_texture >& displacementAsset)
+{
+    packed_mesh mesh = loader.wait("box.obj", meshAsset);
+    mip_texture imageTexture = loader.wait("texture.bmp", imageAsset);
+    mip_texture normalTexture = loader.wait("normal.bmp", normalAsset);
+    mip_texture displacementTexture = loader.wait("displacement.bmp", displacementAsset);
+    software_rasterizer rasterizer(options.width, options.height);
+    if (mesh.vertex_count() == 0 || !mesh.indices()) {
+        std::cout << "Cannot read a 3D model from the file!" << std::endl;
+        return 1;
+    }
+    if (!rasterizer.set_texture(TEXTURE_COLOR, imageTexture) || !rasterizer.set_texture(TEXTURE_NORMAL, normalTexture)
+        || !rasterizer.set_texture(TEXTURE_DISPLACEMENT, displacementTexture)) {
+        std::cout << "Failed to open textures!" << std::endl;
+        return 1;
+    }
+
+    // Draw the same frames as the headless mode of the GL path.
+    raster_uniforms uniforms;
+    uniforms.cameraMatrix = scene_camera_matrix();
+    uniforms.lightPosition = LIGHT_POSITION;
+    uniforms.cameraPosition = SHADER_CAMERA_POSITION;
+    float fieldOfView = glm::radians(FIELD_OF_VIEW);
+    uniforms.projectionMatrix = glm::perspective(fieldOfView, float(options.width) / options.height, NEAR_PLANE, FAR_PLANE);
+    frame_statistics frameTimes;
+    for (int frameNumber = 0; frameNumber < options.frames; frameNumber++) {
+        auto frameBegin = std::chrono::steady_clock::now();
+        uniforms.modelMatrix = scene_model_matrix(float(frameNumber * FIXED_TIMESTEP) / 2);
+        glm::vec3 meshCenter = glm::vec3(uniforms.modelMatrix * glm::vec4(mesh.position_offset() + mesh.position_scale() * 0.5f, 1.0f));
+        size_t lod = select_lod(mesh, glm::length(meshCenter - CAMERA_POSITION), fieldOfView, options.height);
+        rasterizer.clear(BACKGROUND_COLOR);
+        rasterizer.draw(mesh, lod, uniforms);
+        frameTimes.add(std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - frameBegin).count());
+    }
+
+    std::cout << "Software frames: " << frameTimes.count() << " at " << options.width << "x" << options.height
+              << ", frame time ms: average " << frameTimes.average()
+              << ", p50 " << frameTimes.percentile(50.0)
+              << ", p95 " << frameTimes.percentile(95.0)
+              << ", p99 " << frameTimes.percentile(99.0)
+              << ", " << 1000.0 / frameTimes.average() << " fps" << std::endl;
+    const raster_statistics& statistics = rasterizer.statistics();
+    if (statistics.pixels > 0) {
+        std::cout << "Texture fetches per pixel: " << double(statistics.fetches) / statistics.pixels
+                  << ", parallax " << double(statistics.displacementFetches) / statistics.pixels << std::endl;
+    }
+    if (!options.dumpFile.empty() && !bitmap_image::save(options.dumpFile.c_str(), options.width, options.height, rasterizer.pixels())) {
+        std::cout << "Failed to write the frame to " << options.dumpFile << "!" << std::endl;
+    }
+    if (!options.compareFile.empty() && !compare_frame(options.compareFile.c_str(), options.width, options.height, rasterizer.pixels())) {
+        std::cout << "The frame differs too much from " << options.compareFile << "!" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    // Benchmarks run on their own instead of drawing.
+    if (argc == 2 && strcmp(argv[1], "--tangent-benchmark") == 0) {
+        return benchmarks::run_tangents();
+    }
+    if (argc == 2 && strcmp(argv[1], "--ray-benchmark") == 0) {
+        return benchmarks::run_rays();
+    }
+    if (argc == 2 && strcmp(argv[1], "--encode-benchmark") == 0) {
+        return benchmarks::run_encoding();
+    }
+
+    // Read the command line.
+    run_options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cout << "Usage: " << argv[0] << " [--headless | --software] [--frames <count>] [--size <width>x<height>] [--dump <file.bmp>]"
+                  << " [--trace <file.json>] [--compare <file.bmp>] [--instances <count>]"
+                  << " [--grid-scale <factor>] [--msaa <samples>] [--fxaa] [--render-scale <factor>]"
+                  << " [--target-frame-time <ms>] [--lights <count>] [--light-benchmark]"
+                  << " [--virtual-texture <file.bmp>] [--tile-cache <tiles>] [--tile-budget <tiles>] [--no-persistent-map]" << std::endl;
+        std::cout << "       " << argv[0] << " --tangent-benchmark | --ray-benchmark | --encode-benchmark" << std::endl;
+        return 1;
+    }
+    if (options.lightBenchmark) {
+        // The lights move as in the render loop, the camera and the projection are the ones of the default window.
+        light_clusterer clusterer;
+        clusterer.set_projection(glm::radians(FIELD_OF_VIEW), float(options.width) / options.height, NEAR_PLANE, FAR_PLANE);
+        return benchmarks::run_light_binning(clusterer, scene_camera_matrix(), FIXED_TIMESTEP, update_lights);
+    }
+
+    // Start loading the assets right away, they are read and decoded while the window and the shaders are created.
+    // Textures are compressed, which is checked against the GPU when they are uploaded.
+    // The CPU rasterizer samples uncompressed texels.
+    asset_loader loader;
+    bool compressed = !options.software;
+    std::future< packed_mesh > meshAsset = loader.load_mesh("box.obj");
+    std::future< mip_texture > imageAsset = loader.load_texture("texture.bmp", TEXTURE_COLOR, compressed);
+    std::future< mip_texture > normalAsset = loader.load_texture("normal.bmp", TEXTURE_NORMAL, compressed);
+    std::future< mip_texture > displacementAsset = loader.load_texture("displacement.bmp", TEXTURE_DISPLACEMENT, compressed);
+    if (options.software) {
+        return render_software(options, loader, meshAsset, imageAsset, normalAsset, displacementAsset);
+    }
+
     // Initalize GLFW.
-    glfwInit();
-    glfwWindowHint(GLFW_SAMPLES, 32);
+    double windowBegin = loader.now();
+#ifdef GLFW_PLATFORM_NULL
+    if (options.headless) {
+        // GLFW 3.4 can run without a display server. The context then comes from OSMesa, e.g. Mesa llvmpipe without a GPU.
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+    }
+#endif
+    if (!glfwInit()) {
+        std::cout << "Failed to initialize GLFW!" << std::endl;
+        abort();
+    }
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    // The scene is drawn into its own framebuffer with its own samples, the window only receives the scaled result.
+    glfwWindowHint(GLFW_SAMPLES, 0);
+    if (options.headless) {
+        // The window only holds the context, frames go to an off-screen framebuffer.
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifdef GLFW_PLATFORM_NULL
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+    }
     // Define structure that will be attached to the window object.
-    window_user_struct windowStruct = { WINDOW_WIDTH, WINDOW_HEIGHT };
+    window_user_struct windowStruct = { options.width, options.height };
     // Create a window.
     GLFWwindow* window = glfwCreateWindow(windowStruct.width, windowStruct.height, "GLExample", NULL, NULL);
     if (!window) {
@@ -67,6 +1120,10 @@ int main()
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     // Select OpenGL context.
     glfwMakeContextCurrent(window);
+    if (options.targetFrameTime > 0.0) {
+        // Frame times must not be rounded up to the display refresh, that would hide the headroom from the dynamic resolution.
+        glfwSwapInterval(0);
+    }
 
     // Initialize OpenGL.
     if (glewInit() != GLEW_OK)
@@ -74,175 +1131,218 @@ int main()
         std::cout << "Failed to initialize OpenGL!" << std::endl;
         abort();
     }
+    loader.add_span("window", "create", windowBegin, loader.now());
 
-    // Load and compile a vertex shader.
-    std::ifstream vertexShaderStream("main.vs");
-    if (!vertexShaderStream) {
-        std::cout << "Failed to read the fragment shader file!" << std::endl;
-        abort();
-    }
-    std::string vertexShaderCode((std::istreambuf_iterator< char >(vertexShaderStream)), std::istreambuf_iterator< char >());
-    auto vertexShaderCodeStr = vertexShaderCode.c_str();
-    int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexShader, 1, &vertexShaderCodeStr, NULL);
-    glCompileShader(vertexShader);
-    // Check for shader compilation errors.
-    int vertexShaderSuccess;
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &vertexShaderSuccess);
-    if (!vertexShaderSuccess) {
-        char infoLog[ERROR_BUFFER_SIZE];
-        glGetShaderInfoLog(vertexShader, ERROR_BUFFER_SIZE, NULL, infoLog);
-        std::cout << "Vertex shader compilation failed:" << std::endl << infoLog << std::endl;
+    // Load the shader program. The binary is cached after the first compilation, later starts skip compiling GLSL.
+    double shaderBegin = loader.now();
+    bool programCached = false;
+    std::string programLog;
+    GLuint shaderProgram = program_cache::load("main.vs", "main.fs", cone_step_map::shader_defines(), programCached, programLog);
+    if (!shaderProgram) {
+        std::cout << programLog << std::endl;
         abort();
     }
 
-    // Load and compile a fragment shader.
-    int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    std::ifstream fragmentShaderStream("main.fs");
-    if (!vertexShaderStream) {
-        std::cout << "Failed to read the fragment shader file!" << std::endl;
-        abort();
-    }
-    std::string fragmentShaderCode((std::istreambuf_iterator< char >(fragmentShaderStream)), std::istreambuf_iterator< char >());
-    auto fragmentShaderCodeStr = fragmentShaderCode.c_str();
-    glShaderSource(fragmentShader, 1, &fragmentShaderCodeStr, NULL);
-    glCompileShader(fragmentShader);
-    // Check for shader compilation errors.
-    int fragmentShaderSuccess;
-    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &fragmentShaderSuccess);
-    if (!fragmentShaderSuccess) {
-        char infoLog[ERROR_BUFFER_SIZE];
-        glGetShaderInfoLog(fragmentShader, 512, NULL, infoLog);
-        std::cout << "Fragment shader compilation failed:" << std::endl << infoLog << std::endl;
-        abort();
-    }
+    // Connect the uniform blocks to their binding points and the samplers to their texture units.
+    // Neither changes while the program is used, so it is set once after linking.
+    glUniformBlockBinding(shaderProgram, glGetUniformBlockIndex(shaderProgram, "frameUniforms"), FRAME_UNIFORMS_BINDING);
+    glUniformBlockBinding(shaderProgram, glGetUniformBlockIndex(shaderProgram, "objectUniforms"), OBJECT_UNIFORMS_BINDING);
+    glUseProgram(shaderProgram);
+    glUniform1i(glGetUniformLocation(shaderProgram, "colorTexture"), 0);
+    glUniform1i(glGetUniformLocation(shaderProgram, "normalTexture"), 1);
+    glUniform1i(glGetUniformLocation(shaderProgram, "displacementTexture"), 2);
+    glUniform1i(glGetUniformLocation(shaderProgram, "clusterTexture"), CLUSTER_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(shaderProgram, "lightIndexTexture"), LIGHT_INDEX_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(shaderProgram, "lightTexture"), LIGHT_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(shaderProgram, "pageTableTexture"), PAGE_TABLE_TEXTURE_UNIT);
+    glUniform1i(glGetUniformLocation(shaderProgram, "tileCacheTexture"), TILE_CACHE_TEXTURE_UNIT);
+    glUseProgram(0);
+    loader.add_span("main.vs, main.fs", programCached ? "cached" : "compile", shaderBegin, loader.now());
 
-    // Link shaders into a shader program.
-    GLuint shaderProgram = glCreateProgram();
-    glAttachShader(shaderProgram, vertexShader);
-    glAttachShader(shaderProgram, fragmentShader);
+    // Load the program of the feedback pass of the virtual texture. It shares the vertex shader and its uniform blocks.
+    GLuint feedbackProgram = 0;
+    if (!options.virtualTexture.empty()) {
+        double feedbackShaderBegin = loader.now();
+        feedbackProgram = program_cache::load("main.vs", "feedback.fs", std::string(), programCached, programLog);
+        if (!feedbackProgram) {
+            std::cout << programLog << std::endl;
+            abort();
+        }
+        glUniformBlockBinding(feedbackProgram, glGetUniformBlockIndex(feedbackProgram, "frameUniforms"), FRAME_UNIFORMS_BINDING);
+        glUniformBlockBinding(feedbackProgram, glGetUniformBlockIndex(feedbackProgram, "objectUniforms"), OBJECT_UNIFORMS_BINDING);
+        loader.add_span("main.vs, feedback.fs", programCached ? "cached" : "compile", feedbackShaderBegin, loader.now());
+    }
 
-    glLinkProgram(shaderProgram);
-    // check for linking errors
-    int programSuccess;
-    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &programSuccess);
-    if (!programSuccess) {
-        char infoLog[ERROR_BUFFER_SIZE];
-        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-        std::cout << "Program linking failed:" << std::endl << infoLog << std::endl;
+    // Load the program that scales the scene to the output and applies FXAA.
+    double postShaderBegin = loader.now();
+    GLuint postProgram = program_cache::load("post.vs", "post.fs", std::string(), programCached, programLog);
+    if (!postProgram) {
+        std::cout << programLog << std::endl;
         abort();
     }
+    loader.add_span("post.vs, post.fs", programCached ? "cached" : "compile", postShaderBegin, loader.now());
 
-    // Delete shaders after the program is linked.
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    // Read a 3D object.
-    object obj("box.obj");
-    if (obj.vertexes().size() == 0) {
+    // Take a 3D object packed into compact indexed vertices.
+    // The packed mesh is cached next to the .obj file and memory mapped on the next start.
+    packed_mesh mesh = loader.wait("box.obj", meshAsset);
+    if (mesh.vertex_count() == 0) {
         std::cout << "Cannot read a 3D model from the file!" << std::endl;
         abort();
     }
+    std::cout << "Vertex quantization error: position " << mesh.error().position
+              << ", uv " << mesh.error().uv
+              << ", normal " << mesh.error().normal << " deg"
+              << ", tangent " << mesh.error().tangent << " deg"
+              << ", bitangent " << mesh.error().bitangent << " deg" << std::endl;
+    std::cout << "Vertex cache: ACMR " << mesh.vertex_cache().before.acmr << " -> " << mesh.vertex_cache().after.acmr
+              << ", ATVR " << mesh.vertex_cache().before.atvr << " -> " << mesh.vertex_cache().after.atvr << std::endl;
+    for (size_t i = 0; i < mesh.lods().size(); i++) {
+        std::cout << "LOD " << i << ": " << mesh.lods()[i].indexCount / 3 << " triangles, error " << mesh.lods()[i].error << std::endl;
+    }
 
     // Create a vertex array object that is a collection of attribute buffers describing each vertex.
+    double meshUploadBegin = loader.now();
     GLuint vao;
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
-    // Create a buffer that contains vertex coordinates.
+    // Create a buffer that contains packed vertices.
     GLuint vertexBuffer;
     glGenBuffers(1, &vertexBuffer);
     glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, obj.vertexes().size() * sizeof(glm::vec3), obj.vertexes().data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBufferData(GL_ARRAY_BUFFER, mesh.vertex_count() * sizeof(packed_vertex), mesh.vertices(), GL_STATIC_DRAW);
 
-    // Create a buffer that contains texture coordinates per vertex.
-    GLuint uvBuffer;
-    glGenBuffers(1, &uvBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-    glBufferData(GL_ARRAY_BUFFER, obj.uvs().size() * sizeof(glm::vec2), obj.uvs().data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Describe the packed vertex buffer. All attributes are interleaved in one buffer.
+    // The attribute layout is a part of the vertex array object state, so it is described only once.
+    // Describe packed position: 4 unsigned normalized 16-bit values.
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(packed_vertex), (void*)offsetof(packed_vertex, position));
 
-    // Create a buffer that contains normals per vertex.
-    GLuint normalBuffer;
-    glGenBuffers(1, &normalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, obj.normals().size() * sizeof(glm::vec3), obj.normals().data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Describe texture coordinates: 2 half floats.
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(packed_vertex), (void*)offsetof(packed_vertex, uv));
+
+    // Describe octahedral normal: 2 signed normalized 16-bit values.
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, sizeof(packed_vertex), (void*)offsetof(packed_vertex, normal));
 
-    // Create a buffer that contains tangents per vertex.
-    GLuint tangentBuffer;
-    glGenBuffers(1, &tangentBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
-    glBufferData(GL_ARRAY_BUFFER, obj.tangents().size() * sizeof(glm::vec3), &obj.tangents()[0], GL_STATIC_DRAW);
+    // Describe octahedral tangent: 2 signed normalized 16-bit values.
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(packed_vertex), (void*)offsetof(packed_vertex, tangent));
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    // Create a buffer that contains bitangents per vertex.
-    GLuint bitangentBuffer;
-    glGenBuffers(1, &bitangentBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, bitangentBuffer);
-    glBufferData(GL_ARRAY_BUFFER, obj.tangents().size() * sizeof(glm::vec3), &obj.bitangents()[0], GL_STATIC_DRAW);
+    // Create a buffer that contains vertex indices of each triangle.
+    // The element buffer binding is a part of the vertex array object state, so keep it bound.
+    GLuint indexBuffer = 0;
+    GLenum indexType = mesh.index_size() == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    if (mesh.indices()) {
+        glGenBuffers(1, &indexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.index_count() * mesh.index_size(), mesh.indices(), GL_STATIC_DRAW);
+    }
+
+    // Create a buffer with a transform per instance. It is rewritten every frame in the stress mode.
+    GLuint instanceBuffer;
+    glGenBuffers(1, &instanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    std::vector< uint32_t > allInstances(options.instances);
+    for (int i = 0; i < options.instances; i++) {
+        allInstances[i] = uint32_t(i);
+    }
+    std::vector< instance_transform > instances(options.instances);
+    update_instances(0.0f, options.instances, options.gridScale, allInstances, instances.data());
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(instance_transform), instances.data(),
+                 options.instances > 1 ? GL_STREAM_DRAW : GL_STATIC_DRAW);
+
+    // Describe instance attributes, they advance once per instance: rotation and position with scale as 4 floats each.
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(instance_transform), (void*)offsetof(instance_transform, rotation));
+    glVertexAttribDivisor(4, 1);
+    glEnableVertexAttribArray(5);
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(instance_transform), (void*)offsetof(instance_transform, positionScale));
+    glVertexAttribDivisor(5, 1);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     // Unbind vertex attribute array to not accidentaly make changes to it.
     glBindVertexArray(0);
+    loader.add_span("box.obj", "upload", meshUploadBegin, loader.now());
 
-    // Read an image texure file.
-    bitmap_image imageTexture("texture.bmp");
-    if (imageTexture.data().size() == 0) {
+    // Bounding sphere of the mesh around its origin. It contains the mesh in any rotation, so the spheres
+    // of the instances of the stress mode are placed once and stay valid while the instances spin.
+    glm::vec3 meshBoxCenter = mesh.position_offset() + mesh.position_scale() * 0.5f;
+    float meshRadius = glm::length(meshBoxCenter) + glm::length(mesh.position_scale()) * 0.5f;
+    frustum_culler culler;
+    if (options.instances > 1) {
+        float scale = instance_scale(options.instances, options.gridScale);
+        for (int i = 0; i < options.instances; i++) {
+            culler.add(instance_position(i, options.instances, options.gridScale), meshRadius * scale);
+        }
+    }
+
+    // Textures are loaded compressed into blocks, check that the GPU can sample them.
+    // BC4 and BC5 (RGTC) are core since OpenGL 3.0, BC1 (S3TC) is an extension.
+    bool colorCompressed = GLEW_EXT_texture_compression_s3tc;
+    bool rgtcCompressed = GLEW_VERSION_3_0 || GLEW_ARB_texture_compression_rgtc;
+
+    // Take an image texure with mip levels. They are built on the first start and cached next to the file.
+    mip_texture imageTexture = receive_texture(loader, "texture.bmp", TEXTURE_COLOR, imageAsset, colorCompressed);
+    if (imageTexture.levels().empty()) {
         std::cout << "Failed to open image texture!" << std::endl;
         abort();
     }
+    print_compression_error("color", imageTexture);
     // Allocate the texture.
+    double imageUploadBegin = loader.now();
     glActiveTexture(GL_TEXTURE0);
     GLuint colorTextureId;
     glGenTextures(1, &colorTextureId);
     glBindTexture(GL_TEXTURE_2D, colorTextureId);
-    // Write image data to the texture.
-    glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, imageTexture.width(), imageTexture.height(), 0, GL_BGR, GL_UNSIGNED_BYTE, &imageTexture.data()[0]);
+    // Write all mip levels to the texture.
+    upload_mip_texture(imageTexture);
     // Set texture scaling parameters.
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    // Generate a mipmap for scaling.
-    glGenerateMipmap(GL_TEXTURE_2D);;
+    loader.add_span("texture.bmp", "upload", imageUploadBegin, loader.now());
 
-    // Read a normal texure file.
-    bitmap_image normalTexture("normal.bmp");
-    if (normalTexture.data().size() == 0) {
+    // Take a normal texure with mip levels. They are built on the first start and cached next to the file.
+    mip_texture normalTexture = receive_texture(loader, "normal.bmp", TEXTURE_NORMAL, normalAsset, rgtcCompressed);
+    if (normalTexture.levels().empty()) {
         std::cout << "Failed to open normal texture!" << std::endl;
         abort();
     }
+    print_compression_error("normal", normalTexture);
     // Allocate the texture.
+    double normalUploadBegin = loader.now();
     glActiveTexture(GL_TEXTURE1);
     GLuint normalTextureId;
     glGenTextures(1, &normalTextureId);
     glBindTexture(GL_TEXTURE_2D, normalTextureId);
-    // Write image data to the texture.
-    glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, normalTexture.width(), normalTexture.height(), 0, GL_BGR, GL_UNSIGNED_BYTE, &normalTexture.data()[0]);
+    // Write all mip levels to the texture.
+    upload_mip_texture(normalTexture);
     // Set texture scaling parameters.
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    // Generate a mipmap for scaling.
-    glGenerateMipmap(GL_TEXTURE_2D);
+    loader.add_span("normal.bmp", "upload", normalUploadBegin, loader.now());
 
-    // Read a displacement texure file.
-    bitmap_image displacementTexture("displacement.bmp");
-    if (displacementTexture.data().size() == 0) {
+    // Take a displacement texure with mip levels. They are built on the first start and cached next to the file.
+    mip_texture displacementTexture = receive_texture(loader, "displacement.bmp", TEXTURE_DISPLACEMENT, displacementAsset, rgtcCompressed);
+    if (displacementTexture.levels().empty()) {
         std::cout << "Failed to open displacement texture!" << std::endl;
         abort();
     }
+    print_compression_error("displacement", displacementTexture);
     // Allocate the texture.
+    double displacementUploadBegin = loader.now();
     glActiveTexture(GL_TEXTURE2);
     GLuint displacementTextureId;
     glGenTextures(1, &displacementTextureId);
     glBindTexture(GL_TEXTURE_2D, displacementTextureId);
-    // Write image data to the texture.
-    glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, displacementTexture.width(), displacementTexture.height(), 0, GL_BGR, GL_UNSIGNED_BYTE, &displacementTexture.data()[0]);
+    // Write all mip levels to the texture.
+    upload_mip_texture(displacementTexture);
     // Set texture scaling parameters.
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    // Generate a mipmap for scaling.
-    glGenerateMipmap(GL_TEXTURE_2D);
+    loader.add_span("displacement.bmp", "upload", displacementUploadBegin, loader.now());
 
     // Enable depth test and removing of back-facing triangles.
     glEnable(GL_DEPTH_TEST);
@@ -250,107 +1350,418 @@ int main()
     glEnable(GL_CULL_FACE);
 
     // Create a camera matrix.
-    glm::vec3 cameraPosition(0, 0, -7.0);
-    glm::mat4 cameraMatrix = glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0));
-    cameraMatrix = glm::translate(cameraMatrix, -cameraPosition);
+    glm::vec3 cameraPosition = CAMERA_POSITION;
+    glm::mat4 cameraMatrix = scene_camera_matrix();
 
     // Define light source.
-    glm::vec3 lightPosition(0, 0, -10.0);
+    glm::vec3 lightPosition = LIGHT_POSITION;
+
+    // The frame and the object values are written every frame into a ring buffer, so writing them never waits
+    // for the GPU to finish the frames that still read the values before.
+    uniform_ring uniformRing(UNIFORM_RING_FRAME_SIZE, options.persistentMapping);
+
+    // Create buffer textures for the clustered point lights, they are written every frame.
+    // Without point lights the clusters stay empty and are written once.
+    GLuint clusterBuffer;
+    GLuint lightIndexBuffer;
+    GLuint lightBuffer;
+    GLuint clusterTextureId = create_buffer_texture(GL_RG32UI, clusterBuffer);
+    GLuint lightIndexTextureId = create_buffer_texture(GL_R16UI, lightIndexBuffer);
+    GLuint lightTextureId = create_buffer_texture(GL_RGBA32F, lightBuffer);
+    light_clusterer clusterer;
+
+    // The background color does not change.
+    glClearColor(BACKGROUND_COLOR.x, BACKGROUND_COLOR.y, BACKGROUND_COLOR.z, 1.0f);
+
+    // The headless mode presents into an off-screen framebuffer.
+    offscreen_target target = {};
+    if (options.headless && !create_offscreen_target(options.width, options.height, target)) {
+        std::cout << "Failed to create an off-screen framebuffer!" << std::endl;
+        abort();
+    }
+    // The scene is drawn at a fraction of the output size that the controller adjusts to the measured frame times.
+    scene_target scene(options.samples, options.fxaa, postProgram);
+    if (!scene.resize(windowStruct.width, windowStruct.height)) {
+        std::cout << "Failed to create the scene framebuffer!" << std::endl;
+        abort();
+    }
+    resolution_controller resolution(options.targetFrameTime, MIN_RENDER_SCALE, 1.0f, options.renderScale);
+    std::cout << "Antialiasing: " << scene.samples() << "x MSAA" << (options.fxaa ? ", FXAA" : "") << std::endl;
 
     // Render loop.
-    while (!glfwWindowShouldClose(window))
+    // The headless mode draws a fixed number of frames with a fixed time step, so every run draws the same frames.
+    // Each frame is split into profiler zones. GL state changes go through the state cache that drops redundant ones
+    // and counts the calls, the counts are passed to the profiler at the end of each frame.
+    frame_statistics frameTimes;
+    frame_profiler profiler;
+    render_state state;
+    upload_stream_buffer(state, clusterBuffer, clusterer.clusters().data(), clusterer.clusters().size() * sizeof(uint32_t));
+    upload_stream_buffer(state, lightIndexBuffer, clusterer.indices().data(), clusterer.indices().size() * sizeof(uint16_t));
+    upload_stream_buffer(state, lightBuffer, clusterer.light_data().data(), clusterer.light_data().size() * sizeof(glm::vec4));
+
+    // Stream the color texture in tiles instead, if it is given. The tiles are built on the first start and kept
+    // next to the file, the last level is loaded here and the rest is read while the scene is drawn.
+    virtual_texture virtualTexture(unsigned(options.tileCacheSlots), unsigned(options.tileUploadBudget), PAGE_TABLE_TEXTURE_UNIT,
+                                   TILE_CACHE_TEXTURE_UNIT);
+    texture_feedback feedback(feedbackProgram);
+    if (!options.virtualTexture.empty()) {
+        double tilesBegin = loader.now();
+        if (!virtualTexture.open(options.virtualTexture.c_str(), colorCompressed, state)) {
+            std::cout << "Failed to open the virtual texture " << options.virtualTexture << "!" << std::endl;
+            abort();
+        }
+        virtualTexture.set_uniforms(state, shaderProgram);
+        virtualTexture.set_uniforms(state, feedbackProgram);
+        if (!feedback.resize(windowStruct.width, windowStruct.height)) {
+            std::cout << "Failed to create the feedback framebuffer!" << std::endl;
+            abort();
+        }
+        state.invalidate();
+        loader.add_span(options.virtualTexture.c_str(), "tiles", tilesBegin, loader.now());
+    }
+
+    // Produce the animated scene on a simulation thread, while the render thread draws the snapshot before.
+    frame_pipeline pipeline;
+    pipeline.published = 0;
+    pipeline.taken = 0;
+    pipeline.stop = false;
+    pipeline.statistics = pipeline_statistics();
+    std::thread simulation(run_simulation, std::cref(options), std::ref(pipeline));
+    // Time from the start of the snapshot to the end of the frame that has drawn it.
+    frame_statistics frameLatencies;
+
+    bool firstFrame = true;
+    double firstFrameBegin = loader.now();
+    int frameNumber = 0;
+    // Output size the scene framebuffer is allocated for.
+    int sceneWidth = windowStruct.width;
+    int sceneHeight = windowStruct.height;
+    // Frame times and resolution since the last report of the dynamic resolution.
+    double reportTime = 0.0;
+    double reportMaxTime = 0.0;
+    double reportPixels = 0.0;
+    // Average number of pixels the scene is drawn at, for the report at the end.
+    double pixelSum = 0.0;
+    while (options.headless ? frameNumber < options.frames : !glfwWindowShouldClose(window))
     {
-        // Clean up color and depth buffers.
-        glClearColor(0.8f, 0.8f, 0.8f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        double frameBegin = glfwGetTime();
+        profiler.begin_frame();
+        state.reset_counters();
+
+        // Follow the window size and clean up the used part of the color and depth buffers.
+        profiler.begin_zone("clear");
+        if (windowStruct.width != sceneWidth || windowStruct.height != sceneHeight) {
+            sceneWidth = windowStruct.width;
+            sceneHeight = windowStruct.height;
+            if (sceneWidth > 0 && sceneHeight > 0 && !scene.resize(sceneWidth, sceneHeight)) {
+                std::cout << "Failed to resize the scene framebuffer!" << std::endl;
+                abort();
+            }
+            if (feedbackProgram && sceneWidth > 0 && sceneHeight > 0 && !feedback.resize(sceneWidth, sceneHeight)) {
+                std::cout << "Failed to resize the feedback framebuffer!" << std::endl;
+                abort();
+            }
+            state.invalidate();
+        }
+        scene.begin(state, resolution.scale());
+        profiler.end_zone();
 
-        // Select the shader program.
-        glUseProgram(shaderProgram);
+        // Take the latest snapshot of the scene from the simulation thread.
+        profiler.begin_zone("snapshot");
+        const scene_snapshot& snapshot = take_snapshot(options, pipeline);
+        profiler.end_zone();
 
-        // Create a model matrix that combines rotations around x and y axis with different speed.
-        float time = float(glfwGetTime()) / 2;
-        glm::mat4 modelMatrix = glm::mat4(1.0f);
-        modelMatrix *= glm::rotate(glm::mat4(1.0f), time, glm::vec3(0, 1, 0));
-        modelMatrix *= glm::rotate(glm::mat4(1.0f), time / 2, glm::vec3(1, 0, 0));
+        profiler.begin_zone("uniforms");
+        glm::mat4 modelMatrix = snapshot.modelMatrix;
 
         // Create a projection matrix.
         float aspectRatio = float(windowStruct.width) / windowStruct.height;
-        glm::mat4 projectionMatrix = glm::perspective(glm::radians(30.0f), aspectRatio, 0.1f, 100.0f);
-
-        // Add uniform values for matrices and positions.
-        GLint modelMatrixUniform = glGetUniformLocation(shaderProgram, "modelMatrix");
-        glUniformMatrix4fv(modelMatrixUniform, 1, GL_FALSE, glm::value_ptr(modelMatrix));
-        GLint cameraMatrixUniform = glGetUniformLocation(shaderProgram, "cameraMatrix");
-        glUniformMatrix4fv(cameraMatrixUniform, 1, GL_FALSE, glm::value_ptr(cameraMatrix));
-        GLint projectionMatrixUniform = glGetUniformLocation(shaderProgram, "projectionMatrix");
-        glUniformMatrix4fv(projectionMatrixUniform, 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-        GLint lightPositionUniform = glGetUniformLocation(shaderProgram, "lightPosition");
-        glUniform3fv(lightPositionUniform, 1, glm::value_ptr(lightPosition));
-        GLint cameraPositionUniform = glGetUniformLocation(shaderProgram, "cameraPosition");
-        glUniform3fv(cameraPositionUniform, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, -10.0f)));
-
-        // Add uniform values for textures.
-        GLuint colorTextureUniform  = glGetUniformLocation(shaderProgram, "colorTexture");
-        glUniform1i(colorTextureUniform, 0);
-        GLuint normalTextureUniform  = glGetUniformLocation(shaderProgram, "normalTexture");
-        glUniform1i(normalTextureUniform, 1);
-        GLuint displacementTextureUniform  = glGetUniformLocation(shaderProgram, "displacementTexture");
-        glUniform1i(displacementTextureUniform, 2);
-
-        // Bind the vertex array object we are going to draw and define how buffer values are split per vertices.
-        glBindVertexArray(vao);
-
-        // Describe vertex coordinates buffer.
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-        // Describe texture coordinates buffer.
-        glEnableVertexAttribArray(1);
-        glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-        // Describe normal buffer.
-        glEnableVertexAttribArray(2);
-        glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-        // Describe tangent buffer.
-        glEnableVertexAttribArray(3);
-        glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-        // Describe bitangent buffer.
-        glEnableVertexAttribArray(4);
-        glBindBuffer(GL_ARRAY_BUFFER, bitangentBuffer);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-        // Set up viewport.
-        glViewport(0, 0, windowStruct.width, windowStruct.height);
-
-        // Draw the vertex attribute buffer.
-        glDrawArrays(GL_TRIANGLES, 0, obj.vertexes().size());
-
-        // Swap buffers.
-        glfwSwapBuffers(window);
+        float fieldOfView = glm::radians(FIELD_OF_VIEW);
+        glm::mat4 projectionMatrix = glm::perspective(fieldOfView, aspectRatio, NEAR_PLANE, FAR_PLANE);
+
+        // Select a level of detail by the distance to the center of the mesh.
+        // Instances share one level, it is selected for the grid center and the mesh shrunk by the instance scale,
+        // which is the same as moving the camera away by the inverse scale.
+        glm::vec3 meshCenter = glm::vec3(modelMatrix * glm::vec4(mesh.position_offset() + mesh.position_scale() * 0.5f, 1.0f));
+        float instanceScale = instance_scale(options.instances, options.gridScale);
+        float lodDistance = glm::length(meshCenter * instanceScale - cameraPosition) / instanceScale;
+        size_t lod = select_lod(mesh, lodDistance, fieldOfView, scene.render_height());
+
+        // Write the values into the part of the ring of this frame, the draws bind the written ranges.
+        frame_uniforms frameUniforms;
+        frameUniforms.cameraMatrix = cameraMatrix;
+        frameUniforms.projectionMatrix = projectionMatrix;
+        frameUniforms.lightPosition = glm::vec4(lightPosition, 1.0f);
+        frameUniforms.cameraPosition = glm::vec4(SHADER_CAMERA_POSITION, 1.0f);
+        glm::vec2 sliceMapping = clusterer.slice_mapping();
+        frameUniforms.clusterScale = glm::vec4(float(light_clusterer::GRID_X) / scene.render_width(),
+                                               float(light_clusterer::GRID_Y) / scene.render_height(), sliceMapping.x, sliceMapping.y);
+        object_uniforms objectUniforms;
+        objectUniforms.modelMatrix = modelMatrix;
+        objectUniforms.positionOffset = glm::vec4(mesh.position_offset(), 1.0f);
+        objectUniforms.positionScale = glm::vec4(mesh.position_scale(), 1.0f);
+        uniformRing.begin_frame();
+        GLintptr frameUniformsOffset = 0;
+        GLintptr objectUniformsOffset = 0;
+        if (!uniformRing.write(&frameUniforms, sizeof(frameUniforms), frameUniformsOffset)
+                || !uniformRing.write(&objectUniforms, sizeof(objectUniforms), objectUniformsOffset)) {
+            std::cout << "The uniform ring is too small for a frame!" << std::endl;
+            abort();
+        }
+        uniformRing.flush(state);
+        profiler.end_zone();
+
+        // Assign the point lights of the snapshot to the clusters of the view frustum and upload the lists.
+        if (options.lights > 0) {
+            profiler.begin_zone("lights");
+            clusterer.set_projection(fieldOfView, aspectRatio, NEAR_PLANE, FAR_PLANE);
+            clusterer.bin(cameraMatrix, snapshot.lights);
+            upload_stream_buffer(state, clusterBuffer, clusterer.clusters().data(), clusterer.clusters().size() * sizeof(uint32_t));
+            upload_stream_buffer(state, lightIndexBuffer, clusterer.indices().data(), clusterer.indices().size() * sizeof(uint16_t));
+            upload_stream_buffer(state, lightBuffer, clusterer.light_data().data(), clusterer.light_data().size() * sizeof(glm::vec4));
+            profiler.end_zone();
+        }
+
+        // Request the tiles that the feedback has seen and write the tiles read since the last frame into the cache.
+        if (feedbackProgram) {
+            profiler.begin_zone("streaming");
+            virtualTexture.update(state, feedback.tiles());
+            profiler.end_zone();
+        }
+
+        // Cull the instances of the stress mode against the view frustum and write the transforms of the visible ones
+        // packed to the start of the instance buffer. The storage is orphaned, so the driver can give new memory
+        // while the last frames still read the old one.
+        size_t drawnInstances = 1;
+        if (options.instances > 1) {
+            profiler.begin_zone("cull");
+            const std::vector< uint32_t >& visible = culler.cull(projectionMatrix * cameraMatrix);
+            profiler.end_zone();
+            drawnInstances = visible.size();
+            if (!visible.empty()) {
+                profiler.begin_zone("instances");
+                instance_transform* data
+                    = static_cast< instance_transform* >(state.map_array_buffer(instanceBuffer, visible.size() * sizeof(instance_transform)));
+                if (data) {
+                    for (size_t i = 0; i < visible.size(); i++) {
+                        data[i] = snapshot.instances[visible[i]];
+                    }
+                }
+                state.unmap_array_buffer();
+                profiler.end_zone();
+            }
+        }
+
+        // Select the program, the textures, the uniform buffers and the vertex array object and draw all instances.
+        profiler.begin_zone("draw");
+        state.use_program(shaderProgram);
+        state.bind_texture(0, colorTextureId);
+        state.bind_texture(1, normalTextureId);
+        state.bind_texture(2, displacementTextureId);
+        state.bind_texture(CLUSTER_TEXTURE_UNIT, clusterTextureId, GL_TEXTURE_BUFFER);
+        state.bind_texture(LIGHT_INDEX_TEXTURE_UNIT, lightIndexTextureId, GL_TEXTURE_BUFFER);
+        state.bind_texture(LIGHT_TEXTURE_UNIT, lightTextureId, GL_TEXTURE_BUFFER);
+        if (feedbackProgram) {
+            virtualTexture.bind(state);
+        }
+        state.bind_uniform_range(FRAME_UNIFORMS_BINDING, uniformRing.buffer(), frameUniformsOffset, sizeof(frame_uniforms));
+        state.bind_uniform_range(OBJECT_UNIFORMS_BINDING, uniformRing.buffer(), objectUniformsOffset, sizeof(object_uniforms));
+        state.bind_vertex_array(vao);
+        draw_mesh(state, mesh, lod, indexBuffer, indexType, drawnInstances);
+        profiler.end_zone();
+
+        // Draw the scene again at a low resolution to find the tiles it samples. They are read back two frames later.
+        if (feedbackProgram) {
+            profiler.begin_zone("feedback");
+            feedback.begin(state, scene.render_width(), scene.render_height());
+            draw_mesh(state, mesh, lod, indexBuffer, indexType, drawnInstances);
+            feedback.end(state);
+            profiler.end_zone();
+        }
+        // Nothing else reads the part of the ring of this frame.
+        uniformRing.end_frame(state);
+
+        // Scale the scene to the output.
+        profiler.begin_zone("present");
+        scene.present(state, options.headless ? target.framebuffer : 0);
+        profiler.end_zone();
+
+        profiler.begin_zone("swap");
+        if (options.headless) {
+            // Wait for the frame to be drawn, so the frame time includes the GPU work.
+            glFinish();
+        } else {
+            // Swap buffers.
+            glfwSwapBuffers(window);
+        }
+        state.count_calls(1);
+        profiler.end_zone();
+        double frameTime = (glfwGetTime() - frameBegin) * 1000.0;
+        frameTimes.add(frameTime);
+        frameLatencies.add(std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - snapshot.created).count());
+        frameNumber++;
+
+        // Adjust the resolution of the next frames and report it with the frame times regularly.
+        double pixels = double(scene.render_width()) * scene.render_height();
+        pixelSum += pixels;
+        reportTime += frameTime;
+        reportMaxTime = std::max(reportMaxTime, frameTime);
+        reportPixels += pixels;
+        resolution.update(frameTime);
+        if (resolution.target() > 0.0 && frameNumber % RESOLUTION_REPORT_FRAMES == 0) {
+            double outputPixels = double(windowStruct.width) * windowStruct.height;
+            std::cout << "Frame " << frameNumber << ": frame time ms: average " << reportTime / RESOLUTION_REPORT_FRAMES
+                      << ", max " << reportMaxTime << ", resolution " << scene.render_width() << "x" << scene.render_height()
+                      << ", average " << std::sqrt(reportPixels / RESOLUTION_REPORT_FRAMES / outputPixels) * 100.0
+                      << "% of the output size" << std::endl;
+            reportTime = 0.0;
+            reportMaxTime = 0.0;
+            reportPixels = 0.0;
+        }
+
+        // Report how the time to the first frame was spent.
+        if (firstFrame) {
+            firstFrame = false;
+            loader.add_span("first frame", "draw", firstFrameBegin, loader.now());
+            print_timeline(loader);
+        }
 
         // Poll system events.
+        profiler.begin_zone("events");
         glfwPollEvents();
+        profiler.end_zone();
+        profiler.add_calls(state.counters().issued);
+        profiler.add_skipped(state.counters().skipped);
+        profiler.add_upload(size_t(state.counters().uploadBytes));
+        profiler.end_frame();
+    }
+
+    // Stop the simulation thread.
+    {
+        std::lock_guard< std::mutex > lock(pipeline.mutex);
+        pipeline.stop = true;
+    }
+    pipeline.condition.notify_all();
+    simulation.join();
+
+    // Report where the frame time goes.
+    profiler.destroy();
+    profiler.print_summary(std::cout);
+    if (!options.traceFile.empty() && !profiler.write_trace(options.traceFile.c_str())) {
+        std::cout << "Failed to write the trace to " << options.traceFile << "!" << std::endl;
+    }
+
+    // Report the instance throughput of the stress mode.
+    if (options.instances > 1 && frameTimes.count() > 0) {
+        std::cout << "Instances: " << options.instances << " per frame, "
+                  << options.instances / (frameTimes.average() / 1000.0) << " per second" << std::endl;
+        const cull_statistics& culling = culler.statistics();
+        if (culling.tested > 0) {
+            std::cout << "Culling: " << culling.milliseconds / culling.tested * 100000.0 << " ms per 100k instances, "
+                      << 100.0 * culling.visible / culling.tested << "% visible" << std::endl;
+        }
+    }
+
+    // Report the cost of the point lights.
+    const cluster_statistics& binning = clusterer.statistics();
+    if (binning.passes > 0) {
+        size_t clusterCount = size_t(light_clusterer::GRID_X) * light_clusterer::GRID_Y * light_clusterer::GRID_Z;
+        std::cout << "Lights: " << options.lights << ", binning " << binning.milliseconds / binning.passes << " ms per frame, "
+                  << double(binning.indices) / binning.passes / clusterCount << " lights per cluster" << std::endl;
+    }
+
+    // Report how well the tile cache of the virtual texture has kept up with the view.
+    if (feedbackProgram) {
+        const tile_file& tiles = virtualTexture.file();
+        double tileMegabytes = tiles.tile_bytes() / (1024.0 * 1024.0);
+        streaming_statistics streaming = virtualTexture.statistics();
+        std::cout << "Virtual texture: " << tiles.width() << "x" << tiles.height() << ", " << tiles.level_count() << " levels, "
+                  << tiles.tile_count() << " tiles, " << tiles.tile_count() * tileMegabytes << " MB; cache "
+                  << virtualTexture.slot_count() << " tiles, " << virtualTexture.slot_count() * tileMegabytes << " MB, "
+                  << virtualTexture.resident_tiles() << " used, " << virtualTexture.resident_tiles() * tileMegabytes << " MB" << std::endl;
+        if (streaming.requested > 0) {
+            std::cout << "Streaming: " << 100.0 * streaming.hits / streaming.requested << "% of requested tiles cached, "
+                      << streaming.uploads << " uploads, " << streaming.evictions << " evictions, " << streaming.dropped << " dropped, "
+                      << streaming.bytesRead / (1024.0 * 1024.0) << " MB read in " << streaming.readMilliseconds << " ms" << std::endl;
+        }
+        if (streaming.uploads > 0) {
+            std::cout << "Tile latency: average " << streaming.latencySum / streaming.uploads << " ms, "
+                      << double(streaming.latencyFrames) / streaming.uploads << " frames, max " << streaming.latencyMax << " ms, "
+                      << streaming.latencyMaxFrames << " frames" << std::endl;
+        }
+    }
+
+    // Report how the simulation and the render thread have waited for each other and how old the drawn scene was.
+    const pipeline_statistics& pipelining = pipeline.statistics;
+    if (pipelining.snapshots > 0) {
+        std::cout << "Pipeline: " << pipelining.snapshots << " snapshots, " << pipelining.simulationMilliseconds / pipelining.snapshots
+                  << " ms each; simulation waited " << pipelining.simulationWaits << " times, " << pipelining.simulationWaitMilliseconds
+                  << " ms; render waited " << pipelining.renderWaits << " times, " << pipelining.renderWaitMilliseconds << " ms, "
+                  << pipelining.repeats << " frames drew a snapshot again" << std::endl;
+    }
+    if (frameLatencies.count() > 0) {
+        std::cout << "Frame latency from the snapshot to the end of the frame, ms: average " << frameLatencies.average()
+                  << ", p50 " << frameLatencies.percentile(50.0)
+                  << ", p95 " << frameLatencies.percentile(95.0)
+                  << ", p99 " << frameLatencies.percentile(99.0) << std::endl;
+    }
+    const ring_statistics& ring = uniformRing.statistics();
+    if (ring.frames > 0) {
+        std::cout << "Uniform ring: " << (uniformRing.persistent() ? "persistent mapping" : "orphaning") << ", "
+                  << ring.bytes / ring.frames << " bytes per frame, " << ring.waits << " fence waits, " << ring.waitMilliseconds << " ms, "
+                  << ring.orphans << " orphaned" << std::endl;
+    }
+
+    // Report how the dynamic resolution has behaved.
+    const resolution_statistics& scaling = resolution.statistics();
+    if (resolution.target() > 0.0 && scaling.frames > 0) {
+        std::cout << "Resolution: target " << resolution.target() << " ms, scale average " << scaling.scaleSum / scaling.frames
+                  << ", min " << scaling.minScale << ", max " << scaling.maxScale
+                  << ", " << scaling.changes << " changes, " << scaling.reversals << " reversals" << std::endl;
+    }
+
+    if (options.headless) {
+        // Report the frame time distribution.
+        std::cout << "Frames: " << frameTimes.count() << " at " << options.width << "x" << options.height
+                  << ", frame time ms: average " << frameTimes.average()
+                  << ", p50 " << frameTimes.percentile(50.0)
+                  << ", p95 " << frameTimes.percentile(95.0)
+                  << ", p99 " << frameTimes.percentile(99.0) << std::endl;
+        if (frameTimes.count() > 0) {
+            double pixels = pixelSum / frameTimes.count();
+            std::cout << "Effective resolution: " << std::sqrt(pixels / (double(options.width) * options.height)) * 100.0
+                      << "% of the output size, " << pixels / 1000000.0 << " Mpixels per frame" << std::endl;
+        }
+        // Write the last frame to compare it with a reference image.
+        if (!options.dumpFile.empty() && !dump_offscreen_target(target, options.width, options.height, options.dumpFile.c_str())) {
+            std::cout << "Failed to write the frame to " << options.dumpFile << "!" << std::endl;
+        }
+        delete_offscreen_target(target);
     }
 
     // Delete textures.
-    GLuint textures[] = {colorTextureId, normalTextureId, displacementTextureId};
+    GLuint textures[] = {colorTextureId, normalTextureId, displacementTextureId, clusterTextureId, lightIndexTextureId, lightTextureId};
     glDeleteTextures(sizeof(textures) / sizeof(textures[0]), textures);
 
     // Delete vetrex buffers.
-    GLuint buffers[] = { vertexBuffer, uvBuffer, normalBuffer, tangentBuffer, bitangentBuffer };
+    GLuint buffers[] = { vertexBuffer, indexBuffer, instanceBuffer, clusterBuffer, lightIndexBuffer, lightBuffer };
     glDeleteBuffers(sizeof(buffers) / sizeof(buffers[0]), buffers);
 
     // Delete vertex attribute array.
     glDeleteVertexArrays(1, &vao);
 
-    // Delete shader program.
+    // Delete the uniform ring and the scene framebuffer.
+    uniformRing.destroy();
+    scene.destroy();
+
+    // Delete the virtual texture and its feedback buffers.
+    virtualTexture.destroy();
+    feedback.destroy();
+
+    // Delete shader programs.
     glDeleteProgram(shaderProgram);
+    glDeleteProgram(postProgram);
+    glDeleteProgram(feedbackProgram);
 
     // Destroy the window.
     glfwDestroyWindow(window);
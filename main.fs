@@ -4,62 +4,157 @@ in vec2 UV;
 in vec3 lightDirection;
 in vec3 cameraDirection;
 in vec3 viewDirection;
+in vec3 positionCameraSpace;
+in vec3 tangentCameraSpace;
+in vec3 bitangentCameraSpace;
+in vec3 normalCameraSpace;
 
 out vec3 FragColor;
 
-uniform mat4 modelMatrix;
 uniform sampler2D colorTexture;
 uniform sampler2D normalTexture;
 uniform sampler2D displacementTexture;
 
+// Virtual color texture streamed in tiles (see virtual_texture).
+// Slot column, slot row and level of the cached tile for each tile, a mip level per level of the virtual texture.
+uniform sampler2D pageTableTexture;
+// Slots with the cached tiles and their borders.
+uniform sampler2D tileCacheTexture;
+// xy - size of the virtual texture in texels, z - number of levels, w - 1 if the texture is used instead of colorTexture.
+uniform vec4 virtualTextureSize;
+
+// Point lights binned into clusters of the view frustum on the CPU (see light_clusterer).
+// Offset into the index list and light count of each cluster.
+uniform usamplerBuffer clusterTexture;
+// Light numbers of all clusters.
+uniform usamplerBuffer lightIndexTexture;
+// Two texels per light: position in camera space and radius, color.
+uniform samplerBuffer lightTexture;
+
+// Values that are the same for all objects of a frame (see frame_uniforms in main.cpp).
+layout (std140) uniform frameUniforms
+{
+    mat4 cameraMatrix;
+    mat4 projectionMatrix;
+    vec4 lightPosition;
+    vec4 cameraPosition;
+    // xy - clusters per pixel, z and w - scale and bias from the log of the depth to the slice.
+    vec4 clusterScale;
+};
+
 // Shift texture coordinates according to the parallax map.
+// The depth is in R, G keeps the relaxed cone step map built on the CPU, see cone_step_map.
 // @param texCoords Original texture coordinates.
 // @param viewDir Vector from camera to the point.
 // @return New texture coordinates taking into account parallax.
 vec2 parallaxMap(vec2 texCoords, vec3 viewDir)
 {
-    // Define how deep the parallax map is.
-    const float HEIGHT_SCALE = 0.07;
-
-    // Number of depth layers
-    const float NUM_LAYERS = 20;
-
-    // Calculate the size of each layer.
-    float layerDepth = 1.0 / NUM_LAYERS;
-    // Depth of current layer.
-    float currentLayerDepth = 0.0;
-    // Amount to shift the texture coordinates per layer (from vector P).
-    vec2 P = viewDir.xy * HEIGHT_SCALE;
-    vec2 deltaTexCoords = P / NUM_LAYERS;
-
-    // Get initial values.
-    vec2  currentTexCoords     = texCoords;
-    float currentDepthMapValue = texture(displacementTexture, currentTexCoords).r;
-    vec2 shift = vec2(0.0, 0.0);
-
-    while(currentLayerDepth < currentDepthMapValue) {
-        // shift texture coordinates along direction of P
-        shift -= deltaTexCoords;
-        // get depthmap value at current texture coordinates
-        currentDepthMapValue = texture(displacementTexture, currentTexCoords + shift).r;
-        // get depth of next layer
-        currentLayerDepth += layerDepth;
+    // HEIGHT_SCALE, MIN_CONE_STEPS, MAX_CONE_STEPS, SEARCH_STEPS and SURFACE_EPSILON are defined by
+    // cone_step_map::shader_defines() when the program is loaded.
+
+    // The ray goes against the view direction, at most HEIGHT_SCALE in texture coordinates per unit of depth.
+    vec3 ray = vec3(-viewDir.xy * HEIGHT_SCALE, 1.0);
+    float rayRatio = length(ray.xy);
+    // The level of detail is taken once, the loops below are not uniform. The nearest mip level is sampled,
+    // trilinear filtering would fetch two levels per step.
+    vec2 size = vec2(textureSize(displacementTexture, 0));
+    vec2 texelsDx = dFdx(texCoords) * size;
+    vec2 texelsDy = dFdy(texCoords) * size;
+    float lod = floor(max(0.5 * log2(max(dot(texelsDx, texelsDx), dot(texelsDy, texelsDy))), 0.0) + 0.5);
+    // Flat views converge in a few steps, grazing views need more.
+    int coneSteps = int(mix(float(MAX_CONE_STEPS), float(MIN_CONE_STEPS), abs(viewDir.z)));
+
+    // Step to the side of the cone above the surface until the ray is on or below it.
+    vec3 position = vec3(texCoords, 0.0);
+    float stepDepth = 0.0;
+    float height = 1.0;
+    for (int i = 0; i < coneSteps; i++) {
+        vec2 texel = textureLod(displacementTexture, position.xy, lod).rg;
+        height = texel.r - position.z;
+        if (height < SURFACE_EPSILON) {
+            break;
+        }
+        float coneRatio = texel.g * texel.g * HEIGHT_SCALE;
+        stepDepth = coneRatio * height / (rayRatio + coneRatio);
+        position += ray * stepDepth;
     }
 
-    // get texture coordinates before collision (reverse operations)
-    vec2 prevTexCoords = currentTexCoords + deltaTexCoords;
-
-    currentTexCoords += shift;
-
-    // get depth after and before collision for linear interpolation
-    float afterDepth  = currentDepthMapValue - currentLayerDepth;
-    float beforeDepth = texture(displacementTexture, prevTexCoords).r - currentLayerDepth + layerDepth;
+    // A step that ends below the surface has crossed it once, search the crossing from the middle of the step.
+    if (height < 0.0) {
+        vec3 range = ray * (stepDepth * 0.5);
+        position -= range;
+        for (int i = 0; i < SEARCH_STEPS; i++) {
+            range *= 0.5;
+            float depth = textureLod(displacementTexture, position.xy, lod).r;
+            position += position.z < depth ? range : -range;
+        }
+    }
+    return position.xy;
+}
 
-    // interpolation of texture coordinates
-    float weight = afterDepth / (afterDepth - beforeDepth);
-    vec2 finalTexCoords = prevTexCoords * weight + currentTexCoords * (1.0 - weight);
+// Sample the virtual texture at the level of the fragment, or at the coarser level of the nearest cached tile.
+// The tile is looked up the same way as in feedback.fs.
+// @param texCoords Texture coordinates.
+// @param texCoordsDx Derivative of the texture coordinates along x in the window.
+// @param texCoordsDy Derivative of the texture coordinates along y in the window.
+// @return Color of the texture.
+vec3 virtualColor(vec2 texCoords, vec2 texCoordsDx, vec2 texCoordsDy)
+{
+    // Texels of a tile without the border, border and slot size. Must match tile_file::TILE_SIZE, TILE_BORDER and SLOT_SIZE.
+    const float TILE_SIZE = 128.0;
+    const float TILE_BORDER = 4.0;
+    const float SLOT_SIZE = 136.0;
+
+    vec2 texels = clamp(texCoords, 0.0, 1.0) * virtualTextureSize.xy;
+    float lod = log2(max(length(texCoordsDx * virtualTextureSize.xy), length(texCoordsDy * virtualTextureSize.xy)));
+    float level = clamp(floor(lod), 0.0, virtualTextureSize.z - 1.0);
+    float levelTileSize = TILE_SIZE * exp2(level);
+    vec2 tile = min(floor(texels / levelTileSize), ceil(virtualTextureSize.xy / levelTileSize) - 1.0);
+
+    // The entry gives the slot and the level of the cached tile that covers the tile.
+    vec4 entry = floor(texelFetch(pageTableTexture, ivec2(tile), int(level)) * 255.0 + 0.5);
+    vec2 cachedTile = floor(tile * exp2(level - entry.z));
+    vec2 inside = texels * exp2(-entry.z) - cachedTile * TILE_SIZE;
+    vec2 position = (entry.xy * SLOT_SIZE + TILE_BORDER + inside) / vec2(textureSize(tileCacheTexture, 0));
+    return textureLod(tileCacheTexture, position, 0.0).rgb;
+}
 
-    return currentTexCoords;
+// Shade the point lights of the cluster of the fragment, the same way as the main light.
+// @param normal Unit normal in camera space.
+// @param textureColor Color of the surface.
+// @return Sum of the light colors.
+vec3 pointLights(vec3 normal, vec3 textureColor)
+{
+    // Cluster grid size. Must match light_clusterer::GRID_X, GRID_Y and GRID_Z.
+    const ivec3 CLUSTER_GRID = ivec3(16, 16, 24);
+
+    // Find the cluster from the position in the window and the depth.
+    vec3 cell = vec3(gl_FragCoord.xy * clusterScale.xy, log(-positionCameraSpace.z) * clusterScale.z + clusterScale.w);
+    ivec3 clusterCell = clamp(ivec3(cell), ivec3(0), CLUSTER_GRID - 1);
+    int clusterNumber = (clusterCell.z * CLUSTER_GRID.y + clusterCell.y) * CLUSTER_GRID.x + clusterCell.x;
+    uvec2 cluster = texelFetch(clusterTexture, clusterNumber).rg;
+
+    vec3 eyeDirection = normalize(-positionCameraSpace);
+    vec3 color = vec3(0.0);
+    for (uint i = 0u; i < cluster.y; i++) {
+        int light = int(texelFetch(lightIndexTexture, int(cluster.x + i)).r);
+        vec4 positionRadius = texelFetch(lightTexture, light * 2);
+        vec3 lightVector = positionRadius.xyz - positionCameraSpace;
+        float distanceSquared = dot(lightVector, lightVector);
+        float radiusSquared = positionRadius.w * positionRadius.w;
+        if (distanceSquared >= radiusSquared) {
+            continue;
+        }
+        // The light fades smoothly to zero at its radius.
+        float falloff = 1.0 - distanceSquared / radiusSquared;
+        falloff *= falloff;
+        vec3 lightDirection = lightVector * inversesqrt(distanceSquared);
+        float diffuseFactor = max(dot(normal, lightDirection), 0.0);
+        vec3 R = 2.0 * dot(normal, lightDirection) * normal - lightDirection;
+        float specularFactor = max(dot(R, eyeDirection) * 0.5, 0.0) * 0.5;
+        color += texelFetch(lightTexture, light * 2 + 1).rgb * (diffuseFactor + specularFactor) * falloff;
+    }
+    return textureColor * color;
 }
 
 void main()
@@ -71,6 +166,9 @@ void main()
 
     // Adjust the texture coordinate according to the parallax map.
     vec2 texCoords = parallaxMap(UV, viewDirectionNormalized);
+    // Derivatives for the virtual texture, taken before the discard below.
+    vec2 texCoordsDx = dFdx(UV);
+    vec2 texCoordsDy = dFdy(UV);
 
     // Discard fragments that are moved out from the texture after applying the parallax transformation.
     if(texCoords.x > 1.0 || texCoords.y > 1.0 || texCoords.x < 0.0 || texCoords.y < 0.0) {
@@ -78,11 +176,18 @@ void main()
     }
 
     // Read normal vector in texture coordinate system.
-    vec3 texNormalVector = normalize(texture(normalTexture, texCoords).xyz * 2.0 - 1.0);
+    // Only x and y are stored, z is the positive value that makes the vector unit length.
+    vec2 texNormalXY = texture(normalTexture, texCoords).xy * 2.0 - 1.0;
+    vec3 texNormalVector = vec3(texNormalXY, sqrt(max(1.0 - dot(texNormalXY, texNormalXY), 0.0)));
     vec4 normalVec = vec4(texNormalVector, 1.0);
 
     // Read fragment color.
-    vec3 textureColor = texture(colorTexture, texCoords).rgb;
+    vec3 textureColor;
+    if (virtualTextureSize.w > 0.0) {
+        textureColor = virtualColor(texCoords, texCoordsDx, texCoordsDy);
+    } else {
+        textureColor = texture(colorTexture, texCoords).rgb;
+    }
 
     // Ambient component of the color.
     vec3 ambientColor = textureColor * 0.2;
@@ -96,6 +201,10 @@ void main()
     float specularFactor = max((dot(R, cameraDirectionNormalized) * 0.5), 0) * 0.5;
     vec3 specularColor = textureColor * specularFactor;
 
+    // Add the point lights, with the normal moved from the tangent space to the camera space.
+    vec3 normalCamera = normalize(mat3(tangentCameraSpace, bitangentCameraSpace, normalCameraSpace) * texNormalVector);
+    vec3 pointColor = pointLights(normalCamera, textureColor);
+
     // Calculate fragment color.
-    FragColor = ambientColor + diffuseColor + specularColor;
+    FragColor = ambientColor + diffuseColor + specularColor + pointColor;
 }
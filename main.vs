@@ -1,37 +1,102 @@
 #version 330 core
 
-layout (location = 0) in vec3 vertexPosition;
+// Packed vertex (see packed_mesh.h):
+// xyz - position inside the bounding box in [0, 1], w - bitangent sign in [0, 1].
+layout (location = 0) in vec4 vertexPackedPosition;
 layout (location = 1) in vec2 vertexUV;
-layout (location = 2) in vec3 vertexNormal;
-layout (location = 3) in vec3 vertexTangent;
-layout (location = 4) in vec3 vertexBitangent;
+// Octahedral encoding of the normal and the tangent.
+layout (location = 2) in vec2 vertexPackedNormal;
+layout (location = 3) in vec2 vertexPackedTangent;
+// Per-instance transform (see instance_transform in main.cpp):
+// rotation quaternion and xyz - position, w - uniform scale.
+layout (location = 4) in vec4 instanceRotation;
+layout (location = 5) in vec4 instancePositionScale;
 
 out vec2 UV;
 out vec3 lightDirection;
 out vec3 cameraDirection;
 out vec3 viewDirection;
+// Position and tangent space in camera space for the point lights.
+out vec3 positionCameraSpace;
+out vec3 tangentCameraSpace;
+out vec3 bitangentCameraSpace;
+out vec3 normalCameraSpace;
 
-uniform mat4 modelMatrix;
-uniform mat4 cameraMatrix;
-uniform mat4 projectionMatrix;
-uniform vec3 lightPosition;
-uniform vec3 cameraPosition;
+// Values that are the same for all objects of a frame (see frame_uniforms in main.cpp).
+// Vectors are vec4, since std140 aligns vec3 to 16 bytes anyway.
+layout (std140) uniform frameUniforms
+{
+    mat4 cameraMatrix;
+    mat4 projectionMatrix;
+    vec4 lightPosition;
+    vec4 cameraPosition;
+    vec4 clusterScale;
+};
+
+// Values of the drawn object (see object_uniforms in main.cpp).
+layout (std140) uniform objectUniforms
+{
+    mat4 modelMatrix;
+    vec4 positionOffset;
+    vec4 positionScale;
+};
+
+// Decode a unit vector from the octahedral encoding.
+// @param e Encoded vector.
+// @return Unit vector.
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 v = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-v.z, 0.0);
+    v.x += v.x >= 0.0 ? -t : t;
+    v.y += v.y >= 0.0 ? -t : t;
+    return normalize(v);
+}
+
+// Build the transformation matrix of an instance.
+// @param q Rotation quaternion.
+// @param positionScale Position in xyz and uniform scale in w.
+// @return Matrix that scales, rotates and moves the instance.
+mat4 instanceMatrix(vec4 q, vec4 positionScale)
+{
+    vec3 q2 = q.xyz * 2.0;
+    vec3 diagonal = q.xyz * q2;
+    float xy = q.x * q2.y, xz = q.x * q2.z, yz = q.y * q2.z;
+    float wx = q.w * q2.x, wy = q.w * q2.y, wz = q.w * q2.z;
+    mat3 rotation = mat3(
+        1.0 - diagonal.y - diagonal.z, xy + wz, xz - wy,
+        xy - wz, 1.0 - diagonal.x - diagonal.z, yz + wx,
+        xz + wy, yz - wx, 1.0 - diagonal.x - diagonal.y
+    );
+    rotation *= positionScale.w;
+    return mat4(vec4(rotation[0], 0.0), vec4(rotation[1], 0.0), vec4(rotation[2], 0.0), vec4(positionScale.xyz, 1.0));
+}
 
 void main()
 {
+    // Unpack vertex attributes.
+    vec3 vertexPosition = positionOffset.xyz + vertexPackedPosition.xyz * positionScale.xyz;
+    vec3 vertexNormal = octahedralDecode(vertexPackedNormal);
+    vec3 vertexTangent = octahedralDecode(vertexPackedTangent);
+    vec3 vertexBitangent = cross(vertexNormal, vertexTangent) * (vertexPackedPosition.w * 2.0 - 1.0);
+
+    // Place the object rotated by the model matrix with the instance transform.
+    mat4 instanceModelMatrix = instanceMatrix(instanceRotation, instancePositionScale) * modelMatrix;
+
     // Calculate full transformation matrix.
-    mat4 MVP = projectionMatrix * cameraMatrix * modelMatrix;
+    mat4 MVP = projectionMatrix * cameraMatrix * instanceModelMatrix;
 
     // Calculate direction from the vertex to the camera.
-    vec3 vertexPositionCameraSpace = (cameraMatrix * modelMatrix * vec4(vertexPosition, 1.0)).xyz;
+    vec3 vertexPositionCameraSpace = (cameraMatrix * instanceModelMatrix * vec4(vertexPosition, 1.0)).xyz;
     vec3 eyeDirectionCameraSpace = vec3(0, 0, 0) - vertexPositionCameraSpace;
 
     // Calculation direction of the light.
-    vec3 lightPositionCameraSpace = (cameraMatrix * vec4(lightPosition,1)).xyz;
+    vec3 lightPositionCameraSpace = (cameraMatrix * vec4(lightPosition.xyz, 1)).xyz;
     vec3 lightDirectionCameraSpace = lightPositionCameraSpace + eyeDirectionCameraSpace;
 
     // Rotation matrix to transform from model space to camera space.
-    mat3 MV3x3 = mat3(cameraMatrix) * mat3(modelMatrix);
+    // The instance scale is uniform, so it only changes the length of the vectors that are normalized later.
+    mat3 MV3x3 = mat3(cameraMatrix) * mat3(instanceModelMatrix);
 
     // Transform vectors to camera space.
     vec3 vertexTangentCameraSpace = MV3x3 * vertexTangent;
@@ -56,5 +121,11 @@ void main()
     cameraDirection =  normalize(invTBN * eyeDirectionCameraSpace);
 
     // Output view direction in tangent space.
-    viewDirection = invTBN * vertexPosition - invTBN * cameraPosition;
+    viewDirection = invTBN * vertexPosition - invTBN * cameraPosition.xyz;
+
+    // Output the vectors the point lights are shaded with.
+    positionCameraSpace = vertexPositionCameraSpace;
+    tangentCameraSpace = vertexTangentCameraSpace;
+    bitangentCameraSpace = vertexBitangentCameraSpace;
+    normalCameraSpace = vertexNormalCameraSpace;
 }
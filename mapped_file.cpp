@@ -0,0 +1,182 @@
+#include "mapped_file.h"
+
+#include <atomic>
+#include <cstring>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+mapped_file::mapped_file()
+    : m_data(nullptr)
+    , m_size(0)
+#ifdef _WIN32
+    , m_mapping(nullptr)
+#endif
+{
+}
+
+mapped_file::mapped_file(const char* fileName)
+    : m_data(nullptr)
+    , m_size(0)
+#ifdef _WIN32
+    , m_mapping(nullptr)
+#endif
+{
+#ifdef _WIN32
+    // Open the file.
+    HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    // Empty files cannot be mapped.
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return;
+    }
+    // Create a read-only mapping of the whole file. The mapping keeps the file open on its own.
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+        return;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        return;
+    }
+    m_mapping = mapping;
+    m_data = static_cast< const char* >(view);
+    m_size = static_cast< size_t >(fileSize.QuadPart);
+#else
+    // Open the file.
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    // Empty files cannot be mapped.
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+        ::close(fd);
+        return;
+    }
+    // Create a read-only mapping of the whole file. The mapping keeps the file open on its own.
+    void* view = mmap(NULL, static_cast< size_t >(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (view == MAP_FAILED) {
+        return;
+    }
+    // The content is usually scanned from the beginning to the end.
+    madvise(view, static_cast< size_t >(fileStat.st_size), MADV_SEQUENTIAL);
+    m_data = static_cast< const char* >(view);
+    m_size = static_cast< size_t >(fileStat.st_size);
+#endif
+}
+
+mapped_file::mapped_file(mapped_file&& other)
+    : m_data(other.m_data)
+    , m_size(other.m_size)
+#ifdef _WIN32
+    , m_mapping(other.m_mapping)
+#endif
+{
+    other.m_data = nullptr;
+    other.m_size = 0;
+#ifdef _WIN32
+    other.m_mapping = nullptr;
+#endif
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& other)
+{
+    if (this != &other) {
+        close();
+        m_data = other.m_data;
+        m_size = other.m_size;
+        other.m_data = nullptr;
+        other.m_size = 0;
+#ifdef _WIN32
+        m_mapping = other.m_mapping;
+        other.m_mapping = nullptr;
+#endif
+    }
+    return *this;
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+const char* mapped_file::data() const
+{
+    return m_data;
+}
+
+size_t mapped_file::size() const
+{
+    return m_size;
+}
+
+bool mapped_file::file_info(const char* fileName, uint64_t& size, int64_t& time)
+{
+    struct stat fileStat;
+    if (stat(fileName, &fileStat) != 0) {
+        return false;
+    }
+    size = uint64_t(fileStat.st_size);
+    time = int64_t(fileStat.st_mtime);
+    return true;
+}
+
+uint64_t mapped_file::hash(const void* data, size_t size, uint64_t seed)
+{
+    // Mix 8 bytes at a time with a multiply and a shift, then the remaining bytes.
+    const uint64_t MULTIPLIER = 0xFF51AFD7ED558CCDull;
+    const unsigned char* bytes = static_cast< const unsigned char* >(data);
+    uint64_t result = seed ^ (uint64_t(size) * 0x9E3779B97F4A7C15ull);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        result = (result ^ word) * MULTIPLIER;
+        result ^= result >> 32;
+    }
+    for (; i < size; i++) {
+        result = (result ^ bytes[i]) * MULTIPLIER;
+        result ^= result >> 32;
+    }
+    return result;
+}
+
+std::string mapped_file::temporary_name(const std::string& fileName)
+{
+    static std::atomic< unsigned > counter(0);
+#ifdef _WIN32
+    unsigned long process = GetCurrentProcessId();
+#else
+    unsigned long process = static_cast< unsigned long >(getpid());
+#endif
+    return fileName + "." + std::to_string(process) + "." + std::to_string(counter++) + ".tmp";
+}
+
+void mapped_file::close()
+{
+    if (m_data) {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+#else
+        munmap(const_cast< char* >(m_data), m_size);
+#endif
+    }
+    m_data = nullptr;
+    m_size = 0;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Helper class to map a file into memory for read-only access.
+ * The content is not copied: pages are loaded by the OS on first access.
+ */
+class mapped_file
+{
+public:
+    /**
+     * Constructor. Create an empty mapping.
+     */
+    mapped_file();
+    /**
+     * Map the provided file into memory.
+     * If the file cannot be opened or is empty, the mapping is empty.
+     * @param fileName File to map.
+     */
+    mapped_file(const char* fileName);
+    /**
+     * Move constructor.
+     * @param other Mapping to take over.
+     */
+    mapped_file(mapped_file&& other);
+    /**
+     * Move assignment.
+     * @param other Mapping to take over.
+     * @return Reference to this object.
+     */
+    mapped_file& operator=(mapped_file&& other);
+    /**
+     * Destructor. Unmap the file.
+     */
+    ~mapped_file();
+    /**
+     * Return a pointer to the first byte of the file.
+     * @return Pointer to the file content or nullptr if the mapping is empty.
+     */
+    const char* data() const;
+    /**
+     * Return size of the file in bytes.
+     * @return Size of the file in bytes.
+     */
+    size_t size() const;
+    /**
+     * Read size and modification time of a file.
+     * @param fileName File to check.
+     * @param size Size of the file.
+     * @param time Modification time of the file.
+     * @return True if the file exists.
+     */
+    static bool file_info(const char* fileName, uint64_t& size, int64_t& time);
+    /**
+     * Calculate a 64-bit hash of a memory block.
+     * @param data Memory block.
+     * @param size Size of the memory block in bytes.
+     * @param seed Initial value, allows to hash several blocks in a chain.
+     * @return Hash value.
+     */
+    static uint64_t hash(const void* data, size_t size, uint64_t seed = 0);
+    /**
+     * Make a name to write a file under before it is renamed to its final name.
+     * The name contains the process id and a counter, so processes and threads writing the same file at the same time
+     * do not write into each other's files.
+     * @param fileName Final name of the file.
+     * @return Temporary name next to the file.
+     */
+    static std::string temporary_name(const std::string& fileName);
+
+private:
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    /**
+     * Release the mapping and reset the object to an empty state.
+     */
+    void close();
+
+    /**
+     * Pointer to the mapped content.
+     */
+    const char* m_data;
+    /**
+     * Size of the mapped content in bytes.
+     */
+    size_t m_size;
+#ifdef _WIN32
+    /**
+     * Handle of the file mapping object.
+     */
+    void* m_mapping;
+#endif
+};
@@ -0,0 +1,186 @@
+#include "mesh_cache.h"
+#include "mapped_file.h"
+
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+
+packed_mesh mesh_cache::load(const char* fileName, unsigned threadCount, const std::vector< float >& lodRatios)
+{
+    // Try to use the cache.
+    uint64_t lodSettingsHash = mapped_file::hash(lodRatios.data(), lodRatios.size() * sizeof(float));
+    packed_mesh mesh;
+    if (read(fileName, lodSettingsHash, mesh)) {
+        return mesh;
+    }
+    // Parse the .obj file, simplify, optimize and pack it.
+    object obj(fileName, threadCount, true);
+    if (obj.vertexes().empty()) {
+        return packed_mesh();
+    }
+    obj.build_lods(lodRatios);
+    vertex_cache_report vertexCache = obj.optimize();
+    packed_mesh packed(obj, vertexCache);
+    // Store it for the next time. Failing to write the cache is not an error.
+    write(fileName, lodSettingsHash, packed);
+    return packed;
+}
+
+std::string mesh_cache::cache_file_name(const char* fileName)
+{
+    return std::string(fileName) + ".mesh";
+}
+
+void mesh_cache::init_header(header& result)
+{
+    memset(&result, 0, sizeof(result));
+    result.magic = MAGIC;
+    result.version = VERSION;
+    result.vertexSize = sizeof(packed_vertex);
+    // Describe the vertex layout, so a cache written with a different layout is not used.
+    result.attributes[0] = { uint16_t(offsetof(packed_vertex, position)), 4, sizeof(uint16_t) };
+    result.attributes[1] = { uint16_t(offsetof(packed_vertex, uv)), 2, sizeof(uint16_t) };
+    result.attributes[2] = { uint16_t(offsetof(packed_vertex, normal)), 2, sizeof(uint16_t) };
+    result.attributes[3] = { uint16_t(offsetof(packed_vertex, tangent)), 2, sizeof(uint16_t) };
+}
+
+bool mesh_cache::read(const char* fileName, uint64_t lodSettingsHash, packed_mesh& mesh)
+{
+    std::string cacheFileName = cache_file_name(fileName);
+    mapped_file file(cacheFileName.c_str());
+    if (file.size() < sizeof(header)) {
+        return false;
+    }
+    // Verify the format.
+    header expected;
+    init_header(expected);
+    header stored;
+    memcpy(&stored, file.data(), sizeof(header));
+    if (stored.magic != expected.magic || stored.version != expected.version || stored.vertexSize != expected.vertexSize
+            || memcmp(stored.attributes, expected.attributes, sizeof(expected.attributes)) != 0
+            || (stored.indexSize != sizeof(uint16_t) && stored.indexSize != sizeof(uint32_t))
+            || stored.lodSettingsHash != lodSettingsHash) {
+        return false;
+    }
+    // Verify that data blocks are inside the file. Sizes are checked by division to not overflow on corrupted values.
+    if (stored.lodOffset < sizeof(header) || stored.lodOffset > file.size()
+            || stored.lodCount > (file.size() - stored.lodOffset) / sizeof(lod_level)
+            || stored.vertexOffset < sizeof(header) || stored.vertexOffset > file.size() || stored.vertexOffset % DATA_ALIGNMENT != 0
+            || stored.vertexCount > (file.size() - stored.vertexOffset) / sizeof(packed_vertex)
+            || stored.indexOffset < sizeof(header) || stored.indexOffset > file.size() || stored.indexOffset % DATA_ALIGNMENT != 0
+            || stored.indexCount > (file.size() - stored.indexOffset) / stored.indexSize) {
+        return false;
+    }
+    // Verify that the .obj file has not changed. If only its time has changed, compare the content hash.
+    // If the .obj file does not exist, the cache is used on its own.
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (mapped_file::file_info(fileName, sourceSize, sourceTime) && (sourceSize != stored.sourceSize || sourceTime != stored.sourceTime)) {
+        if (sourceSize != stored.sourceSize) {
+            return false;
+        }
+        mapped_file source(fileName);
+        if (mapped_file::hash(source.data(), source.size()) != stored.sourceHash) {
+            return false;
+        }
+    }
+    // Verify the data.
+    const char* lods = file.data() + stored.lodOffset;
+    const char* vertices = file.data() + stored.vertexOffset;
+    const char* indices = file.data() + stored.indexOffset;
+    size_t lodBytes = stored.lodCount * sizeof(lod_level);
+    size_t vertexBytes = stored.vertexCount * sizeof(packed_vertex);
+    size_t indexBytes = stored.indexCount * stored.indexSize;
+    if (mapped_file::hash(indices, indexBytes, mapped_file::hash(vertices, vertexBytes, mapped_file::hash(lods, lodBytes))) != stored.dataHash) {
+        return false;
+    }
+    std::vector< lod_level > levels(stored.lodCount);
+    if (!levels.empty()) {
+        memcpy(levels.data(), lods, lodBytes);
+    }
+    for (const lod_level& level : levels) {
+        if (level.firstIndex > stored.indexCount || level.indexCount > stored.indexCount - level.firstIndex) {
+            return false;
+        }
+    }
+    // Point the mesh to the mapped data.
+    mesh.m_vertices = reinterpret_cast< const packed_vertex* >(vertices);
+    mesh.m_vertexCount = stored.vertexCount;
+    mesh.m_indices = stored.indexCount > 0 ? indices : nullptr;
+    mesh.m_indexCount = stored.indexCount;
+    mesh.m_indexSize = stored.indexSize;
+    mesh.m_lods.swap(levels);
+    mesh.m_positionOffset = glm::vec3(stored.positionOffset[0], stored.positionOffset[1], stored.positionOffset[2]);
+    mesh.m_positionScale = glm::vec3(stored.positionScale[0], stored.positionScale[1], stored.positionScale[2]);
+    mesh.m_error = stored.error;
+    mesh.m_vertexCache = stored.vertexCache;
+    mesh.m_file = std::move(file);
+    return true;
+}
+
+bool mesh_cache::write(const char* fileName, uint64_t lodSettingsHash, const packed_mesh& mesh)
+{
+    // Describe the .obj file.
+    header result;
+    init_header(result);
+    if (!mapped_file::file_info(fileName, result.sourceSize, result.sourceTime)) {
+        return false;
+    }
+    {
+        mapped_file source(fileName);
+        result.sourceHash = mapped_file::hash(source.data(), source.size());
+    }
+    // Describe the mesh.
+    size_t lodBytes = mesh.lods().size() * sizeof(lod_level);
+    size_t vertexBytes = mesh.vertex_count() * sizeof(packed_vertex);
+    size_t indexBytes = mesh.index_count() * mesh.index_size();
+    result.indexSize = uint32_t(mesh.index_size());
+    result.vertexCount = mesh.vertex_count();
+    result.indexCount = mesh.index_count();
+    result.lodCount = uint32_t(mesh.lods().size());
+    result.lodOffset = sizeof(header);
+    result.lodSettingsHash = lodSettingsHash;
+    result.vertexOffset = align(result.lodOffset + lodBytes);
+    result.indexOffset = align(result.vertexOffset + vertexBytes);
+    for (int i = 0; i < 3; i++) {
+        result.positionOffset[i] = mesh.position_offset()[i];
+        result.positionScale[i] = mesh.position_scale()[i];
+    }
+    result.error = mesh.error();
+    result.vertexCache = mesh.vertex_cache();
+    result.dataHash = mapped_file::hash(mesh.indices(), indexBytes, mapped_file::hash(mesh.vertices(), vertexBytes, mapped_file::hash(mesh.lods().data(), lodBytes)));
+    // Write the file under a temporary name.
+    std::string cacheFileName = cache_file_name(fileName);
+    std::string temporaryFileName = mapped_file::temporary_name(cacheFileName);
+    {
+        std::ofstream ofs(temporaryFileName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!ofs) {
+            return false;
+        }
+        const char padding[DATA_ALIGNMENT] = {};
+        ofs.write(reinterpret_cast< const char* >(&result), sizeof(result));
+        ofs.write(reinterpret_cast< const char* >(mesh.lods().data()), lodBytes);
+        ofs.write(padding, result.vertexOffset - result.lodOffset - lodBytes);
+        ofs.write(reinterpret_cast< const char* >(mesh.vertices()), vertexBytes);
+        ofs.write(padding, result.indexOffset - result.vertexOffset - vertexBytes);
+        ofs.write(reinterpret_cast< const char* >(mesh.indices()), indexBytes);
+        if (!ofs) {
+            ofs.close();
+            std::remove(temporaryFileName.c_str());
+            return false;
+        }
+    }
+    // Replace the old cache. Rename does not overwrite files on all platforms, so remove it first.
+    std::remove(cacheFileName.c_str());
+    if (std::rename(temporaryFileName.c_str(), cacheFileName.c_str()) != 0) {
+        std::remove(temporaryFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+uint64_t mesh_cache::align(uint64_t offset)
+{
+    return (offset + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+}
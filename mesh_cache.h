@@ -0,0 +1,147 @@
+#pragma once
+
+#include "packed_mesh.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Binary cache of packed meshes.
+ * The first load of an .obj file parses it and writes the packed mesh to a cache file next to it.
+ * Later loads map the cache file into memory, so vertices and indices go to the GPU without parsing or copying.
+ *
+ * Cache file layout:
+ * | header | levels of detail | vertices (aligned to DATA_ALIGNMENT) | indices (aligned to DATA_ALIGNMENT) |
+ * The cache is rebuilt if its version or vertex layout differs from the current one,
+ * if the .obj file or the level of detail settings have changed or if the data does not match the stored hash.
+ */
+class mesh_cache
+{
+public:
+    /**
+     * Load an indexed packed mesh of the .obj file, from the cache if it is valid.
+     * If the cache is missing or stale, parse the .obj file, build levels of detail, optimize it and write a new cache.
+     * @param fileName The .obj file.
+     * @param threadCount Number of threads to parse the .obj file with, 0 means one thread per hardware core.
+     * @param lodRatios Target sizes of levels of detail, see object::build_lods(). The cache is rebuilt if they change.
+     * @return Packed mesh. Empty if the .obj file cannot be read.
+     */
+    static packed_mesh load(const char* fileName, unsigned threadCount = 1,
+                            const std::vector< float >& lodRatios = mesh_simplifier::default_ratios());
+    /**
+     * Return name of the cache file of the .obj file.
+     * @param fileName The .obj file.
+     * @return Name of the cache file.
+     */
+    static std::string cache_file_name(const char* fileName);
+
+private:
+    /**
+     * First bytes of the cache file.
+     */
+    constexpr static uint32_t MAGIC = 0x4D584C47; // "GLXM"
+    /**
+     * Version of the cache format. Must be changed if the format or the packing changes.
+     */
+    constexpr static uint32_t VERSION = 4;
+    /**
+     * Alignment of data blocks in the cache file.
+     */
+    constexpr static uint64_t DATA_ALIGNMENT = 64;
+    /**
+     * Number of vertex attributes described in the header.
+     */
+    constexpr static int ATTRIBUTE_COUNT = 4;
+
+    /**
+     * Description of a vertex attribute.
+     */
+    struct attribute
+    {
+        /**
+         * Offset of the attribute in the packed vertex.
+         */
+        uint16_t offset;
+        /**
+         * Number of components.
+         */
+        uint8_t components;
+        /**
+         * Size of a component in bytes.
+         */
+        uint8_t componentSize;
+    };
+
+    /**
+     * Header of the cache file.
+     */
+    struct header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vertexSize;
+        uint32_t indexSize;
+        attribute attributes[ATTRIBUTE_COUNT];
+        uint64_t vertexCount;
+        uint64_t indexCount;
+        uint64_t vertexOffset;
+        uint64_t indexOffset;
+        float positionOffset[3];
+        float positionScale[3];
+        quantization_error error;
+        vertex_cache_report vertexCache;
+        uint32_t lodCount;
+        uint64_t lodOffset;
+        /**
+         * Hash of the level of detail ratios the cache was built with.
+         */
+        uint64_t lodSettingsHash;
+        /**
+         * Size of the .obj file the cache was built from.
+         */
+        uint64_t sourceSize;
+        /**
+         * Modification time of the .obj file the cache was built from.
+         */
+        int64_t sourceTime;
+        /**
+         * Hash of the .obj file content.
+         */
+        uint64_t sourceHash;
+        /**
+         * Hash of the levels of detail, vertex and index data.
+         */
+        uint64_t dataHash;
+    };
+
+    /**
+     * Fill a header with values that do not depend on the mesh.
+     * @param result Header to fill.
+     */
+    static void init_header(header& result);
+    /**
+     * Try to map the cache file and validate it against the .obj file.
+     * @param fileName The .obj file.
+     * @param lodSettingsHash Hash of the wanted level of detail ratios.
+     * @param mesh Mesh to receive the mapped data.
+     * @return True if the cache is valid.
+     */
+    static bool read(const char* fileName, uint64_t lodSettingsHash, packed_mesh& mesh);
+    /**
+     * Write the cache file of the .obj file.
+     * The file is written under a temporary name and renamed, so a partial file is never picked up.
+     * @param fileName The .obj file.
+     * @param lodSettingsHash Hash of the level of detail ratios the mesh is built with.
+     * @param mesh Mesh to store.
+     * @return True if the cache is written.
+     */
+    static bool write(const char* fileName, uint64_t lodSettingsHash, const packed_mesh& mesh);
+    /**
+     * Round up an offset to DATA_ALIGNMENT.
+     * @param offset Offset.
+     * @return Aligned offset.
+     */
+    static uint64_t align(uint64_t offset);
+};
@@ -0,0 +1,201 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <numeric>
+
+void mesh_optimizer::optimize_triangles(std::vector< uint32_t >& indices, const std::vector< glm::vec3 >& positions)
+{
+    std::vector< size_t > clusters;
+    indices = tipsify(indices, positions.size(), clusters);
+    sort_clusters(indices, positions, clusters);
+}
+
+std::vector< uint32_t > mesh_optimizer::optimize_vertex_fetch(std::vector< uint32_t >& indices, size_t vertexCount)
+{
+    const uint32_t UNUSED = UINT32_MAX;
+    std::vector< uint32_t > newIndex(vertexCount, UNUSED);
+    std::vector< uint32_t > oldIndex;
+    oldIndex.reserve(vertexCount);
+    // Number vertices in the order they are referenced by triangles.
+    for (uint32_t& index : indices) {
+        if (newIndex[index] == UNUSED) {
+            newIndex[index] = uint32_t(oldIndex.size());
+            oldIndex.push_back(index);
+        }
+        index = newIndex[index];
+    }
+    // Keep unused vertices at the end.
+    for (size_t i = 0; i < vertexCount; i++) {
+        if (newIndex[i] == UNUSED) {
+            oldIndex.push_back(uint32_t(i));
+        }
+    }
+    return oldIndex;
+}
+
+vertex_cache_statistics mesh_optimizer::analyze_vertex_cache(const std::vector< uint32_t >& indices, size_t vertexCount)
+{
+    vertex_cache_statistics result = { 0.0f, 0.0f };
+    if (indices.empty() || vertexCount == 0) {
+        return result;
+    }
+    // A vertex is in the FIFO cache if less than CACHE_SIZE vertices have been added since it was added.
+    std::vector< size_t > addedAt(vertexCount, 0);
+    size_t misses = 0;
+    for (uint32_t index : indices) {
+        if (addedAt[index] == 0 || misses - addedAt[index] >= CACHE_SIZE) {
+            misses++;
+            addedAt[index] = misses;
+        }
+    }
+    result.acmr = float(misses) / float(indices.size() / 3);
+    result.atvr = float(misses) / float(vertexCount);
+    return result;
+}
+
+std::vector< uint32_t > mesh_optimizer::tipsify(const std::vector< uint32_t >& indices, size_t vertexCount, std::vector< size_t >& clusters)
+{
+    size_t triangleCount = indices.size() / 3;
+    std::vector< uint32_t > result;
+    result.reserve(indices.size());
+    clusters.clear();
+    // Build vertex-triangle adjacency: triangles of vertex v are adjacency[offsets[v]..offsets[v + 1]).
+    std::vector< uint32_t > offsets(vertexCount + 1, 0);
+    for (uint32_t index : indices) {
+        offsets[index + 1]++;
+    }
+    std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+    std::vector< uint32_t > adjacency(indices.size());
+    std::vector< uint32_t > fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+        adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+    }
+    // Number of not yet emitted triangles of each vertex.
+    std::vector< uint32_t > liveTriangles(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        liveTriangles[v] = offsets[v + 1] - offsets[v];
+    }
+    // Time when each vertex was put to the cache.
+    std::vector< size_t > cacheTime(vertexCount, 0);
+    std::vector< bool > emitted(triangleCount, false);
+    // Stack of recently used vertices to continue from when the fanning vertex has no triangles left.
+    std::vector< uint32_t > deadEnd;
+    std::vector< uint32_t > candidates;
+    const size_t CACHE = CACHE_SIZE;
+    size_t time = CACHE + 1;
+    size_t cursor = 0;
+    long fanning = vertexCount > 0 && triangleCount > 0 ? long(indices[0]) : -1;
+    clusters.push_back(0);
+    while (fanning >= 0) {
+        // Emit all remaining triangles around the fanning vertex.
+        candidates.clear();
+        for (uint32_t k = offsets[fanning]; k < offsets[fanning + 1]; k++) {
+            uint32_t triangle = adjacency[k];
+            if (emitted[triangle]) {
+                continue;
+            }
+            for (size_t j = 0; j < 3; j++) {
+                uint32_t v = indices[triangle * 3 + j];
+                result.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                liveTriangles[v]--;
+                if (time - cacheTime[v] > CACHE) {
+                    cacheTime[v] = time;
+                    time++;
+                }
+            }
+            emitted[triangle] = true;
+        }
+        // Choose the next fanning vertex among the vertices of the emitted triangles:
+        // prefer the oldest one that will still be in the cache after its remaining triangles are emitted.
+        long next = -1;
+        long best = -1;
+        for (uint32_t v : candidates) {
+            if (liveTriangles[v] == 0) {
+                continue;
+            }
+            long priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= CACHE) {
+                priority = long(time - cacheTime[v]);
+            }
+            if (priority > best) {
+                best = priority;
+                next = v;
+            }
+        }
+        if (next < 0) {
+            // Dead end: the cache locality is lost, so a new cluster starts here.
+            while (!deadEnd.empty() && next < 0) {
+                uint32_t v = deadEnd.back();
+                deadEnd.pop_back();
+                if (liveTriangles[v] > 0) {
+                    next = v;
+                }
+            }
+            while (next < 0 && cursor < vertexCount) {
+                if (liveTriangles[cursor] > 0) {
+                    next = long(cursor);
+                }
+                cursor++;
+            }
+            if (next >= 0) {
+                clusters.push_back(result.size() / 3);
+            }
+        }
+        fanning = next;
+    }
+    return result;
+}
+
+void mesh_optimizer::sort_clusters(std::vector< uint32_t >& indices, const std::vector< glm::vec3 >& positions, const std::vector< size_t >& clusters)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (clusters.size() < 2 || triangleCount == 0) {
+        return;
+    }
+    // Calculate area-weighted center and normal of each cluster and of the whole mesh.
+    std::vector< glm::vec3 > centers(clusters.size(), glm::vec3(0.0f));
+    std::vector< glm::vec3 > normals(clusters.size(), glm::vec3(0.0f));
+    std::vector< float > areas(clusters.size(), 0.0f);
+    glm::vec3 meshCenter(0.0f);
+    float meshArea = 0.0f;
+    for (size_t c = 0; c < clusters.size(); c++) {
+        size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+        for (size_t t = clusters[c]; t < end; t++) {
+            const glm::vec3& p0 = positions[indices[t * 3]];
+            const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+            const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+            glm::vec3 center = (p0 + p1 + p2) / 3.0f;
+            centers[c] += center * area;
+            normals[c] += normal;
+            areas[c] += area;
+        }
+        meshCenter += centers[c];
+        meshArea += areas[c];
+    }
+    if (meshArea > 0.0f) {
+        meshCenter /= meshArea;
+    }
+    // Clusters that face away from the center are on the outside and are likely to occlude others.
+    std::vector< float > keys(clusters.size(), 0.0f);
+    for (size_t c = 0; c < clusters.size(); c++) {
+        float normalLength = glm::length(normals[c]);
+        if (areas[c] > 0.0f && normalLength > 0.0f) {
+            keys[c] = glm::dot(centers[c] / areas[c] - meshCenter, normals[c] / normalLength);
+        }
+    }
+    std::vector< size_t > order(clusters.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+    // Copy clusters in the new order.
+    std::vector< uint32_t > result;
+    result.reserve(indices.size());
+    for (size_t c : order) {
+        size_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+        result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + end * 3);
+    }
+    indices.swap(result);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * Vertex cache efficiency of a triangle order.
+ */
+struct vertex_cache_statistics
+{
+    /**
+     * Average cache miss ratio: transformed vertices per triangle. 0.5 is the ideal for large regular meshes, 3 is the worst.
+     */
+    float acmr;
+    /**
+     * Average transformed vertex ratio: transformed vertices per unique vertex. 1 is the ideal.
+     */
+    float atvr;
+};
+
+/**
+ * Vertex cache efficiency before and after the optimization.
+ */
+struct vertex_cache_report
+{
+    vertex_cache_statistics before;
+    vertex_cache_statistics after;
+};
+
+/**
+ * Helper class to reorder triangles and vertices of an indexed mesh for the GPU.
+ *
+ * The optimization has three steps:
+ * 1. Triangles are reordered for the post-transform vertex cache with the Tipsify algorithm.
+ *    See "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw", Sander, Nehab, Barczak, 2007.
+ * 2. Triangle clusters produced by Tipsify are sorted so outer parts of the mesh are drawn first
+ *    and hide inner ones, which reduces overdraw of the expensive fragment shader.
+ * 3. Vertices are reordered in the order of the first use, so vertex fetches go through memory linearly.
+ */
+class mesh_optimizer
+{
+public:
+    /**
+     * Size of the simulated FIFO vertex cache used for the optimization and the statistics.
+     */
+    constexpr static size_t CACHE_SIZE = 16;
+
+    /**
+     * Reorder triangles for the vertex cache and then for overdraw.
+     * @param indices Vertex indices, 3 per triangle. Reordered in place.
+     * @param positions Vertex positions, used to sort clusters.
+     */
+    static void optimize_triangles(std::vector< uint32_t >& indices, const std::vector< glm::vec3 >& positions);
+    /**
+     * Build a vertex order for linear vertex fetching and rewrite indices accordingly.
+     * Vertices that are not used by any triangle go to the end.
+     * @param indices Vertex indices. Rewritten to refer to the new vertex order.
+     * @param vertexCount Number of vertices.
+     * @return For each new vertex, the index of the old vertex to take.
+     */
+    static std::vector< uint32_t > optimize_vertex_fetch(std::vector< uint32_t >& indices, size_t vertexCount);
+    /**
+     * Simulate a FIFO vertex cache of CACHE_SIZE entries and measure its efficiency.
+     * @param indices Vertex indices, 3 per triangle.
+     * @param vertexCount Number of vertices.
+     * @return Cache statistics.
+     */
+    static vertex_cache_statistics analyze_vertex_cache(const std::vector< uint32_t >& indices, size_t vertexCount);
+
+private:
+    /**
+     * Reorder triangles with the Tipsify algorithm.
+     * @param indices Vertex indices, 3 per triangle.
+     * @param vertexCount Number of vertices.
+     * @param clusters Receives the first triangle of each cluster: a run of triangles drawn without a cache flush.
+     * @return Reordered indices.
+     */
+    static std::vector< uint32_t > tipsify(const std::vector< uint32_t >& indices, size_t vertexCount, std::vector< size_t >& clusters);
+    /**
+     * Sort clusters so the ones facing outwards from the mesh center are drawn first.
+     * @param indices Vertex indices reordered by tipsify(). Reordered in place.
+     * @param positions Vertex positions.
+     * @param clusters First triangle of each cluster.
+     */
+    static void sort_clusters(std::vector< uint32_t >& indices, const std::vector< glm::vec3 >& positions, const std::vector< size_t >& clusters);
+};
@@ -0,0 +1,442 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <iterator>
+
+constexpr uint32_t mesh_simplifier::NO_PAIR;
+
+mesh_simplifier::mesh_simplifier(const std::vector< uint32_t >& indices, const std::vector< glm::vec3 >& positions)
+    : m_positions(positions)
+    , m_indices(indices)
+    , m_quadrics(positions.size(), quadric())
+    , m_error(0.0)
+{
+    lock_vertices(indices);
+    // Each triangle adds its plane to the quadrics of its vertices, weighted by its area.
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        // Calculate the plane in double precision, large coordinates lose too much in floats.
+        const glm::vec3& p0 = m_positions[indices[i]];
+        const glm::vec3& p1 = m_positions[indices[i + 1]];
+        const glm::vec3& p2 = m_positions[indices[i + 2]];
+        double e1[3] = { double(p1.x) - p0.x, double(p1.y) - p0.y, double(p1.z) - p0.z };
+        double e2[3] = { double(p2.x) - p0.x, double(p2.y) - p0.y, double(p2.z) - p0.z };
+        double normal[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length == 0.0) {
+            continue;
+        }
+        for (int j = 0; j < 3; j++) {
+            normal[j] /= length;
+        }
+        double area = length * 0.5;
+        double d = -(normal[0] * p0.x + normal[1] * p0.y + normal[2] * p0.z);
+        quadric plane;
+        plane.a00 = normal[0] * normal[0] * area;
+        plane.a01 = normal[0] * normal[1] * area;
+        plane.a02 = normal[0] * normal[2] * area;
+        plane.a11 = normal[1] * normal[1] * area;
+        plane.a12 = normal[1] * normal[2] * area;
+        plane.a22 = normal[2] * normal[2] * area;
+        plane.b0 = normal[0] * d * area;
+        plane.b1 = normal[1] * d * area;
+        plane.b2 = normal[2] * d * area;
+        plane.c = d * d * area;
+        plane.weight = area;
+        for (size_t j = 0; j < 3; j++) {
+            add(m_quadrics[indices[i + j]], plane);
+        }
+    }
+}
+
+std::vector< uint32_t > mesh_simplifier::simplify(size_t targetIndexCount)
+{
+    for (int pass = 0; pass < MAX_PASSES && m_indices.size() > targetIndexCount; pass++) {
+        if (collapse_pass(targetIndexCount) == 0) {
+            break;
+        }
+    }
+    return m_indices;
+}
+
+float mesh_simplifier::error() const
+{
+    return float(std::sqrt(m_error));
+}
+
+std::vector< float > mesh_simplifier::default_ratios()
+{
+    return { 0.5f, 0.25f, 0.125f, 0.0625f, 0.03125f };
+}
+
+void mesh_simplifier::lock_vertices(const std::vector< uint32_t >& indices)
+{
+    size_t vertexCount = m_positions.size();
+    m_locked.assign(vertexCount, false);
+    m_pairs.assign(vertexCount, NO_PAIR);
+    // Sort vertices by position to find the ones that share a position.
+    // Vertices are unique (position, uv, normal) tuples, so a shared position means a UV or a normal seam.
+    std::vector< uint32_t > order(vertexCount);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        const glm::vec3& pa = m_positions[a];
+        const glm::vec3& pb = m_positions[b];
+        if (pa.x != pb.x) {
+            return pa.x < pb.x;
+        }
+        if (pa.y != pb.y) {
+            return pa.y < pb.y;
+        }
+        if (pa.z != pb.z) {
+            return pa.z < pb.z;
+        }
+        return a < b;
+    });
+    // Number each position by its first vertex. Two vertices with the same position are a pair on a seam,
+    // more are a corner where seams meet.
+    std::vector< uint32_t > canonical(vertexCount);
+    for (size_t begin = 0; begin < vertexCount;) {
+        size_t end = begin + 1;
+        while (end < vertexCount && m_positions[order[end]] == m_positions[order[begin]]) {
+            end++;
+        }
+        for (size_t i = begin; i < end; i++) {
+            canonical[order[i]] = order[begin];
+            m_locked[order[i]] = end - begin > 2;
+        }
+        if (end - begin == 2) {
+            m_pairs[order[begin]] = order[begin + 1];
+            m_pairs[order[begin + 1]] = order[begin];
+        }
+        begin = end;
+    }
+    // An edge between positions that is used by one triangle is a border, by more than two a non-manifold edge.
+    // All vertices at the positions of such edges are locked.
+    std::vector< uint64_t > edges;
+    edges.reserve(indices.size());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        for (size_t j = 0; j < 3; j++) {
+            uint32_t a = canonical[indices[i + j]];
+            uint32_t b = canonical[indices[i + (j + 1) % 3]];
+            if (a != b) {
+                edges.push_back(uint64_t(std::min(a, b)) << 32 | std::max(a, b));
+            }
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    std::vector< bool > lockedPositions(vertexCount, false);
+    for (size_t begin = 0; begin < edges.size();) {
+        size_t end = begin + 1;
+        while (end < edges.size() && edges[end] == edges[begin]) {
+            end++;
+        }
+        if (end - begin != 2) {
+            lockedPositions[uint32_t(edges[begin] >> 32)] = true;
+            lockedPositions[uint32_t(edges[begin])] = true;
+        }
+        begin = end;
+    }
+    // Everywhere else an edge between vertices that is used by one triangle is a seam edge.
+    // A seam goes straight through a pair if both vertices have two seam edges each, otherwise the seam ends
+    // or branches there and the pair is a corner. Vertices without a pair only touch seams at corners, removing them
+    // does not tear the seam.
+    edges.clear();
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        for (size_t j = 0; j < 3; j++) {
+            uint32_t a = indices[i + j];
+            uint32_t b = indices[i + (j + 1) % 3];
+            if (a != b) {
+                edges.push_back(uint64_t(std::min(a, b)) << 32 | std::max(a, b));
+            }
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    std::vector< uint32_t > seamEdges(vertexCount, 0);
+    for (size_t begin = 0; begin < edges.size();) {
+        size_t end = begin + 1;
+        while (end < edges.size() && edges[end] == edges[begin]) {
+            end++;
+        }
+        if (end - begin == 1) {
+            seamEdges[uint32_t(edges[begin] >> 32)]++;
+            seamEdges[uint32_t(edges[begin])]++;
+        }
+        begin = end;
+    }
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        uint32_t pair = m_pairs[v];
+        bool seam = pair != NO_PAIR && seamEdges[v] == 2 && seamEdges[pair] == 2;
+        if (lockedPositions[canonical[v]] || (pair != NO_PAIR && !seam)) {
+            m_locked[v] = true;
+        }
+    }
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        if (m_pairs[v] != NO_PAIR && (m_locked[v] || m_locked[m_pairs[v]])) {
+            m_locked[v] = true;
+            m_pairs[v] = NO_PAIR;
+        }
+    }
+}
+
+size_t mesh_simplifier::collapse_pass(size_t targetIndexCount)
+{
+    size_t vertexCount = m_positions.size();
+    size_t triangleCount = m_indices.size() / 3;
+    // Build vertex-triangle adjacency of the current mesh.
+    m_offsets.assign(vertexCount + 1, 0);
+    for (uint32_t index : m_indices) {
+        m_offsets[index + 1]++;
+    }
+    std::partial_sum(m_offsets.begin(), m_offsets.end(), m_offsets.begin());
+    m_adjacency.resize(m_indices.size());
+    std::vector< uint32_t > fill(m_offsets.begin(), m_offsets.end() - 1);
+    for (size_t i = 0; i < m_indices.size(); i++) {
+        m_adjacency[fill[m_indices[i]]++] = uint32_t(i / 3);
+    }
+    // Find the cheapest collapse of each free vertex into one of its neighbours.
+    // Vertices that the previous pass has not changed keep their collapse.
+    if (m_best.empty()) {
+        m_best.resize(vertexCount);
+        m_dirty.assign(vertexCount, true);
+    }
+    // The collapse of a seam vertex depends on the neighbourhood of its pair too.
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        if (m_pairs[v] != NO_PAIR && m_dirty[v]) {
+            m_dirty[m_pairs[v]] = true;
+        }
+    }
+    std::vector< collapse > candidates;
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        if (m_locked[v]) {
+            continue;
+        }
+        collapse& best = m_best[v];
+        if (m_dirty[v]) {
+            m_dirty[v] = false;
+            best.from = v;
+            best.to = v;
+            best.cost = 0.0f;
+            for (uint32_t k = m_offsets[v]; k < m_offsets[v + 1]; k++) {
+                const uint32_t* triangle = &m_indices[m_adjacency[k] * 3];
+                for (size_t j = 0; j < 3; j++) {
+                    uint32_t to = triangle[j];
+                    if (to == v) {
+                        continue;
+                    }
+                    float cost = float(evaluate(m_quadrics[v], m_quadrics[to], m_positions[to]));
+                    uint32_t pair = m_pairs[v];
+                    if (pair != NO_PAIR) {
+                        // Seam vertices only move along the seam, and their pairs move with them.
+                        uint32_t pairTarget = seam_target(v, to);
+                        if (pairTarget == NO_PAIR) {
+                            continue;
+                        }
+                        cost = std::max(cost, float(evaluate(m_quadrics[pair], m_quadrics[pairTarget], m_positions[pairTarget])));
+                    }
+                    if (best.to == v || cost < best.cost || (cost == best.cost && to < best.to)) {
+                        best.to = to;
+                        best.cost = cost;
+                    }
+                }
+            }
+        }
+        if (best.to != v) {
+            candidates.push_back(best);
+        }
+    }
+    if (candidates.empty()) {
+        return 0;
+    }
+    // A collapse removes about two triangles. Candidates much worse than the needed number are left
+    // for the next pass, where they may become cheaper after their neighbours have changed,
+    // so only the cheapest candidates have to be sorted.
+    auto cheaper = [](const collapse& a, const collapse& b) {
+        return a.cost < b.cost || (a.cost == b.cost && a.from < b.from);
+    };
+    size_t goal = (triangleCount - targetIndexCount / 3) / 2 + 1;
+    size_t considered = std::min(candidates.size(), goal + goal / 2 + 1);
+    std::nth_element(candidates.begin(), candidates.begin() + considered - 1, candidates.end(), cheaper);
+    std::sort(candidates.begin(), candidates.begin() + considered, cheaper);
+    // Collapse vertices whose neighbourhoods do not overlap, so each collapse is checked against the actual mesh.
+    std::vector< bool > touched(vertexCount, false);
+    std::vector< uint32_t > remap(vertexCount);
+    std::iota(remap.begin(), remap.end(), 0);
+    size_t collapses = 0;
+    size_t removedTriangles = 0;
+    for (size_t i = 0; i < considered && (triangleCount - removedTriangles) * 3 > targetIndexCount; i++) {
+        const collapse& candidate = candidates[i];
+        if (touched[candidate.from] || touched[candidate.to] || !can_collapse(candidate.from, candidate.to)) {
+            continue;
+        }
+        // A seam vertex and its pair collapse together or not at all.
+        uint32_t pair = m_pairs[candidate.from];
+        uint32_t pairTarget = NO_PAIR;
+        if (pair != NO_PAIR) {
+            pairTarget = seam_target(candidate.from, candidate.to);
+            if (pairTarget == NO_PAIR || touched[pair] || touched[pairTarget] || !can_collapse(pair, pairTarget)) {
+                continue;
+            }
+        }
+        removedTriangles += apply_collapse(candidate.from, candidate.to, candidate.cost, touched, remap);
+        if (pair != NO_PAIR) {
+            removedTriangles += apply_collapse(pair, pairTarget, candidate.cost, touched, remap);
+        }
+        collapses++;
+    }
+    // Vertices around removed ones have new neighbours.
+    for (size_t v = 0; v < vertexCount; v++) {
+        if (touched[v]) {
+            m_dirty[v] = true;
+        }
+    }
+    // Apply the collapses and drop triangles that have become degenerate.
+    std::vector< uint32_t > result;
+    result.reserve(m_indices.size());
+    for (size_t i = 0; i < m_indices.size(); i += 3) {
+        uint32_t a = remap[m_indices[i]];
+        uint32_t b = remap[m_indices[i + 1]];
+        uint32_t c = remap[m_indices[i + 2]];
+        if (a != b && b != c && a != c) {
+            result.push_back(a);
+            result.push_back(b);
+            result.push_back(c);
+        }
+    }
+    m_indices.swap(result);
+    return collapses;
+}
+
+uint32_t mesh_simplifier::seam_target(uint32_t from, uint32_t to) const
+{
+    // The edge to the neighbour is on the seam if the other triangle at its positions belongs to the other side.
+    uint32_t shared = 0;
+    for (uint32_t k = m_offsets[from]; k < m_offsets[from + 1]; k++) {
+        const uint32_t* triangle = &m_indices[m_adjacency[k] * 3];
+        shared += triangle[0] == to || triangle[1] == to || triangle[2] == to;
+    }
+    if (shared != 1) {
+        return NO_PAIR;
+    }
+    // The positions of the edge have two triangles, so the pair has exactly one neighbour at the position of the neighbour.
+    uint32_t pair = m_pairs[from];
+    for (uint32_t k = m_offsets[pair]; k < m_offsets[pair + 1]; k++) {
+        const uint32_t* triangle = &m_indices[m_adjacency[k] * 3];
+        for (size_t j = 0; j < 3; j++) {
+            if (triangle[j] != pair && m_positions[triangle[j]] == m_positions[to]) {
+                return triangle[j];
+            }
+        }
+    }
+    return NO_PAIR;
+}
+
+size_t mesh_simplifier::apply_collapse(uint32_t from, uint32_t to, float cost, std::vector< bool >& touched, std::vector< uint32_t >& remap)
+{
+    size_t removedTriangles = 0;
+    for (uint32_t k = m_offsets[from]; k < m_offsets[from + 1]; k++) {
+        const uint32_t* triangle = &m_indices[m_adjacency[k] * 3];
+        bool removed = false;
+        for (size_t j = 0; j < 3; j++) {
+            touched[triangle[j]] = true;
+            removed = removed || triangle[j] == to;
+        }
+        if (removed) {
+            removedTriangles++;
+        }
+    }
+    // Neighbours of the kept vertex see its new quadric and have to find their collapses again.
+    for (uint32_t k = m_offsets[to]; k < m_offsets[to + 1]; k++) {
+        const uint32_t* triangle = &m_indices[m_adjacency[k] * 3];
+        for (size_t j = 0; j < 3; j++) {
+            m_dirty[triangle[j]] = true;
+        }
+    }
+    remap[from] = to;
+    add(m_quadrics[to], m_quadrics[from]);
+    m_error = std::max(m_error, double(cost));
+    return removedTriangles;
+}
+
+bool mesh_simplifier::can_collapse(uint32_t from, uint32_t to) const
+{
+    // Triangles that contain both vertices disappear, the others get the new vertex and must not flip over.
+    std::vector< uint32_t > fromNeighbours;
+    std::vector< uint32_t > opposite;
+    for (uint32_t k = m_offsets[from]; k < m_offsets[from + 1]; k++) {
+        const uint32_t* triangle = &m_indices[m_adjacency[k] * 3];
+        if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+            opposite.push_back(triangle[0] ^ triangle[1] ^ triangle[2] ^ from ^ to);
+            continue;
+        }
+        glm::vec3 p[3];
+        glm::vec3 q[3];
+        for (size_t j = 0; j < 3; j++) {
+            p[j] = m_positions[triangle[j]];
+            q[j] = m_positions[triangle[j] == from ? to : triangle[j]];
+            if (triangle[j] != from) {
+                fromNeighbours.push_back(triangle[j]);
+            }
+        }
+        glm::vec3 oldNormal = glm::cross(p[1] - p[0], p[2] - p[0]);
+        glm::vec3 newNormal = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(oldNormal, newNormal) <= 0.0f && glm::dot(oldNormal, oldNormal) > 0.0f) {
+            return false;
+        }
+    }
+    // Vertices adjacent to both ends, other than the opposite ones of the removed triangles,
+    // would get two edges between the same vertices and the mesh would stop being manifold.
+    std::vector< uint32_t > toNeighbours;
+    for (uint32_t k = m_offsets[to]; k < m_offsets[to + 1]; k++) {
+        const uint32_t* triangle = &m_indices[m_adjacency[k] * 3];
+        for (size_t j = 0; j < 3; j++) {
+            if (triangle[j] != to && triangle[j] != from) {
+                toNeighbours.push_back(triangle[j]);
+            }
+        }
+    }
+    std::sort(fromNeighbours.begin(), fromNeighbours.end());
+    fromNeighbours.erase(std::unique(fromNeighbours.begin(), fromNeighbours.end()), fromNeighbours.end());
+    std::sort(toNeighbours.begin(), toNeighbours.end());
+    toNeighbours.erase(std::unique(toNeighbours.begin(), toNeighbours.end()), toNeighbours.end());
+    std::vector< uint32_t > common;
+    std::set_intersection(fromNeighbours.begin(), fromNeighbours.end(), toNeighbours.begin(), toNeighbours.end(), std::back_inserter(common));
+    for (uint32_t v : common) {
+        if (std::find(opposite.begin(), opposite.end(), v) == opposite.end()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void mesh_simplifier::add(quadric& q, const quadric& other)
+{
+    q.a00 += other.a00;
+    q.a01 += other.a01;
+    q.a02 += other.a02;
+    q.a11 += other.a11;
+    q.a12 += other.a12;
+    q.a22 += other.a22;
+    q.b0 += other.b0;
+    q.b1 += other.b1;
+    q.b2 += other.b2;
+    q.c += other.c;
+    q.weight += other.weight;
+}
+
+double mesh_simplifier::evaluate(const quadric& q1, const quadric& q2, const glm::vec3& p)
+{
+    double weight = q1.weight + q2.weight;
+    if (weight <= 0.0) {
+        return 0.0;
+    }
+    // p^T A p + 2 b^T p + c, where A is the symmetric 3x3 part of the quadric.
+    double x = p.x;
+    double y = p.y;
+    double z = p.z;
+    double result = (q1.a00 + q2.a00) * x * x + (q1.a11 + q2.a11) * y * y + (q1.a22 + q2.a22) * z * z
+            + 2.0 * ((q1.a01 + q2.a01) * x * y + (q1.a02 + q2.a02) * x * z + (q1.a12 + q2.a12) * y * z)
+            + 2.0 * ((q1.b0 + q2.b0) * x + (q1.b1 + q2.b1) * y + (q1.b2 + q2.b2) * z) + (q1.c + q2.c);
+    // Rounding can make the sum slightly negative.
+    return std::max(result, 0.0) / weight;
+}
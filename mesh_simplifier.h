@@ -0,0 +1,200 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * Level of detail of an indexed mesh: a range of the index array drawn instead of the full mesh.
+ * All levels share the same vertices.
+ */
+struct lod_level
+{
+    /**
+     * First index of the level in the index array.
+     */
+    uint32_t firstIndex;
+    /**
+     * Number of indices of the level, 3 per triangle.
+     */
+    uint32_t indexCount;
+    /**
+     * Geometric error of the level in object units: the approximate distance between
+     * the simplified surface and the full mesh. 0 for the full mesh.
+     */
+    float error;
+};
+
+/**
+ * Helper class to build coarser versions of an indexed mesh.
+ *
+ * Edges are collapsed one vertex into another in the order of the quadric error metric.
+ * See "Surface Simplification Using Quadric Error Metrics", Garland, Heckbert, 1997.
+ * A UV or normal seam is a line where two vertices share each position. A seam vertex only collapses along the seam,
+ * together with its pair on the other side, which collapses into the pair of the same neighbour, so both sides keep
+ * the same edges and no cracks appear. Corners of seams (more than two vertices with the same position, or a seam
+ * that does not go straight through) and vertices on mesh borders are locked, so silhouettes of open meshes keep
+ * their shape.
+ * Vertices only disappear, they never move, so all levels can share the vertex buffer of the full mesh.
+ *
+ * The simplifier keeps its state between calls of simplify(), so each call continues from
+ * the previous level and errors accumulate along the chain.
+ */
+class mesh_simplifier
+{
+public:
+    /**
+     * Constructor. Classify vertices and calculate their quadrics from the full mesh.
+     * @param indices Vertex indices of the full mesh, 3 per triangle.
+     * @param positions Vertex positions.
+     */
+    mesh_simplifier(const std::vector< uint32_t >& indices, const std::vector< glm::vec3 >& positions);
+    /**
+     * Continue simplification until the mesh has at most the given number of indices
+     * or no edge can be collapsed anymore.
+     * @param targetIndexCount Wanted number of indices.
+     * @return Indices of the simplified mesh.
+     */
+    std::vector< uint32_t > simplify(size_t targetIndexCount);
+    /**
+     * Return the error of the last simplified mesh.
+     * @return Geometric error in object units.
+     */
+    float error() const;
+    /**
+     * Return the default target sizes of levels of detail relative to the full mesh.
+     * Each level has half of the triangles of the previous one.
+     * @return Ratios of triangle counts.
+     */
+    static std::vector< float > default_ratios();
+
+private:
+    /**
+     * Maximal number of collapse passes of one simplify() call.
+     */
+    constexpr static int MAX_PASSES = 100;
+
+    /**
+     * Symmetric 4x4 matrix that sums squared distances to a set of planes, weighted by the plane areas.
+     */
+    struct quadric
+    {
+        double a00, a01, a02, a11, a12, a22;
+        double b0, b1, b2;
+        double c;
+        /**
+         * Sum of the plane areas.
+         */
+        double weight;
+    };
+
+    /**
+     * Marks vertices that have no pair on a seam.
+     */
+    constexpr static uint32_t NO_PAIR = UINT32_MAX;
+
+    /**
+     * Candidate collapse of a vertex into its neighbour.
+     */
+    struct collapse
+    {
+        uint32_t from;
+        uint32_t to;
+        /**
+         * Quadric error of the collapse.
+         */
+        float cost;
+    };
+
+    /**
+     * Pair the vertices of seams and lock seam corners and border vertices.
+     * @param indices Vertex indices of the full mesh.
+     */
+    void lock_vertices(const std::vector< uint32_t >& indices);
+    /**
+     * Find the vertex a seam vertex's pair collapses into when the seam vertex collapses into a neighbour.
+     * The collapse must follow the seam: the edge to the neighbour is used by one triangle of the current mesh,
+     * and the pair has an edge to a vertex at the position of the neighbour.
+     * @param from Seam vertex.
+     * @param to Neighbour of the seam vertex.
+     * @return Vertex the pair collapses into, NO_PAIR if the edge is not on the seam.
+     */
+    uint32_t seam_target(uint32_t from, uint32_t to) const;
+    /**
+     * Replace a vertex in its triangles and update the quadrics, the error and the collapse state of the pass.
+     * @param from Vertex to remove.
+     * @param to Vertex to replace it with.
+     * @param cost Quadric error of the collapse.
+     * @param touched Vertices whose triangles have changed in this pass.
+     * @param remap Vertex each vertex is replaced with.
+     * @return Number of triangles removed by the collapse.
+     */
+    size_t apply_collapse(uint32_t from, uint32_t to, float cost, std::vector< bool >& touched, std::vector< uint32_t >& remap);
+    /**
+     * Do one pass of independent collapses.
+     * @param targetIndexCount Wanted number of indices.
+     * @return Number of collapses done.
+     */
+    size_t collapse_pass(size_t targetIndexCount);
+    /**
+     * Check that replacing a vertex in its triangles keeps the surface valid:
+     * no triangle flips over and the mesh stays manifold.
+     * @param from Vertex to remove.
+     * @param to Vertex to replace it with.
+     * @return True if the collapse is allowed.
+     */
+    bool can_collapse(uint32_t from, uint32_t to) const;
+    /**
+     * Add two quadrics.
+     * @param q Quadric to add to.
+     * @param other Quadric to add.
+     */
+    static void add(quadric& q, const quadric& other);
+    /**
+     * Calculate the mean squared distance from a point to the planes of the sum of two quadrics.
+     * @param q1 First quadric.
+     * @param q2 Second quadric.
+     * @param p Point.
+     * @return Squared distance.
+     */
+    static double evaluate(const quadric& q1, const quadric& q2, const glm::vec3& p);
+
+    /**
+     * Vertex positions.
+     */
+    std::vector< glm::vec3 > m_positions;
+    /**
+     * Current vertex indices, 3 per triangle.
+     */
+    std::vector< uint32_t > m_indices;
+    /**
+     * Accumulated quadric of each vertex.
+     */
+    std::vector< quadric > m_quadrics;
+    /**
+     * Vertices that must not be removed.
+     */
+    std::vector< bool > m_locked;
+    /**
+     * The other vertex with the same position of each seam vertex, NO_PAIR for other vertices.
+     */
+    std::vector< uint32_t > m_pairs;
+    /**
+     * Triangles of each vertex: m_adjacency[m_offsets[v]..m_offsets[v + 1]).
+     */
+    std::vector< uint32_t > m_offsets;
+    std::vector< uint32_t > m_adjacency;
+    /**
+     * Cheapest collapse of each vertex found by the previous passes.
+     */
+    std::vector< collapse > m_best;
+    /**
+     * Vertices whose neighbourhood has changed since their cheapest collapse was found.
+     */
+    std::vector< bool > m_dirty;
+    /**
+     * Largest squared error of the collapses done so far.
+     */
+    double m_error;
+};
@@ -0,0 +1,214 @@
+#include "mip_generator.h"
+#include "thread_pool.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+
+int mip_generator::next_size(int size)
+{
+    return std::max(size / 2, 1);
+}
+
+std::vector< float > mip_generator::downsample(thread_pool& pool, const std::vector< float >& source, int width, int height, mip_filter filter)
+{
+    const float BOX_WEIGHTS[2] = { 0.5f, 0.5f };
+    const float* weights = filter == MIP_FILTER_KAISER ? kaiser_weights() : BOX_WEIGHTS;
+    int tapCount = filter == MIP_FILTER_KAISER ? KAISER_TAPS : 2;
+    // Taps are centered between source texels 2 * x and 2 * x + 1.
+    int firstTap = 1 - tapCount / 2;
+    std::vector< float > columns = filter_columns(pool, source, width, height, weights, tapCount, firstTap, false);
+    std::vector< float > rows = filter_columns(pool, transpose(columns, width, next_size(height)), next_size(height), width,
+                                               weights, tapCount, firstTap, false);
+    return transpose(rows, next_size(height), next_size(width));
+}
+
+std::vector< float > mip_generator::downsample_max(thread_pool& pool, const std::vector< float >& source, int width, int height)
+{
+    std::vector< float > columns = filter_columns(pool, source, width, height, nullptr, 2, 0, true);
+    std::vector< float > rows = filter_columns(pool, transpose(columns, width, next_size(height)), next_size(height), width,
+                                               nullptr, 2, 0, true);
+    return transpose(rows, next_size(height), next_size(width));
+}
+
+std::vector< float > mip_generator::downsample_min(thread_pool& pool, const std::vector< float >& source, int width, int height)
+{
+    // The minimum is the negated maximum of the negated values.
+    std::vector< float > negated(source.size());
+    std::transform(source.begin(), source.end(), negated.begin(), [](float value) { return -value; });
+    std::vector< float > result = downsample_max(pool, negated, width, height);
+    std::transform(result.begin(), result.end(), result.begin(), [](float value) { return -value; });
+    return result;
+}
+
+void mip_generator::normalize(std::vector< float >& x, std::vector< float >& y, std::vector< float >& z)
+{
+    const simd_float ZERO = simd_broadcast(0.0f);
+    const simd_float ONE = simd_broadcast(1.0f);
+    size_t count = x.size();
+    size_t i = 0;
+    for (; i + simd_float::WIDTH <= count; i += simd_float::WIDTH) {
+        simd_float vx = simd_load(&x[i]);
+        simd_float vy = simd_load(&y[i]);
+        simd_float vz = simd_load(&z[i]);
+        simd_float length = simd_sqrt(vx * vx + vy * vy + vz * vz);
+        simd_mask valid = length > ZERO;
+        simd_float inverse = ONE / simd_select(valid, length, ONE);
+        simd_store(&x[i], simd_select(valid, vx * inverse, ZERO));
+        simd_store(&y[i], simd_select(valid, vy * inverse, ZERO));
+        simd_store(&z[i], simd_select(valid, vz * inverse, ONE));
+    }
+    for (; i < count; i++) {
+        float length = std::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+        if (length > 0.0f) {
+            x[i] /= length;
+            y[i] /= length;
+            z[i] /= length;
+        } else {
+            x[i] = 0.0f;
+            y[i] = 0.0f;
+            z[i] = 1.0f;
+        }
+    }
+}
+
+float mip_generator::srgb_to_linear(uint8_t value)
+{
+    static const std::vector< float > table = []() {
+        std::vector< float > result(256);
+        for (int i = 0; i < 256; i++) {
+            double c = i / 255.0;
+            result[i] = float(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+        }
+        return result;
+    }();
+    return table[value];
+}
+
+uint8_t mip_generator::linear_to_srgb(float value)
+{
+    // Linear values where the nearest sRGB value changes from i - 1 to i.
+    static const std::vector< float > thresholds = []() {
+        std::vector< float > result(256);
+        result[0] = 0.0f;
+        for (int i = 1; i < 256; i++) {
+            double c = (i - 0.5) / 255.0;
+            result[i] = float(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+        }
+        return result;
+    }();
+    // Find the last threshold that is not above the value.
+    int result = 0;
+    for (int step = 128; step > 0; step /= 2) {
+        if (thresholds[result + step] <= value) {
+            result += step;
+        }
+    }
+    return uint8_t(result);
+}
+
+std::vector< float > mip_generator::filter_columns(thread_pool& pool, const std::vector< float >& source, int width, int height,
+                                                   const float* weights, int tapCount, int firstTap, bool maximum)
+{
+    int outHeight = next_size(height);
+    std::vector< float > result(size_t(width) * size_t(outHeight));
+    pool.parallel_for(size_t(outHeight), [&](size_t begin, size_t end) {
+        const float* rows[KAISER_TAPS + 1];
+        float rowWeights[KAISER_TAPS + 1];
+        for (size_t y = begin; y < end; y++) {
+            // Collect source rows of the taps, clamped to the plane.
+            int count = tapCount;
+            for (int tap = 0; tap < tapCount; tap++) {
+                int row = std::min(std::max(int(y) * 2 + firstTap + tap, 0), height - 1);
+                rows[tap] = &source[size_t(row) * size_t(width)];
+                rowWeights[tap] = weights ? weights[tap] : 0.0f;
+            }
+            if (tapCount == 2 && (height & 1) && int(y) == outHeight - 1) {
+                rows[count++] = &source[size_t(height - 1) * size_t(width)];
+                for (int tap = 0; tap < count; tap++) {
+                    rowWeights[tap] = 1.0f / 3.0f;
+                }
+            }
+            float* out = &result[y * size_t(width)];
+            int x = 0;
+            for (; x + simd_float::WIDTH <= width; x += simd_float::WIDTH) {
+                simd_float sum = simd_load(rows[0] + x);
+                if (maximum) {
+                    for (int tap = 1; tap < count; tap++) {
+                        sum = simd_max(sum, simd_load(rows[tap] + x));
+                    }
+                } else {
+                    sum = sum * simd_broadcast(rowWeights[0]);
+                    for (int tap = 1; tap < count; tap++) {
+                        sum = sum + simd_load(rows[tap] + x) * simd_broadcast(rowWeights[tap]);
+                    }
+                }
+                simd_store(out + x, sum);
+            }
+            for (; x < width; x++) {
+                float sum = maximum ? rows[0][x] : rows[0][x] * rowWeights[0];
+                for (int tap = 1; tap < count; tap++) {
+                    sum = maximum ? std::max(sum, rows[tap][x]) : sum + rows[tap][x] * rowWeights[tap];
+                }
+                out[x] = sum;
+            }
+        }
+    });
+    return result;
+}
+
+std::vector< float > mip_generator::transpose(const std::vector< float >& source, int width, int height)
+{
+    // Go in small tiles, so both planes are accessed in cache lines.
+    const int TILE = 16;
+    std::vector< float > result(source.size());
+    for (int y0 = 0; y0 < height; y0 += TILE) {
+        for (int x0 = 0; x0 < width; x0 += TILE) {
+            int y1 = std::min(y0 + TILE, height);
+            int x1 = std::min(x0 + TILE, width);
+            for (int y = y0; y < y1; y++) {
+                for (int x = x0; x < x1; x++) {
+                    result[size_t(x) * size_t(height) + size_t(y)] = source[size_t(y) * size_t(width) + size_t(x)];
+                }
+            }
+        }
+    }
+    return result;
+}
+
+const float* mip_generator::kaiser_weights()
+{
+    static const std::vector< float > weights = []() {
+        // Modified Bessel function of the first kind of order 0.
+        auto bessel = [](double x) {
+            double sum = 1.0;
+            double term = 1.0;
+            for (int k = 1; k < 32; k++) {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        };
+        // Taps are at half-integer distances from the center in source texels.
+        // The sinc is scaled to the output texel size, the window spans the whole filter.
+        const double PI = 3.14159265358979323846;
+        double radius = KAISER_TAPS / 2.0;
+        std::vector< double > values(KAISER_TAPS);
+        double total = 0.0;
+        for (int tap = 0; tap < KAISER_TAPS; tap++) {
+            double distance = tap - KAISER_TAPS / 2 + 0.5;
+            double x = distance / 2.0;
+            double sinc = std::sin(PI * x) / (PI * x);
+            double ratio = distance / radius;
+            double window = bessel(KAISER_ALPHA * std::sqrt(std::max(0.0, 1.0 - ratio * ratio))) / bessel(KAISER_ALPHA);
+            values[tap] = sinc * window;
+            total += values[tap];
+        }
+        std::vector< float > result(KAISER_TAPS);
+        for (int tap = 0; tap < KAISER_TAPS; tap++) {
+            result[tap] = float(values[tap] / total);
+        }
+        return result;
+    }();
+    return weights.data();
+}
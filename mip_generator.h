@@ -0,0 +1,149 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class thread_pool;
+
+/**
+ * How the shader uses the texels of a texture. Defines how mip levels are filtered.
+ */
+enum texture_usage
+{
+    /**
+     * Color in sRGB space. Filtered in linear space.
+     */
+    TEXTURE_COLOR = 0,
+    /**
+     * Normal vectors encoded as n * 0.5 + 0.5. Renormalized after filtering.
+     */
+    TEXTURE_NORMAL = 1,
+    /**
+     * Depth map for parallax mapping in R, the relaxed cone step map of level 0 is built into G, see cone_step_map.
+     * Each texel keeps the maximum depth and the minimum cone ratio of its footprint.
+     */
+    TEXTURE_DISPLACEMENT = 2
+};
+
+/**
+ * Filter used to build mip levels of color and normal textures.
+ */
+enum mip_filter
+{
+    /**
+     * Average of 2x2 texels.
+     */
+    MIP_FILTER_BOX = 0,
+    /**
+     * Kaiser-windowed sinc over 8x8 texels. Keeps mip levels sharper than the box filter.
+     */
+    MIP_FILTER_KAISER = 1
+};
+
+/**
+ * Helper class to build mip levels of textures on the CPU.
+ *
+ * Images are processed as planes of float values, one plane per channel.
+ * Each level is filtered from the previous one by a separable filter: the columns of the image are
+ * filtered and the plane is transposed twice, so both passes run the same SIMD kernel over whole rows.
+ */
+class mip_generator
+{
+public:
+    /**
+     * Calculate size of the next mip level.
+     * @param size Width or height of a level.
+     * @return Width or height of the next level.
+     */
+    static int next_size(int size);
+    /**
+     * Halve a plane with the given filter.
+     * The box filter merges an odd last row or column into the last texel, the Kaiser filter covers it anyway.
+     * @param pool Threads to filter with.
+     * @param source Source plane.
+     * @param width Width of the source plane.
+     * @param height Height of the source plane.
+     * @param filter Filter to use.
+     * @return Plane of next_size(width) x next_size(height) values.
+     */
+    static std::vector< float > downsample(thread_pool& pool, const std::vector< float >& source, int width, int height, mip_filter filter);
+    /**
+     * Halve a plane keeping the maximum of each 2x2 block of texels.
+     * An odd last row or column is merged into the last texel.
+     * @param pool Threads to filter with.
+     * @param source Source plane.
+     * @param width Width of the source plane.
+     * @param height Height of the source plane.
+     * @return Plane of next_size(width) x next_size(height) values.
+     */
+    static std::vector< float > downsample_max(thread_pool& pool, const std::vector< float >& source, int width, int height);
+    /**
+     * Halve a plane keeping the minimum of each 2x2 block of texels, see downsample_max().
+     * @param pool Threads to filter with.
+     * @param source Source plane.
+     * @param width Width of the source plane.
+     * @param height Height of the source plane.
+     * @return Plane of next_size(width) x next_size(height) values.
+     */
+    static std::vector< float > downsample_min(thread_pool& pool, const std::vector< float >& source, int width, int height);
+    /**
+     * Normalize vectors stored in three planes. Zero vectors become (0, 0, 1).
+     * @param x Plane of x components.
+     * @param y Plane of y components.
+     * @param z Plane of z components.
+     */
+    static void normalize(std::vector< float >& x, std::vector< float >& y, std::vector< float >& z);
+    /**
+     * Convert an 8-bit sRGB value to a linear value in [0, 1].
+     * @param value sRGB value.
+     * @return Linear value.
+     */
+    static float srgb_to_linear(uint8_t value);
+    /**
+     * Convert a linear value to the nearest 8-bit sRGB value.
+     * @param value Linear value, clamped to [0, 1].
+     * @return sRGB value.
+     */
+    static uint8_t linear_to_srgb(float value);
+
+private:
+    /**
+     * Number of taps of the Kaiser filter.
+     */
+    constexpr static int KAISER_TAPS = 8;
+    /**
+     * Shape parameter of the Kaiser window.
+     */
+    constexpr static double KAISER_ALPHA = 4.0;
+
+    /**
+     * Halve the height of a plane. Each output row is a weighted sum (or the maximum) of source rows
+     * 2 * y + firstTap ... 2 * y + firstTap + tapCount - 1, clamped to the plane.
+     * Two-tap filters take the odd last row into the last output row with equal weights.
+     * @param pool Threads to filter with.
+     * @param source Source plane.
+     * @param width Width of the plane.
+     * @param height Height of the source plane.
+     * @param weights Weights of the taps, ignored for the maximum.
+     * @param tapCount Number of taps.
+     * @param firstTap Offset of the first tap.
+     * @param maximum Take the maximum instead of the weighted sum.
+     * @return Plane of width x next_size(height) values.
+     */
+    static std::vector< float > filter_columns(thread_pool& pool, const std::vector< float >& source, int width, int height,
+                                               const float* weights, int tapCount, int firstTap, bool maximum);
+    /**
+     * Transpose a plane.
+     * @param source Source plane.
+     * @param width Width of the source plane.
+     * @param height Height of the source plane.
+     * @return Plane of height x width values.
+     */
+    static std::vector< float > transpose(const std::vector< float >& source, int width, int height);
+    /**
+     * Return weights of the Kaiser filter for halving.
+     * @return KAISER_TAPS weights that sum to 1.
+     */
+    static const float* kaiser_weights();
+};
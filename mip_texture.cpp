@@ -0,0 +1,219 @@
+#include "mip_texture.h"
+#include "thread_pool.h"
+#include "block_encoder.h"
+#include "cone_step_map.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+mip_texture::mip_texture(const bitmap_image& image, texture_usage usage, mip_filter filter, unsigned threadCount)
+    : m_data(nullptr)
+    , m_format(TEXTURE_FORMAT_BGR8)
+    , m_usage(usage)
+    , m_error({ 0.0f, 0.0f })
+{
+    if (!image.pixels()) {
+        return;
+    }
+    uint32_t width = uint32_t(image.width());
+    uint32_t height = uint32_t(image.height());
+    // Reserve space for the whole chain, it is a bit less than 4/3 of the first level.
+    m_storage.reserve(row_size(width) * height * 4 / 3 + 64);
+    // The first level is the image itself, only the alpha channel is dropped.
+    // Its texels are also converted to planes of values in the space the filter works in.
+    std::vector< float > planes[3];
+    for (std::vector< float >& plane : planes) {
+        plane.resize(size_t(width) * height);
+    }
+    m_storage.resize(row_size(width) * height);
+    int bytesPerPixel = image.bytes_per_pixel();
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t* source = image.row(int(y));
+        uint8_t* target = &m_storage[row_size(width) * y];
+        for (uint32_t x = 0; x < width; x++) {
+            for (int c = 0; c < 3; c++) {
+                uint8_t value = source[x * bytesPerPixel + c];
+                target[x * 3 + c] = value;
+                float& decoded = planes[c][size_t(y) * width + x];
+                if (usage == TEXTURE_COLOR) {
+                    decoded = mip_generator::srgb_to_linear(value);
+                } else if (usage == TEXTURE_NORMAL) {
+                    decoded = value / 255.0f * 2.0f - 1.0f;
+                } else {
+                    decoded = value / 255.0f;
+                }
+            }
+        }
+    }
+    m_levels.push_back({ width, height, 0, m_storage.size() });
+    thread_pool pool(threadCount);
+    if (usage == TEXTURE_DISPLACEMENT) {
+        // The depth is read from R, G is replaced by the cone step map of the depth.
+        planes[1] = cone_step_map::build(pool, planes[2], int(width), int(height));
+        for (uint32_t y = 0; y < height; y++) {
+            uint8_t* target = &m_storage[row_size(width) * y];
+            for (uint32_t x = 0; x < width; x++) {
+                target[x * 3 + 1] = uint8_t(std::round(planes[1][size_t(y) * width + x] * 255.0f));
+            }
+        }
+    }
+    // Filter each level from the previous one, the planes keep full precision between levels.
+    while (width > 1 || height > 1) {
+        for (int c = 0; c < 3; c++) {
+            std::vector< float >& plane = planes[c];
+            if (usage == TEXTURE_DISPLACEMENT && c == 1) {
+                // A coarser texel must not step farther than any texel it covers.
+                plane = mip_generator::downsample_min(pool, plane, int(width), int(height));
+            } else if (usage == TEXTURE_DISPLACEMENT) {
+                plane = mip_generator::downsample_max(pool, plane, int(width), int(height));
+            } else {
+                plane = mip_generator::downsample(pool, plane, int(width), int(height), filter);
+            }
+        }
+        width = uint32_t(mip_generator::next_size(int(width)));
+        height = uint32_t(mip_generator::next_size(int(height)));
+        if (usage == TEXTURE_NORMAL) {
+            // Averaged normals are shorter than 1, the shader expects unit vectors.
+            // Planes are in B, G, R order, that is z, y, x.
+            mip_generator::normalize(planes[2], planes[1], planes[0]);
+        }
+        append_level(planes, width, height);
+    }
+    m_data = m_storage.data();
+}
+
+mip_texture::mip_texture()
+    : m_data(nullptr)
+    , m_format(TEXTURE_FORMAT_BGR8)
+    , m_usage(TEXTURE_COLOR)
+    , m_error({ 0.0f, 0.0f })
+{
+}
+
+texture_format mip_texture::format() const
+{
+    return m_format;
+}
+
+texture_usage mip_texture::usage() const
+{
+    return m_usage;
+}
+
+const std::vector< mip_level >& mip_texture::levels() const
+{
+    return m_levels;
+}
+
+const uint8_t* mip_texture::data() const
+{
+    return m_data;
+}
+
+const uint8_t* mip_texture::level_data(size_t level) const
+{
+    return m_data + m_levels[level].offset;
+}
+
+compression_error mip_texture::error() const
+{
+    return m_error;
+}
+
+void mip_texture::compress(unsigned threadCount)
+{
+    if (m_levels.empty() || m_format != TEXTURE_FORMAT_BGR8) {
+        return;
+    }
+    texture_format format = compressed_format(m_usage);
+    // Sizes of all levels are known, so the storage is allocated once.
+    std::vector< uint8_t > storage;
+    std::vector< mip_level > levels;
+    size_t total = 0;
+    for (const mip_level& level : m_levels) {
+        total += level_size(format, level.width, level.height);
+    }
+    storage.resize(total);
+    thread_pool pool(threadCount);
+    double squaredError = 0.0;
+    double valueCount = 0.0;
+    uint64_t offset = 0;
+    for (size_t i = 0; i < m_levels.size(); i++) {
+        const mip_level& source = m_levels[i];
+        mip_level level = { source.width, source.height, offset, level_size(format, source.width, source.height) };
+        const uint8_t* texels = level_data(i);
+        size_t stride = row_size(source.width);
+        uint8_t* blocks = &storage[offset];
+        double texelCount = double(source.width) * source.height;
+        if (format == TEXTURE_FORMAT_BC1) {
+            squaredError += block_encoder::encode_bc1(pool, texels, stride, source.width, source.height, blocks);
+            valueCount += texelCount * 3;
+        } else if (format == TEXTURE_FORMAT_BC5) {
+            squaredError += block_encoder::encode_bc5(pool, texels, stride, source.width, source.height, blocks);
+            valueCount += texelCount * 2;
+        } else {
+            squaredError += block_encoder::encode_bc4(pool, texels, stride, source.width, source.height, 2, blocks);
+            valueCount += texelCount;
+        }
+        levels.push_back(level);
+        offset += level.size;
+    }
+    double rmse = std::sqrt(squaredError / valueCount);
+    m_error.rmse = float(rmse);
+    m_error.psnr = rmse > 0.0 ? float(20.0 * std::log10(255.0 / rmse)) : std::numeric_limits< float >::infinity();
+    // Replace the texels, the texture may have been mapped from a cache file.
+    m_storage.swap(storage);
+    m_levels.swap(levels);
+    m_file = mapped_file();
+    m_data = m_storage.data();
+    m_format = format;
+}
+
+texture_format mip_texture::compressed_format(texture_usage usage)
+{
+    return usage == TEXTURE_COLOR ? TEXTURE_FORMAT_BC1 : TEXTURE_FORMAT_BC5;
+}
+
+size_t mip_texture::level_size(texture_format format, uint32_t width, uint32_t height)
+{
+    size_t blocks = size_t(block_encoder::block_count(width)) * block_encoder::block_count(height);
+    switch (format) {
+    case TEXTURE_FORMAT_BC1:
+        return blocks * block_encoder::BC1_BLOCK_SIZE;
+    case TEXTURE_FORMAT_BC4:
+        return blocks * block_encoder::BC4_BLOCK_SIZE;
+    case TEXTURE_FORMAT_BC5:
+        return blocks * block_encoder::BC5_BLOCK_SIZE;
+    default:
+        return row_size(width) * height;
+    }
+}
+
+size_t mip_texture::row_size(uint32_t width)
+{
+    return (size_t(width) * 3 + 3) / 4 * 4;
+}
+
+void mip_texture::append_level(const std::vector< float >* planes, uint32_t width, uint32_t height)
+{
+    mip_level level = { width, height, m_storage.size(), row_size(width) * height };
+    m_storage.resize(m_storage.size() + level.size);
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t* target = &m_storage[level.offset + row_size(width) * y];
+        for (uint32_t x = 0; x < width; x++) {
+            for (int c = 0; c < 3; c++) {
+                float value = planes[c][size_t(y) * width + x];
+                if (m_usage == TEXTURE_COLOR) {
+                    target[x * 3 + c] = mip_generator::linear_to_srgb(value);
+                } else {
+                    if (m_usage == TEXTURE_NORMAL) {
+                        value = value * 0.5f + 0.5f;
+                    }
+                    target[x * 3 + c] = uint8_t(std::round(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+                }
+            }
+        }
+    }
+    m_levels.push_back(level);
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "bitmap_image.h"
+#include "mip_generator.h"
+#include "mapped_file.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Format of texels of a mip_texture.
+ */
+enum texture_format
+{
+    /**
+     * 3 bytes per texel: B, G, R. Rows are padded to 4 bytes, the default GL_UNPACK_ALIGNMENT.
+     */
+    TEXTURE_FORMAT_BGR8 = 0,
+    /**
+     * BC1 blocks of B, G, R texels, 8 bytes per 4x4 texels.
+     */
+    TEXTURE_FORMAT_BC1 = 1,
+    /**
+     * BC4 blocks of the R channel, 8 bytes per 4x4 texels.
+     */
+    TEXTURE_FORMAT_BC4 = 2,
+    /**
+     * BC5 blocks of the R and G channels, 16 bytes per 4x4 texels.
+     */
+    TEXTURE_FORMAT_BC5 = 3
+};
+
+/**
+ * Error of compressed texels against the uncompressed ones, over all levels.
+ */
+struct compression_error
+{
+    /**
+     * Root mean square error of the stored channels in 8-bit units.
+     */
+    float rmse;
+    /**
+     * Peak signal to noise ratio in dB, infinite if there is no error.
+     */
+    float psnr;
+};
+
+/**
+ * Description of one mip level of a texture.
+ */
+struct mip_level
+{
+    /**
+     * Width of the level in texels.
+     */
+    uint32_t width;
+    /**
+     * Height of the level in texels.
+     */
+    uint32_t height;
+    /**
+     * Offset of the level in the texture data in bytes.
+     */
+    uint64_t offset;
+    /**
+     * Size of the level in bytes.
+     */
+    uint64_t size;
+};
+
+/**
+ * Texture with the full chain of mip levels, from the original image down to 1x1 texel.
+ * Levels are built on the CPU with mip_generator according to the texture usage,
+ * so they can be uploaded level by level without glGenerateMipmap.
+ * Rows go from the bottom of the image to the top, the order OpenGL expects.
+ * Levels can be compressed into 4x4 texel blocks with block_encoder after they are built.
+ */
+class mip_texture
+{
+public:
+    /**
+     * Constructor. Build mip levels of the image.
+     * @param image Source image, it becomes level 0. Only G of displacement textures is replaced by the cone step map.
+     * @param usage How the texture is used, defines how levels are filtered.
+     * @param filter Filter for color and normal textures. Displacement textures always keep the maximum depth
+     *               and the minimum cone ratio.
+     * @param threadCount Number of threads to filter with, 0 means one thread per hardware core.
+     */
+    mip_texture(const bitmap_image& image, texture_usage usage, mip_filter filter = MIP_FILTER_KAISER, unsigned threadCount = 1);
+    /**
+     * Constructor. Create an empty texture.
+     */
+    mip_texture();
+    /**
+     * Return format of the texels.
+     * @return Texel format.
+     */
+    texture_format format() const;
+    /**
+     * Return how the texture is used.
+     * @return Texture usage.
+     */
+    texture_usage usage() const;
+    /**
+     * Return mip levels, level 0 is the full size image.
+     * @return Mip levels, empty if the texture is empty.
+     */
+    const std::vector< mip_level >& levels() const;
+    /**
+     * Return a pointer to the data of all levels.
+     * @return Texture data.
+     */
+    const uint8_t* data() const;
+    /**
+     * Return a pointer to the texels of a level.
+     * @param level Level number.
+     * @return Texels of the level.
+     */
+    const uint8_t* level_data(size_t level) const;
+    /**
+     * Return error of the compression.
+     * @return Compression error, zero if the texture is not compressed.
+     */
+    compression_error error() const;
+    /**
+     * Compress all levels into the block format of the texture usage, see compressed_format().
+     * Does nothing if the texture is empty or already compressed.
+     * @param threadCount Number of threads to compress with, 0 means one thread per hardware core.
+     */
+    void compress(unsigned threadCount = 1);
+    /**
+     * Return the block format for a texture usage.
+     * Color textures use BC1, normal textures keep x and y in BC5 and displacement textures keep the depth and
+     * the cone step map in BC5.
+     * @param usage Texture usage.
+     * @return Compressed texel format.
+     */
+    static texture_format compressed_format(texture_usage usage);
+    /**
+     * Return size of a level in bytes.
+     * @param format Texel format.
+     * @param width Width of the level in texels.
+     * @param height Height of the level in texels.
+     * @return Level size.
+     */
+    static size_t level_size(texture_format format, uint32_t width, uint32_t height);
+    /**
+     * Return size of a row of TEXTURE_FORMAT_BGR8 texels in bytes.
+     * @param width Width of the row in texels.
+     * @return Row size padded to 4 bytes.
+     */
+    static size_t row_size(uint32_t width);
+
+private:
+    /**
+     * texture_cache stores the levels in files and maps them back.
+     */
+    friend class texture_cache;
+
+    /**
+     * Convert planes of filtered values back to texels and append them as a new level.
+     * @param planes Planes of B, G and R values.
+     * @param width Width of the level.
+     * @param height Height of the level.
+     */
+    void append_level(const std::vector< float >* planes, uint32_t width, uint32_t height);
+
+    /**
+     * Storage of texels if the texture is built from an image.
+     */
+    std::vector< uint8_t > m_storage;
+    /**
+     * Mapped cache file if the texture is loaded from a cache.
+     */
+    mapped_file m_file;
+    /**
+     * Pointer to texels inside one of the storages.
+     */
+    const uint8_t* m_data;
+    /**
+     * Mip levels.
+     */
+    std::vector< mip_level > m_levels;
+    /**
+     * Texel format.
+     */
+    texture_format m_format;
+    /**
+     * Texture usage.
+     */
+    texture_usage m_usage;
+    /**
+     * Compression error.
+     */
+    compression_error m_error;
+};
@@ -1,24 +1,337 @@
 #include "object.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "tangent_space.h"
 
-object::object(const char* fileName) {
-    // Open the file.
-    std::ifstream ifs(fileName);
-    if (!ifs) {
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <climits>
+
+object::object(const char* fileName, unsigned threadCount, bool indexed) {
+    // Map the file into memory. The parser reads the content in place without copying it.
+    mapped_file file(fileName);
+    if (!file.data()) {
+        return;
+    }
+    thread_pool pool(threadCount);
+    // Split the file into chunks that start and end at line boundaries and parse them in parallel.
+    // Each chunk collects its own arrays, so the workers do not share any state.
+    const char* fileBegin = file.data();
+    const char* fileEnd = file.data() + file.size();
+    std::vector< const char* > bounds(pool.size() + 1, fileEnd);
+    bounds[0] = fileBegin;
+    for (size_t i = 1; i < pool.size(); i++) {
+        const char* bound = fileBegin + file.size() * i / pool.size();
+        if (bound < bounds[i - 1]) {
+            bound = bounds[i - 1];
+        }
+        // Move the bound right after the next line break.
+        const char* lineEnd = static_cast< const char* >(memchr(bound, '\n', fileEnd - bound));
+        bounds[i] = lineEnd ? lineEnd + 1 : fileEnd;
+    }
+    std::vector< parsed_chunk > chunks(pool.size());
+    pool.parallel_for(chunks.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            parse_range(bounds[i], bounds[i + 1], chunks[i]);
+        }
+    });
+    // Merge chunks in the file order. Positive indices in the file are global (counted from the beginning of the file),
+    // so after concatenation they refer to the right elements without any changes. Relative ones are moved by the offset
+    // of their chunk.
+    // Each chunk is copied to its offset in the merged arrays.
+    parsed_chunk merged;
+    if (chunks.size() == 1) {
+        merged = std::move(chunks[0]);
+    } else {
+        merge_chunks(pool, chunks, merged);
+    }
+    remove_invalid_faces(merged);
+    // Build vertex arrays.
+    if (indexed) {
+        build_indexed(pool, merged);
+    } else {
+        build_unindexed(pool, merged);
+    }
+}
+
+void object::build_unindexed(thread_pool& pool, const parsed_chunk& merged)
+{
+    const std::vector< glm::vec3 >& vertices = merged.vertices;
+    const std::vector< glm::vec2 >& uvs = merged.uvs;
+    const std::vector< glm::vec3 >& normals = merged.normals;
+    const std::vector< int >& vertexIndices = merged.vertexIndices;
+    const std::vector< int >& uvIndices = merged.uvIndices;
+    const std::vector< int >& normalIndices = merged.normalIndices;
+    // Now we have arrays that represent unique vertices, uvs, normals and index arrays
+    // that refer to the corresponding values for each point.
+    // We should create vertex, uvs and normal arrays for each point in each face.
+    // Note that although the same vertex can be used in different faces it does not mean
+    // that tuples of (vertex, uv, normal) are the same.
+    // For optimization purposes it makes sense to only keep unique tuples and address them using indices
+    // which is what build_indexed() does. Here every point gets its own copy of the data.
+    // Every output element depends only on its own input, so the work is split between threads
+    // and the result is the same for any number of threads.
+    size_t pointCount = vertexIndices.size();
+    m_vertices.resize(pointCount);
+    m_uvs.resize(pointCount);
+    m_normals.resize(pointCount);
+    pool.parallel_for(pointCount, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            m_vertices[i] = vertices[vertexIndices[i]];
+            m_uvs[i] = uvs[uvIndices[i]];
+            m_normals[i] = normals[normalIndices[i]];
+        }
+    });
+    // Calculate tangents and bitangents using vertex, uv and normal buffers.
+    // Process each triangle, so 3 vertices.
+    // In order to be able to jump from the world to texture coordinate system we can use TBN matrix which is
+    // | Tx Bx Nx |
+    // | Ty By Ny |
+    // | Tz Bz Nz |
+    // where T - tangent, B - bitangent, N - normal.
+    // TBN matrix is orthogonal because this is a rotation matrix, however during calculations we may
+    // introduce precision errors and the particular TBN matrix may become not orthogonal anymore.
+    // To fix this tangent_space applies Gramm-Schmidt process for mathrix orthogonalization in the same pass.
+    // See https://en.wikipedia.org/wiki/Gram%E2%80%93Schmidt_process
+    m_tangents.resize(pointCount);
+    m_bitangents.resize(pointCount);
+    pool.parallel_for(pointCount / 3, [&](size_t begin, size_t end) {
+        tangent_space::compute_points(&m_vertices[begin * 3], &m_uvs[begin * 3], &m_normals[begin * 3], end - begin,
+                                      &m_tangents[begin * 3], &m_bitangents[begin * 3]);
+    });
+}
+
+void object::build_indexed(thread_pool& pool, const parsed_chunk& merged)
+{
+    const std::vector< glm::vec3 >& vertices = merged.vertices;
+    const std::vector< glm::vec2 >& uvs = merged.uvs;
+    const std::vector< glm::vec3 >& normals = merged.normals;
+    const std::vector< int >& vertexIndices = merged.vertexIndices;
+    const std::vector< int >& uvIndices = merged.uvIndices;
+    const std::vector< int >& normalIndices = merged.normalIndices;
+    size_t pointCount = vertexIndices.size();
+    // Find unique (vertex, uv, normal) tuples using an open addressing hash table.
+    // The table stores numbers of unique tuples, the first point that used a tuple keeps its key.
+    // Unique vertices are numbered in the order of the first use, so the result is deterministic.
+    size_t capacity = 16;
+    while (capacity < pointCount * 2) {
+        capacity *= 2;
+    }
+    const uint32_t EMPTY = UINT32_MAX;
+    std::vector< uint32_t > table(capacity, EMPTY);
+    std::vector< uint32_t > firstPoint;
+    firstPoint.reserve(pointCount / 2);
+    m_indices.resize(pointCount);
+    for (size_t i = 0; i < pointCount; i++) {
+        uint32_t v = uint32_t(vertexIndices[i]);
+        uint32_t t = uint32_t(uvIndices[i]);
+        uint32_t n = uint32_t(normalIndices[i]);
+        // Mix the three indices into a hash.
+        uint64_t hash = (uint64_t(v) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(t) * 0xC2B2AE3D27D4EB4Full) ^ (uint64_t(n) * 0x165667B19E3779F9ull);
+        hash ^= hash >> 29;
+        size_t slot = size_t(hash) & (capacity - 1);
+        while (true) {
+            uint32_t unique = table[slot];
+            if (unique == EMPTY) {
+                // New tuple.
+                unique = uint32_t(firstPoint.size());
+                table[slot] = unique;
+                firstPoint.push_back(uint32_t(i));
+                m_indices[i] = unique;
+                break;
+            }
+            uint32_t point = firstPoint[unique];
+            if (uint32_t(vertexIndices[point]) == v && uint32_t(uvIndices[point]) == t && uint32_t(normalIndices[point]) == n) {
+                // Known tuple.
+                m_indices[i] = unique;
+                break;
+            }
+            slot = (slot + 1) & (capacity - 1);
+        }
+    }
+    // Copy data of unique vertices.
+    size_t uniqueCount = firstPoint.size();
+    m_vertices.resize(uniqueCount);
+    m_uvs.resize(uniqueCount);
+    m_normals.resize(uniqueCount);
+    pool.parallel_for(uniqueCount, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t point = firstPoint[i];
+            m_vertices[i] = vertices[vertexIndices[point]];
+            m_uvs[i] = uvs[uvIndices[point]];
+            m_normals[i] = normals[normalIndices[point]];
+        }
+    });
+    // The full mesh is the first level of detail.
+    m_lods.assign(1, lod_level{ 0, uint32_t(m_indices.size()), 0.0f });
+    // Calculate tangents and bitangents of each triangle the same way build_unindexed() does.
+    size_t triangleCount = pointCount / 3;
+    std::vector< glm::vec3 > triangleTangents(triangleCount);
+    std::vector< glm::vec3 > triangleBitangents(triangleCount);
+    pool.parallel_for(triangleCount, [&](size_t begin, size_t end) {
+        tangent_space::compute_triangles(m_vertices.data(), m_uvs.data(), &m_indices[begin * 3], end - begin,
+                                         &triangleTangents[begin], &triangleBitangents[begin]);
+    });
+    // A vertex shared by several triangles gets the sum of their tangents and bitangents.
+    // Triangles are added in their order, so the sums do not depend on the number of threads.
+    // Triangles with degenerate UVs have zero vectors and do not spoil their neighbours.
+    m_tangents.assign(uniqueCount, glm::vec3(0.0f));
+    m_bitangents.assign(uniqueCount, glm::vec3(0.0f));
+    for (size_t i = 0; i < triangleCount; i++) {
+        for (size_t j = 0; j < 3; j++) {
+            m_tangents[m_indices[i * 3 + j]] += triangleTangents[i];
+            m_bitangents[m_indices[i * 3 + j]] += triangleBitangents[i];
+        }
+    }
+    // Normalize the sums and apply Gramm-Schmidt process like build_unindexed() does.
+    pool.parallel_for(uniqueCount, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            tangent_space::orthogonalize(m_normals[i], m_tangents[i], m_bitangents[i]);
+        }
+    });
+}
+
+const std::vector< glm::vec3 >& object::vertexes() const
+{
+    return m_vertices;
+}
+
+const std::vector< glm::vec2 >& object::uvs() const
+{
+    return m_uvs;
+}
+
+const std::vector< glm::vec3 >& object::normals() const
+{
+    return m_normals;
+}
+
+std::vector< glm::vec3 > object::tangents() const
+{
+    return m_tangents;
+}
+
+std::vector< glm::vec3 > object::bitangents() const
+{
+    return m_bitangents;
+}
+
+const std::vector< uint32_t >& object::indices() const
+{
+    return m_indices;
+}
+
+const std::vector< lod_level >& object::lods() const
+{
+    return m_lods;
+}
+
+vertex_cache_report object::optimize()
+{
+    vertex_cache_report report;
+    if (m_indices.empty()) {
+        report.before = mesh_optimizer::analyze_vertex_cache(m_indices, m_vertices.size());
+        report.after = report.before;
+        return report;
+    }
+    // Reorder triangles of each level of detail separately, so levels stay contiguous ranges.
+    for (size_t i = 0; i < m_lods.size(); i++) {
+        std::vector< uint32_t >::iterator begin = m_indices.begin() + m_lods[i].firstIndex;
+        std::vector< uint32_t > levelIndices(begin, begin + m_lods[i].indexCount);
+        if (i == 0) {
+            report.before = mesh_optimizer::analyze_vertex_cache(levelIndices, m_vertices.size());
+        }
+        mesh_optimizer::optimize_triangles(levelIndices, m_vertices);
+        std::copy(levelIndices.begin(), levelIndices.end(), begin);
+    }
+    // Reorder vertices to follow the new triangle order. The full mesh goes first, so it is fetched linearly.
+    std::vector< uint32_t > order = mesh_optimizer::optimize_vertex_fetch(m_indices, m_vertices.size());
+    std::vector< glm::vec3 > vertices(order.size());
+    std::vector< glm::vec2 > uvs(order.size());
+    std::vector< glm::vec3 > normals(order.size());
+    std::vector< glm::vec3 > tangents(order.size());
+    std::vector< glm::vec3 > bitangents(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        vertices[i] = m_vertices[order[i]];
+        uvs[i] = m_uvs[order[i]];
+        normals[i] = m_normals[order[i]];
+        tangents[i] = m_tangents[order[i]];
+        bitangents[i] = m_bitangents[order[i]];
+    }
+    m_vertices.swap(vertices);
+    m_uvs.swap(uvs);
+    m_normals.swap(normals);
+    m_tangents.swap(tangents);
+    m_bitangents.swap(bitangents);
+    std::vector< uint32_t > fullIndices(m_indices.begin(), m_indices.begin() + m_lods[0].indexCount);
+    report.after = mesh_optimizer::analyze_vertex_cache(fullIndices, m_vertices.size());
+    return report;
+}
+
+void object::build_lods(const std::vector< float >& ratios)
+{
+    if (m_lods.empty()) {
         return;
     }
-    // Prepare arrays for inexed vertices, uvs and normals.
-    std::vector< glm::vec3 > vertices;
-    std::vector< glm::vec2 > uvs;
-    std::vector< glm::vec3 > normals;
-    std::vector< int > vertexIndices;
-    std::vector< int > uvIndices;
-    std::vector< int > normalIndices;
-    // Read the file line by line.
-    std::string line;
-    while (ifs) {
-        getline(ifs, line);
+    // Drop levels built before and simplify the full mesh step by step.
+    size_t fullCount = m_lods[0].indexCount;
+    m_indices.resize(fullCount);
+    m_lods.resize(1);
+    mesh_simplifier simplifier(m_indices, m_vertices);
+    for (float ratio : ratios) {
+        size_t target = size_t(double(fullCount / 3) * ratio) * 3;
+        std::vector< uint32_t > level = simplifier.simplify(target);
+        if (level.empty() || level.size() > m_lods.back().indexCount * MAX_LOD_SIZE_RATIO) {
+            break;
+        }
+        m_lods.push_back(lod_level{ uint32_t(m_indices.size()), uint32_t(level.size()), simplifier.error() });
+        m_indices.insert(m_indices.end(), level.begin(), level.end());
+    }
+}
+
+size_t object::index_size() const
+{
+    // 16-bit indices are enough to address up to 65536 vertices.
+    return m_vertices.size() <= 0x10000 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+std::vector< uint8_t > object::index_buffer() const
+{
+    std::vector< uint8_t > buffer(m_indices.size() * index_size());
+    if (index_size() == sizeof(uint16_t)) {
+        uint16_t* shortIndices = reinterpret_cast< uint16_t* >(buffer.data());
+        for (size_t i = 0; i < m_indices.size(); i++) {
+            shortIndices[i] = uint16_t(m_indices[i]);
+        }
+    } else if (!m_indices.empty()) {
+        memcpy(buffer.data(), m_indices.data(), buffer.size());
+    }
+    return buffer;
+}
+
+void object::parse_range(const char* begin, const char* end, parsed_chunk& chunk)
+{
+    // Tokens of the current line and of the current face vertex.
+    // They point into the mapped file, so no memory is allocated per line.
+    token tokens[MAX_TOKENS];
+    token entries[MAX_TOKENS];
+    // Read the range line by line.
+    const char* lineBegin = begin;
+    while (lineBegin < end) {
+        // Find the end of the line.
+        const char* lineEnd = static_cast< const char* >(memchr(lineBegin, '\n', end - lineBegin));
+        if (!lineEnd) {
+            lineEnd = end;
+        }
+        const char* line = lineBegin;
+        size_t lineLength = lineEnd - lineBegin;
+        // The last line may have no line break, do not step past the end of the range.
+        lineBegin = lineEnd < end ? lineEnd + 1 : end;
         // Skip empty or invalid lines.
-        if (line.length() < 3) {
+        if (lineLength < 3) {
             continue;
         }
         // Parse vertices (start with 'v ').
@@ -26,177 +339,271 @@ object::object(const char* fileName) {
             // Vertex has the following format:
             // v [x] [y] [z] [w]
             // where [w] is optional.
-            std::vector< std::string > tokens = split_string(line);
-            if (tokens.size() != 4 && tokens.size() != 5) {
+            size_t tokenCount = split_range(line, lineEnd, ' ', tokens);
+            if (tokenCount != 4 && tokenCount != 5) {
                 // Skip malfomred lines.
                 continue;
             }
             // Add the vertex.
-            float x = std::stof(tokens[1].c_str());
-            float y = std::stof(tokens[2].c_str());
-            float z = std::stof(tokens[3].c_str());
-            vertices.push_back({ x, y, z });
+            float x, y, z;
+            if (!parse_float(tokens[1], x) || !parse_float(tokens[2], y) || !parse_float(tokens[3], z)) {
+                // Skip malfomred lines.
+                continue;
+            }
+            chunk.vertices.push_back({ x, y, z });
         }
         // Parse UV (start with 'vt ').
         if (line[0] == 'v' && line[1] == 't' && line[2] == ' ') {
             // UV has the following format:
             // vt [u] [v] [w]
             // where [w] is optional.
-            std::vector< std::string > tokens = split_string(line);
-            if (tokens.size() != 3 && tokens.size() != 4) {
+            size_t tokenCount = split_range(line, lineEnd, ' ', tokens);
+            if (tokenCount != 3 && tokenCount != 4) {
                 // Skip malfomred lines.
                 continue;
             }
             // Add the UV token.
-            float u = std::stof(tokens[1].c_str());
-            float v = std::stof(tokens[2].c_str());
-            uvs.push_back({ u, v });
+            float u, v;
+            if (!parse_float(tokens[1], u) || !parse_float(tokens[2], v)) {
+                // Skip malfomred lines.
+                continue;
+            }
+            chunk.uvs.push_back({ u, v });
         }
         // Parse normals (start with 'vn ').
         if (line[0] == 'v' && line[1] == 'n' && line[2] == ' ') {
             // Normals have the following format:
             // vn [x] [y] [z]
-            std::vector< std::string > tokens = split_string(line);
-            if (tokens.size() != 4) {
+            size_t tokenCount = split_range(line, lineEnd, ' ', tokens);
+            if (tokenCount != 4) {
                 // Skip malfomred lines.
                 continue;
             }
             // Add the normal.
-            float x = std::stof(tokens[1].c_str());
-            float y = std::stof(tokens[2].c_str());
-            float z = std::stof(tokens[3].c_str());
-
-            normals.push_back(glm::normalize(glm::vec3{ x, y, z }));
+            float x, y, z;
+            if (!parse_float(tokens[1], x) || !parse_float(tokens[2], y) || !parse_float(tokens[3], z)) {
+                // Skip malfomred lines.
+                continue;
+            }
+            chunk.normals.push_back(glm::normalize(glm::vec3{ x, y, z }));
         }
         // Parse faces (start with 'f ').
         if (line[0] == 'f' && line[1] == ' ') {
             // Faces have the following format:
             // f [vertexIndex]/[uvIndex]/[normalIndex] [vertexIndex]/[uvIndex]/[normalIndex] [vertexIndex]/[uvIndex]/[normalIndex]
-            std::vector< std::string > tokens = split_string(line);
-            if (tokens.size() != 4) {
+            size_t tokenCount = split_range(line, lineEnd, ' ', tokens);
+            if (tokenCount != 4) {
                 // Skip malfomred lines.
                 continue;
             }
             // Parce each vertex of the triangle.
-            for (size_t i = 1; i < tokens.size(); i++) {
-                std::string vertex = tokens[i];
-                std::vector< std::string > entries = split_string(vertex, '/');
+            // The whole face is parsed first so a malformed vertex does not leave a partial triangle.
+            int face[9];
+            bool valid = true;
+            for (size_t i = 1; i < tokenCount && valid; i++) {
+                size_t entryCount = split_range(tokens[i].begin, tokens[i].end, '/', entries);
+                valid = entryCount >= 3
+                     && parse_int(entries[0], face[(i - 1) * 3])
+                     && parse_int(entries[1], face[(i - 1) * 3 + 1])
+                     && parse_int(entries[2], face[(i - 1) * 3 + 2]);
+            }
+            if (!valid) {
+                // Skip malfomred lines.
+                continue;
+            }
+            // Indices start from 1, negative ones count back from the last element read so far.
+            // Index 0 becomes -1 and is rejected with the other invalid indices after merging.
+            size_t counts[3] = { chunk.vertices.size(), chunk.uvs.size(), chunk.normals.size() };
+            for (size_t i = 0; i < 9; i++) {
+                if (face[i] < 0) {
+                    chunk.relativeIndices.push_back(chunk.vertexIndices.size() * 3 + i);
+                    face[i] += int(counts[i % 3]);
+                } else {
+                    face[i] -= 1;
+                }
+            }
+            for (size_t i = 0; i < 9; i += 3) {
                 // Save vertex index.
-                int vertexIndex = std::stoi(entries[0]) - 1;
-                vertexIndices.push_back(vertexIndex);
+                chunk.vertexIndices.push_back(face[i]);
                 // Save UV index.
-                int uvIndex = std::stoi(entries[1]) - 1;
-                uvIndices.push_back(uvIndex);
+                chunk.uvIndices.push_back(face[i + 1]);
                 // Save normal index.
-                int normalIndex = std::stoi(entries[2]) - 1;
-                normalIndices.push_back(normalIndex);
+                chunk.normalIndices.push_back(face[i + 2]);
             }
         }
     }
-    // Now we have arrays that represent unique vertices, uvs, normals and index arrays
-    // that refer to the corresponding values for each point.
-    // We should create vertex, uvs and normal arrays for each point in each face.
-    // Note that although the same vertex can be used in different faces it does not mean
-    // that tuples of (vertex, uv, normal) are the same.
-    // For optimization purposes it makes sense to only keep unique tuples and address them using indices.
-    // However in this example we use unindexed buffers.
-    for (size_t index : vertexIndices) {
-        m_vertices.push_back(vertices[index]);
-    }
-    for (auto index : uvIndices) {
-        m_uvs.push_back(uvs[index]);
-    }
-    for (auto index : normalIndices) {
-        m_normals.push_back(normals[index]);
-    }
-    // Calculate tangents and bitangents using vertex, uv and normal buffers.
-    // Process each triangle, so 3 vertices.
-    for (size_t i = 0; i < vertexIndices.size(); i += 3) {
-        // Extract vertices.
-        glm::vec3 v0 = vertices[vertexIndices[i]];
-        glm::vec3 v1 = vertices[vertexIndices[i + 1]];
-        glm::vec3 v2 = vertices[vertexIndices[i + 2]];
-        // Extract UV coordinates.
-        glm::vec2 uv0 = uvs[uvIndices[i]];
-        glm::vec2 uv1 = uvs[uvIndices[i + 1]];
-        glm::vec2 uv2 = uvs[uvIndices[i + 2]];
-        // Calculate vectors from v0 along triangle edges in world coordinate system.
-        glm::vec3 deltaPos1 = v1 - v0;
-        glm::vec3 deltaPos2 = v2 - v0;
-        // Calculate vectors from v0 along triangle edges in texture coordinate system.
-        glm::vec2 deltaUV1 = uv1 - uv0;
-        glm::vec2 deltaUV2 = uv2 - uv0;
-        // We should calcualte tangent (T) and bitangent (B) vectors in the world space that go along texture coordinates.
-        // In other words we should solve a system of equations:
-        //   deltaPos1 = deltaUV1.x * T + deltaUV1.y * B
-        //   deltaPos2 = deltaUV2.x * T + deltaUV2.y * B
-        float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
-        glm::vec3 tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y)*r;
-        glm::vec3 bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x)*r;
-        // Normalize vectors.
-        tangent = glm::normalize(tangent);
-        bitangent = glm::normalize(bitangent);
-        // Tangent and bitangent are the same for all vertices in the same triangle, so simply add them 3 times.
-        m_tangents.push_back(tangent);
-        m_tangents.push_back(tangent);
-        m_tangents.push_back(tangent);
-        m_bitangents.push_back(bitangent);
-        m_bitangents.push_back(bitangent);
-        m_bitangents.push_back(bitangent);
-    }
-    // In order to be able to jump from the world to texture coordinate system we can use TBN matrix which is
-    // | Tx Bx Nx |
-    // | Ty By Ny |
-    // | Tz Bz Nz |
-    // where T - tangent, B - bitangent, N - normal.
-    // TBN matrix is orthogonal because this is a rotation matrix, however during calculations we may
-    // introduce precision errors and the particular TBN matrix may become not orthogonal anymore.
-    // To fix this we should apply Gramm-Schmidt process for mathrix orthogonalization.
-    // See https://en.wikipedia.org/wiki/Gram%E2%80%93Schmidt_process
-    for (size_t i = 0; i < vertexIndices.size(); i++)
-    {
-        glm::vec3 & n = normals[normalIndices[i]];
-        glm::vec3 & t = m_tangents[i];
-        glm::vec3 & b = m_bitangents[i];
-        t = glm::normalize(t - n * glm::dot(n, t));
-        if (glm::dot(glm::cross(n, t), b) < 0.0f){
-            t = t * -1.0f;
-        }
-    }
 }
 
-const std::vector< glm::vec3 >& object::vertexes() const
+void object::merge_chunks(thread_pool& pool, std::vector< parsed_chunk >& chunks, parsed_chunk& merged)
 {
-    return m_vertices;
-}
-
-const std::vector< glm::vec2 >& object::uvs() const
-{
-    return m_uvs;
+    // Calculate offset of each chunk in the merged arrays.
+    std::vector< size_t > vertexOffsets(chunks.size() + 1, 0);
+    std::vector< size_t > uvOffsets(chunks.size() + 1, 0);
+    std::vector< size_t > normalOffsets(chunks.size() + 1, 0);
+    std::vector< size_t > indexOffsets(chunks.size() + 1, 0);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        vertexOffsets[i + 1] = vertexOffsets[i] + chunks[i].vertices.size();
+        uvOffsets[i + 1] = uvOffsets[i] + chunks[i].uvs.size();
+        normalOffsets[i + 1] = normalOffsets[i] + chunks[i].normals.size();
+        indexOffsets[i + 1] = indexOffsets[i] + chunks[i].vertexIndices.size();
+    }
+    merged.vertices.resize(vertexOffsets.back());
+    merged.uvs.resize(uvOffsets.back());
+    merged.normals.resize(normalOffsets.back());
+    merged.vertexIndices.resize(indexOffsets.back());
+    merged.uvIndices.resize(indexOffsets.back());
+    merged.normalIndices.resize(indexOffsets.back());
+    // Copy chunks in parallel and release their memory as soon as possible.
+    pool.parallel_for(chunks.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            parsed_chunk& chunk = chunks[i];
+            std::copy(chunk.vertices.begin(), chunk.vertices.end(), merged.vertices.begin() + vertexOffsets[i]);
+            std::copy(chunk.uvs.begin(), chunk.uvs.end(), merged.uvs.begin() + uvOffsets[i]);
+            std::copy(chunk.normals.begin(), chunk.normals.end(), merged.normals.begin() + normalOffsets[i]);
+            std::copy(chunk.vertexIndices.begin(), chunk.vertexIndices.end(), merged.vertexIndices.begin() + indexOffsets[i]);
+            std::copy(chunk.uvIndices.begin(), chunk.uvIndices.end(), merged.uvIndices.begin() + indexOffsets[i]);
+            std::copy(chunk.normalIndices.begin(), chunk.normalIndices.end(), merged.normalIndices.begin() + indexOffsets[i]);
+            // Relative indices were counted from the beginning of the chunk.
+            std::vector< int >* indices[3] = { &merged.vertexIndices, &merged.uvIndices, &merged.normalIndices };
+            size_t offsets[3] = { vertexOffsets[i], uvOffsets[i], normalOffsets[i] };
+            for (size_t relative : chunk.relativeIndices) {
+                size_t component = relative % 3;
+                (*indices[component])[indexOffsets[i] + relative / 3] += int(offsets[component]);
+            }
+            chunk = parsed_chunk();
+        }
+    });
 }
 
-const std::vector< glm::vec3 >& object::normals() const
+void object::remove_invalid_faces(parsed_chunk& merged)
 {
-    return m_normals;
+    // Compact the faces in place, the order of the remaining ones is kept.
+    size_t pointCount = merged.vertexIndices.size();
+    size_t kept = 0;
+    for (size_t i = 0; i + 3 <= pointCount; i += 3) {
+        bool valid = true;
+        for (size_t j = i; j < i + 3; j++) {
+            valid = valid && merged.vertexIndices[j] >= 0 && size_t(merged.vertexIndices[j]) < merged.vertices.size()
+                 && merged.uvIndices[j] >= 0 && size_t(merged.uvIndices[j]) < merged.uvs.size()
+                 && merged.normalIndices[j] >= 0 && size_t(merged.normalIndices[j]) < merged.normals.size();
+        }
+        if (!valid) {
+            continue;
+        }
+        for (size_t j = i; j < i + 3; j++, kept++) {
+            merged.vertexIndices[kept] = merged.vertexIndices[j];
+            merged.uvIndices[kept] = merged.uvIndices[j];
+            merged.normalIndices[kept] = merged.normalIndices[j];
+        }
+    }
+    merged.vertexIndices.resize(kept);
+    merged.uvIndices.resize(kept);
+    merged.normalIndices.resize(kept);
+    merged.relativeIndices.clear();
 }
 
-std::vector< glm::vec3 > object::tangents() const
+size_t object::split_range(const char* begin, const char* end, char delim, token* tokens)
 {
-    return m_tangents;
+    size_t count = 0;
+    const char* tokenBegin = begin;
+    while (tokenBegin < end) {
+        // Find the next delimiter or the end of the range.
+        const char* tokenEnd = tokenBegin;
+        while (tokenEnd < end && *tokenEnd != delim) {
+            ++tokenEnd;
+        }
+        if (count < MAX_TOKENS) {
+            tokens[count] = { tokenBegin, tokenEnd };
+        }
+        ++count;
+        tokenBegin = tokenEnd < end ? tokenEnd + 1 : end;
+    }
+    return count;
 }
 
-std::vector< glm::vec3 > object::bitangents() const
+bool object::parse_float(const token& tok, float& value)
 {
-    return m_bitangents;
+    // Most numbers in .obj files look like [-]ddd.dddddd, so convert them directly.
+    // If the mantissa fits in 24 bits and the power of ten is small, both are exact floats
+    // and a single IEEE multiplication or division gives the correctly rounded result,
+    // which is exactly what std::strtof returns.
+    static const float POWERS_OF_TEN[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+    const char* p = tok.begin;
+    bool negative = false;
+    if (p < tok.end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    const char* digitsBegin = p;
+    while (p < tok.end && *p >= '0' && *p <= '9') {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits += mantissa != 0;
+        ++p;
+    }
+    bool hasDigits = p != digitsBegin;
+    if (p < tok.end && *p == '.') {
+        ++p;
+        const char* fractionBegin = p;
+        while (p < tok.end && *p >= '0' && *p <= '9') {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+            --exponent;
+            ++p;
+        }
+        hasDigits = hasDigits || p != fractionBegin;
+    }
+    // Exponents, hexadecimal numbers, infinities and long mantissas are left to std::strtof.
+    bool simple = hasDigits && digits <= 18 && (p == tok.end || (*p != 'e' && *p != 'E' && *p != 'x' && *p != 'X'));
+    if (simple && mantissa <= (1u << 24) && exponent >= -10) {
+        float result = float(mantissa) / POWERS_OF_TEN[-exponent];
+        value = negative ? -result : result;
+        return true;
+    }
+    // Copy the token to a null-terminated buffer on the stack and use the library function.
+    size_t length = tok.end - tok.begin;
+    if (length >= MAX_NUMBER_LENGTH) {
+        std::string number(tok.begin, tok.end);
+        char* numberEnd = nullptr;
+        value = std::strtof(number.c_str(), &numberEnd);
+        return numberEnd != number.c_str();
+    }
+    char buffer[MAX_NUMBER_LENGTH];
+    memcpy(buffer, tok.begin, length);
+    buffer[length] = '\0';
+    char* numberEnd = nullptr;
+    value = std::strtof(buffer, &numberEnd);
+    return numberEnd != buffer;
 }
 
-std::vector< std::string > object::split_string(const std::string& str, char delim) const
+bool object::parse_int(const token& tok, int& value)
 {
-    std::vector< std::string > result;
-    std::stringstream ss(str);
-    std::string token;
-    while (std::getline(ss, token, delim)) {
-        result.push_back(token);
+    const char* p = tok.begin;
+    // Skip leading whitespaces like std::stoi does.
+    while (p < tok.end && (*p == ' ' || (*p >= '\t' && *p <= '\r'))) {
+        ++p;
+    }
+    bool negative = false;
+    if (p < tok.end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    const char* digitsBegin = p;
+    // Values out of the range of int are rejected like std::stoi does, so the line is skipped.
+    const int64_t limit = negative ? -int64_t(INT_MIN) : int64_t(INT_MAX);
+    int64_t result = 0;
+    while (p < tok.end && *p >= '0' && *p <= '9') {
+        result = result * 10 + (*p - '0');
+        if (result > limit) {
+            return false;
+        }
+        ++p;
+    }
+    if (p == digitsBegin) {
+        return false;
     }
-    return result;
+    value = int(negative ? -result : result);
+    return true;
 }
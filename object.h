@@ -1,10 +1,13 @@
 #pragma once
 
 #include <vector>
-#include <string>
-#include <fstream>
-#include <sstream>
+#include <cstddef>
+#include <cstdint>
 #include <glm/glm.hpp>
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+
+class thread_pool;
 
 /**
  * Parse wavefront .obj file and extracts vertices, UVs and normales.
@@ -15,9 +18,16 @@ class object
 public:
     /**
      * Constructor. Read a 3D object from the provided file.
+     * With more than one thread the file is split into line-aligned chunks that are parsed in parallel,
+     * and the following processing is split between threads as well.
+     * The result does not depend on the number of threads.
+     * By default each point of each triangle gets its own copy of the vertex data.
+     * In indexed mode only unique (vertex, uv, normal) tuples are kept and triangles are described by indices().
      * @param fileName File to read.
+     * @param threadCount Number of threads to use, 0 means one thread per hardware core.
+     * @param indexed Keep only unique vertices and build an index array.
      */
-    object(const char* fileName);
+    object(const char* fileName, unsigned threadCount = 1, bool indexed = false);
     /**
      * Return an array of vertices.
      * @return Array of vertices.
@@ -43,15 +53,147 @@ public:
      * @return Array of bitangents.
      */
     std::vector< glm::vec3 > bitangents() const;
+    /**
+     * Return an array of vertex indices, 3 per triangle.
+     * Levels of detail built by build_lods() follow the full mesh, see lods().
+     * The array is empty if the object is not indexed.
+     * @return Array of indices.
+     */
+    const std::vector< uint32_t >& indices() const;
+    /**
+     * Return levels of detail, from the full mesh to the coarsest one.
+     * The array is empty if the object is not indexed.
+     * @return Array of levels.
+     */
+    const std::vector< lod_level >& lods() const;
+    /**
+     * Return size of one index in index_buffer() in bytes.
+     * 16-bit indices are used when there are few enough vertices, otherwise 32-bit.
+     * @return 2 or 4.
+     */
+    size_t index_size() const;
+    /**
+     * Return indices packed into index_size() bytes each, ready to be uploaded to an element buffer.
+     * @return Packed indices.
+     */
+    std::vector< uint8_t > index_buffer() const;
+    /**
+     * Reorder triangles and vertices for the GPU: for the post-transform vertex cache,
+     * for less overdraw and for linear vertex fetching. See mesh_optimizer.
+     * Does nothing if the object is not indexed.
+     * @return Vertex cache efficiency before and after the optimization.
+     */
+    vertex_cache_report optimize();
+    /**
+     * Build coarser levels of detail with mesh_simplifier and append their indices to indices().
+     * The chain stops early when a level cannot be made noticeably smaller than the previous one.
+     * Does nothing if the object is not indexed.
+     * @param ratios Target triangle count of each level relative to the full mesh, in decreasing order.
+     */
+    void build_lods(const std::vector< float >& ratios);
 
 private:
     /**
-     * Helper function to split a string into tokens using the given delimiter.
-     * @param str String to split.
+     * Maximal number of tokens per line that are stored while splitting.
+     * Longer lines are still counted correctly, but their extra tokens are dropped.
+     */
+    constexpr static size_t MAX_TOKENS = 8;
+    /**
+     * Maximal length of a number that is copied to a temporary buffer for the slow parsing path.
+     */
+    constexpr static size_t MAX_NUMBER_LENGTH = 64;
+    /**
+     * A level of detail is kept only if it has at most this part of the triangles of the previous level.
+     */
+    constexpr static float MAX_LOD_SIZE_RATIO = 0.8f;
+
+    /**
+     * Indexed vertices, uvs, normals and faces read from a part of the file.
+     * Indices start from 0, invalid ones are kept and the faces that use them are removed after merging.
+     */
+    struct parsed_chunk
+    {
+        std::vector< glm::vec3 > vertices;
+        std::vector< glm::vec2 > uvs;
+        std::vector< glm::vec3 > normals;
+        std::vector< int > vertexIndices;
+        std::vector< int > uvIndices;
+        std::vector< int > normalIndices;
+        /**
+         * Relative (negative) indices are resolved against the elements of the chunk, so they have to be moved
+         * by the offset of the chunk when it is merged. Each entry is point * 3 plus 0 for the vertex, 1 for the uv
+         * and 2 for the normal index.
+         */
+        std::vector< size_t > relativeIndices;
+    };
+
+    /**
+     * A range of characters inside the mapped file.
+     * Tokens refer to the file content directly, so no strings are allocated during parsing.
+     */
+    struct token
+    {
+        const char* begin;
+        const char* end;
+    };
+
+    /**
+     * Parse lines of the file in the given range.
+     * @param begin First character of the range, must be the beginning of a line.
+     * @param end Character after the last one of the range, must be the end of a line.
+     * @param chunk Chunk to add the parsed elements to.
+     */
+    static void parse_range(const char* begin, const char* end, parsed_chunk& chunk);
+    /**
+     * Concatenate chunks in their order. Chunks are cleared while being merged.
+     * @param pool Threads to copy the chunks with.
+     * @param chunks Chunks to merge.
+     * @param merged Chunk to receive the merged arrays.
+     */
+    static void merge_chunks(thread_pool& pool, std::vector< parsed_chunk >& chunks, parsed_chunk& merged);
+    /**
+     * Remove faces that refer to a vertex, uv or normal that does not exist.
+     * @param merged Parsed file content.
+     */
+    static void remove_invalid_faces(parsed_chunk& merged);
+    /**
+     * Fill vertex arrays with a copy of the data for each point of each triangle.
+     * @param pool Threads to process the data with.
+     * @param merged Parsed file content.
+     */
+    void build_unindexed(thread_pool& pool, const parsed_chunk& merged);
+    /**
+     * Fill vertex arrays with unique vertices and build the index array.
+     * @param pool Threads to process the data with.
+     * @param merged Parsed file content.
+     */
+    void build_indexed(thread_pool& pool, const parsed_chunk& merged);
+    /**
+     * Helper function to split a range of characters into tokens using the given delimiter.
+     * Follows std::getline semantics: adjacent delimiters produce empty tokens
+     * and a trailing delimiter does not produce a token.
+     * @param begin First character of the range.
+     * @param end Character after the last one of the range.
      * @param delim Delimiter.
-     * @return Array of tokens.
+     * @param tokens Array of at least MAX_TOKENS elements to receive the tokens.
+     * @return Number of tokens in the range (can be bigger than MAX_TOKENS).
      */
-    std::vector< std::string > split_string(const std::string& str, char delim = ' ') const;
+    static size_t split_range(const char* begin, const char* end, char delim, token* tokens);
+    /**
+     * Parse a floating point number in the same way std::stof does.
+     * Short decimal numbers are converted directly, others are passed to std::strtof.
+     * @param tok Token to parse.
+     * @param value Parsed value.
+     * @return True if the token starts with a number.
+     */
+    static bool parse_float(const token& tok, float& value);
+    /**
+     * Parse an integer number in the same way std::stoi does.
+     * @param tok Token to parse.
+     * @param value Parsed value.
+     * @return True if the token starts with a number.
+     */
+    static bool parse_int(const token& tok, int& value);
 
     /**
      * Array of vertices.
@@ -73,4 +215,12 @@ private:
      * Array of bitangents.
      */
     std::vector< glm::vec3 > m_bitangents;
+    /**
+     * Array of indices.
+     */
+    std::vector< uint32_t > m_indices;
+    /**
+     * Levels of detail.
+     */
+    std::vector< lod_level > m_lods;
 };
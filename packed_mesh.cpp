@@ -0,0 +1,174 @@
+#include "packed_mesh.h"
+
+#include <cmath>
+#include <algorithm>
+
+packed_mesh::packed_mesh(const object& obj, const vertex_cache_report& vertexCache)
+    : m_vertices(nullptr)
+    , m_vertexCount(0)
+    , m_indices(nullptr)
+    , m_indexCount(obj.indices().size())
+    , m_indexSize(obj.index_size())
+    , m_lods(obj.lods())
+    , m_positionOffset(0.0f)
+    , m_positionScale(0.0f)
+    , m_error()
+    , m_vertexCache(vertexCache)
+{
+    const std::vector< glm::vec3 >& vertices = obj.vertexes();
+    const std::vector< glm::vec2 >& uvs = obj.uvs();
+    const std::vector< glm::vec3 >& normals = obj.normals();
+    std::vector< glm::vec3 > tangents = obj.tangents();
+    std::vector< glm::vec3 > bitangents = obj.bitangents();
+    if (vertices.empty()) {
+        return;
+    }
+    // Calculate the bounding box. Positions are stored as fractions of its size.
+    glm::vec3 minimum = vertices[0];
+    glm::vec3 maximum = vertices[0];
+    for (const glm::vec3& v : vertices) {
+        minimum = glm::min(minimum, v);
+        maximum = glm::max(maximum, v);
+    }
+    m_positionOffset = minimum;
+    m_positionScale = maximum - minimum;
+    glm::vec3 inverseScale(0.0f);
+    for (int i = 0; i < 3; i++) {
+        if (m_positionScale[i] > 0.0f) {
+            inverseScale[i] = 1.0f / m_positionScale[i];
+        }
+    }
+    // Pack each vertex and measure how far the decoded values are from the original ones.
+    m_vertexStorage.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        packed_vertex& packed = m_vertexStorage[i];
+        // Position.
+        glm::vec3 relative = (vertices[i] - m_positionOffset) * inverseScale;
+        glm::vec3 decodedPosition = m_positionOffset;
+        for (int j = 0; j < 3; j++) {
+            float quantized = std::round(glm::clamp(relative[j], 0.0f, 1.0f) * 65535.0f);
+            packed.position[j] = uint16_t(quantized);
+            decodedPosition[j] += quantized / 65535.0f * m_positionScale[j];
+        }
+        m_error.position = std::max(m_error.position, glm::length(decodedPosition - vertices[i]));
+        // Texture coordinates.
+        packed.uv = glm::packHalf2x16(uvs[i]);
+        glm::vec2 decodedUv = glm::unpackHalf2x16(packed.uv);
+        m_error.uv = std::max(m_error.uv, std::max(std::fabs(decodedUv.x - uvs[i].x), std::fabs(decodedUv.y - uvs[i].y)));
+        // Normal and tangent.
+        packed.normal = encode_octahedral(normals[i]);
+        packed.tangent = encode_octahedral(tangents[i]);
+        glm::vec3 decodedNormal = decode_octahedral(packed.normal);
+        glm::vec3 decodedTangent = decode_octahedral(packed.tangent);
+        m_error.normal = std::max(m_error.normal, angle_degrees(decodedNormal, normals[i]));
+        m_error.tangent = std::max(m_error.tangent, angle_degrees(decodedTangent, tangents[i]));
+        // Bitangent is replaced by its direction relative to the normal and the tangent.
+        bool positive = glm::dot(glm::cross(normals[i], tangents[i]), bitangents[i]) >= 0.0f;
+        packed.position[3] = positive ? 65535 : 0;
+        glm::vec3 decodedBitangent = glm::cross(decodedNormal, decodedTangent) * (positive ? 1.0f : -1.0f);
+        m_error.bitangent = std::max(m_error.bitangent, angle_degrees(decodedBitangent, bitangents[i]));
+    }
+    // Keep indices in the narrowest type.
+    m_indexStorage = obj.index_buffer();
+    m_vertices = m_vertexStorage.data();
+    m_vertexCount = m_vertexStorage.size();
+    m_indices = m_indexStorage.empty() ? nullptr : m_indexStorage.data();
+}
+
+packed_mesh::packed_mesh()
+    : m_vertices(nullptr)
+    , m_vertexCount(0)
+    , m_indices(nullptr)
+    , m_indexCount(0)
+    , m_indexSize(sizeof(uint16_t))
+    , m_lods()
+    , m_positionOffset(0.0f)
+    , m_positionScale(0.0f)
+    , m_error()
+    , m_vertexCache()
+{
+}
+
+const packed_vertex* packed_mesh::vertices() const
+{
+    return m_vertices;
+}
+
+size_t packed_mesh::vertex_count() const
+{
+    return m_vertexCount;
+}
+
+const void* packed_mesh::indices() const
+{
+    return m_indices;
+}
+
+size_t packed_mesh::index_count() const
+{
+    return m_indexCount;
+}
+
+size_t packed_mesh::index_size() const
+{
+    return m_indexSize;
+}
+
+const std::vector< lod_level >& packed_mesh::lods() const
+{
+    return m_lods;
+}
+
+glm::vec3 packed_mesh::position_offset() const
+{
+    return m_positionOffset;
+}
+
+glm::vec3 packed_mesh::position_scale() const
+{
+    return m_positionScale;
+}
+
+const quantization_error& packed_mesh::error() const
+{
+    return m_error;
+}
+
+const vertex_cache_report& packed_mesh::vertex_cache() const
+{
+    return m_vertexCache;
+}
+
+uint32_t packed_mesh::encode_octahedral(const glm::vec3& v)
+{
+    // Project the vector on the octahedron |x| + |y| + |z| = 1 and then on the z = 0 plane.
+    // The lower half of the octahedron is folded over the diagonals.
+    float sum = std::fabs(v.x) + std::fabs(v.y) + std::fabs(v.z);
+    if (sum == 0.0f) {
+        return glm::packSnorm2x16(glm::vec2(0.0f));
+    }
+    glm::vec2 p(v.x / sum, v.y / sum);
+    if (v.z < 0.0f) {
+        glm::vec2 folded((1.0f - std::fabs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+                         (1.0f - std::fabs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+        p = folded;
+    }
+    return glm::packSnorm2x16(p);
+}
+
+glm::vec3 packed_mesh::decode_octahedral(uint32_t packed)
+{
+    // Must match the decoding in main.vs.
+    glm::vec2 p = glm::unpackSnorm2x16(packed);
+    glm::vec3 v(p.x, p.y, 1.0f - std::fabs(p.x) - std::fabs(p.y));
+    float t = std::max(-v.z, 0.0f);
+    v.x += v.x >= 0.0f ? -t : t;
+    v.y += v.y >= 0.0f ? -t : t;
+    return glm::normalize(v);
+}
+
+float packed_mesh::angle_degrees(const glm::vec3& a, const glm::vec3& b)
+{
+    float cosine = glm::dot(glm::normalize(a), glm::normalize(b));
+    return glm::degrees(std::acos(glm::clamp(cosine, -1.0f, 1.0f)));
+}
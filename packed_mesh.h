@@ -0,0 +1,212 @@
+#pragma once
+
+#include "object.h"
+#include "mapped_file.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * Vertex of a packed mesh: all attributes interleaved in 20 bytes.
+ */
+struct packed_vertex
+{
+    /**
+     * Position inside the bounding box of the mesh as unsigned normalized 16-bit values.
+     * The 4th value stores the bitangent sign: 0 for -1 and 65535 for +1.
+     */
+    uint16_t position[4];
+    /**
+     * Texture coordinates as two half floats.
+     */
+    uint32_t uv;
+    /**
+     * Octahedral encoding of the normal as two signed normalized 16-bit values.
+     */
+    uint32_t normal;
+    /**
+     * Octahedral encoding of the tangent as two signed normalized 16-bit values.
+     */
+    uint32_t tangent;
+};
+
+/**
+ * Maximal differences between the original and the packed vertex attributes.
+ */
+struct quantization_error
+{
+    /**
+     * Maximal position error in object units.
+     */
+    float position;
+    /**
+     * Maximal texture coordinate error.
+     */
+    float uv;
+    /**
+     * Maximal normal error in degrees.
+     */
+    float normal;
+    /**
+     * Maximal tangent error in degrees.
+     */
+    float tangent;
+    /**
+     * Maximal error of the bitangent rebuilt as sign * cross(normal, tangent) in degrees.
+     */
+    float bitangent;
+};
+
+/**
+ * Packs vertices of an object into a single interleaved stream of compact vertices.
+ * Positions are stored relative to the bounding box, so the shader needs position_offset()
+ * and position_scale() to restore them. Bitangents are not stored: the shader rebuilds them
+ * from the normal, the tangent and the stored sign.
+ */
+class packed_mesh
+{
+public:
+    /**
+     * Constructor. Pack vertices, indices and levels of detail of the object.
+     * @param obj Object to pack.
+     * @param vertexCache Vertex cache efficiency of the object to keep with the mesh, see object::optimize().
+     */
+    packed_mesh(const object& obj, const vertex_cache_report& vertexCache = vertex_cache_report());
+    /**
+     * Constructor. Create an empty mesh.
+     */
+    packed_mesh();
+    /**
+     * Return a pointer to the array of packed vertices.
+     * @return Array of packed vertices.
+     */
+    const packed_vertex* vertices() const;
+    /**
+     * Return number of vertices.
+     * @return Number of vertices.
+     */
+    size_t vertex_count() const;
+    /**
+     * Return a pointer to the packed indices, 3 per triangle.
+     * @return Packed indices or nullptr if the mesh is not indexed.
+     */
+    const void* indices() const;
+    /**
+     * Return number of indices.
+     * @return Number of indices.
+     */
+    size_t index_count() const;
+    /**
+     * Return size of one index in bytes.
+     * @return 2 or 4.
+     */
+    size_t index_size() const;
+    /**
+     * Return levels of detail. Each level is a range of indices(), the first one is the full mesh.
+     * @return Levels of detail, empty if the mesh is not indexed.
+     */
+    const std::vector< lod_level >& lods() const;
+    /**
+     * Return the minimal corner of the bounding box, it is the position encoded by 0.
+     * @return Position offset.
+     */
+    glm::vec3 position_offset() const;
+    /**
+     * Return the size of the bounding box, it is the distance encoded by 65535.
+     * @return Position scale.
+     */
+    glm::vec3 position_scale() const;
+    /**
+     * Return the quantization error measured while packing.
+     * @return Quantization error.
+     */
+    const quantization_error& error() const;
+    /**
+     * Return vertex cache efficiency of the mesh before and after the optimization.
+     * @return Vertex cache report.
+     */
+    const vertex_cache_report& vertex_cache() const;
+
+    /**
+     * Encode a unit vector with the octahedral mapping.
+     * See http://jcgt.org/published/0003/02/01/
+     * @param v Unit vector.
+     * @return Encoded vector packed into two signed normalized 16-bit values.
+     */
+    static uint32_t encode_octahedral(const glm::vec3& v);
+    /**
+     * Decode a unit vector encoded by encode_octahedral().
+     * @param packed Encoded vector.
+     * @return Unit vector.
+     */
+    static glm::vec3 decode_octahedral(uint32_t packed);
+
+private:
+    /**
+     * mesh_cache stores the packed data in files and maps them back.
+     */
+    friend class mesh_cache;
+
+    /**
+     * Helper function to measure angle between two vectors.
+     * @param a First vector.
+     * @param b Second vector.
+     * @return Angle in degrees.
+     */
+    static float angle_degrees(const glm::vec3& a, const glm::vec3& b);
+
+    /**
+     * Storage of packed vertices if the mesh is built from an object.
+     */
+    std::vector< packed_vertex > m_vertexStorage;
+    /**
+     * Storage of packed indices if the mesh is built from an object.
+     */
+    std::vector< uint8_t > m_indexStorage;
+    /**
+     * Mapped cache file if the mesh is loaded from a cache.
+     */
+    mapped_file m_file;
+    /**
+     * Pointer to packed vertices inside one of the storages.
+     */
+    const packed_vertex* m_vertices;
+    /**
+     * Number of vertices.
+     */
+    size_t m_vertexCount;
+    /**
+     * Pointer to packed indices inside one of the storages.
+     */
+    const void* m_indices;
+    /**
+     * Number of indices.
+     */
+    size_t m_indexCount;
+    /**
+     * Size of one index in bytes.
+     */
+    size_t m_indexSize;
+    /**
+     * Levels of detail.
+     */
+    std::vector< lod_level > m_lods;
+    /**
+     * Minimal corner of the bounding box.
+     */
+    glm::vec3 m_positionOffset;
+    /**
+     * Size of the bounding box.
+     */
+    glm::vec3 m_positionScale;
+    /**
+     * Quantization error.
+     */
+    quantization_error m_error;
+    /**
+     * Vertex cache efficiency.
+     */
+    vertex_cache_report m_vertexCache;
+};
@@ -0,0 +1,80 @@
+#version 330 core
+
+in vec2 UV;
+
+out vec3 FragColor;
+
+// Scene drawn at a lower resolution into the lower left part of the texture (see scene_target).
+uniform sampler2D sourceTexture;
+// Fraction of the texture that holds the scene.
+uniform vec2 sourceScale;
+// Smooth edges with FXAA.
+uniform bool fxaaEnabled;
+
+// Read the scene with bilinear filtering, clamped to its part of the texture.
+// @param texCoords Texture coordinates.
+// @param texelSize Size of a texel in texture coordinates.
+// @return Color.
+vec3 source(vec2 texCoords, vec2 texelSize)
+{
+    return texture(sourceTexture, clamp(texCoords, texelSize * 0.5, sourceScale - texelSize * 0.5)).rgb;
+}
+
+// Return the luma of a color.
+// @param color Color.
+// @return Luma.
+float luma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+// Smooth an edge with the fast approximate antialiasing of Timothy Lottes, close to the console variant of FXAA 3.11.
+// Pixels whose neighbours have little contrast are kept. Otherwise the luma of the 4 diagonal neighbours gives
+// the direction along the edge, and the color is averaged along it over up to SPAN_MAX texels. The wider average
+// is rejected if it leaves the luma range of the neighbours, which happens when it crosses another edge.
+// @param texCoords Texture coordinates of the pixel.
+// @param texelSize Size of a texel in texture coordinates.
+// @return Color.
+vec3 fxaa(vec2 texCoords, vec2 texelSize)
+{
+    // Longest distance averaged along an edge in texels.
+    const float SPAN_MAX = 8.0;
+    // Keep the direction from growing too steep in flat and dark regions.
+    const float REDUCE_MUL = 1.0 / 8.0;
+    const float REDUCE_MIN = 1.0 / 128.0;
+    // Smallest luma contrast that is smoothed, relative to the brightest neighbour and absolute.
+    const float EDGE_THRESHOLD = 0.125;
+    const float EDGE_THRESHOLD_MIN = 0.05;
+
+    float lumaNW = luma(source(texCoords + vec2(-0.5, 0.5) * texelSize, texelSize));
+    float lumaNE = luma(source(texCoords + vec2(0.5, 0.5) * texelSize, texelSize));
+    float lumaSW = luma(source(texCoords + vec2(-0.5, -0.5) * texelSize, texelSize));
+    float lumaSE = luma(source(texCoords + vec2(0.5, -0.5) * texelSize, texelSize));
+    vec3 color = source(texCoords, texelSize);
+    float lumaM = luma(color);
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+    if (lumaMax - lumaMin < max(EDGE_THRESHOLD_MIN, lumaMax * EDGE_THRESHOLD)) {
+        return color;
+    }
+
+    // The edge runs across the luma gradient.
+    vec2 direction = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+    float directionReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25 * REDUCE_MUL, REDUCE_MIN);
+    float inverseDirectionMin = 1.0 / (min(abs(direction.x), abs(direction.y)) + directionReduce);
+    direction = clamp(direction * inverseDirectionMin, -SPAN_MAX, SPAN_MAX) * texelSize;
+
+    vec3 colorA = 0.5 * (source(texCoords + direction * (1.0 / 3.0 - 0.5), texelSize)
+                         + source(texCoords + direction * (2.0 / 3.0 - 0.5), texelSize));
+    vec3 colorB = colorA * 0.5 + 0.25 * (source(texCoords - direction * 0.5, texelSize)
+                                         + source(texCoords + direction * 0.5, texelSize));
+    float lumaB = luma(colorB);
+    return lumaB < lumaMin || lumaB > lumaMax ? colorA : colorB;
+}
+
+void main()
+{
+    vec2 texelSize = 1.0 / vec2(textureSize(sourceTexture, 0));
+    vec2 texCoords = UV * sourceScale;
+    FragColor = fxaaEnabled ? fxaa(texCoords, texelSize) : source(texCoords, texelSize);
+}
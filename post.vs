@@ -0,0 +1,12 @@
+#version 330 core
+
+// Texture coordinates over the output, 0 to 1.
+out vec2 UV;
+
+void main()
+{
+    // A single triangle that covers the whole output, its corners are made from the vertex number.
+    vec2 position = vec2((gl_VertexID & 1) * 4.0 - 1.0, (gl_VertexID & 2) * 2.0 - 1.0);
+    UV = position * 0.5 + 0.5;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
@@ -0,0 +1,254 @@
+#include "program_cache.h"
+#include "mapped_file.h"
+
+#include <fstream>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+
+/**
+ * Read a whole text file.
+ * @param fileName File name.
+ * @param text Receives the content.
+ * @return False if the file cannot be read.
+ */
+bool read_text(const char* fileName, std::string& text)
+{
+    std::ifstream ifs(fileName, std::ios::binary);
+    if (!ifs) {
+        return false;
+    }
+    text.assign(std::istreambuf_iterator< char >(ifs), std::istreambuf_iterator< char >());
+    return true;
+}
+
+/**
+ * Hash a string with its length, so that the boundaries of hashed strings matter.
+ * @param text String, may be NULL.
+ * @param seed Hash of the previous strings.
+ * @return Hash.
+ */
+uint64_t hash_string(const char* text, uint64_t seed)
+{
+    uint64_t size = text ? strlen(text) : 0;
+    return mapped_file::hash(text, size, mapped_file::hash(&size, sizeof(size), seed));
+}
+
+/**
+ * Insert lines after the #version line of a shader, which must stay the first line.
+ * A #line directive after them keeps the line numbers of compiler messages those of the file.
+ * @param code Source of the shader.
+ * @param defines Lines to insert.
+ */
+void insert_defines(std::string& code, const std::string& defines)
+{
+    if (defines.empty()) {
+        return;
+    }
+    size_t position = 0;
+    int line = 1;
+    if (code.compare(0, 8, "#version") == 0) {
+        position = code.find('\n');
+        position = position == std::string::npos ? code.size() : position + 1;
+        line = 2;
+    }
+    code.insert(position, defines + "#line " + std::to_string(line) + "\n");
+}
+
+}
+
+GLuint program_cache::load(const char* vertexFileName, const char* fragmentFileName, const std::string& defines, bool& cached,
+                           std::string& log)
+{
+    cached = false;
+    std::string vertexCode;
+    if (!read_text(vertexFileName, vertexCode)) {
+        log = std::string("Failed to read the vertex shader file ") + vertexFileName + "!";
+        return 0;
+    }
+    std::string fragmentCode;
+    if (!read_text(fragmentFileName, fragmentCode)) {
+        log = std::string("Failed to read the fragment shader file ") + fragmentFileName + "!";
+        return 0;
+    }
+    insert_defines(vertexCode, defines);
+    insert_defines(fragmentCode, defines);
+    // Try to use the cache.
+    bool binarySupported = supported();
+    std::string cacheFileName = cache_file_name(fragmentFileName);
+    uint64_t programKey = key(vertexCode, fragmentCode);
+    if (binarySupported) {
+        GLuint program = read(cacheFileName.c_str(), programKey);
+        if (program) {
+            cached = true;
+            return program;
+        }
+    }
+    // Compile the shaders and store the binary for the next time. Failing to write the cache is not an error.
+    GLuint program = build(vertexCode, fragmentCode, binarySupported, log);
+    if (program && binarySupported) {
+        write(cacheFileName.c_str(), programKey, program);
+    }
+    return program;
+}
+
+std::string program_cache::cache_file_name(const char* fragmentFileName)
+{
+    return std::string(fragmentFileName) + ".program";
+}
+
+bool program_cache::supported()
+{
+    if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+        return false;
+    }
+    // The extension may be exposed without any binary format, e.g. if the driver has no shader cache.
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    return formatCount > 0;
+}
+
+uint64_t program_cache::key(const std::string& vertexCode, const std::string& fragmentCode)
+{
+    uint64_t result = hash_string(vertexCode.c_str(), 0);
+    result = hash_string(fragmentCode.c_str(), result);
+    result = hash_string(reinterpret_cast< const char* >(glGetString(GL_VENDOR)), result);
+    result = hash_string(reinterpret_cast< const char* >(glGetString(GL_RENDERER)), result);
+    return hash_string(reinterpret_cast< const char* >(glGetString(GL_VERSION)), result);
+}
+
+GLuint program_cache::read(const char* fileName, uint64_t key)
+{
+    mapped_file file(fileName);
+    if (file.size() < sizeof(header)) {
+        return 0;
+    }
+    // Verify the format and the key.
+    header stored;
+    memcpy(&stored, file.data(), sizeof(header));
+    if (stored.magic != MAGIC || stored.version != VERSION || stored.key != key) {
+        return 0;
+    }
+    // Verify the data. The size is checked against the file before it is used.
+    const char* data = file.data() + sizeof(header);
+    if (stored.dataSize == 0 || stored.dataSize > file.size() - sizeof(header)
+            || mapped_file::hash(data, stored.dataSize) != stored.dataHash) {
+        return 0;
+    }
+    // The driver validates the binary itself and fails the link status if it does not accept it.
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, GLenum(stored.binaryFormat), data, GLsizei(stored.dataSize));
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+bool program_cache::write(const char* fileName, uint64_t key, GLuint program)
+{
+    // Fetch the binary.
+    GLint binarySize = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+    if (binarySize <= 0) {
+        return false;
+    }
+    std::vector< char > binary(binarySize);
+    GLsizei length = 0;
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(program, binarySize, &length, &binaryFormat, binary.data());
+    if (length <= 0) {
+        return false;
+    }
+    header result;
+    memset(&result, 0, sizeof(result));
+    result.magic = MAGIC;
+    result.version = VERSION;
+    result.binaryFormat = uint32_t(binaryFormat);
+    result.key = key;
+    result.dataSize = uint64_t(length);
+    result.dataHash = mapped_file::hash(binary.data(), result.dataSize);
+    // Write the file under a temporary name.
+    std::string temporaryFileName = mapped_file::temporary_name(fileName);
+    {
+        std::ofstream ofs(temporaryFileName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!ofs) {
+            return false;
+        }
+        ofs.write(reinterpret_cast< const char* >(&result), sizeof(result));
+        ofs.write(binary.data(), result.dataSize);
+        if (!ofs) {
+            ofs.close();
+            std::remove(temporaryFileName.c_str());
+            return false;
+        }
+    }
+    // Replace the old cache. Rename does not overwrite files on all platforms, so remove it first.
+    std::remove(fileName);
+    if (std::rename(temporaryFileName.c_str(), fileName) != 0) {
+        std::remove(temporaryFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+GLuint program_cache::build(const std::string& vertexCode, const std::string& fragmentCode, bool retrievable, std::string& log)
+{
+    GLuint vertexShader = compile(GL_VERTEX_SHADER, vertexCode, log);
+    if (!vertexShader) {
+        log = "Vertex shader compilation failed:\n" + log;
+        return 0;
+    }
+    GLuint fragmentShader = compile(GL_FRAGMENT_SHADER, fragmentCode, log);
+    if (!fragmentShader) {
+        glDeleteShader(vertexShader);
+        log = "Fragment shader compilation failed:\n" + log;
+        return 0;
+    }
+    // Link shaders into a shader program. The hint must be set before linking for the binary to be retrievable.
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    if (retrievable) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program);
+    // Delete shaders after the program is linked.
+    glDetachShader(program, vertexShader);
+    glDetachShader(program, fragmentShader);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infoLog[LOG_SIZE];
+        glGetProgramInfoLog(program, LOG_SIZE, NULL, infoLog);
+        log = std::string("Program linking failed:\n") + infoLog;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+GLuint program_cache::compile(GLenum type, const std::string& code, std::string& log)
+{
+    const char* source = code.c_str();
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint success = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char infoLog[LOG_SIZE];
+        glGetShaderInfoLog(shader, LOG_SIZE, NULL, infoLog);
+        log = infoLog;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Binary cache of linked shader programs.
+ * The first load compiles and links the shaders and writes the program binary of the driver to a cache file next to
+ * the fragment shader, programs may share a vertex shader. Later loads hand the binary back to the driver, so no GLSL is compiled at startup.
+ *
+ * Cache file layout:
+ * | header | program binary |
+ * The binary is only valid for the driver that produced it. The header keeps a hash of both shader sources with their
+ * defines and the GL vendor, renderer and version strings, the cache is rebuilt if any of them has changed. The
+ * driver may still reject a binary, e.g. after an update that kept the version string, the shaders are then compiled as usual.
+ */
+class program_cache
+{
+public:
+    /**
+     * Load a program of a vertex and a fragment shader, from the cache if it is valid.
+     * If the cache is missing, stale or rejected, compile and link the shaders and write a new cache.
+     * A GL context must be current.
+     * @param vertexFileName The vertex shader file.
+     * @param fragmentFileName The fragment shader file.
+     * @param defines Lines inserted after the #version line of both shaders, e.g. #define lines. May be empty.
+     * @param cached Receives true if the program comes from the cache.
+     * @param log Receives the error message if the program cannot be built.
+     * @return Linked program. 0 if a shader cannot be read, compiled or linked.
+     */
+    static GLuint load(const char* vertexFileName, const char* fragmentFileName, const std::string& defines, bool& cached,
+                       std::string& log);
+    /**
+     * Return name of the cache file of the program.
+     * @param fragmentFileName The fragment shader file.
+     * @return Name of the cache file.
+     */
+    static std::string cache_file_name(const char* fragmentFileName);
+
+private:
+    /**
+     * First bytes of the cache file.
+     */
+    constexpr static uint32_t MAGIC = 0x50584C47; // "GLXP"
+    /**
+     * Version of the cache format.
+     */
+    constexpr static uint32_t VERSION = 1;
+    /**
+     * Size of the buffer for compiler and linker messages.
+     */
+    constexpr static int LOG_SIZE = 2048;
+
+    /**
+     * Header of the cache file.
+     */
+    struct header
+    {
+        uint32_t magic;
+        uint32_t version;
+        /**
+         * Driver specific format returned by glGetProgramBinary.
+         */
+        uint32_t binaryFormat;
+        uint32_t reserved;
+        /**
+         * Hash of the shader sources and the GL strings, see key().
+         */
+        uint64_t key;
+        uint64_t dataSize;
+        /**
+         * Hash of the program binary.
+         */
+        uint64_t dataHash;
+    };
+
+    /**
+     * Check whether the driver can return program binaries.
+     * @return True if program binaries are supported.
+     */
+    static bool supported();
+    /**
+     * Hash the shader sources together with the GL vendor, renderer and version strings.
+     * @param vertexCode Source of the vertex shader.
+     * @param fragmentCode Source of the fragment shader.
+     * @return Cache key.
+     */
+    static uint64_t key(const std::string& vertexCode, const std::string& fragmentCode);
+    /**
+     * Try to create the program from the cache file.
+     * @param fileName The cache file.
+     * @param key Wanted cache key.
+     * @return Linked program. 0 if the cache is missing, stale or rejected by the driver.
+     */
+    static GLuint read(const char* fileName, uint64_t key);
+    /**
+     * Write the binary of a linked program to the cache file.
+     * The file is written under a temporary name and renamed, so a partial file is never picked up.
+     * @param fileName The cache file.
+     * @param key Cache key.
+     * @param program Program linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT.
+     * @return True if the cache is written.
+     */
+    static bool write(const char* fileName, uint64_t key, GLuint program);
+    /**
+     * Compile and link a program.
+     * @param vertexCode Source of the vertex shader.
+     * @param fragmentCode Source of the fragment shader.
+     * @param retrievable Ask the driver to keep the binary of the program.
+     * @param log Receives the error message.
+     * @return Linked program. 0 if a shader cannot be compiled or linked.
+     */
+    static GLuint build(const std::string& vertexCode, const std::string& fragmentCode, bool retrievable, std::string& log);
+    /**
+     * Compile a shader.
+     * @param type Shader type.
+     * @param code Source.
+     * @param log Receives the error message.
+     * @return Shader. 0 if it cannot be compiled.
+     */
+    static GLuint compile(GLenum type, const std::string& code, std::string& log);
+};
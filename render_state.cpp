@@ -0,0 +1,181 @@
+#include "render_state.h"
+
+#include <algorithm>
+
+constexpr GLuint render_state::UNKNOWN;
+
+render_state::render_state()
+    : m_counters({ 0, 0, 0 })
+{
+    invalidate();
+}
+
+void render_state::invalidate()
+{
+    m_program = UNKNOWN;
+    m_vertexArray = UNKNOWN;
+    m_activeTexture = UNKNOWN;
+    std::fill(m_textures, m_textures + MAX_TEXTURE_UNITS, UNKNOWN);
+    m_arrayBuffer = UNKNOWN;
+    std::fill(m_uniformBuffers, m_uniformBuffers + MAX_UNIFORM_BUFFERS, UNKNOWN);
+    std::fill(m_uniformOffsets, m_uniformOffsets + MAX_UNIFORM_BUFFERS, 0);
+    std::fill(m_uniformSizes, m_uniformSizes + MAX_UNIFORM_BUFFERS, 0);
+    m_readFramebuffer = UNKNOWN;
+    m_drawFramebuffer = UNKNOWN;
+    std::fill(m_viewport, m_viewport + 4, -1);
+}
+
+void render_state::use_program(GLuint program)
+{
+    bool changed = m_program != program;
+    if (changed) {
+        glUseProgram(program);
+        m_program = program;
+    }
+    count(changed);
+}
+
+void render_state::bind_vertex_array(GLuint vertexArray)
+{
+    bool changed = m_vertexArray != vertexArray;
+    if (changed) {
+        glBindVertexArray(vertexArray);
+        m_vertexArray = vertexArray;
+    }
+    count(changed);
+}
+
+void render_state::bind_texture(GLuint unit, GLuint texture, GLenum target)
+{
+    if (m_textures[unit] == texture) {
+        count(false);
+        return;
+    }
+    // The texture unit only needs to be selected if a texture is actually bound.
+    if (m_activeTexture != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        m_activeTexture = unit;
+        count(true);
+    }
+    glBindTexture(target, texture);
+    m_textures[unit] = texture;
+    count(true);
+}
+
+void render_state::activate_texture(GLuint unit, GLuint texture, GLenum target)
+{
+    bind_texture(unit, texture, target);
+    bool changed = m_activeTexture != unit;
+    if (changed) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        m_activeTexture = unit;
+    }
+    count(changed);
+}
+
+void render_state::bind_uniform_range(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    bool changed = m_uniformBuffers[index] != buffer || m_uniformOffsets[index] != offset || m_uniformSizes[index] != size;
+    if (changed) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+        m_uniformBuffers[index] = buffer;
+        m_uniformOffsets[index] = offset;
+        m_uniformSizes[index] = size;
+    }
+    count(changed);
+}
+
+void render_state::bind_array_buffer(GLuint buffer)
+{
+    bool changed = m_arrayBuffer != buffer;
+    if (changed) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        m_arrayBuffer = buffer;
+    }
+    count(changed);
+}
+
+void* render_state::map_array_buffer(GLuint buffer, size_t size)
+{
+    bind_array_buffer(buffer);
+    glBufferData(GL_ARRAY_BUFFER, GLsizeiptr(size), nullptr, GL_STREAM_DRAW);
+    void* data = glMapBufferRange(GL_ARRAY_BUFFER, 0, GLsizeiptr(size), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    m_counters.uploadBytes += size;
+    count_calls(2);
+    return data;
+}
+
+void render_state::unmap_array_buffer()
+{
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    count_calls(1);
+}
+
+void render_state::bind_framebuffer(GLuint framebuffer)
+{
+    bool changed = m_readFramebuffer != framebuffer || m_drawFramebuffer != framebuffer;
+    if (changed) {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        m_readFramebuffer = framebuffer;
+        m_drawFramebuffer = framebuffer;
+    }
+    count(changed);
+}
+
+void render_state::bind_framebuffers(GLuint readFramebuffer, GLuint drawFramebuffer)
+{
+    bool readChanged = m_readFramebuffer != readFramebuffer;
+    if (readChanged) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+        m_readFramebuffer = readFramebuffer;
+    }
+    count(readChanged);
+    bool drawChanged = m_drawFramebuffer != drawFramebuffer;
+    if (drawChanged) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+        m_drawFramebuffer = drawFramebuffer;
+    }
+    count(drawChanged);
+}
+
+void render_state::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    bool changed = m_viewport[0] != x || m_viewport[1] != y || m_viewport[2] != width || m_viewport[3] != height;
+    if (changed) {
+        glViewport(x, y, width, height);
+        m_viewport[0] = x;
+        m_viewport[1] = y;
+        m_viewport[2] = width;
+        m_viewport[3] = height;
+    }
+    count(changed);
+}
+
+void render_state::count_calls(unsigned count)
+{
+    m_counters.issued += count;
+}
+
+void render_state::count_upload(size_t bytes)
+{
+    m_counters.uploadBytes += bytes;
+}
+
+const render_counters& render_state::counters() const
+{
+    return m_counters;
+}
+
+void render_state::reset_counters()
+{
+    m_counters = { 0, 0, 0 };
+}
+
+void render_state::count(bool issued)
+{
+    if (issued) {
+        m_counters.issued++;
+    } else {
+        m_counters.skipped++;
+    }
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Counters of GL calls made through render_state.
+ */
+struct render_counters
+{
+    /**
+     * Calls that reached the driver.
+     */
+    unsigned issued;
+    /**
+     * Calls that were dropped because they would not change the state.
+     */
+    unsigned skipped;
+    /**
+     * Bytes uploaded to buffers.
+     */
+    uint64_t uploadBytes;
+};
+
+/**
+ * Thin layer over the GL state that the render loop changes.
+ * It remembers the bound program, vertex array, textures, buffers, read and draw framebuffers and viewport
+ * and drops calls that would set the same values again.
+ *
+ * The layer assumes it is the only code that changes this state. If other code changes it, call invalidate().
+ */
+class render_state
+{
+public:
+    /**
+     * Maximal number of texture units that are tracked.
+     */
+    constexpr static GLuint MAX_TEXTURE_UNITS = 16;
+    /**
+     * Maximal number of uniform buffer binding points that are tracked.
+     */
+    constexpr static GLuint MAX_UNIFORM_BUFFERS = 16;
+
+    /**
+     * Constructor. The state is unknown, so the first call of each kind always reaches the driver.
+     */
+    render_state();
+    /**
+     * Forget the tracked state, e.g. after code outside the layer has changed it.
+     */
+    void invalidate();
+    /**
+     * Select a shader program.
+     * @param program Program.
+     */
+    void use_program(GLuint program);
+    /**
+     * Bind a vertex array object.
+     * @param vertexArray Vertex array object.
+     */
+    void bind_vertex_array(GLuint vertexArray);
+    /**
+     * Bind a texture to a texture unit.
+     * Only one texture is tracked per unit, so a unit should always be used with the same target.
+     * @param unit Texture unit number, less than MAX_TEXTURE_UNITS.
+     * @param texture Texture.
+     * @param target Texture target, e.g. GL_TEXTURE_BUFFER.
+     */
+    void bind_texture(GLuint unit, GLuint texture, GLenum target = GL_TEXTURE_2D);
+    /**
+     * Bind a texture to a texture unit and make the unit active, so calls such as glTexSubImage2D change the texture.
+     * @param unit Texture unit number, less than MAX_TEXTURE_UNITS.
+     * @param texture Texture.
+     * @param target Texture target.
+     */
+    void activate_texture(GLuint unit, GLuint texture, GLenum target = GL_TEXTURE_2D);
+    /**
+     * Bind a range of a uniform buffer to an indexed binding point, e.g. the part of a ring buffer written for a frame.
+     * @param index Binding point, less than MAX_UNIFORM_BUFFERS.
+     * @param buffer Buffer.
+     * @param offset Start of the range, a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+     * @param size Size of the range in bytes.
+     */
+    void bind_uniform_range(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    /**
+     * Bind a buffer to the GL_ARRAY_BUFFER binding point.
+     * @param buffer Buffer.
+     */
+    void bind_array_buffer(GLuint buffer);
+    /**
+     * Replace the storage of a vertex buffer that is rewritten every frame and map the new storage for writing.
+     * The old storage is orphaned, so the driver does not wait for draws that still read it.
+     * The buffer stays bound to GL_ARRAY_BUFFER until unmap_array_buffer() is called.
+     * @param buffer Buffer.
+     * @param size Size of the new storage in bytes.
+     * @return Pointer to the mapped storage, nullptr if it cannot be mapped.
+     */
+    void* map_array_buffer(GLuint buffer, size_t size);
+    /**
+     * Finish writing the buffer mapped by map_array_buffer().
+     */
+    void unmap_array_buffer();
+    /**
+     * Bind a framebuffer for drawing and reading.
+     * @param framebuffer Framebuffer, 0 for the window.
+     */
+    void bind_framebuffer(GLuint framebuffer);
+    /**
+     * Bind separate framebuffers for reading and drawing, e.g. for glBlitFramebuffer.
+     * @param readFramebuffer Framebuffer to read from, 0 for the window.
+     * @param drawFramebuffer Framebuffer to draw into, 0 for the window.
+     */
+    void bind_framebuffers(GLuint readFramebuffer, GLuint drawFramebuffer);
+    /**
+     * Set the viewport.
+     * @param x Left edge.
+     * @param y Bottom edge.
+     * @param width Width.
+     * @param height Height.
+     */
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    /**
+     * Count calls that do not go through the layer, such as clears and draws.
+     * @param count Number of calls.
+     */
+    void count_calls(unsigned count);
+    /**
+     * Count bytes written to buffers outside the layer, such as through a persistent mapping.
+     * @param bytes Number of bytes.
+     */
+    void count_upload(size_t bytes);
+    /**
+     * Return the counters since the last reset.
+     * @return Counters.
+     */
+    const render_counters& counters() const;
+    /**
+     * Reset the counters, e.g. at the start of a frame.
+     */
+    void reset_counters();
+
+private:
+    /**
+     * Value of tracked names that are not known.
+     */
+    constexpr static GLuint UNKNOWN = ~GLuint(0);
+
+    /**
+     * Count a call that reached the driver or was dropped.
+     * @param issued True if the call reached the driver.
+     */
+    void count(bool issued);
+
+    GLuint m_program;
+    GLuint m_vertexArray;
+    GLuint m_activeTexture;
+    GLuint m_textures[MAX_TEXTURE_UNITS];
+    GLuint m_arrayBuffer;
+    GLuint m_uniformBuffers[MAX_UNIFORM_BUFFERS];
+    /**
+     * Range bound to each uniform buffer binding point.
+     */
+    GLintptr m_uniformOffsets[MAX_UNIFORM_BUFFERS];
+    GLsizeiptr m_uniformSizes[MAX_UNIFORM_BUFFERS];
+    GLuint m_readFramebuffer;
+    GLuint m_drawFramebuffer;
+    GLint m_viewport[4];
+    /**
+     * Counters since the last reset.
+     */
+    render_counters m_counters;
+};
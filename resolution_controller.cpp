@@ -0,0 +1,77 @@
+#include "resolution_controller.h"
+
+#include <algorithm>
+#include <cmath>
+
+resolution_controller::resolution_controller(double targetMilliseconds, float minScale, float maxScale, float scale)
+    : m_target(targetMilliseconds)
+    , m_minScale(minScale)
+    , m_maxScale(maxScale)
+    , m_scale(std::min(std::max(scale, minScale), maxScale))
+    , m_settleFrames(SETTLE_FRAMES)
+    , m_lastDirection(0)
+    , m_statistics({ 0, 0.0, m_scale, m_scale, 0, 0 })
+{
+    m_samples.reserve(SAMPLE_FRAMES);
+}
+
+float resolution_controller::update(double milliseconds)
+{
+    m_statistics.frames++;
+    m_statistics.scaleSum += m_scale;
+    if (m_target <= 0.0) {
+        return m_scale;
+    }
+    if (m_settleFrames > 0) {
+        m_settleFrames--;
+        return m_scale;
+    }
+    m_samples.push_back(milliseconds);
+    if (m_samples.size() < SAMPLE_FRAMES) {
+        return m_scale;
+    }
+    std::nth_element(m_samples.begin(), m_samples.begin() + SAMPLE_FRAMES / 2, m_samples.end());
+    double median = m_samples[SAMPLE_FRAMES / 2];
+    m_samples.clear();
+
+    // Keep the scale while the frame time is inside the band below the target.
+    double wanted = m_target * (1.0 - HEADROOM);
+    if (median <= m_target && median >= wanted) {
+        return m_scale;
+    }
+    // The number of pixels goes with the square of the scale.
+    float factor = float(std::sqrt(wanted / median));
+    factor = std::min(std::max(factor, 1.0f - MAX_DECREASE), 1.0f + MAX_INCREASE);
+    float scale = std::round(m_scale * factor / SCALE_STEP) * SCALE_STEP;
+    scale = std::min(std::max(scale, m_minScale), m_maxScale);
+    if (scale == m_scale) {
+        return m_scale;
+    }
+
+    int direction = scale > m_scale ? 1 : -1;
+    if (m_lastDirection != 0 && direction != m_lastDirection) {
+        m_statistics.reversals++;
+    }
+    m_lastDirection = direction;
+    m_statistics.changes++;
+    m_statistics.minScale = std::min(m_statistics.minScale, scale);
+    m_statistics.maxScale = std::max(m_statistics.maxScale, scale);
+    m_scale = scale;
+    m_settleFrames = SETTLE_FRAMES;
+    return m_scale;
+}
+
+float resolution_controller::scale() const
+{
+    return m_scale;
+}
+
+double resolution_controller::target() const
+{
+    return m_target;
+}
+
+const resolution_statistics& resolution_controller::statistics() const
+{
+    return m_statistics;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * Statistics of the scale changes of a resolution_controller.
+ */
+struct resolution_statistics
+{
+    /**
+     * Number of frames and the sum of their scales, for the average scale.
+     */
+    size_t frames;
+    double scaleSum;
+    float minScale;
+    float maxScale;
+    /**
+     * Number of times the scale has changed.
+     */
+    unsigned changes;
+    /**
+     * Number of changes in the opposite direction of the previous change. Many reversals mean the scale oscillates.
+     */
+    unsigned reversals;
+};
+
+/**
+ * Controller of the dynamic resolution. It chooses the fraction of the output size the scene is rendered at,
+ * so the measured frame time stays at a target.
+ *
+ * The controller waits SETTLE_FRAMES after each change, so the frames still queued at the old scale do not count,
+ * then takes the median of SAMPLE_FRAMES frame times, which ignores single hitches. The frame time is assumed to grow
+ * with the number of pixels, so the scale is corrected by the square root of the ratio of the wanted time to the
+ * median. The wanted time lies HEADROOM below the target, and the scale is kept while the median is between the two,
+ * which keeps the scale from oscillating around the target. A scale may drop at once by up to MAX_DECREASE, but only
+ * rises by MAX_INCREASE per step, so a frame time over the target is corrected quickly and headroom is probed slowly.
+ * Scales are multiples of SCALE_STEP, smaller corrections are ignored.
+ */
+class resolution_controller
+{
+public:
+    /**
+     * Number of frames ignored after a scale change.
+     */
+    constexpr static size_t SETTLE_FRAMES = 4;
+    /**
+     * Number of frames whose median frame time is compared with the target.
+     */
+    constexpr static size_t SAMPLE_FRAMES = 8;
+    /**
+     * Fraction of the target frame time that is kept free. The scale rises only if frames are this much faster.
+     */
+    constexpr static float HEADROOM = 0.1f;
+    /**
+     * Largest relative change of the scale in one step.
+     */
+    constexpr static float MAX_DECREASE = 0.25f;
+    constexpr static float MAX_INCREASE = 0.1f;
+    /**
+     * Granularity of the scale.
+     */
+    constexpr static float SCALE_STEP = 0.025f;
+
+    /**
+     * Constructor.
+     * @param targetMilliseconds Wanted frame time, 0 keeps the initial scale.
+     * @param minScale Smallest scale.
+     * @param maxScale Largest scale.
+     * @param scale Initial scale.
+     */
+    resolution_controller(double targetMilliseconds, float minScale, float maxScale, float scale);
+    /**
+     * Add the time of a frame drawn at the current scale and update the scale.
+     * @param milliseconds Frame time in milliseconds.
+     * @return Scale of the next frame.
+     */
+    float update(double milliseconds);
+    /**
+     * Return the scale of the next frame.
+     * @return Fraction of the output width and height.
+     */
+    float scale() const;
+    /**
+     * Return the target frame time.
+     * @return Time in milliseconds, 0 if the scale is fixed.
+     */
+    double target() const;
+    /**
+     * Return the statistics of the scale over all updates.
+     * @return Statistics.
+     */
+    const resolution_statistics& statistics() const;
+
+private:
+    double m_target;
+    float m_minScale;
+    float m_maxScale;
+    float m_scale;
+    /**
+     * Frames left to ignore after the last change.
+     */
+    size_t m_settleFrames;
+    /**
+     * Frame times collected since the settle frames.
+     */
+    std::vector< double > m_samples;
+    /**
+     * Direction of the last change: -1 down, 1 up, 0 none yet.
+     */
+    int m_lastDirection;
+    resolution_statistics m_statistics;
+};
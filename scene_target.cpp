@@ -0,0 +1,167 @@
+#include "scene_target.h"
+#include "render_state.h"
+
+#include <algorithm>
+#include <cmath>
+
+scene_target::scene_target(int samples, bool fxaa, GLuint program)
+    : m_samples(1)
+    , m_fxaa(fxaa)
+    , m_program(program)
+    , m_sourceScaleLocation(glGetUniformLocation(program, "sourceScale"))
+    , m_vertexArray(0)
+    , m_framebuffer(0)
+    , m_colorBuffer(0)
+    , m_depthBuffer(0)
+    , m_resolveFramebuffer(0)
+    , m_texture(0)
+    , m_width(0)
+    , m_height(0)
+    , m_renderWidth(0)
+    , m_renderHeight(0)
+    , m_sourceScale{ -1.0f, -1.0f }
+{
+    GLint maxSamples = 0;
+    glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+    m_samples = std::max(std::min(samples, int(maxSamples)), 1);
+    glGenVertexArrays(1, &m_vertexArray);
+    // The texture unit and FXAA do not change while the program is used.
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "sourceTexture"), 0);
+    glUniform1i(glGetUniformLocation(program, "fxaaEnabled"), fxaa ? 1 : 0);
+    glUseProgram(0);
+}
+
+void scene_target::destroy()
+{
+    delete_buffers();
+    glDeleteVertexArrays(1, &m_vertexArray);
+    m_vertexArray = 0;
+}
+
+bool scene_target::resize(int width, int height)
+{
+    if (width == m_width && height == m_height) {
+        return true;
+    }
+    delete_buffers();
+    m_width = width;
+    m_height = height;
+    bool complete = true;
+
+    // Single-sampled texture, the post program reads it with bilinear filtering and never outside the used part.
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glGenFramebuffers(1, &m_resolveFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_resolveFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0);
+
+    glGenRenderbuffers(1, &m_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+    if (m_samples > 1) {
+        // Multisampled buffers that the scene is drawn into.
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, m_samples, GL_DEPTH_COMPONENT24, width, height);
+        glGenRenderbuffers(1, &m_colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_colorBuffer);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, m_samples, GL_RGBA8, width, height);
+        complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glGenFramebuffers(1, &m_framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBuffer);
+    } else {
+        // The scene is drawn straight into the texture.
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    }
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+    complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return complete;
+}
+
+void scene_target::begin(render_state& state, float scale)
+{
+    m_renderWidth = std::min(std::max(int(std::lround(m_width * scale)), 1), m_width);
+    m_renderHeight = std::min(std::max(int(std::lround(m_height * scale)), 1), m_height);
+    state.bind_framebuffer(m_samples > 1 ? m_framebuffer : m_resolveFramebuffer);
+    state.viewport(0, 0, m_renderWidth, m_renderHeight);
+    // glClear ignores the viewport, the scissor keeps it to the used part.
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(0, 0, m_renderWidth, m_renderHeight);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+    state.count_calls(4);
+}
+
+void scene_target::present(render_state& state, GLuint framebuffer)
+{
+    // Nothing to scale or smooth, resolving the samples into the output is all that is left.
+    if (m_renderWidth == m_width && m_renderHeight == m_height && !m_fxaa) {
+        state.bind_framebuffers(m_samples > 1 ? m_framebuffer : m_resolveFramebuffer, framebuffer);
+        glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        state.count_calls(1);
+        return;
+    }
+
+    if (m_samples > 1) {
+        state.bind_framebuffers(m_framebuffer, m_resolveFramebuffer);
+        glBlitFramebuffer(0, 0, m_renderWidth, m_renderHeight, 0, 0, m_renderWidth, m_renderHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        state.count_calls(1);
+    }
+
+    // Draw a triangle over the whole output, without depth test and culling.
+    state.bind_framebuffer(framebuffer);
+    state.viewport(0, 0, m_width, m_height);
+    state.use_program(m_program);
+    state.bind_texture(0, m_texture);
+    state.bind_vertex_array(m_vertexArray);
+    float sourceScale[2] = { float(m_renderWidth) / m_width, float(m_renderHeight) / m_height };
+    if (sourceScale[0] != m_sourceScale[0] || sourceScale[1] != m_sourceScale[1]) {
+        glUniform2f(m_sourceScaleLocation, sourceScale[0], sourceScale[1]);
+        m_sourceScale[0] = sourceScale[0];
+        m_sourceScale[1] = sourceScale[1];
+        state.count_calls(1);
+    }
+    glDisable(GL_DEPTH_TEST);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glEnable(GL_DEPTH_TEST);
+    state.count_calls(3);
+}
+
+int scene_target::samples() const
+{
+    return m_samples;
+}
+
+int scene_target::render_width() const
+{
+    return m_renderWidth;
+}
+
+int scene_target::render_height() const
+{
+    return m_renderHeight;
+}
+
+void scene_target::delete_buffers()
+{
+    GLuint framebuffers[] = { m_framebuffer, m_resolveFramebuffer };
+    glDeleteFramebuffers(sizeof(framebuffers) / sizeof(framebuffers[0]), framebuffers);
+    GLuint renderbuffers[] = { m_colorBuffer, m_depthBuffer };
+    glDeleteRenderbuffers(sizeof(renderbuffers) / sizeof(renderbuffers[0]), renderbuffers);
+    glDeleteTextures(1, &m_texture);
+    m_framebuffer = 0;
+    m_colorBuffer = 0;
+    m_depthBuffer = 0;
+    m_resolveFramebuffer = 0;
+    m_texture = 0;
+    m_width = 0;
+    m_height = 0;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+class render_state;
+
+/**
+ * Off-screen framebuffer the scene is drawn into before it is scaled to the output.
+ *
+ * Buffers are allocated at the output size once, a frame at a lower resolution only uses the lower left part of them,
+ * so changing the resolution every few frames does not reallocate anything. With multisampling the scene is drawn
+ * into multisampled renderbuffers and the used part is resolved into a single-sampled texture, without it the scene
+ * is drawn straight into the texture.
+ *
+ * The texture is then drawn over the whole output with the post program (post.vs, post.fs). It scales the frame
+ * bilinearly and optionally smooths edges with FXAA, which is much cheaper than multisampling since it runs once
+ * per output pixel after the scene. A frame at the full resolution without FXAA skips the post program and is
+ * resolved straight into the output.
+ */
+class scene_target
+{
+public:
+    /**
+     * Constructor. Needs a current GL context, buffers are allocated by resize().
+     * @param samples Wanted number of samples per pixel, 0 or 1 disables multisampling.
+     *                It is limited to what the driver supports.
+     * @param fxaa Smooth edges with FXAA.
+     * @param program Linked post program.
+     */
+    scene_target(int samples, bool fxaa, GLuint program);
+    /**
+     * Delete the buffers. Must be called while the GL context is current.
+     */
+    void destroy();
+    /**
+     * Allocate the buffers for an output size, does nothing if the size has not changed.
+     * Bindings are changed behind the state cache, call render_state::invalidate() afterwards.
+     * @param width Output width in pixels.
+     * @param height Output height in pixels.
+     * @return True if the framebuffers are complete.
+     */
+    bool resize(int width, int height);
+    /**
+     * Bind the framebuffer for drawing the scene at a fraction of the output size and clear the used part.
+     * @param state GL state cache.
+     * @param scale Fraction of the output width and height.
+     */
+    void begin(render_state& state, float scale);
+    /**
+     * Resolve the scene drawn since begin() and draw it scaled over a framebuffer.
+     * @param state GL state cache.
+     * @param framebuffer Framebuffer to draw into, 0 for the window.
+     */
+    void present(render_state& state, GLuint framebuffer);
+    /**
+     * Return the number of samples per pixel.
+     * @return Samples, 1 without multisampling.
+     */
+    int samples() const;
+    /**
+     * Return the size the scene is drawn at since the last begin().
+     * @return Size in pixels.
+     */
+    int render_width() const;
+    int render_height() const;
+
+private:
+    scene_target(const scene_target&) = delete;
+    scene_target& operator=(const scene_target&) = delete;
+
+    /**
+     * Delete the framebuffers, the renderbuffers and the texture.
+     */
+    void delete_buffers();
+
+    int m_samples;
+    bool m_fxaa;
+    GLuint m_program;
+    /**
+     * Location of the sourceScale uniform of the post program.
+     */
+    GLint m_sourceScaleLocation;
+    /**
+     * Empty vertex array, the full screen triangle of post.vs has no attributes.
+     */
+    GLuint m_vertexArray;
+    /**
+     * Multisampled framebuffer the scene is drawn into, 0 without multisampling.
+     */
+    GLuint m_framebuffer;
+    GLuint m_colorBuffer;
+    /**
+     * Depth buffer, multisampled if m_framebuffer is used.
+     */
+    GLuint m_depthBuffer;
+    /**
+     * Single-sampled framebuffer with the texture read by the post program.
+     */
+    GLuint m_resolveFramebuffer;
+    GLuint m_texture;
+    /**
+     * Allocated size and the size of the current frame.
+     */
+    int m_width;
+    int m_height;
+    int m_renderWidth;
+    int m_renderHeight;
+    /**
+     * Value of sourceScale last given to the post program.
+     */
+    float m_sourceScale[2];
+};
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+
+// Select the widest instruction set enabled for the compiler.
+// Build with -mavx2 (or /arch:AVX2) to get 8 lanes, x86-64 always has at least SSE2 with 4 lanes,
+// other targets fall back to scalar code with 1 lane. Define SIMD_DISABLE to force the scalar code.
+#if defined(SIMD_DISABLE)
+#elif defined(__AVX2__)
+#define SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__FMA__) && (defined(SIMD_AVX2) || defined(SIMD_SSE2))
+#include <immintrin.h>
+#endif
+
+/**
+ * Helper type that holds WIDTH float values processed with one instruction.
+ * Code written with it is compiled to AVX2, SSE2 or plain scalar code depending on the compiler flags.
+ * Arithmetic operations are IEEE operations on each lane, so they round exactly like scalar float code.
+ * simd_round() rounds halfway values to even and simd_floor() rounds down, both expect values that fit into int32.
+ * simd_fma() rounds once when the target has FMA instructions (-mfma) and twice otherwise, the same as its float overload.
+ * The compiler may contract other multiplications and additions differently in SIMD and scalar code,
+ * so code that must give the same results in both forms uses simd_fma() for every product it adds.
+ */
+struct simd_float
+{
+#if defined(SIMD_AVX2)
+    constexpr static int WIDTH = 8;
+    typedef __m256 native;
+#elif defined(SIMD_SSE2)
+    constexpr static int WIDTH = 4;
+    typedef __m128 native;
+#else
+    constexpr static int WIDTH = 1;
+    typedef float native;
+#endif
+    native v;
+};
+
+/**
+ * Result of a lane-wise comparison of two simd_float values.
+ */
+struct simd_mask
+{
+#if defined(SIMD_AVX2)
+    typedef __m256 native;
+#elif defined(SIMD_SSE2)
+    typedef __m128 native;
+#else
+    typedef bool native;
+#endif
+    native v;
+};
+
+#if defined(SIMD_AVX2)
+
+inline simd_float simd_load(const float* p) { return { _mm256_loadu_ps(p) }; }
+inline void simd_store(float* p, simd_float a) { _mm256_storeu_ps(p, a.v); }
+inline simd_float simd_broadcast(float a) { return { _mm256_set1_ps(a) }; }
+inline simd_float operator+(simd_float a, simd_float b) { return { _mm256_add_ps(a.v, b.v) }; }
+inline simd_float operator-(simd_float a, simd_float b) { return { _mm256_sub_ps(a.v, b.v) }; }
+inline simd_float operator*(simd_float a, simd_float b) { return { _mm256_mul_ps(a.v, b.v) }; }
+inline simd_float operator/(simd_float a, simd_float b) { return { _mm256_div_ps(a.v, b.v) }; }
+inline simd_float operator-(simd_float a) { return { _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)) }; }
+#if defined(__FMA__)
+inline simd_float simd_fma(simd_float a, simd_float b, simd_float c) { return { _mm256_fmadd_ps(a.v, b.v, c.v) }; }
+#else
+inline simd_float simd_fma(simd_float a, simd_float b, simd_float c) { return { _mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v) }; }
+#endif
+inline simd_float simd_sqrt(simd_float a) { return { _mm256_sqrt_ps(a.v) }; }
+inline simd_float simd_min(simd_float a, simd_float b) { return { _mm256_min_ps(a.v, b.v) }; }
+inline simd_float simd_max(simd_float a, simd_float b) { return { _mm256_max_ps(a.v, b.v) }; }
+inline simd_float simd_abs(simd_float a) { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; }
+inline simd_mask operator<(simd_float a, simd_float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+inline simd_mask operator<=(simd_float a, simd_float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+inline simd_mask operator>(simd_float a, simd_float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+inline simd_mask operator>=(simd_float a, simd_float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+inline simd_mask operator&(simd_mask a, simd_mask b) { return { _mm256_and_ps(a.v, b.v) }; }
+inline simd_mask operator|(simd_mask a, simd_mask b) { return { _mm256_or_ps(a.v, b.v) }; }
+inline simd_mask simd_not(simd_mask a) { return { _mm256_xor_ps(a.v, _mm256_castsi256_ps(_mm256_set1_epi32(-1))) }; }
+inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+inline int simd_bits(simd_mask m) { return _mm256_movemask_ps(m.v); }
+inline simd_float simd_round(simd_float a) { return { _mm256_round_ps(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC) }; }
+inline simd_float simd_floor(simd_float a) { return { _mm256_floor_ps(a.v) }; }
+
+#elif defined(SIMD_SSE2)
+
+inline simd_float simd_load(const float* p) { return { _mm_loadu_ps(p) }; }
+inline void simd_store(float* p, simd_float a) { _mm_storeu_ps(p, a.v); }
+inline simd_float simd_broadcast(float a) { return { _mm_set1_ps(a) }; }
+inline simd_float operator+(simd_float a, simd_float b) { return { _mm_add_ps(a.v, b.v) }; }
+inline simd_float operator-(simd_float a, simd_float b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline simd_float operator*(simd_float a, simd_float b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline simd_float operator/(simd_float a, simd_float b) { return { _mm_div_ps(a.v, b.v) }; }
+inline simd_float operator-(simd_float a) { return { _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)) }; }
+#if defined(__FMA__)
+inline simd_float simd_fma(simd_float a, simd_float b, simd_float c) { return { _mm_fmadd_ps(a.v, b.v, c.v) }; }
+#else
+inline simd_float simd_fma(simd_float a, simd_float b, simd_float c) { return { _mm_add_ps(_mm_mul_ps(a.v, b.v), c.v) }; }
+#endif
+inline simd_float simd_sqrt(simd_float a) { return { _mm_sqrt_ps(a.v) }; }
+inline simd_float simd_min(simd_float a, simd_float b) { return { _mm_min_ps(a.v, b.v) }; }
+inline simd_float simd_max(simd_float a, simd_float b) { return { _mm_max_ps(a.v, b.v) }; }
+inline simd_float simd_abs(simd_float a) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+inline simd_mask operator<(simd_float a, simd_float b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+inline simd_mask operator<=(simd_float a, simd_float b) { return { _mm_cmple_ps(a.v, b.v) }; }
+inline simd_mask operator>(simd_float a, simd_float b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+inline simd_mask operator>=(simd_float a, simd_float b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+inline simd_mask operator&(simd_mask a, simd_mask b) { return { _mm_and_ps(a.v, b.v) }; }
+inline simd_mask operator|(simd_mask a, simd_mask b) { return { _mm_or_ps(a.v, b.v) }; }
+inline simd_mask simd_not(simd_mask a) { return { _mm_xor_ps(a.v, _mm_castsi128_ps(_mm_set1_epi32(-1))) }; }
+inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { return { _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)) }; }
+inline int simd_bits(simd_mask m) { return _mm_movemask_ps(m.v); }
+inline simd_float simd_round(simd_float a) { return { _mm_cvtepi32_ps(_mm_cvtps_epi32(a.v)) }; }
+inline simd_float simd_floor(simd_float a)
+{
+    // Truncate, then step down the lanes that were rounded up, which are the negative ones with a fraction.
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    return { _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.0f))) };
+}
+
+#else
+
+inline simd_float simd_load(const float* p) { return { *p }; }
+inline void simd_store(float* p, simd_float a) { *p = a.v; }
+inline simd_float simd_broadcast(float a) { return { a }; }
+inline simd_float operator+(simd_float a, simd_float b) { return { a.v + b.v }; }
+inline simd_float operator-(simd_float a, simd_float b) { return { a.v - b.v }; }
+inline simd_float operator*(simd_float a, simd_float b) { return { a.v * b.v }; }
+inline simd_float operator/(simd_float a, simd_float b) { return { a.v / b.v }; }
+inline simd_float operator-(simd_float a) { return { -a.v }; }
+#if defined(__FMA__)
+inline simd_float simd_fma(simd_float a, simd_float b, simd_float c) { return { __builtin_fmaf(a.v, b.v, c.v) }; }
+#else
+inline simd_float simd_fma(simd_float a, simd_float b, simd_float c) { return { a.v * b.v + c.v }; }
+#endif
+inline simd_float simd_sqrt(simd_float a) { return { __builtin_sqrtf(a.v) }; }
+inline simd_float simd_min(simd_float a, simd_float b) { return { b.v < a.v ? b.v : a.v }; }
+inline simd_float simd_max(simd_float a, simd_float b) { return { a.v < b.v ? b.v : a.v }; }
+inline simd_float simd_abs(simd_float a) { return { a.v < 0.0f ? -a.v : a.v }; }
+inline simd_mask operator<(simd_float a, simd_float b) { return { a.v < b.v }; }
+inline simd_mask operator<=(simd_float a, simd_float b) { return { a.v <= b.v }; }
+inline simd_mask operator>(simd_float a, simd_float b) { return { a.v > b.v }; }
+inline simd_mask operator>=(simd_float a, simd_float b) { return { a.v >= b.v }; }
+inline simd_mask operator&(simd_mask a, simd_mask b) { return { a.v && b.v }; }
+inline simd_mask operator|(simd_mask a, simd_mask b) { return { a.v || b.v }; }
+inline simd_mask simd_not(simd_mask a) { return { !a.v }; }
+inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { return { m.v ? a.v : b.v }; }
+inline int simd_bits(simd_mask m) { return m.v ? 1 : 0; }
+inline simd_float simd_round(simd_float a) { return { __builtin_rintf(a.v) }; }
+inline simd_float simd_floor(simd_float a) { return { __builtin_floorf(a.v) }; }
+
+#endif
+
+/**
+ * Multiply and add float values the way simd_fma() does for each lane.
+ * @param a First factor.
+ * @param b Second factor.
+ * @param c Addend.
+ * @return a * b + c.
+ */
+#if defined(__FMA__)
+inline float simd_fma(float a, float b, float c) { return __builtin_fmaf(a, b, c); }
+#else
+inline float simd_fma(float a, float b, float c) { return a * b + c; }
+#endif
+/**
+ * Return true if the comparison is true for any lane.
+ * @param m Comparison result.
+ * @return True if any lane is set.
+ */
+inline bool simd_any(simd_mask m) { return simd_bits(m) != 0; }
+/**
+ * Return true if the comparison is true for all lanes.
+ * @param m Comparison result.
+ * @return True if all lanes are set.
+ */
+inline bool simd_all(simd_mask m) { return simd_bits(m) == (1 << simd_float::WIDTH) - 1; }
@@ -0,0 +1,660 @@
+#include "software_rasterizer.h"
+#include "cone_step_map.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+/**
+ * Offsets of the lanes of simd_float from the first pixel.
+ */
+const float LANE_OFFSETS[8] = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f };
+
+/**
+ * Count the lanes of a lane mask.
+ * @param bits Lane mask, bit i for lane i.
+ * @return Number of set bits.
+ */
+int lane_count(int bits)
+{
+    int count = 0;
+    for (; bits != 0; bits &= bits - 1) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Scale a vector of simd_float::WIDTH lanes to unit length.
+ * @param vector X, y and z components.
+ */
+void normalize(simd_float vector[3])
+{
+    simd_float inverseLength = simd_broadcast(1.0f) / simd_sqrt(vector[0] * vector[0] + vector[1] * vector[1] + vector[2] * vector[2]);
+    for (int i = 0; i < 3; i++) {
+        vector[i] = vector[i] * inverseLength;
+    }
+}
+
+}
+
+software_rasterizer::software_rasterizer(int width, int height, unsigned threadCount)
+    : m_width(width)
+    , m_height(height)
+    , m_paddedWidth((width + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE)
+    , m_paddedHeight((height + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE)
+    , m_tilesX(m_paddedWidth / TILE_SIZE)
+    , m_tilesY(m_paddedHeight / TILE_SIZE)
+    , m_rowSize(mip_texture::row_size(uint32_t(width)))
+    , m_depth(size_t(m_paddedWidth) * m_paddedHeight, 1.0f)
+    , m_blockDepth(size_t(m_paddedWidth / HIZ_BLOCK_SIZE) * (m_paddedHeight / HIZ_BLOCK_SIZE), 1.0f)
+    , m_bins(size_t(m_tilesX) * m_tilesY)
+    , m_tileStatistics(m_bins.size())
+    , m_statistics({ 0, 0, 0 })
+    , m_pool(threadCount)
+{
+    m_pixels.resize(m_rowSize * height, 0);
+}
+
+bool software_rasterizer::set_texture(texture_usage usage, const mip_texture& texture)
+{
+    if (texture.levels().empty() || texture.format() != TEXTURE_FORMAT_BGR8) {
+        return false;
+    }
+    std::vector< texture_level >& levels = m_textures[usage];
+    levels.resize(texture.levels().size());
+    for (size_t i = 0; i < levels.size(); i++) {
+        const mip_level& source = texture.levels()[i];
+        texture_level& level = levels[i];
+        level.width = int(source.width);
+        level.height = int(source.height);
+        level.texels.resize(size_t(level.width) * level.height * 3);
+        size_t rowSize = mip_texture::row_size(source.width);
+        for (int y = 0; y < level.height; y++) {
+            const uint8_t* row = texture.level_data(i) + y * rowSize;
+            float* texels = level.texels.data() + size_t(y) * level.width * 3;
+            for (int x = 0; x < level.width; x++) {
+                // Texels are stored as B, G, R, the shaders see R, G, B.
+                texels[x * 3] = row[x * 3 + 2] / 255.0f;
+                texels[x * 3 + 1] = row[x * 3 + 1] / 255.0f;
+                texels[x * 3 + 2] = row[x * 3] / 255.0f;
+            }
+        }
+    }
+    return true;
+}
+
+void software_rasterizer::clear(const glm::vec3& color)
+{
+    uint8_t bgr[3];
+    for (int i = 0; i < 3; i++) {
+        bgr[2 - i] = uint8_t(std::round(glm::clamp(color[i], 0.0f, 1.0f) * 255.0f));
+    }
+    for (int y = 0; y < m_height; y++) {
+        uint8_t* row = m_pixels.data() + y * m_rowSize;
+        for (int x = 0; x < m_width; x++) {
+            row[x * 3] = bgr[0];
+            row[x * 3 + 1] = bgr[1];
+            row[x * 3 + 2] = bgr[2];
+        }
+    }
+    std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+    std::fill(m_blockDepth.begin(), m_blockDepth.end(), 1.0f);
+}
+
+void software_rasterizer::draw(const packed_mesh& mesh, size_t lod, const raster_uniforms& uniforms)
+{
+    if (!mesh.indices() || lod >= mesh.lods().size() || m_textures[TEXTURE_COLOR].empty() || m_textures[TEXTURE_NORMAL].empty()
+        || m_textures[TEXTURE_DISPLACEMENT].empty()) {
+        return;
+    }
+    // Transform all vertices, levels of detail share them.
+    glm::mat4 mv = uniforms.cameraMatrix * uniforms.modelMatrix;
+    glm::mat4 mvp = uniforms.projectionMatrix * mv;
+    glm::vec3 lightPositionCameraSpace = glm::vec3(uniforms.cameraMatrix * glm::vec4(uniforms.lightPosition, 1.0f));
+    m_vertices.resize(mesh.vertex_count());
+    m_pool.parallel_for(mesh.vertex_count(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            m_vertices[i] = shade_vertex(mesh.vertices()[i], mesh, uniforms, mv, mvp, lightPositionCameraSpace);
+        }
+    });
+
+    // Set up and bin triangles in the order of the index buffer.
+    m_triangles.clear();
+    for (std::vector< uint32_t >& bin : m_bins) {
+        bin.clear();
+    }
+    const lod_level& level = mesh.lods()[lod];
+    for (uint32_t i = 0; i + 2 < level.indexCount; i += 3) {
+        uint32_t index[3];
+        for (int j = 0; j < 3; j++) {
+            size_t position = size_t(level.firstIndex) + i + j;
+            if (mesh.index_size() == sizeof(uint16_t)) {
+                index[j] = static_cast< const uint16_t* >(mesh.indices())[position];
+            } else {
+                index[j] = static_cast< const uint32_t* >(mesh.indices())[position];
+            }
+        }
+        setup_triangle(m_vertices[index[0]], m_vertices[index[1]], m_vertices[index[2]]);
+    }
+
+    // Draw tiles in parallel.
+    m_pool.parallel_for(m_bins.size(), [&](size_t begin, size_t end) {
+        for (size_t tile = begin; tile < end; tile++) {
+            draw_tile(tile);
+        }
+    });
+    for (const raster_statistics& tile : m_tileStatistics) {
+        m_statistics.pixels += tile.pixels;
+        m_statistics.fetches += tile.fetches;
+        m_statistics.displacementFetches += tile.displacementFetches;
+    }
+}
+
+const uint8_t* software_rasterizer::pixels() const
+{
+    return m_pixels.data();
+}
+
+int software_rasterizer::width() const
+{
+    return m_width;
+}
+
+int software_rasterizer::height() const
+{
+    return m_height;
+}
+
+const raster_statistics& software_rasterizer::statistics() const
+{
+    return m_statistics;
+}
+
+software_rasterizer::vertex_output software_rasterizer::shade_vertex(const packed_vertex& vertex, const packed_mesh& mesh,
+                                                                     const raster_uniforms& uniforms, const glm::mat4& mv,
+                                                                     const glm::mat4& mvp, const glm::vec3& lightPositionCameraSpace)
+{
+    // Unpack vertex attributes like main.vs does.
+    glm::vec3 position = mesh.position_offset();
+    for (int i = 0; i < 3; i++) {
+        position[i] += vertex.position[i] / 65535.0f * mesh.position_scale()[i];
+    }
+    glm::vec3 normal = packed_mesh::decode_octahedral(vertex.normal);
+    glm::vec3 tangent = packed_mesh::decode_octahedral(vertex.tangent);
+    glm::vec3 bitangent = glm::cross(normal, tangent) * (vertex.position[3] / 65535.0f * 2.0f - 1.0f);
+
+    vertex_output result;
+    result.position = mvp * glm::vec4(position, 1.0f);
+
+    // Directions to the camera and the light in camera space.
+    glm::vec3 eyeDirectionCameraSpace = -glm::vec3(mv * glm::vec4(position, 1.0f));
+    glm::vec3 lightDirectionCameraSpace = lightPositionCameraSpace + eyeDirectionCameraSpace;
+
+    // Rows of the inverse TBN matrix are the tangent frame in camera space. Model and camera matrices are affine,
+    // so the rotation part of their product is the product of their rotation parts.
+    glm::vec3 tangentCameraSpace = glm::vec3(mv * glm::vec4(tangent, 0.0f));
+    glm::vec3 bitangentCameraSpace = glm::vec3(mv * glm::vec4(bitangent, 0.0f));
+    glm::vec3 normalCameraSpace = glm::vec3(mv * glm::vec4(normal, 0.0f));
+    auto toTangentSpace = [&](const glm::vec3& v) {
+        return glm::vec3(glm::dot(tangentCameraSpace, v), glm::dot(bitangentCameraSpace, v), glm::dot(normalCameraSpace, v));
+    };
+    glm::vec2 uv = glm::unpackHalf2x16(vertex.uv);
+    glm::vec3 lightDirection = glm::normalize(toTangentSpace(lightDirectionCameraSpace));
+    glm::vec3 cameraDirection = glm::normalize(toTangentSpace(eyeDirectionCameraSpace));
+    glm::vec3 viewDirection = toTangentSpace(position) - toTangentSpace(uniforms.cameraPosition);
+    float* varyings = result.varyings;
+    varyings[0] = uv.x;
+    varyings[1] = uv.y;
+    for (int i = 0; i < 3; i++) {
+        varyings[2 + i] = lightDirection[i];
+        varyings[5 + i] = cameraDirection[i];
+        varyings[8 + i] = viewDirection[i];
+    }
+    return result;
+}
+
+void software_rasterizer::setup_triangle(const vertex_output& a, const vertex_output& b, const vertex_output& c)
+{
+    // A vertex is in front of the near plane if z >= -w.
+    const vertex_output* vertices[3] = { &a, &b, &c };
+    float distances[3];
+    int inside = 0;
+    for (int i = 0; i < 3; i++) {
+        distances[i] = vertices[i]->position.z + vertices[i]->position.w;
+        inside += distances[i] >= 0.0f ? 1 : 0;
+    }
+    if (inside == 3) {
+        bin_triangle(a, b, c);
+        return;
+    }
+    if (inside == 0) {
+        return;
+    }
+    // Cut off the part behind the near plane, the rest is a triangle or a quad. Values are linear in clip space.
+    vertex_output polygon[4];
+    int count = 0;
+    for (int i = 0; i < 3; i++) {
+        int next = (i + 1) % 3;
+        if (distances[i] >= 0.0f) {
+            polygon[count++] = *vertices[i];
+        }
+        if ((distances[i] >= 0.0f) != (distances[next] >= 0.0f)) {
+            float t = distances[i] / (distances[i] - distances[next]);
+            vertex_output& cut = polygon[count++];
+            cut.position = vertices[i]->position + (vertices[next]->position - vertices[i]->position) * t;
+            for (int j = 0; j < VARYING_COUNT; j++) {
+                cut.varyings[j] = vertices[i]->varyings[j] + (vertices[next]->varyings[j] - vertices[i]->varyings[j]) * t;
+            }
+        }
+    }
+    for (int i = 1; i + 1 < count; i++) {
+        bin_triangle(polygon[0], polygon[i], polygon[i + 1]);
+    }
+}
+
+void software_rasterizer::bin_triangle(const vertex_output& a, const vertex_output& b, const vertex_output& c)
+{
+    // Project to the screen, y goes up like in the GL window coordinates.
+    const vertex_output* vertices[3] = { &a, &b, &c };
+    float x[3];
+    float y[3];
+    float values[3][PLANE_COUNT];
+    for (int i = 0; i < 3; i++) {
+        const glm::vec4& position = vertices[i]->position;
+        float q = 1.0f / position.w;
+        x[i] = (position.x * q * 0.5f + 0.5f) * m_width;
+        y[i] = (position.y * q * 0.5f + 0.5f) * m_height;
+        values[i][0] = position.z * q * 0.5f + 0.5f;
+        values[i][1] = q;
+        for (int j = 0; j < VARYING_COUNT; j++) {
+            values[i][2 + j] = vertices[i]->varyings[j] * q;
+        }
+    }
+    // Front faces are counter-clockwise, drop back faces and empty triangles.
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(area > 0.0f)) {
+        return;
+    }
+    raster_triangle triangle;
+    triangle.minX = std::max(int(std::ceil(std::min({ x[0], x[1], x[2] }) - 0.5f)), 0);
+    triangle.minY = std::max(int(std::ceil(std::min({ y[0], y[1], y[2] }) - 0.5f)), 0);
+    triangle.maxX = std::min(int(std::floor(std::max({ x[0], x[1], x[2] }) - 0.5f)), m_width - 1);
+    triangle.maxY = std::min(int(std::floor(std::max({ y[0], y[1], y[2] }) - 0.5f)), m_height - 1);
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+        return;
+    }
+    triangle.minDepth = std::min({ values[0][0], values[1][0], values[2][0] });
+    // Edge i goes from vertex i to the next one and is zero at the vertex opposite to it,
+    // so edge i divided by the area is the barycentric weight of the vertex i + 2.
+    for (int i = 0; i < 3; i++) {
+        int next = (i + 1) % 3;
+        float dx = x[next] - x[i];
+        float dy = y[next] - y[i];
+        triangle.edges[i][0] = -dy;
+        triangle.edges[i][1] = dx;
+        triangle.edges[i][2] = dy * x[i] - dx * y[i];
+        // The inside is on the left, pixels on left edges and top edges belong to the triangle.
+        triangle.ownsEdge[i] = dy < 0.0f || (dy == 0.0f && dx < 0.0f);
+    }
+    for (int p = 0; p < PLANE_COUNT; p++) {
+        for (int k = 0; k < 3; k++) {
+            float value = 0.0f;
+            for (int i = 0; i < 3; i++) {
+                value += values[(i + 2) % 3][p] * triangle.edges[i][k];
+            }
+            triangle.planes[p][k] = value / area;
+        }
+    }
+    uint32_t index = uint32_t(m_triangles.size());
+    m_triangles.push_back(triangle);
+    for (int ty = triangle.minY / TILE_SIZE; ty <= triangle.maxY / TILE_SIZE; ty++) {
+        for (int tx = triangle.minX / TILE_SIZE; tx <= triangle.maxX / TILE_SIZE; tx++) {
+            m_bins[size_t(ty) * m_tilesX + tx].push_back(index);
+        }
+    }
+}
+
+void software_rasterizer::draw_tile(size_t tile)
+{
+    const int tileX = int(tile % m_tilesX) * TILE_SIZE;
+    const int tileY = int(tile / m_tilesX) * TILE_SIZE;
+    const int blocksPerRow = m_paddedWidth / HIZ_BLOCK_SIZE;
+    const simd_float ZERO = simd_broadcast(0.0f);
+    const simd_float HALF = simd_broadcast(0.5f);
+    const simd_float ONE = simd_broadcast(1.0f);
+    const simd_float CHANNEL_MAX = simd_broadcast(255.0f);
+    const simd_float LANES = simd_load(LANE_OFFSETS);
+    const simd_float FRAME_WIDTH = simd_broadcast(float(m_width));
+    raster_statistics& statistics = m_tileStatistics[tile];
+    statistics = { 0, 0, 0 };
+    for (uint32_t index : m_bins[tile]) {
+        const raster_triangle& triangle = m_triangles[index];
+        int minX = std::max(triangle.minX, tileX);
+        int minY = std::max(triangle.minY, tileY);
+        int maxX = std::min(triangle.maxX, tileX + TILE_SIZE - 1);
+        int maxY = std::min(triangle.maxY, tileY + TILE_SIZE - 1);
+        simd_float edges[3][3];
+        for (int i = 0; i < 3; i++) {
+            for (int k = 0; k < 3; k++) {
+                edges[i][k] = simd_broadcast(triangle.edges[i][k]);
+            }
+        }
+        simd_float depthPlane[3];
+        for (int k = 0; k < 3; k++) {
+            depthPlane[k] = simd_broadcast(triangle.planes[0][k]);
+        }
+        for (int blockY = minY / HIZ_BLOCK_SIZE * HIZ_BLOCK_SIZE; blockY <= maxY; blockY += HIZ_BLOCK_SIZE) {
+            for (int blockX = minX / HIZ_BLOCK_SIZE * HIZ_BLOCK_SIZE; blockX <= maxX; blockX += HIZ_BLOCK_SIZE) {
+                // Skip blocks whose pixels are all nearer than the triangle.
+                float& blockDepth = m_blockDepth[size_t(blockY / HIZ_BLOCK_SIZE) * blocksPerRow + blockX / HIZ_BLOCK_SIZE];
+                if (triangle.minDepth >= blockDepth) {
+                    continue;
+                }
+                bool written = false;
+                for (int y = std::max(blockY, minY); y <= std::min(blockY + HIZ_BLOCK_SIZE - 1, maxY); y++) {
+                    simd_float py = simd_broadcast(y + 0.5f);
+                    float* depthRow = m_depth.data() + size_t(y) * m_paddedWidth;
+                    uint8_t* pixelRow = m_pixels.data() + y * m_rowSize;
+                    for (int x = blockX; x < blockX + HIZ_BLOCK_SIZE; x += simd_float::WIDTH) {
+                        simd_float px = simd_broadcast(x + 0.5f) + LANES;
+                        simd_mask inside = px < FRAME_WIDTH;
+                        for (int i = 0; i < 3; i++) {
+                            simd_float e = edges[i][0] * px + edges[i][1] * py + edges[i][2];
+                            inside = inside & (triangle.ownsEdge[i] ? e >= ZERO : e > ZERO);
+                        }
+                        if (!simd_any(inside)) {
+                            continue;
+                        }
+                        simd_float z = depthPlane[0] * px + depthPlane[1] * py + depthPlane[2];
+                        simd_mask covered = inside & (z < simd_load(depthRow + x));
+                        if (!simd_any(covered)) {
+                            continue;
+                        }
+                        // The shading may discard pixels, so the depth is written only for the shaded ones.
+                        simd_float color[3];
+                        int bits = simd_bits(shade_pixels(triangle, px, py, covered, color, statistics));
+                        if (bits == 0) {
+                            continue;
+                        }
+                        float depths[simd_float::WIDTH];
+                        simd_store(depths, z);
+                        float channels[3][simd_float::WIDTH];
+                        for (int c = 0; c < 3; c++) {
+                            simd_float clamped = simd_min(simd_select(color[c] > ZERO, color[c], ZERO), ONE);
+                            simd_store(channels[c], simd_floor(clamped * CHANNEL_MAX + HALF));
+                        }
+                        for (int lane = 0; lane < simd_float::WIDTH; lane++) {
+                            if (!(bits & (1 << lane))) {
+                                continue;
+                            }
+                            depthRow[x + lane] = depths[lane];
+                            uint8_t* pixel = pixelRow + (x + lane) * 3;
+                            for (int c = 0; c < 3; c++) {
+                                pixel[2 - c] = uint8_t(channels[c][lane]);
+                            }
+                        }
+                        written = true;
+                    }
+                }
+                if (written) {
+                    float farthest = 0.0f;
+                    for (int y = blockY; y < blockY + HIZ_BLOCK_SIZE; y++) {
+                        const float* depthRow = m_depth.data() + size_t(y) * m_paddedWidth + blockX;
+                        farthest = std::max(farthest, *std::max_element(depthRow, depthRow + HIZ_BLOCK_SIZE));
+                    }
+                    blockDepth = farthest;
+                }
+            }
+        }
+    }
+}
+
+simd_mask software_rasterizer::shade_pixels(const raster_triangle& triangle, simd_float x, simd_float y, simd_mask covered,
+                                            simd_float color[3], raster_statistics& statistics) const
+{
+    const simd_float ZERO = simd_broadcast(0.0f);
+    const simd_float HALF = simd_broadcast(0.5f);
+    const simd_float ONE = simd_broadcast(1.0f);
+    const simd_float TWO = simd_broadcast(2.0f);
+    int coveredBits = simd_bits(covered);
+    statistics.pixels += lane_count(coveredBits);
+    // Interpolate the varyings with perspective correction.
+    auto plane = [&](int p, int k) { return simd_broadcast(triangle.planes[p][k]); };
+    auto interpolate = [&](int p) { return plane(p, 0) * x + plane(p, 1) * y + plane(p, 2); };
+    simd_float w = ONE / interpolate(1);
+    simd_float varyings[VARYING_COUNT];
+    for (int i = 0; i < VARYING_COUNT; i++) {
+        varyings[i] = interpolate(2 + i) * w;
+    }
+    simd_float u = varyings[0];
+    simd_float v = varyings[1];
+    simd_float viewDirection[3] = { varyings[8], varyings[9], varyings[10] };
+    simd_float lightDirection[3] = { varyings[2], varyings[3], varyings[4] };
+    simd_float cameraDirection[3] = { varyings[5], varyings[6], varyings[7] };
+    normalize(viewDirection);
+    normalize(lightDirection);
+    normalize(cameraDirection);
+
+    // Level of detail of each texture from the screen space derivatives of the texture coordinates.
+    // The derivative of u = (u / w) / (1 / w) is ((u / w)' - u * (1 / w)') * w.
+    simd_float uDx = (plane(2, 0) - u * plane(1, 0)) * w;
+    simd_float vDx = (plane(3, 0) - v * plane(1, 0)) * w;
+    simd_float uDy = (plane(2, 1) - u * plane(1, 1)) * w;
+    simd_float vDy = (plane(3, 1) - v * plane(1, 1)) * w;
+    auto lod = [&](const std::vector< texture_level >& levels) {
+        simd_float width = simd_broadcast(float(levels[0].width));
+        simd_float height = simd_broadcast(float(levels[0].height));
+        simd_float rhoX = simd_sqrt(uDx * width * (uDx * width) + vDx * height * (vDx * height));
+        simd_float rhoY = simd_sqrt(uDy * width * (uDy * width) + vDy * height * (vDy * height));
+        float lods[simd_float::WIDTH];
+        simd_store(lods, simd_max(rhoX, rhoY));
+        for (int lane = 0; lane < simd_float::WIDTH; lane++) {
+            lods[lane] = coveredBits & (1 << lane) ? std::log2(lods[lane]) : 0.0f;
+        }
+        return simd_load(lods);
+    };
+    // Textures of the same size share the level of detail.
+    const std::vector< texture_level >& displacement = m_textures[TEXTURE_DISPLACEMENT];
+    const std::vector< texture_level >& normalTexture = m_textures[TEXTURE_NORMAL];
+    const std::vector< texture_level >& colorTexture = m_textures[TEXTURE_COLOR];
+    auto same_size = [&](const std::vector< texture_level >& levels) {
+        return levels[0].width == displacement[0].width && levels[0].height == displacement[0].height;
+    };
+    simd_float displacementLod = lod(displacement);
+    simd_float normalLod = same_size(normalTexture) ? displacementLod : lod(normalTexture);
+    simd_float colorLod = same_size(colorTexture) ? displacementLod : lod(colorTexture);
+
+    // The cone steps sample the nearest mip level of the displacement like main.fs.
+    simd_float lastLevel = simd_broadcast(float(displacement.size() - 1));
+    simd_float nearestLevel = simd_min(simd_floor(simd_select(displacementLod > ZERO, displacementLod, ZERO) + HALF), lastLevel);
+    float levelIndices[simd_float::WIDTH];
+    simd_store(levelIndices, nearestLevel);
+    const texture_level* displacementLevels[simd_float::WIDTH];
+    for (int lane = 0; lane < simd_float::WIDTH; lane++) {
+        displacementLevels[lane] = &displacement[size_t(levelIndices[lane])];
+    }
+    int parallaxFetches = 0;
+
+    // Relaxed cone stepping: step to the side of the cone above the surface until the ray is on or below it.
+    // A lane stops at the surface or after its number of steps, the loop ends when all lanes have stopped.
+    simd_float rayX = viewDirection[0] * simd_broadcast(-cone_step_map::MAX_RATIO);
+    simd_float rayY = viewDirection[1] * simd_broadcast(-cone_step_map::MAX_RATIO);
+    simd_float rayRatio = simd_sqrt(rayX * rayX + rayY * rayY);
+    simd_float coneSteps = simd_broadcast(float(cone_step_map::MAX_STEPS))
+                           + simd_broadcast(float(cone_step_map::MIN_STEPS - cone_step_map::MAX_STEPS)) * simd_abs(viewDirection[2]);
+    const simd_float SURFACE_EPSILON = simd_broadcast(cone_step_map::SURFACE_EPSILON);
+    const simd_float MAX_RATIO = simd_broadcast(cone_step_map::MAX_RATIO);
+    simd_float texU = u;
+    simd_float texV = v;
+    simd_float rayDepth = ZERO;
+    simd_float stepDepth = ZERO;
+    simd_float height = ONE;
+    simd_mask marching = covered;
+    for (int i = 0; i < cone_step_map::MAX_STEPS; i++) {
+        // A lane takes int(coneSteps) steps.
+        marching = marching & (simd_broadcast(float(i + 1)) <= coneSteps);
+        int bits = simd_bits(marching);
+        if (bits == 0) {
+            break;
+        }
+        simd_float texel[2];
+        sample_level(displacementLevels, texU, texV, bits, 2, texel);
+        parallaxFetches += lane_count(bits);
+        height = simd_select(marching, texel[0] - rayDepth, height);
+        marching = marching & simd_not(height < SURFACE_EPSILON);
+        simd_float coneRatio = texel[1] * texel[1] * MAX_RATIO;
+        stepDepth = simd_select(marching, coneRatio * height / (rayRatio + coneRatio), stepDepth);
+        texU = simd_select(marching, texU + rayX * stepDepth, texU);
+        texV = simd_select(marching, texV + rayY * stepDepth, texV);
+        rayDepth = simd_select(marching, rayDepth + stepDepth, rayDepth);
+    }
+    // A step that ends below the surface has crossed it once, search the crossing from the middle of the step.
+    simd_mask crossed = covered & (height < ZERO);
+    int crossedBits = simd_bits(crossed);
+    if (crossedBits != 0) {
+        simd_float range = stepDepth * HALF;
+        texU = simd_select(crossed, texU - rayX * range, texU);
+        texV = simd_select(crossed, texV - rayY * range, texV);
+        rayDepth = simd_select(crossed, rayDepth - range, rayDepth);
+        for (int i = 0; i < cone_step_map::SEARCH_STEPS; i++) {
+            range = range * HALF;
+            simd_float depth;
+            sample_level(displacementLevels, texU, texV, crossedBits, 1, &depth);
+            parallaxFetches += lane_count(crossedBits);
+            simd_float step = range * simd_select(rayDepth < depth, ONE, -ONE);
+            texU = simd_select(crossed, texU + rayX * step, texU);
+            texV = simd_select(crossed, texV + rayY * step, texV);
+            rayDepth = simd_select(crossed, rayDepth + step, rayDepth);
+        }
+    }
+    statistics.displacementFetches += parallaxFetches;
+    statistics.fetches += parallaxFetches;
+
+    // Discard pixels moved out of the texture.
+    simd_mask outside = (texU > ONE) | (texV > ONE) | (texU < ZERO) | (texV < ZERO);
+    simd_mask shaded = covered & simd_not(outside);
+    int shadedBits = simd_bits(shaded);
+    if (shadedBits == 0) {
+        return shaded;
+    }
+
+    // The normal keeps x and y, z is the positive value that makes it unit length.
+    simd_float normalTexel[3];
+    sample(normalTexture, texU, texV, normalLod, shadedBits, normalTexel);
+    simd_float normal[3];
+    normal[0] = normalTexel[0] * TWO - ONE;
+    normal[1] = normalTexel[1] * TWO - ONE;
+    normal[2] = simd_sqrt(simd_max(ONE - (normal[0] * normal[0] + normal[1] * normal[1]), ZERO));
+    simd_float textureColor[3];
+    sample(colorTexture, texU, texV, colorLod, shadedBits, textureColor);
+    statistics.fetches += 2 * lane_count(shadedBits);
+
+    // Ambient, diffuse and specular light.
+    simd_float lightDot = normal[0] * lightDirection[0] + normal[1] * lightDirection[1] + normal[2] * lightDirection[2];
+    simd_float diffuseFactor = simd_max(lightDot, ZERO);
+    simd_float reflectionDot = ZERO;
+    for (int i = 0; i < 3; i++) {
+        simd_float reflection = normal[i] * (TWO * lightDot) - lightDirection[i];
+        reflectionDot = reflectionDot + reflection * cameraDirection[i];
+    }
+    simd_float specularFactor = simd_max(reflectionDot * HALF, ZERO) * HALF;
+    simd_float light = simd_broadcast(0.2f) + diffuseFactor + specularFactor;
+    for (int c = 0; c < 3; c++) {
+        color[c] = textureColor[c] * light;
+    }
+    return shaded;
+}
+
+void software_rasterizer::sample(const std::vector< texture_level >& levels, simd_float u, simd_float v, simd_float lod, int bits,
+                                 simd_float result[3])
+{
+    // Magnification and the finest level use level 0, the coarsest level is used for anything beyond it.
+    const simd_float ZERO = simd_broadcast(0.0f);
+    simd_float clamped = simd_min(simd_select(lod > ZERO, lod, ZERO), simd_broadcast(float(levels.size() - 1)));
+    simd_float finerLevel = simd_floor(clamped);
+    simd_float weight = clamped - finerLevel;
+    float levelIndices[simd_float::WIDTH];
+    simd_store(levelIndices, finerLevel);
+    const texture_level* finer[simd_float::WIDTH];
+    const texture_level* coarser[simd_float::WIDTH];
+    for (int lane = 0; lane < simd_float::WIDTH; lane++) {
+        size_t level = size_t(levelIndices[lane]);
+        finer[lane] = &levels[level];
+        coarser[lane] = &levels[std::min(level + 1, levels.size() - 1)];
+    }
+    // Lanes with a weight of 0 keep the finer value, they skip the coarser level.
+    simd_float finerTexels[3];
+    simd_float coarserTexels[3];
+    sample_level(finer, u, v, bits, 3, finerTexels);
+    sample_level(coarser, u, v, bits & simd_bits(weight > ZERO), 3, coarserTexels);
+    for (int c = 0; c < 3; c++) {
+        result[c] = finerTexels[c] + (coarserTexels[c] - finerTexels[c]) * weight;
+    }
+}
+
+void software_rasterizer::sample_level(const texture_level* const* levels, simd_float u, simd_float v, int bits, int channels,
+                                       simd_float* result)
+{
+    const simd_float ZERO = simd_broadcast(0.0f);
+    const simd_float HALF = simd_broadcast(0.5f);
+    float sizes[2][simd_float::WIDTH];
+    for (int lane = 0; lane < simd_float::WIDTH; lane++) {
+        sizes[0][lane] = float(levels[lane]->width);
+        sizes[1][lane] = float(levels[lane]->height);
+    }
+    simd_float width = simd_load(sizes[0]);
+    simd_float height = simd_load(sizes[1]);
+    simd_float s = u * width - HALF;
+    simd_float t = v * height - HALF;
+    simd_float s0 = simd_floor(s);
+    simd_float t0 = simd_floor(t);
+    simd_float fs = s - s0;
+    simd_float ft = t - t0;
+    // Repeat wrapping without integer division. Lanes that end up outside the level, e.g. NaN coordinates, read texel 0.
+    simd_float x0 = s0 - simd_floor(s0 / width) * width;
+    simd_float y0 = t0 - simd_floor(t0 / height) * height;
+    x0 = simd_select((x0 >= ZERO) & (x0 < width), x0, ZERO);
+    y0 = simd_select((y0 >= ZERO) & (y0 < height), y0, ZERO);
+    float columns[simd_float::WIDTH];
+    float rows[simd_float::WIDTH];
+    simd_store(columns, x0);
+    simd_store(rows, y0);
+
+    // Fetch the four texels of each lane: bottom left, bottom right, top left and top right.
+    float texels[4][3][simd_float::WIDTH];
+    for (int lane = 0; lane < simd_float::WIDTH; lane++) {
+        if (!(bits & (1 << lane))) {
+            for (int corner = 0; corner < 4; corner++) {
+                for (int c = 0; c < channels; c++) {
+                    texels[corner][c][lane] = 0.0f;
+                }
+            }
+            continue;
+        }
+        const texture_level& level = *levels[lane];
+        int xa = int(columns[lane]);
+        int xb = xa + 1 < level.width ? xa + 1 : 0;
+        int ya = int(rows[lane]);
+        int yb = ya + 1 < level.height ? ya + 1 : 0;
+        const float* row0 = level.texels.data() + size_t(ya) * level.width * 3;
+        const float* row1 = level.texels.data() + size_t(yb) * level.width * 3;
+        for (int c = 0; c < channels; c++) {
+            texels[0][c][lane] = row0[xa * 3 + c];
+            texels[1][c][lane] = row0[xb * 3 + c];
+            texels[2][c][lane] = row1[xa * 3 + c];
+            texels[3][c][lane] = row1[xb * 3 + c];
+        }
+    }
+    for (int c = 0; c < channels; c++) {
+        simd_float bottomLeft = simd_load(texels[0][c]);
+        simd_float bottomRight = simd_load(texels[1][c]);
+        simd_float topLeft = simd_load(texels[2][c]);
+        simd_float topRight = simd_load(texels[3][c]);
+        simd_float bottom = bottomLeft + (bottomRight - bottomLeft) * fs;
+        simd_float top = topLeft + (topRight - topLeft) * fs;
+        result[c] = bottom + (top - bottom) * ft;
+    }
+}
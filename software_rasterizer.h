@@ -0,0 +1,283 @@
+#pragma once
+
+#include "packed_mesh.h"
+#include "mip_texture.h"
+#include "thread_pool.h"
+#include "simd.h"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * Values of the shader uniforms, see main.vs.
+ */
+struct raster_uniforms
+{
+    glm::mat4 modelMatrix;
+    glm::mat4 cameraMatrix;
+    glm::mat4 projectionMatrix;
+    glm::vec3 lightPosition;
+    glm::vec3 cameraPosition;
+};
+
+/**
+ * Totals of the pixels shaded since the rasterizer was created.
+ */
+struct raster_statistics
+{
+    /**
+     * Number of shaded pixels, including the discarded ones.
+     */
+    uint64_t pixels;
+    /**
+     * Number of texture fetches of all textures and of the displacement texture alone.
+     * A trilinear sample counts as one fetch, like a texture() call in the shaders.
+     */
+    uint64_t fetches;
+    uint64_t displacementFetches;
+};
+
+/**
+ * Renderer on the CPU that draws packed meshes the way main.vs and main.fs do, for machines without a GPU.
+ *
+ * Vertices are transformed in parallel. Triangles are clipped against the near plane, culled if they face away,
+ * and binned into TILE_SIZE x TILE_SIZE tiles of the screen. Tiles are drawn in parallel, one tile by one thread,
+ * with the triangles in the order of the index buffer, so the image does not depend on the number of threads.
+ * Inside a tile, triangles are walked in HIZ_BLOCK_SIZE x HIZ_BLOCK_SIZE blocks. Each block keeps the farthest
+ * depth of its pixels and is skipped if the triangle is behind it. Edge functions, the depth test and the shading
+ * are evaluated for simd_float::WIDTH pixels of a row at once.
+ *
+ * Shading follows the shaders: relaxed cone stepping in the displacement texture, the normal from the normal
+ * texture and ambient, diffuse and specular light. Each lane steps until it reaches the surface and then waits
+ * for the other lanes, like the pixels of a GPU wave. Textures are sampled with trilinear filtering and repeat
+ * wrapping, the level of detail comes from the exact screen space derivatives of the texture coordinates. Texels
+ * are fetched lane by lane and filtered for all lanes at once.
+ * Pixels are sampled once at their centers, the GL path may use multisampling, so edges are harder.
+ *
+ * The frame is stored like glReadPixels returns it with GL_BGR: rows from the bottom, padded to 4 bytes.
+ */
+class software_rasterizer
+{
+public:
+    /**
+     * Side of a screen tile in pixels, a multiple of HIZ_BLOCK_SIZE.
+     */
+    constexpr static int TILE_SIZE = 64;
+    /**
+     * Side of a block of pixels with a common farthest depth, a multiple of simd_float::WIDTH.
+     */
+    constexpr static int HIZ_BLOCK_SIZE = 8;
+
+    /**
+     * Constructor.
+     * @param width Frame width in pixels.
+     * @param height Frame height in pixels.
+     * @param threadCount Number of threads to draw with, 0 means one thread per hardware core.
+     */
+    software_rasterizer(int width, int height, unsigned threadCount = 0);
+    /**
+     * Set a texture sampled by the shading. The texels are copied.
+     * @param usage Texture slot: color, normal or displacement.
+     * @param texture Texture with mip levels in TEXTURE_FORMAT_BGR8.
+     * @return False if the texture is empty or compressed.
+     */
+    bool set_texture(texture_usage usage, const mip_texture& texture);
+    /**
+     * Fill the frame with a color and reset the depth buffer.
+     * @param color Color with components in [0, 1].
+     */
+    void clear(const glm::vec3& color);
+    /**
+     * Draw a level of detail of a mesh. All three textures must be set.
+     * @param mesh Mesh with an index buffer.
+     * @param lod Level of detail.
+     * @param uniforms Transformations and positions.
+     */
+    void draw(const packed_mesh& mesh, size_t lod, const raster_uniforms& uniforms);
+    /**
+     * Return the frame: B, G, R bytes, rows from the bottom padded to 4 bytes.
+     * @return Pixels.
+     */
+    const uint8_t* pixels() const;
+    /**
+     * Return the frame width.
+     * @return Width in pixels.
+     */
+    int width() const;
+    /**
+     * Return the frame height.
+     * @return Height in pixels.
+     */
+    int height() const;
+    /**
+     * Return totals of all draws.
+     * @return Statistics.
+     */
+    const raster_statistics& statistics() const;
+
+private:
+    software_rasterizer(const software_rasterizer&) = delete;
+    software_rasterizer& operator=(const software_rasterizer&) = delete;
+
+    /**
+     * Number of values passed from the vertices to the pixels: UV, light, camera and view directions.
+     */
+    constexpr static int VARYING_COUNT = 11;
+    /**
+     * Number of planes of a triangle: depth, 1 / w and each varying divided by w.
+     */
+    constexpr static int PLANE_COUNT = 2 + VARYING_COUNT;
+
+    /**
+     * One mip level with R, G, B floats per texel.
+     */
+    struct texture_level
+    {
+        int width;
+        int height;
+        std::vector< float > texels;
+    };
+
+    /**
+     * Transformed vertex.
+     */
+    struct vertex_output
+    {
+        /**
+         * Position in clip space.
+         */
+        glm::vec4 position;
+        float varyings[VARYING_COUNT];
+    };
+
+    /**
+     * Triangle ready to be drawn. Values are functions a * x + b * y + c of the pixel center.
+     */
+    struct raster_triangle
+    {
+        /**
+         * Edge functions, positive inside.
+         */
+        float edges[3][3];
+        /**
+         * True for edges that own the pixels exactly on them (top-left rule).
+         */
+        bool ownsEdge[3];
+        float planes[PLANE_COUNT][3];
+        /**
+         * Bounding box of the covered pixels, inclusive.
+         */
+        int minX;
+        int minY;
+        int maxX;
+        int maxY;
+        /**
+         * Nearest depth of the triangle.
+         */
+        float minDepth;
+    };
+
+    /**
+     * Run the vertex shader on a vertex.
+     * @param vertex Packed vertex.
+     * @param mesh Mesh the vertex belongs to.
+     * @param uniforms Uniform values.
+     * @param mv Model-view matrix.
+     * @param mvp Model-view-projection matrix.
+     * @param lightPositionCameraSpace Light position in camera space.
+     * @return Transformed vertex.
+     */
+    static vertex_output shade_vertex(const packed_vertex& vertex, const packed_mesh& mesh, const raster_uniforms& uniforms,
+                                      const glm::mat4& mv, const glm::mat4& mvp, const glm::vec3& lightPositionCameraSpace);
+    /**
+     * Clip a triangle against the near plane, set up the parts and bin them into tiles.
+     * @param a First vertex.
+     * @param b Second vertex.
+     * @param c Third vertex.
+     */
+    void setup_triangle(const vertex_output& a, const vertex_output& b, const vertex_output& c);
+    /**
+     * Set up a triangle whose vertices are in front of the near plane and bin it into tiles.
+     * @param a First vertex.
+     * @param b Second vertex.
+     * @param c Third vertex.
+     */
+    void bin_triangle(const vertex_output& a, const vertex_output& b, const vertex_output& c);
+    /**
+     * Draw the binned triangles of a tile.
+     * @param tile Tile number.
+     */
+    void draw_tile(size_t tile);
+    /**
+     * Run the fragment shader on simd_float::WIDTH pixels of a row.
+     * @param triangle Triangle that covers the pixels.
+     * @param x Pixel centers.
+     * @param y Pixel centers.
+     * @param covered Lanes to shade.
+     * @param color Receives the R, G, B colors.
+     * @param statistics Receives the counts of the pixels.
+     * @return Lanes that are shaded and not discarded.
+     */
+    simd_mask shade_pixels(const raster_triangle& triangle, simd_float x, simd_float y, simd_mask covered, simd_float color[3],
+                           raster_statistics& statistics) const;
+    /**
+     * Sample a texture with trilinear filtering and repeat wrapping, each lane at its own level of detail.
+     * @param levels Mip levels of the texture.
+     * @param u Texture coordinates.
+     * @param v Texture coordinates.
+     * @param lod Level of detail, log2 of the texels per pixel.
+     * @param bits Lanes to sample, bit i for lane i. The other lanes receive 0.
+     * @param result Receives the R, G, B values.
+     */
+    static void sample(const std::vector< texture_level >& levels, simd_float u, simd_float v, simd_float lod, int bits,
+                       simd_float result[3]);
+    /**
+     * Sample a mip level for each lane with bilinear filtering and repeat wrapping.
+     * @param levels Mip level of each lane.
+     * @param u Texture coordinates.
+     * @param v Texture coordinates.
+     * @param bits Lanes to sample, bit i for lane i. The other lanes receive 0.
+     * @param channels Number of channels to sample, starting with R.
+     * @param result Receives the values of the channels.
+     */
+    static void sample_level(const texture_level* const* levels, simd_float u, simd_float v, int bits, int channels,
+                             simd_float* result);
+
+    int m_width;
+    int m_height;
+    /**
+     * Width and height of the depth buffer, rounded up to whole tiles.
+     */
+    int m_paddedWidth;
+    int m_paddedHeight;
+    int m_tilesX;
+    int m_tilesY;
+    /**
+     * Frame in the layout of pixels().
+     */
+    std::vector< uint8_t > m_pixels;
+    size_t m_rowSize;
+    std::vector< float > m_depth;
+    /**
+     * Farthest depth of each block.
+     */
+    std::vector< float > m_blockDepth;
+    /**
+     * Mip levels of the color, normal and displacement textures, indexed by texture_usage.
+     */
+    std::vector< texture_level > m_textures[3];
+    std::vector< vertex_output > m_vertices;
+    std::vector< raster_triangle > m_triangles;
+    /**
+     * Indices of the triangles that touch each tile, in drawing order.
+     */
+    std::vector< std::vector< uint32_t > > m_bins;
+    /**
+     * Counts of each tile in the last draw, added to the totals in tile order.
+     */
+    std::vector< raster_statistics > m_tileStatistics;
+    raster_statistics m_statistics;
+    thread_pool m_pool;
+};
@@ -0,0 +1,272 @@
+#include "tangent_space.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void tangent_space::compute_points(const glm::vec3* positions, const glm::vec2* uvs, const glm::vec3* normals, size_t triangleCount,
+                                   glm::vec3* tangents, glm::vec3* bitangents)
+{
+    if (BLOCK_SIZE == 1) {
+        // Structures of arrays only add copies when there is one lane.
+        compute_points_scalar(positions, uvs, normals, triangleCount, tangents, bitangents);
+        return;
+    }
+    const simd_float ONE = simd_broadcast(1.0f);
+    const simd_float MINUS_ONE = simd_broadcast(-1.0f);
+    const simd_float ZERO = simd_broadcast(0.0f);
+    const simd_float MAX = simd_broadcast(std::numeric_limits< float >::max());
+    for (size_t first = 0; first < triangleCount; first += BLOCK_SIZE) {
+        int count = int(std::min< size_t >(BLOCK_SIZE, triangleCount - first));
+        // Convert the block to structures of arrays. Missing triangles at the end are left zero.
+        block data = {};
+        for (int lane = 0; lane < count; lane++) {
+            size_t i = (first + size_t(lane)) * 3;
+            for (int c = 0; c < 3; c++) {
+                data.edge1[c][lane] = positions[i + 1][c] - positions[i][c];
+                data.edge2[c][lane] = positions[i + 2][c] - positions[i][c];
+            }
+            for (int c = 0; c < 2; c++) {
+                data.deltaUV1[c][lane] = uvs[i + 1][c] - uvs[i][c];
+                data.deltaUV2[c][lane] = uvs[i + 2][c] - uvs[i][c];
+            }
+        }
+        int validLanes = solve(data);
+        for (int lane = 0; lane < count; lane++) {
+            if (!(validLanes & (1 << lane))) {
+                solve_degenerate(data, lane);
+            }
+        }
+        simd_float tx = simd_load(data.tangent[0]);
+        simd_float ty = simd_load(data.tangent[1]);
+        simd_float tz = simd_load(data.tangent[2]);
+        simd_float bx = simd_load(data.bitangent[0]);
+        simd_float by = simd_load(data.bitangent[1]);
+        simd_float bz = simd_load(data.bitangent[2]);
+        // Gather the normals of all points of the block at once, the triangles are read in the memory order.
+        float normal[3][3][BLOCK_SIZE] = {};
+        for (int lane = 0; lane < count; lane++) {
+            const glm::vec3* n = normals + (first + size_t(lane)) * 3;
+            for (int j = 0; j < 3; j++) {
+                normal[j][0][lane] = n[j].x;
+                normal[j][1][lane] = n[j].y;
+                normal[j][2][lane] = n[j].z;
+            }
+        }
+        // The tangent frame is the same for all points of a triangle, but normals are not,
+        // so the Gram-Schmidt process and the handedness fix are done for each point.
+        float tangent[3][3][BLOCK_SIZE];
+        int validPoints[3];
+        for (int j = 0; j < 3; j++) {
+            simd_float nx = simd_load(normal[j][0]);
+            simd_float ny = simd_load(normal[j][1]);
+            simd_float nz = simd_load(normal[j][2]);
+            // Remove the part of the tangent that goes along the normal.
+            simd_float d = nx * tx + ny * ty + nz * tz;
+            simd_float ux = tx - nx * d;
+            simd_float uy = ty - ny * d;
+            simd_float uz = tz - nz * d;
+            simd_float length = ux * ux + uy * uy + uz * uz;
+            simd_mask valid = (length > ZERO) & (length <= MAX);
+            simd_float inverse = ONE / simd_sqrt(length);
+            ux = ux * inverse;
+            uy = uy * inverse;
+            uz = uz * inverse;
+            // Flip the tangent if cross(N, T) goes against the bitangent.
+            simd_float cx = ny * uz - uy * nz;
+            simd_float cy = nz * ux - uz * nx;
+            simd_float cz = nx * uy - ux * ny;
+            simd_mask flip = (cx * bx + cy * by + cz * bz) < ZERO;
+            simd_store(tangent[j][0], simd_select(flip, ux * MINUS_ONE, ux));
+            simd_store(tangent[j][1], simd_select(flip, uy * MINUS_ONE, uy));
+            simd_store(tangent[j][2], simd_select(flip, uz * MINUS_ONE, uz));
+            validPoints[j] = simd_bits(valid);
+        }
+        for (int lane = 0; lane < count; lane++) {
+            size_t i = (first + size_t(lane)) * 3;
+            glm::vec3 bitangent(data.bitangent[0][lane], data.bitangent[1][lane], data.bitangent[2][lane]);
+            for (int j = 0; j < 3; j++) {
+                bitangents[i + j] = bitangent;
+                if (validPoints[j] & (1 << lane)) {
+                    tangents[i + j] = glm::vec3(tangent[j][0][lane], tangent[j][1][lane], tangent[j][2][lane]);
+                } else {
+                    // The tangent goes along the normal, let the scalar code pick another one.
+                    tangents[i + j] = glm::vec3(data.tangent[0][lane], data.tangent[1][lane], data.tangent[2][lane]);
+                    orthogonalize(normals[i + j], tangents[i + j], bitangents[i + j]);
+                }
+            }
+        }
+    }
+}
+
+void tangent_space::compute_points_scalar(const glm::vec3* positions, const glm::vec2* uvs, const glm::vec3* normals, size_t triangleCount,
+                                          glm::vec3* tangents, glm::vec3* bitangents)
+{
+    const float MAX = std::numeric_limits< float >::max();
+    for (size_t i = 0; i < triangleCount * 3; i += 3) {
+        // Solve the same system as solve() does, in the same order of operations.
+        glm::vec3 edge1 = positions[i + 1] - positions[i];
+        glm::vec3 edge2 = positions[i + 2] - positions[i];
+        glm::vec2 deltaUV1 = uvs[i + 1] - uvs[i];
+        glm::vec2 deltaUV2 = uvs[i + 2] - uvs[i];
+        float a = deltaUV1.x * deltaUV2.y;
+        float b = deltaUV1.y * deltaUV2.x;
+        float determinant = a - b;
+        float r = 1.0f / determinant;
+        glm::vec3 tangent = (edge1 * deltaUV2.y - edge2 * deltaUV1.y) * r;
+        glm::vec3 bitangent = (edge2 * deltaUV1.x - edge1 * deltaUV2.x) * r;
+        float tangentLength = glm::dot(tangent, tangent);
+        float bitangentLength = glm::dot(bitangent, bitangent);
+        if (std::abs(determinant) > DEGENERATE_UV_EPSILON * (std::abs(a) + std::abs(b)) && tangentLength > 0.0f && tangentLength <= MAX
+            && bitangentLength > 0.0f && bitangentLength <= MAX) {
+            tangent = tangent * (1.0f / std::sqrt(tangentLength));
+            bitangent = bitangent * (1.0f / std::sqrt(bitangentLength));
+        } else {
+            block data = {};
+            for (int c = 0; c < 3; c++) {
+                data.edge1[c][0] = edge1[c];
+                data.edge2[c][0] = edge2[c];
+            }
+            solve_degenerate(data, 0);
+            tangent = glm::vec3(data.tangent[0][0], data.tangent[1][0], data.tangent[2][0]);
+            bitangent = glm::vec3(data.bitangent[0][0], data.bitangent[1][0], data.bitangent[2][0]);
+        }
+        for (size_t j = 0; j < 3; j++) {
+            tangents[i + j] = tangent;
+            bitangents[i + j] = bitangent;
+        }
+    }
+    // Orthogonalize the tangent of each point in a second pass, which keeps both loops small.
+    for (size_t i = 0; i < triangleCount * 3; i++) {
+        const glm::vec3& n = normals[i];
+        glm::vec3 t = tangents[i] - n * glm::dot(n, tangents[i]);
+        float length = glm::dot(t, t);
+        if (length > 0.0f && length <= MAX) {
+            t = t * (1.0f / std::sqrt(length));
+            tangents[i] = glm::dot(glm::cross(n, t), bitangents[i]) < 0.0f ? t * -1.0f : t;
+        } else {
+            orthogonalize(n, tangents[i], bitangents[i]);
+        }
+    }
+}
+
+void tangent_space::compute_triangles(const glm::vec3* positions, const glm::vec2* uvs, const uint32_t* indices, size_t triangleCount,
+                                      glm::vec3* tangents, glm::vec3* bitangents)
+{
+    for (size_t first = 0; first < triangleCount; first += BLOCK_SIZE) {
+        int count = int(std::min< size_t >(BLOCK_SIZE, triangleCount - first));
+        block data = {};
+        for (int lane = 0; lane < count; lane++) {
+            const uint32_t* triangle = indices + (first + size_t(lane)) * 3;
+            for (int c = 0; c < 3; c++) {
+                data.edge1[c][lane] = positions[triangle[1]][c] - positions[triangle[0]][c];
+                data.edge2[c][lane] = positions[triangle[2]][c] - positions[triangle[0]][c];
+            }
+            for (int c = 0; c < 2; c++) {
+                data.deltaUV1[c][lane] = uvs[triangle[1]][c] - uvs[triangle[0]][c];
+                data.deltaUV2[c][lane] = uvs[triangle[2]][c] - uvs[triangle[0]][c];
+            }
+        }
+        int validLanes = solve(data);
+        for (int lane = 0; lane < count; lane++) {
+            if (validLanes & (1 << lane)) {
+                tangents[first + size_t(lane)] = glm::vec3(data.tangent[0][lane], data.tangent[1][lane], data.tangent[2][lane]);
+                bitangents[first + size_t(lane)] = glm::vec3(data.bitangent[0][lane], data.bitangent[1][lane], data.bitangent[2][lane]);
+            } else {
+                tangents[first + size_t(lane)] = glm::vec3(0.0f);
+                bitangents[first + size_t(lane)] = glm::vec3(0.0f);
+            }
+        }
+    }
+}
+
+void tangent_space::orthogonalize(const glm::vec3& normal, glm::vec3& tangent, glm::vec3& bitangent)
+{
+    const float MAX = std::numeric_limits< float >::max();
+    glm::vec3 t = tangent - normal * glm::dot(normal, tangent);
+    float length = glm::dot(t, t);
+    t = length > 0.0f && length <= MAX ? glm::normalize(t) : perpendicular(normal);
+    length = glm::dot(bitangent, bitangent);
+    bitangent = length > 0.0f && length <= MAX ? glm::normalize(bitangent) : glm::cross(normal, t);
+    if (glm::dot(glm::cross(normal, t), bitangent) < 0.0f) {
+        t = t * -1.0f;
+    }
+    tangent = t;
+}
+
+int tangent_space::solve(block& data)
+{
+    const simd_float ONE = simd_broadcast(1.0f);
+    const simd_float ZERO = simd_broadcast(0.0f);
+    const simd_float MAX = simd_broadcast(std::numeric_limits< float >::max());
+    simd_float e1x = simd_load(data.edge1[0]);
+    simd_float e1y = simd_load(data.edge1[1]);
+    simd_float e1z = simd_load(data.edge1[2]);
+    simd_float e2x = simd_load(data.edge2[0]);
+    simd_float e2y = simd_load(data.edge2[1]);
+    simd_float e2z = simd_load(data.edge2[2]);
+    simd_float du1 = simd_load(data.deltaUV1[0]);
+    simd_float dv1 = simd_load(data.deltaUV1[1]);
+    simd_float du2 = simd_load(data.deltaUV2[0]);
+    simd_float dv2 = simd_load(data.deltaUV2[1]);
+    // We should calcualte tangent (T) and bitangent (B) vectors in the world space that go along texture coordinates.
+    // In other words we should solve a system of equations:
+    //   edge1 = deltaUV1.x * T + deltaUV1.y * B
+    //   edge2 = deltaUV2.x * T + deltaUV2.y * B
+    simd_float a = du1 * dv2;
+    simd_float b = dv1 * du2;
+    simd_float determinant = a - b;
+    simd_float r = ONE / determinant;
+    simd_float tx = (e1x * dv2 - e2x * dv1) * r;
+    simd_float ty = (e1y * dv2 - e2y * dv1) * r;
+    simd_float tz = (e1z * dv2 - e2z * dv1) * r;
+    simd_float bx = (e2x * du1 - e1x * du2) * r;
+    simd_float by = (e2y * du1 - e1y * du2) * r;
+    simd_float bz = (e2z * du1 - e1z * du2) * r;
+    // Normalize vectors.
+    simd_float tangentLength = tx * tx + ty * ty + tz * tz;
+    simd_float bitangentLength = bx * bx + by * by + bz * bz;
+    simd_float tangentInverse = ONE / simd_sqrt(tangentLength);
+    simd_float bitangentInverse = ONE / simd_sqrt(bitangentLength);
+    simd_store(data.tangent[0], tx * tangentInverse);
+    simd_store(data.tangent[1], ty * tangentInverse);
+    simd_store(data.tangent[2], tz * tangentInverse);
+    simd_store(data.bitangent[0], bx * bitangentInverse);
+    simd_store(data.bitangent[1], by * bitangentInverse);
+    simd_store(data.bitangent[2], bz * bitangentInverse);
+    // A zero or almost zero determinant means the texture is not stretched over the triangle,
+    // and a zero or overflown length means the triangle has no area or the division has overflown.
+    // Comparisons with NaN are false, so such lanes are marked as degenerate too.
+    simd_mask valid = (simd_abs(determinant) > simd_broadcast(DEGENERATE_UV_EPSILON) * (simd_abs(a) + simd_abs(b)))
+            & (tangentLength > ZERO) & (tangentLength <= MAX) & (bitangentLength > ZERO) & (bitangentLength <= MAX);
+    return simd_bits(valid);
+}
+
+void tangent_space::solve_degenerate(block& data, int lane)
+{
+    const float MAX = std::numeric_limits< float >::max();
+    glm::vec3 edge1(data.edge1[0][lane], data.edge1[1][lane], data.edge1[2][lane]);
+    glm::vec3 edge2(data.edge2[0][lane], data.edge2[1][lane], data.edge2[2][lane]);
+    // Let the tangent go along the longer edge from the first point and the bitangent complete the frame in the triangle plane.
+    glm::vec3 edge = glm::dot(edge1, edge1) >= glm::dot(edge2, edge2) ? edge1 : edge2;
+    float length = glm::dot(edge, edge);
+    glm::vec3 tangent = length > 0.0f && length <= MAX ? glm::normalize(edge) : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 normal = glm::cross(edge1, edge2);
+    length = glm::dot(normal, normal);
+    normal = length > 0.0f && length <= MAX ? glm::normalize(normal) : perpendicular(tangent);
+    glm::vec3 bitangent = glm::normalize(glm::cross(normal, tangent));
+    for (int c = 0; c < 3; c++) {
+        data.tangent[c][lane] = tangent[c];
+        data.bitangent[c][lane] = bitangent[c];
+    }
+}
+
+glm::vec3 tangent_space::perpendicular(const glm::vec3& v)
+{
+    // Cross the vector with the axis it is the least aligned with.
+    glm::vec3 a = glm::abs(v);
+    glm::vec3 axis = a.x <= a.y && a.x <= a.z ? glm::vec3(1.0f, 0.0f, 0.0f) : (a.y <= a.z ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::vec3 result = glm::cross(v, axis);
+    float length = glm::dot(result, result);
+    return length > 0.0f && length <= std::numeric_limits< float >::max() ? glm::normalize(result) : glm::vec3(1.0f, 0.0f, 0.0f);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "simd.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+/**
+ * Helper class to calculate tangents and bitangents of triangle meshes.
+ *
+ * Triangles are processed in blocks of simd_float::WIDTH triangles stored as structures of arrays,
+ * so one instruction handles the same component of all triangles in the block.
+ * Triangles with degenerate texture coordinates never produce infinite or NaN vectors,
+ * they get a tangent frame built from the geometry instead.
+ */
+class tangent_space
+{
+public:
+    /**
+     * Calculate tangents and bitangents of non-indexed triangles and orthogonalize tangents against the normals.
+     * Each triangle is given by 3 consecutive points.
+     * For each point the tangent is made orthogonal to its normal with the Gram-Schmidt process
+     * and flipped if needed to keep the handedness of the (tangent, bitangent, normal) frame.
+     * @param positions Point positions, 3 per triangle.
+     * @param uvs Point texture coordinates, 3 per triangle.
+     * @param normals Point normals, 3 per triangle.
+     * @param triangleCount Number of triangles.
+     * @param tangents Receives 3 tangents per triangle.
+     * @param bitangents Receives 3 bitangents per triangle.
+     */
+    static void compute_points(const glm::vec3* positions, const glm::vec2* uvs, const glm::vec3* normals, size_t triangleCount,
+                               glm::vec3* tangents, glm::vec3* bitangents);
+    /**
+     * Calculate unit tangents and bitangents of indexed triangles.
+     * Triangles with degenerate texture coordinates get zero vectors, so they do not affect
+     * sums of tangents of their neighbours. orthogonalize() handles vertices that only have such triangles.
+     * @param positions Vertex positions.
+     * @param uvs Vertex texture coordinates.
+     * @param indices Vertex indices, 3 per triangle.
+     * @param triangleCount Number of triangles.
+     * @param tangents Receives one tangent per triangle.
+     * @param bitangents Receives one bitangent per triangle.
+     */
+    static void compute_triangles(const glm::vec3* positions, const glm::vec2* uvs, const uint32_t* indices, size_t triangleCount,
+                                  glm::vec3* tangents, glm::vec3* bitangents);
+    /**
+     * Normalize a bitangent and orthogonalize a tangent against the normal with the Gram-Schmidt process.
+     * Zero vectors, e.g. sums of opposite vectors, are replaced with vectors orthogonal to the normal.
+     * @param normal Unit normal.
+     * @param tangent Tangent. Replaced with a unit tangent orthogonal to the normal.
+     * @param bitangent Bitangent. Replaced with a unit bitangent.
+     */
+    static void orthogonalize(const glm::vec3& normal, glm::vec3& tangent, glm::vec3& bitangent);
+
+private:
+    /**
+     * Number of triangles processed together.
+     */
+    constexpr static int BLOCK_SIZE = simd_float::WIDTH;
+    /**
+     * Determinants of texture coordinate edges smaller than this part of their terms are cancellation noise,
+     * so such triangles are treated as degenerate.
+     */
+    constexpr static float DEGENERATE_UV_EPSILON = 1e-6f;
+
+    /**
+     * Triangle data of a block as structures of arrays.
+     */
+    struct block
+    {
+        /**
+         * Edges from the first point to the second and the third ones in the world space.
+         */
+        float edge1[3][BLOCK_SIZE];
+        float edge2[3][BLOCK_SIZE];
+        /**
+         * The same edges in the texture space.
+         */
+        float deltaUV1[2][BLOCK_SIZE];
+        float deltaUV2[2][BLOCK_SIZE];
+        /**
+         * Calculated unit tangents and bitangents.
+         */
+        float tangent[3][BLOCK_SIZE];
+        float bitangent[3][BLOCK_SIZE];
+    };
+
+    /**
+     * Calculate tangents and bitangents of non-indexed triangles one triangle at a time, then orthogonalize each point.
+     * Used instead of blocks when simd_float has a single lane, the results are the same.
+     * @param positions Point positions, 3 per triangle.
+     * @param uvs Point texture coordinates, 3 per triangle.
+     * @param normals Point normals, 3 per triangle.
+     * @param triangleCount Number of triangles.
+     * @param tangents Receives 3 tangents per triangle.
+     * @param bitangents Receives 3 bitangents per triangle.
+     */
+    static void compute_points_scalar(const glm::vec3* positions, const glm::vec2* uvs, const glm::vec3* normals, size_t triangleCount,
+                                      glm::vec3* tangents, glm::vec3* bitangents);
+    /**
+     * Calculate unit tangents and bitangents of a block from its edges.
+     * @param data Block to process.
+     * @return Bit mask of triangles with valid results. Other triangles are degenerate and their results are undefined.
+     */
+    static int solve(block& data);
+    /**
+     * Build a tangent frame of a triangle whose texture coordinates cannot define one.
+     * @param data Block with the triangle.
+     * @param lane Index of the triangle in the block.
+     */
+    static void solve_degenerate(block& data, int lane);
+    /**
+     * Return a unit vector orthogonal to the given one.
+     * @param v Unit vector.
+     * @return Orthogonal unit vector.
+     */
+    static glm::vec3 perpendicular(const glm::vec3& v);
+};
@@ -0,0 +1,162 @@
+#include "texture_cache.h"
+#include "mapped_file.h"
+
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+mip_texture texture_cache::load(const char* fileName, texture_usage usage, bool compressed, mip_filter filter, unsigned threadCount)
+{
+    // Try to use the cache.
+    texture_format format = compressed ? mip_texture::compressed_format(usage) : TEXTURE_FORMAT_BGR8;
+    mip_texture texture;
+    if (read(fileName, usage, format, filter, texture)) {
+        return texture;
+    }
+    // Read the .bmp file and build the mip levels.
+    bitmap_image image(fileName);
+    if (!image.pixels()) {
+        return mip_texture();
+    }
+    mip_texture built(image, usage, filter, threadCount);
+    if (compressed) {
+        built.compress(threadCount);
+    }
+    // Store it for the next time. Failing to write the cache is not an error.
+    write(fileName, filter, built);
+    return built;
+}
+
+std::string texture_cache::cache_file_name(const char* fileName)
+{
+    return std::string(fileName) + ".tex";
+}
+
+bool texture_cache::read(const char* fileName, texture_usage usage, texture_format format, mip_filter filter, mip_texture& texture)
+{
+    std::string cacheFileName = cache_file_name(fileName);
+    mapped_file file(cacheFileName.c_str());
+    if (file.size() < sizeof(header)) {
+        return false;
+    }
+    // Verify the format.
+    header stored;
+    memcpy(&stored, file.data(), sizeof(header));
+    if (stored.magic != MAGIC || stored.version != VERSION || stored.format != uint32_t(format)
+            || stored.usage != uint32_t(usage) || stored.filter != uint32_t(filter)) {
+        return false;
+    }
+    // Verify that data blocks are inside the file. Sizes are checked by division to not overflow on corrupted values.
+    if (stored.levelOffset < sizeof(header) || stored.levelOffset > file.size()
+            || stored.levelCount == 0 || stored.levelCount > (file.size() - stored.levelOffset) / sizeof(mip_level)
+            || stored.dataOffset < sizeof(header) || stored.dataOffset > file.size() || stored.dataOffset % DATA_ALIGNMENT != 0
+            || stored.dataSize > file.size() - stored.dataOffset) {
+        return false;
+    }
+    // Verify that the .bmp file has not changed. If only its time has changed, compare the content hash.
+    // If the .bmp file does not exist, the cache is used on its own.
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (mapped_file::file_info(fileName, sourceSize, sourceTime) && (sourceSize != stored.sourceSize || sourceTime != stored.sourceTime)) {
+        if (sourceSize != stored.sourceSize) {
+            return false;
+        }
+        mapped_file source(fileName);
+        if (mapped_file::hash(source.data(), source.size()) != stored.sourceHash) {
+            return false;
+        }
+    }
+    // Verify the data.
+    const char* levels = file.data() + stored.levelOffset;
+    const char* data = file.data() + stored.dataOffset;
+    size_t levelBytes = stored.levelCount * sizeof(mip_level);
+    if (mapped_file::hash(data, stored.dataSize, mapped_file::hash(levels, levelBytes)) != stored.dataHash) {
+        return false;
+    }
+    // Verify that levels form a mip chain and lie inside the data.
+    std::vector< mip_level > chain(stored.levelCount);
+    memcpy(chain.data(), levels, levelBytes);
+    for (size_t i = 0; i < chain.size(); i++) {
+        const mip_level& level = chain[i];
+        if (level.width == 0 || level.height == 0 || level.offset > stored.dataSize || level.size > stored.dataSize - level.offset
+                || level.size != mip_texture::level_size(format, level.width, level.height)) {
+            return false;
+        }
+        if (i > 0 && (level.width != uint32_t(mip_generator::next_size(int(chain[i - 1].width)))
+                || level.height != uint32_t(mip_generator::next_size(int(chain[i - 1].height))))) {
+            return false;
+        }
+    }
+    // Point the texture to the mapped data.
+    texture.m_data = reinterpret_cast< const uint8_t* >(data);
+    texture.m_levels.swap(chain);
+    texture.m_format = format;
+    texture.m_usage = usage;
+    texture.m_error = { stored.rmse, stored.psnr };
+    texture.m_file = std::move(file);
+    return true;
+}
+
+bool texture_cache::write(const char* fileName, mip_filter filter, const mip_texture& texture)
+{
+    // Describe the .bmp file.
+    header result;
+    memset(&result, 0, sizeof(result));
+    result.magic = MAGIC;
+    result.version = VERSION;
+    if (!mapped_file::file_info(fileName, result.sourceSize, result.sourceTime)) {
+        return false;
+    }
+    {
+        mapped_file source(fileName);
+        result.sourceHash = mapped_file::hash(source.data(), source.size());
+    }
+    // Describe the texture.
+    size_t levelBytes = texture.levels().size() * sizeof(mip_level);
+    result.format = uint32_t(texture.format());
+    result.usage = uint32_t(texture.usage());
+    result.filter = uint32_t(filter);
+    result.rmse = texture.error().rmse;
+    result.psnr = texture.error().psnr;
+    result.levelCount = uint32_t(texture.levels().size());
+    result.levelOffset = sizeof(header);
+    result.dataOffset = (result.levelOffset + levelBytes + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+    result.dataSize = data_size(texture);
+    result.dataHash = mapped_file::hash(texture.data(), result.dataSize, mapped_file::hash(texture.levels().data(), levelBytes));
+    // Write the file under a temporary name.
+    std::string cacheFileName = cache_file_name(fileName);
+    std::string temporaryFileName = mapped_file::temporary_name(cacheFileName);
+    {
+        std::ofstream ofs(temporaryFileName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!ofs) {
+            return false;
+        }
+        const char padding[DATA_ALIGNMENT] = {};
+        ofs.write(reinterpret_cast< const char* >(&result), sizeof(result));
+        ofs.write(reinterpret_cast< const char* >(texture.levels().data()), levelBytes);
+        ofs.write(padding, result.dataOffset - result.levelOffset - levelBytes);
+        ofs.write(reinterpret_cast< const char* >(texture.data()), result.dataSize);
+        if (!ofs) {
+            ofs.close();
+            std::remove(temporaryFileName.c_str());
+            return false;
+        }
+    }
+    // Replace the old cache. Rename does not overwrite files on all platforms, so remove it first.
+    std::remove(cacheFileName.c_str());
+    if (std::rename(temporaryFileName.c_str(), cacheFileName.c_str()) != 0) {
+        std::remove(temporaryFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+uint64_t texture_cache::data_size(const mip_texture& texture)
+{
+    uint64_t result = 0;
+    for (const mip_level& level : texture.levels()) {
+        result = std::max(result, level.offset + level.size);
+    }
+    return result;
+}
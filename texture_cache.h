@@ -0,0 +1,117 @@
+#pragma once
+
+#include "mip_texture.h"
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Binary cache of textures with precomputed mip levels.
+ * The first load of a .bmp file builds its mip chain and writes it to a cache file next to it.
+ * Later loads map the cache file into memory, so levels go to the GPU without filtering or copying.
+ *
+ * Cache file layout:
+ * | header | mip levels | texels of all levels (aligned to DATA_ALIGNMENT) |
+ * The cache is rebuilt if its version differs from the current one, if it was built for another usage, format or filter,
+ * if the .bmp file has changed or if the data does not match the stored hash.
+ */
+class texture_cache
+{
+public:
+    /**
+     * Load a texture with mip levels for the .bmp file, from the cache if it is valid.
+     * If the cache is missing or stale, read the .bmp file, build the mip levels and write a new cache.
+     * @param fileName The .bmp file.
+     * @param usage How the texture is used, see mip_texture.
+     * @param compressed Compress the levels into the block format of the usage, see mip_texture::compressed_format().
+     * @param filter Filter for color and normal textures.
+     * @param threadCount Number of threads to build and compress mip levels with, 0 means one thread per hardware core.
+     * @return Texture. Empty if the .bmp file cannot be read.
+     */
+    static mip_texture load(const char* fileName, texture_usage usage, bool compressed = false, mip_filter filter = MIP_FILTER_KAISER,
+                            unsigned threadCount = 1);
+    /**
+     * Return name of the cache file of the .bmp file.
+     * @param fileName The .bmp file.
+     * @return Name of the cache file.
+     */
+    static std::string cache_file_name(const char* fileName);
+
+private:
+    /**
+     * First bytes of the cache file.
+     */
+    constexpr static uint32_t MAGIC = 0x54584C47; // "GLXT"
+    /**
+     * Version of the cache format. Must be changed if the format or the filters change.
+     */
+    constexpr static uint32_t VERSION = 3;
+    /**
+     * Alignment of the texel data in the cache file.
+     */
+    constexpr static uint64_t DATA_ALIGNMENT = 64;
+
+    /**
+     * Header of the cache file.
+     */
+    struct header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t format;
+        uint32_t usage;
+        uint32_t filter;
+        uint32_t levelCount;
+        /**
+         * Compression error of the texture, see compression_error.
+         */
+        float rmse;
+        float psnr;
+        uint64_t levelOffset;
+        uint64_t dataOffset;
+        uint64_t dataSize;
+        /**
+         * Size of the .bmp file the cache was built from.
+         */
+        uint64_t sourceSize;
+        /**
+         * Modification time of the .bmp file the cache was built from.
+         */
+        int64_t sourceTime;
+        /**
+         * Hash of the .bmp file content.
+         */
+        uint64_t sourceHash;
+        /**
+         * Hash of the mip levels and the texel data.
+         */
+        uint64_t dataHash;
+    };
+
+    /**
+     * Try to map the cache file and validate it against the .bmp file.
+     * @param fileName The .bmp file.
+     * @param usage Wanted texture usage.
+     * @param format Wanted texel format.
+     * @param filter Wanted filter.
+     * @param texture Texture to receive the mapped data.
+     * @return True if the cache is valid.
+     */
+    static bool read(const char* fileName, texture_usage usage, texture_format format, mip_filter filter, mip_texture& texture);
+    /**
+     * Write the cache file of the .bmp file.
+     * The file is written under a temporary name and renamed, so a partial file is never picked up.
+     * @param fileName The .bmp file.
+     * @param filter Filter the texture is built with.
+     * @param texture Texture to store.
+     * @return True if the cache is written.
+     */
+    static bool write(const char* fileName, mip_filter filter, const mip_texture& texture);
+    /**
+     * Return size of the texel data of all levels.
+     * @param texture Texture.
+     * @return Size in bytes.
+     */
+    static uint64_t data_size(const mip_texture& texture);
+};
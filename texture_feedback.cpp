@@ -0,0 +1,145 @@
+#include "texture_feedback.h"
+#include "render_state.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+texture_feedback::texture_feedback(GLuint program)
+    : m_program(program)
+    , m_lodBiasLocation(program ? glGetUniformLocation(program, "feedbackLodBias") : -1)
+    , m_framebuffer(0)
+    , m_colorBuffer(0)
+    , m_depthBuffer(0)
+    , m_pixelBuffers{ 0, 0 }
+    , m_pixelWidths{ 0, 0 }
+    , m_pixelHeights{ 0, 0 }
+    , m_next(0)
+    , m_width(0)
+    , m_height(0)
+    , m_lodBias(1.0f)
+{
+}
+
+void texture_feedback::destroy()
+{
+    delete_buffers();
+}
+
+bool texture_feedback::resize(int width, int height)
+{
+    int feedbackWidth = std::max(width / DIVISOR, 1);
+    int feedbackHeight = std::max(height / DIVISOR, 1);
+    if (feedbackWidth == m_width && feedbackHeight == m_height) {
+        return true;
+    }
+    delete_buffers();
+    m_width = feedbackWidth;
+    m_height = feedbackHeight;
+
+    // Tile and level of each pixel, and depth so that only visible surfaces ask for tiles.
+    glGenRenderbuffers(1, &m_colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_width, m_height);
+    glGenRenderbuffers(1, &m_depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, m_width, m_height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &m_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(2, m_pixelBuffers);
+    for (GLuint buffer : m_pixelBuffers) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(m_width) * m_height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return complete;
+}
+
+void texture_feedback::begin(render_state& state, int renderWidth, int renderHeight)
+{
+    int width = std::min(std::max(renderWidth / DIVISOR, 1), m_width);
+    int height = std::min(std::max(renderHeight / DIVISOR, 1), m_height);
+    m_pixelWidths[m_next] = width;
+    m_pixelHeights[m_next] = height;
+    state.bind_framebuffer(m_framebuffer);
+    state.viewport(0, 0, width, height);
+    // Pixels without a surface stay 0, which is not a valid tile. glClearBuffer keeps the clear color of the scene.
+    const GLfloat noTile[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    const GLfloat farDepth = 1.0f;
+    glClearBufferfv(GL_COLOR, 0, noTile);
+    glClearBufferfv(GL_DEPTH, 0, &farDepth);
+    state.count_calls(2);
+    // The lower resolution makes the texture coordinates change faster between pixels, the bias moves the level back.
+    state.use_program(m_program);
+    float lodBias = std::log2(float(width) / renderWidth);
+    if (lodBias != m_lodBias) {
+        glUniform1f(m_lodBiasLocation, lodBias);
+        m_lodBias = lodBias;
+        state.count_calls(1);
+    }
+}
+
+void texture_feedback::end(render_state& state)
+{
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[m_next]);
+    glReadPixels(0, 0, m_pixelWidths[m_next], m_pixelHeights[m_next], GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    state.count_calls(3);
+    m_next ^= 1;
+}
+
+const std::vector< tile_id >& texture_feedback::tiles()
+{
+    m_tiles.clear();
+    size_t count = size_t(m_pixelWidths[m_next]) * m_pixelHeights[m_next];
+    if (count == 0) {
+        return m_tiles;
+    }
+    m_pixels.resize(count);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffers[m_next]);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(count * 4), GL_MAP_READ_BIT);
+    if (mapped) {
+        memcpy(m_pixels.data(), mapped, count * 4);
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!mapped) {
+        return m_tiles;
+    }
+    // A pixel holds the column, the row, the level and 255 in its bytes. As a little-endian value it sorts
+    // by level, row and column, so equal tiles become neighbours.
+    std::sort(m_pixels.begin(), m_pixels.end());
+    uint32_t last = 0;
+    for (uint32_t pixel : m_pixels) {
+        if (pixel != last && (pixel >> 24) != 0) {
+            m_tiles.push_back({ (pixel >> 16) & 0xFF, pixel & 0xFF, (pixel >> 8) & 0xFF });
+        }
+        last = pixel;
+    }
+    return m_tiles;
+}
+
+void texture_feedback::delete_buffers()
+{
+    glDeleteFramebuffers(1, &m_framebuffer);
+    GLuint renderbuffers[] = { m_colorBuffer, m_depthBuffer };
+    glDeleteRenderbuffers(sizeof(renderbuffers) / sizeof(renderbuffers[0]), renderbuffers);
+    glDeleteBuffers(2, m_pixelBuffers);
+    m_framebuffer = 0;
+    m_colorBuffer = 0;
+    m_depthBuffer = 0;
+    m_pixelBuffers[0] = 0;
+    m_pixelBuffers[1] = 0;
+    m_pixelWidths[0] = 0;
+    m_pixelWidths[1] = 0;
+    m_pixelHeights[0] = 0;
+    m_pixelHeights[1] = 0;
+    m_width = 0;
+    m_height = 0;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <vector>
+#include <cstdint>
+
+class render_state;
+
+/**
+ * Tile of a virtual texture.
+ */
+struct tile_id
+{
+    uint32_t level;
+    /**
+     * Tile column from the left and row from the bottom.
+     */
+    uint32_t x;
+    uint32_t y;
+};
+
+/**
+ * Feedback pass of a virtual texture. The scene is drawn a second time at 1 / DIVISOR of its resolution with the
+ * feedback program (main.vs, feedback.fs), which writes the tile and the level that the scene samples at each pixel.
+ *
+ * The pixels are read back into one of two pixel buffers, which is mapped when the next pass has been drawn as well,
+ * so reading the feedback does not wait for the GPU to finish the pass. The tiles are therefore two frames old,
+ * which is small next to the time a tile takes to stream in.
+ */
+class texture_feedback
+{
+public:
+    /**
+     * Ratio of the scene resolution to the feedback resolution along each side.
+     */
+    constexpr static int DIVISOR = 8;
+
+    /**
+     * Constructor. Needs a current GL context, buffers are allocated by resize().
+     * @param program Linked feedback program, 0 if the feedback is not used.
+     */
+    texture_feedback(GLuint program);
+    /**
+     * Delete the buffers. Must be called while the GL context is current.
+     */
+    void destroy();
+    /**
+     * Allocate the buffers for a scene size, does nothing if the size has not changed.
+     * Bindings are changed behind the state cache, call render_state::invalidate() afterwards.
+     * @param width Scene width in pixels.
+     * @param height Scene height in pixels.
+     * @return True if the framebuffer is complete.
+     */
+    bool resize(int width, int height);
+    /**
+     * Bind and clear the framebuffer and select the feedback program. The caller then draws the scene.
+     * @param state GL state cache.
+     * @param renderWidth Width the scene is drawn at in this frame.
+     * @param renderHeight Height the scene is drawn at in this frame.
+     */
+    void begin(render_state& state, int renderWidth, int renderHeight);
+    /**
+     * Start reading the pixels of the pass.
+     * @param state GL state cache.
+     */
+    void end(render_state& state);
+    /**
+     * Return the tiles of the pass before the last one. Call it before begin().
+     * @return Tiles sampled by the scene, each once, sorted by level, row and column.
+     */
+    const std::vector< tile_id >& tiles();
+
+private:
+    texture_feedback(const texture_feedback&) = delete;
+    texture_feedback& operator=(const texture_feedback&) = delete;
+
+    /**
+     * Delete the framebuffer and the pixel buffers.
+     */
+    void delete_buffers();
+
+    GLuint m_program;
+    GLint m_lodBiasLocation;
+    GLuint m_framebuffer;
+    GLuint m_colorBuffer;
+    GLuint m_depthBuffer;
+    /**
+     * Pixel buffers that the passes are read into in turn.
+     */
+    GLuint m_pixelBuffers[2];
+    /**
+     * Size of the pixels read into each pixel buffer, 0 if nothing has been read.
+     */
+    int m_pixelWidths[2];
+    int m_pixelHeights[2];
+    /**
+     * Pixel buffer of the next pass.
+     */
+    int m_next;
+    /**
+     * Allocated size.
+     */
+    int m_width;
+    int m_height;
+    /**
+     * Last value of the LOD bias uniform.
+     */
+    float m_lodBias;
+    /**
+     * Tiles of the last mapped pass and the pixels they are collected from.
+     */
+    std::vector< uint32_t > m_pixels;
+    std::vector< tile_id > m_tiles;
+};
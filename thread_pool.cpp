@@ -0,0 +1,112 @@
+#include "thread_pool.h"
+
+#include <memory>
+
+thread_pool::thread_pool(unsigned threadCount)
+    : m_stop(false)
+{
+    if (threadCount == 0) {
+        threadCount = hardware_threads();
+    }
+    // The calling thread is counted as one of the threads.
+    for (unsigned i = 1; i < threadCount; i++) {
+        m_workers.emplace_back(&thread_pool::worker, this);
+    }
+}
+
+thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard< std::mutex > lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    for (std::thread& worker : m_workers) {
+        worker.join();
+    }
+}
+
+unsigned thread_pool::size() const
+{
+    return static_cast< unsigned >(m_workers.size()) + 1;
+}
+
+void thread_pool::parallel_for(size_t count, const std::function< void(size_t begin, size_t end) >& body)
+{
+    size_t parts = size();
+    if (parts > count) {
+        parts = count;
+    }
+    if (parts <= 1) {
+        if (count > 0) {
+            body(0, count);
+        }
+        return;
+    }
+    // Count finished parts to know when to return.
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    size_t done = 0;
+    // Give all parts except the first one to the workers.
+    for (size_t part = 1; part < parts; part++) {
+        size_t begin = count * part / parts;
+        size_t end = count * (part + 1) / parts;
+        enqueue([&, begin, end]() {
+            body(begin, end);
+            std::lock_guard< std::mutex > lock(doneMutex);
+            if (++done == parts - 1) {
+                doneCondition.notify_one();
+            }
+        });
+    }
+    // Process the first part on the calling thread.
+    body(0, count / parts);
+    // Wait for the rest.
+    std::unique_lock< std::mutex > lock(doneMutex);
+    doneCondition.wait(lock, [&]() { return done == parts - 1; });
+}
+
+std::future< void > thread_pool::submit(std::function< void() > task)
+{
+    // std::function needs a copyable target, so the packaged task is shared.
+    auto packaged = std::make_shared< std::packaged_task< void() > >(std::move(task));
+    std::future< void > result = packaged->get_future();
+    if (m_workers.empty()) {
+        (*packaged)();
+    } else {
+        enqueue([packaged]() { (*packaged)(); });
+    }
+    return result;
+}
+
+unsigned thread_pool::hardware_threads()
+{
+    unsigned count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+
+void thread_pool::enqueue(std::function< void() > task)
+{
+    {
+        std::lock_guard< std::mutex > lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_condition.notify_one();
+}
+
+void thread_pool::worker()
+{
+    while (true) {
+        std::function< void() > task;
+        {
+            std::unique_lock< std::mutex > lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if (m_tasks.empty()) {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
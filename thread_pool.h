@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <cstddef>
+
+/**
+ * Helper class that keeps a set of worker threads and runs tasks on them.
+ * The thread that calls parallel_for() also takes part in the work,
+ * so a pool of size 1 does not start any threads and runs everything inline.
+ */
+class thread_pool
+{
+public:
+    /**
+     * Constructor. Start worker threads.
+     * @param threadCount Total number of threads including the calling one.
+     *                    0 means one thread per hardware core.
+     */
+    thread_pool(unsigned threadCount);
+    /**
+     * Destructor. Wait for the queued tasks and stop worker threads.
+     */
+    ~thread_pool();
+    /**
+     * Return the total number of threads including the calling one.
+     * @return Number of threads.
+     */
+    unsigned size() const;
+    /**
+     * Split range [0, count) into size() contiguous parts of almost equal length
+     * and process them in parallel. Return when all parts are processed.
+     * The split only depends on count and size(), so the same input is always split the same way.
+     * @param count Number of elements to process.
+     * @param body Function that processes elements [begin, end).
+     */
+    void parallel_for(size_t count, const std::function< void(size_t begin, size_t end) >& body);
+    /**
+     * Run a task on a worker thread and return without waiting for it.
+     * A pool without workers runs the task on the calling thread before returning.
+     * @param task Task to run.
+     * @return Future that becomes ready when the task is finished.
+     */
+    std::future< void > submit(std::function< void() > task);
+    /**
+     * Return the number of hardware threads, at least 1.
+     * @return Number of hardware threads.
+     */
+    static unsigned hardware_threads();
+
+private:
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    /**
+     * Put a task into the queue and wake up a worker.
+     * @param task Task to run.
+     */
+    void enqueue(std::function< void() > task);
+    /**
+     * Main loop of a worker thread.
+     */
+    void worker();
+
+    /**
+     * Worker threads.
+     */
+    std::vector< std::thread > m_workers;
+    /**
+     * Tasks waiting for a free worker.
+     */
+    std::deque< std::function< void() > > m_tasks;
+    /**
+     * Mutex that protects the task queue.
+     */
+    std::mutex m_mutex;
+    /**
+     * Signaled when a task is added or the pool is stopped.
+     */
+    std::condition_variable m_condition;
+    /**
+     * Set when the pool is being destroyed.
+     */
+    bool m_stop;
+};
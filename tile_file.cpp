@@ -0,0 +1,348 @@
+#include "tile_file.h"
+#include "block_encoder.h"
+#include "mapped_file.h"
+#include "mip_generator.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+tile_file::tile_file()
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+bool tile_file::open(const char* fileName, bool compressed, unsigned threadCount)
+{
+    texture_format format = compressed ? TEXTURE_FORMAT_BC1 : TEXTURE_FORMAT_BGR8;
+    std::string tileFileName = tile_file_name(fileName);
+    m_stream.close();
+    m_levelTiles.clear();
+    memset(&m_header, 0, sizeof(m_header));
+    // Use the existing file if it is valid, otherwise build it and try once more.
+    for (int attempt = 0; attempt < 2; attempt++) {
+        m_stream.clear();
+        m_stream.open(tileFileName.c_str(), std::ios::binary);
+        header stored;
+        if (m_stream && m_stream.read(reinterpret_cast< char* >(&stored), sizeof(stored)) && valid(fileName, format, stored)) {
+            m_header = stored;
+            break;
+        }
+        m_stream.close();
+        if (attempt > 0 || !build(fileName, format, threadCount)) {
+            return false;
+        }
+    }
+    uint32_t first = 0;
+    for (uint32_t level = 0; level < m_header.levelCount; level++) {
+        m_levelTiles.push_back(first);
+        first += tiles_x(level) * tiles_y(level);
+    }
+    m_levelTiles.push_back(first);
+    return true;
+}
+
+std::string tile_file::tile_file_name(const char* fileName)
+{
+    return std::string(fileName) + ".tiles";
+}
+
+texture_format tile_file::format() const
+{
+    return texture_format(m_header.format);
+}
+
+uint32_t tile_file::width() const
+{
+    return m_header.width;
+}
+
+uint32_t tile_file::height() const
+{
+    return m_header.height;
+}
+
+uint32_t tile_file::level_count() const
+{
+    return m_header.levelCount;
+}
+
+uint32_t tile_file::tiles_x(uint32_t level) const
+{
+    return (level_size(m_header.width, level) + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+uint32_t tile_file::tiles_y(uint32_t level) const
+{
+    return (level_size(m_header.height, level) + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+uint32_t tile_file::tile_count() const
+{
+    return m_levelTiles.empty() ? 0 : m_levelTiles.back();
+}
+
+uint32_t tile_file::tile_index(uint32_t level, uint32_t x, uint32_t y) const
+{
+    return m_levelTiles[level] + y * tiles_x(level) + x;
+}
+
+size_t tile_file::tile_bytes() const
+{
+    return size_t(m_header.tileBytes);
+}
+
+bool tile_file::read(uint32_t index, uint8_t* result)
+{
+    m_stream.clear();
+    m_stream.seekg(std::streamoff(m_header.dataOffset + uint64_t(index) * m_header.tileBytes));
+    m_stream.read(reinterpret_cast< char* >(result), std::streamsize(m_header.tileBytes));
+    return bool(m_stream);
+}
+
+bool tile_file::valid(const char* fileName, texture_format format, const header& stored)
+{
+    // Verify the format.
+    if (stored.magic != MAGIC || stored.version != VERSION || stored.format != uint32_t(format) || stored.tileSize != TILE_SIZE
+            || stored.tileBorder != TILE_BORDER || stored.tileBytes != mip_texture::level_size(format, SLOT_SIZE, SLOT_SIZE)
+            || stored.width == 0 || stored.height == 0 || stored.levelCount != count_levels(stored.width, stored.height)
+            || stored.dataOffset < sizeof(header)) {
+        return false;
+    }
+    // Verify that all tiles are inside the file.
+    uint64_t tileCount = 0;
+    for (uint32_t level = 0; level < stored.levelCount; level++) {
+        uint64_t tilesX = (level_size(stored.width, level) + TILE_SIZE - 1) / TILE_SIZE;
+        uint64_t tilesY = (level_size(stored.height, level) + TILE_SIZE - 1) / TILE_SIZE;
+        tileCount += tilesX * tilesY;
+    }
+    uint64_t fileSize;
+    int64_t fileTime;
+    if (!mapped_file::file_info(tile_file_name(fileName).c_str(), fileSize, fileTime)
+            || fileSize < stored.dataOffset + tileCount * stored.tileBytes) {
+        return false;
+    }
+    // Verify that the .bmp file has not changed. If only its time has changed, compare the content hash.
+    // If the .bmp file does not exist, the tiles are used on their own.
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (mapped_file::file_info(fileName, sourceSize, sourceTime) && (sourceSize != stored.sourceSize || sourceTime != stored.sourceTime)) {
+        if (sourceSize != stored.sourceSize) {
+            return false;
+        }
+        mapped_file source(fileName);
+        if (mapped_file::hash(source.data(), source.size()) != stored.sourceHash) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool tile_file::build(const char* fileName, texture_format format, unsigned threadCount)
+{
+    bitmap_image image(fileName);
+    if (!image.pixels()) {
+        return false;
+    }
+    // Describe the .bmp file and the tiles.
+    header result;
+    memset(&result, 0, sizeof(result));
+    result.magic = MAGIC;
+    result.version = VERSION;
+    result.format = uint32_t(format);
+    result.tileSize = TILE_SIZE;
+    result.tileBorder = TILE_BORDER;
+    result.width = uint32_t(image.width());
+    result.height = uint32_t(image.height());
+    if ((result.width + TILE_SIZE - 1) / TILE_SIZE > MAX_TILES || (result.height + TILE_SIZE - 1) / TILE_SIZE > MAX_TILES) {
+        return false;
+    }
+    result.levelCount = count_levels(result.width, result.height);
+    result.tileBytes = mip_texture::level_size(format, SLOT_SIZE, SLOT_SIZE);
+    result.dataOffset = sizeof(header);
+    if (!mapped_file::file_info(fileName, result.sourceSize, result.sourceTime)) {
+        return false;
+    }
+    {
+        mapped_file source(fileName);
+        result.sourceHash = mapped_file::hash(source.data(), source.size());
+    }
+
+    // Write the file under a temporary name. Tiles are written a row of tiles at a time, so memory does not grow with the image.
+    std::string tileFileName = tile_file_name(fileName);
+    std::string temporaryFileName = mapped_file::temporary_name(tileFileName);
+    {
+        std::ofstream ofs(temporaryFileName.c_str(), std::ios::binary | std::ios::trunc);
+        if (!ofs) {
+            return false;
+        }
+        ofs.write(reinterpret_cast< const char* >(&result), sizeof(result));
+        std::vector< level_rows > levels(result.levelCount);
+        uint32_t firstTile = 0;
+        for (uint32_t level = 0; level < result.levelCount; level++) {
+            level_rows& rows = levels[level];
+            rows.width = level_size(result.width, level);
+            rows.height = level_size(result.height, level);
+            rows.lastColumn = float(result.width - ((rows.width - 1) << level)) / float(1u << level);
+            rows.lastRow = float(result.height - ((rows.height - 1) << level)) / float(1u << level);
+            rows.rows.resize(size_t(rows.width) * 3 * SLOT_SIZE);
+            rows.line.resize(size_t(rows.width) * 3);
+            rows.pending.resize(size_t(rows.width) * 3);
+            rows.firstTile = firstTile;
+            rows.tileRow = 0;
+            firstTile += (rows.width + TILE_SIZE - 1) / TILE_SIZE * ((rows.height + TILE_SIZE - 1) / TILE_SIZE);
+        }
+
+        thread_pool pool(threadCount);
+        size_t stride = mip_texture::row_size(SLOT_SIZE);
+        size_t texelBytes = stride * SLOT_SIZE;
+        std::vector< uint8_t > texels(texelBytes * TILES_PER_BATCH);
+        std::vector< uint8_t > blocks(result.tileBytes);
+        // Write the rows of tiles of a level whose rows are all there, a batch of tiles at a time.
+        auto writeTiles = [&](level_rows& rows, uint32_t y) {
+            uint32_t tilesX = (rows.width + TILE_SIZE - 1) / TILE_SIZE;
+            uint32_t tilesY = (rows.height + TILE_SIZE - 1) / TILE_SIZE;
+            while (rows.tileRow < tilesY && y >= std::min(rows.tileRow * TILE_SIZE + TILE_SIZE + TILE_BORDER - 1, rows.height - 1)) {
+                uint64_t tile = rows.firstTile + uint64_t(rows.tileRow) * tilesX;
+                ofs.seekp(std::streamoff(result.dataOffset + tile * result.tileBytes));
+                for (uint32_t first = 0; first < tilesX; first += TILES_PER_BATCH) {
+                    uint32_t batch = std::min(tilesX - first, uint32_t(TILES_PER_BATCH));
+                    pool.parallel_for(batch, [&](size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; i++) {
+                            gather_tile(rows, first + uint32_t(i), rows.tileRow, &texels[i * texelBytes]);
+                        }
+                    });
+                    // The encoder splits each tile between the threads itself.
+                    for (uint32_t i = 0; i < batch; i++) {
+                        if (format == TEXTURE_FORMAT_BC1) {
+                            block_encoder::encode_bc1(pool, &texels[i * texelBytes], stride, SLOT_SIZE, SLOT_SIZE, blocks.data());
+                            ofs.write(reinterpret_cast< const char* >(blocks.data()), std::streamsize(result.tileBytes));
+                        } else {
+                            ofs.write(reinterpret_cast< const char* >(&texels[i * texelBytes]), std::streamsize(texelBytes));
+                        }
+                    }
+                }
+                rows.tileRow++;
+            }
+        };
+
+        // Level 0 keeps the texels of the image, its rows are converted to linear space for the levels above. Columns of a
+        // level only depend on their columns of the level below, so the threads build strips of columns that cover whole
+        // texels of the last level.
+        int bytesPerPixel = image.bytes_per_pixel();
+        uint32_t stripWidth = 1u << (result.levelCount - 1);
+        uint32_t strips = (result.width + stripWidth - 1) / stripWidth;
+        level_rows& base = levels[0];
+        for (uint32_t y = 0; y < result.height; y++) {
+            // Every second row completes a row of the next level, and so on up.
+            uint32_t completed = 0;
+            pool.parallel_for(strips, [&](size_t begin, size_t end) {
+                uint32_t first = uint32_t(begin) * stripWidth;
+                uint32_t last = std::min(uint32_t(end) * stripWidth, base.width);
+                const uint8_t* source = image.row(int(y));
+                uint8_t* target = &base.rows[size_t(y % SLOT_SIZE) * base.width * 3];
+                for (uint32_t x = first; x < last; x++) {
+                    for (int c = 0; c < 3; c++) {
+                        uint8_t value = source[size_t(x) * bytesPerPixel + c];
+                        target[x * 3 + c] = value;
+                        base.line[x * 3 + c] = mip_generator::srgb_to_linear(value);
+                    }
+                }
+                uint32_t level = 0;
+                while (level + 1 < result.levelCount && reduce_row(levels[level], levels[level + 1], y >> level, first >> (level + 1),
+                                                                   level_size(last, level + 1))) {
+                    level++;
+                }
+                if (begin == 0) {
+                    completed = level;
+                }
+            });
+            for (uint32_t level = 0; level <= completed; level++) {
+                writeTiles(levels[level], y >> level);
+            }
+        }
+        if (!ofs) {
+            ofs.close();
+            std::remove(temporaryFileName.c_str());
+            return false;
+        }
+    }
+    // Replace the old file. Rename does not overwrite files on all platforms, so remove it first.
+    std::remove(tileFileName.c_str());
+    if (std::rename(temporaryFileName.c_str(), tileFileName.c_str()) != 0) {
+        std::remove(temporaryFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool tile_file::reduce_row(const level_rows& source, level_rows& target, uint32_t y, uint32_t begin, uint32_t end)
+{
+    // An even row waits for the odd row above it, unless it is the last row.
+    bool paired = (y & 1) != 0;
+    bool waiting = !paired && y + 1 < source.height;
+    std::vector< float >& half = waiting ? target.pending : target.line;
+    // Average pairs of columns, weighted by their footprint, as mip_texture filters color textures in linear space.
+    for (uint32_t x = begin; x < end; x++) {
+        const float* left = &source.line[size_t(x) * 6];
+        float* result = &half[size_t(x) * 3];
+        if (x * 2 + 1 == source.width) {
+            std::copy(left, left + 3, result);
+            continue;
+        }
+        float weight = x * 2 + 2 == source.width ? source.lastColumn : 1.0f;
+        for (int c = 0; c < 3; c++) {
+            result[c] = (left[c] + left[3 + c] * weight) / (1.0f + weight);
+        }
+    }
+    if (waiting) {
+        return false;
+    }
+    // Average the pair of rows the same way.
+    if (paired) {
+        float weight = y + 1 == source.height ? source.lastRow : 1.0f;
+        for (size_t i = size_t(begin) * 3; i < size_t(end) * 3; i++) {
+            target.line[i] = (target.pending[i] + target.line[i] * weight) / (1.0f + weight);
+        }
+    }
+    uint8_t* row = &target.rows[size_t((y / 2) % SLOT_SIZE) * target.width * 3];
+    for (size_t i = size_t(begin) * 3; i < size_t(end) * 3; i++) {
+        row[i] = mip_generator::linear_to_srgb(target.line[i]);
+    }
+    return true;
+}
+
+void tile_file::gather_tile(const level_rows& rows, uint32_t tileX, uint32_t tileY, uint8_t* texels)
+{
+    size_t stride = mip_texture::row_size(SLOT_SIZE);
+    // Columns of the level that the columns of the tile cover.
+    uint32_t columns[SLOT_SIZE];
+    for (uint32_t i = 0; i < SLOT_SIZE; i++) {
+        int64_t x = int64_t(tileX) * TILE_SIZE + i - TILE_BORDER;
+        columns[i] = uint32_t(std::min(std::max< int64_t >(x, 0), int64_t(rows.width) - 1));
+    }
+    for (uint32_t j = 0; j < SLOT_SIZE; j++) {
+        int64_t y = int64_t(tileY) * TILE_SIZE + j - TILE_BORDER;
+        uint32_t levelY = uint32_t(std::min(std::max< int64_t >(y, 0), int64_t(rows.height) - 1));
+        const uint8_t* source = &rows.rows[size_t(levelY % SLOT_SIZE) * rows.width * 3];
+        uint8_t* target = texels + stride * j;
+        for (uint32_t i = 0; i < SLOT_SIZE; i++) {
+            memcpy(target + i * 3, source + size_t(columns[i]) * 3, 3);
+        }
+    }
+}
+
+uint32_t tile_file::count_levels(uint32_t width, uint32_t height)
+{
+    uint32_t level = 0;
+    while (level_size(width, level) > TILE_SIZE || level_size(height, level) > TILE_SIZE) {
+        level++;
+    }
+    return level + 1;
+}
+
+uint32_t tile_file::level_size(uint32_t size, uint32_t level)
+{
+    return uint32_t((uint64_t(size) + (uint64_t(1) << level) - 1) >> level);
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include "mip_texture.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Color texture split into square tiles of all mip levels, stored in a file next to the .bmp file.
+ * A virtual_texture streams the tiles into a cache on the GPU, so the texture never has to fit into memory at once.
+ *
+ * Level L is the image scaled by 1 / 2^L, its width is the image width divided by 2^L and rounded up. Levels are
+ * split into tiles of TILE_SIZE x TILE_SIZE texels, the last level has a single tile. Each tile also keeps
+ * TILE_BORDER texels of its neighbours around it (the edge texels are repeated at the edge of the level), so
+ * bilinear filtering inside a tile never reads texels of another tile. Tiles are stored uncompressed or as BC1 blocks.
+ *
+ * The tiler never holds more than a row of tiles of each level in memory, the .bmp file is mapped and paged in by
+ * the OS. Each texel of level L is the average of its 2^L x 2^L texels of the image in linear space. All levels are
+ * built in one pass over the rows of the image, each row of level L + 1 from two rows of level L. Texels are weighted
+ * by the size of their footprint, which is smaller in the last column and row of odd sizes, so the result is the
+ * same as if each texel was averaged straight from the image.
+ *
+ * Tile file layout:
+ * | header | tiles of level 0, row by row from the bottom | tiles of level 1 | ... |
+ * The file is rebuilt if its version differs from the current one, if it was built for another format or tile size,
+ * or if the .bmp file has changed.
+ */
+class tile_file
+{
+public:
+    /**
+     * Size of a tile in texels without the border. Must match TILE_SIZE of main.fs and feedback.fs.
+     */
+    constexpr static uint32_t TILE_SIZE = 128;
+    /**
+     * Texels of the neighbour tiles kept on each side of a tile. Must match TILE_BORDER of main.fs.
+     */
+    constexpr static uint32_t TILE_BORDER = 4;
+    /**
+     * Size of a stored tile in texels with the border. A multiple of 4, so BC1 blocks do not cross tiles.
+     */
+    constexpr static uint32_t SLOT_SIZE = TILE_SIZE + TILE_BORDER * 2;
+    /**
+     * Largest number of tiles along a side of level 0. texture_feedback reports tile coordinates in 8 bits.
+     */
+    constexpr static uint32_t MAX_TILES = 256;
+
+    /**
+     * Constructor. Create a closed tile file.
+     */
+    tile_file();
+    /**
+     * Open the tile file of a .bmp file. If the file is missing or stale, build it from the .bmp file first.
+     * @param fileName The .bmp file with a color texture.
+     * @param compressed Store tiles as BC1 blocks.
+     * @param threadCount Number of threads to build tiles with, 0 means one thread per hardware core.
+     * @return True if the tile file is open. False if the .bmp file cannot be read or is larger than MAX_TILES tiles.
+     */
+    bool open(const char* fileName, bool compressed, unsigned threadCount = 0);
+    /**
+     * Return name of the tile file of the .bmp file.
+     * @param fileName The .bmp file.
+     * @return Name of the tile file.
+     */
+    static std::string tile_file_name(const char* fileName);
+    /**
+     * Return format of the texels of the tiles.
+     * @return TEXTURE_FORMAT_BGR8 or TEXTURE_FORMAT_BC1.
+     */
+    texture_format format() const;
+    /**
+     * Return size of level 0.
+     * @return Width or height in texels.
+     */
+    uint32_t width() const;
+    uint32_t height() const;
+    /**
+     * Return number of levels, the last level is a single tile.
+     * @return Number of levels, 0 if the file is not open.
+     */
+    uint32_t level_count() const;
+    /**
+     * Return number of tiles along a side of a level.
+     * @param level Level number.
+     * @return Number of tile columns or rows.
+     */
+    uint32_t tiles_x(uint32_t level) const;
+    uint32_t tiles_y(uint32_t level) const;
+    /**
+     * Return number of tiles of all levels.
+     * @return Number of tiles.
+     */
+    uint32_t tile_count() const;
+    /**
+     * Return the number of a tile in the file.
+     * @param level Level number.
+     * @param x Tile column from the left.
+     * @param y Tile row from the bottom.
+     * @return Tile number.
+     */
+    uint32_t tile_index(uint32_t level, uint32_t x, uint32_t y) const;
+    /**
+     * Return size of a stored tile.
+     * @return Size in bytes.
+     */
+    size_t tile_bytes() const;
+    /**
+     * Read a tile. Reads are not synchronized, only one thread may read at a time.
+     * @param index Tile number.
+     * @param result Receives tile_bytes() bytes: SLOT_SIZE rows of texels from the bottom, or BC1 blocks.
+     * @return True if the tile is read.
+     */
+    bool read(uint32_t index, uint8_t* result);
+
+private:
+    tile_file(const tile_file&) = delete;
+    tile_file& operator=(const tile_file&) = delete;
+
+    /**
+     * First bytes of the tile file.
+     */
+    constexpr static uint32_t MAGIC = 0x54564C47; // "GLVT"
+    /**
+     * Version of the tile format. Must be changed if the format or the filter changes.
+     */
+    constexpr static uint32_t VERSION = 1;
+    /**
+     * Number of tiles built in parallel before they are written.
+     */
+    constexpr static uint32_t TILES_PER_BATCH = 16;
+
+    /**
+     * Header of the tile file.
+     */
+    struct header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t format;
+        uint32_t tileSize;
+        uint32_t tileBorder;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+        uint64_t tileBytes;
+        uint64_t dataOffset;
+        /**
+         * Size, modification time and content hash of the .bmp file the tiles were built from.
+         */
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint64_t sourceHash;
+    };
+
+    /**
+     * Rows of a level while the tile file is built. Rows come in from the bottom.
+     */
+    struct level_rows
+    {
+        uint32_t width;
+        uint32_t height;
+        /**
+         * Size of the footprint of the last column and of the last row in the image, relative to the other texels.
+         */
+        float lastColumn;
+        float lastRow;
+        /**
+         * Last SLOT_SIZE rows of B, G, R texels, row y is at y % SLOT_SIZE.
+         */
+        std::vector< uint8_t > rows;
+        /**
+         * Newest row in linear space.
+         */
+        std::vector< float > line;
+        /**
+         * Even row of the level below, halved but still waiting for the odd row.
+         */
+        std::vector< float > pending;
+        /**
+         * Number of the first tile of the level and the next row of tiles to write.
+         */
+        uint32_t firstTile;
+        uint32_t tileRow;
+    };
+
+    /**
+     * Check that the tile file matches the .bmp file and the wanted format.
+     * @param fileName The .bmp file.
+     * @param format Wanted texel format.
+     * @param stored Header of the tile file.
+     * @return True if the file can be used.
+     */
+    static bool valid(const char* fileName, texture_format format, const header& stored);
+    /**
+     * Build the tile file of the .bmp file.
+     * The file is written under a temporary name and renamed, so a partial file is never picked up.
+     * @param fileName The .bmp file.
+     * @param format Texel format.
+     * @param threadCount Number of threads to build tiles with.
+     * @return True if the tile file is written.
+     */
+    static bool build(const char* fileName, texture_format format, unsigned threadCount);
+    /**
+     * Halve columns of the newest row of a level into the next level.
+     * @param source Level of the row, the row is in its line.
+     * @param target Next level.
+     * @param y Row number in the source level.
+     * @param begin First column of the target level.
+     * @param end Column of the target level after the last one.
+     * @return True if a row of the target level is complete, it is then in the line and the rows of the target.
+     */
+    static bool reduce_row(const level_rows& source, level_rows& target, uint32_t y, uint32_t begin, uint32_t end);
+    /**
+     * Copy the texels of a tile from the rows of its level. Texels outside the level repeat the edge.
+     * @param rows Level of the tile, holding all rows the tile covers.
+     * @param tileX Tile column.
+     * @param tileY Tile row.
+     * @param texels Receives SLOT_SIZE rows of B, G, R texels, mip_texture::row_size(SLOT_SIZE) bytes each.
+     */
+    static void gather_tile(const level_rows& rows, uint32_t tileX, uint32_t tileY, uint8_t* texels);
+    /**
+     * Return number of levels of an image size.
+     * @param width Width of level 0.
+     * @param height Height of level 0.
+     * @return Number of levels down to a single tile.
+     */
+    static uint32_t count_levels(uint32_t width, uint32_t height);
+    /**
+     * Return size of a level along one side.
+     * @param size Width or height of level 0.
+     * @param level Level number.
+     * @return Width or height of the level.
+     */
+    static uint32_t level_size(uint32_t size, uint32_t level);
+
+    /**
+     * Open tile file.
+     */
+    std::ifstream m_stream;
+    /**
+     * Header of the open file.
+     */
+    header m_header;
+    /**
+     * Number of the first tile of each level.
+     */
+    std::vector< uint32_t > m_levelTiles;
+};
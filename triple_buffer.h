@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+
+/**
+ * Hands values from one writer thread to one reader thread without locks.
+ *
+ * There are three values: the writer fills the back one, the reader reads the front one and the middle one holds
+ * the latest published value. Publishing swaps the back value with the middle one and reading a new value swaps
+ * the middle one with the front one, each with a single atomic exchange of the middle index. Neither thread ever
+ * waits for the other, the writer may publish several values between two reads, then only the latest is read.
+ */
+template< typename T >
+class triple_buffer
+{
+public:
+    /**
+     * Constructor. All values are default constructed, the front one is read until the first value is published.
+     */
+    triple_buffer()
+        : m_back(0)
+        , m_middle(1)
+        , m_front(2)
+    {
+    }
+    /**
+     * Return the value the writer fills. Writer thread only.
+     * @return Back value.
+     */
+    T& back()
+    {
+        return m_values[m_back];
+    }
+    /**
+     * Publish the back value and take the old middle value as the new back value. Writer thread only.
+     * The new back value holds older data, the writer must fill it completely.
+     * @return True if the old middle value was never read, i.e. it has been dropped.
+     */
+    bool publish()
+    {
+        unsigned old = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel);
+        m_back = old & INDEX;
+        return (old & FRESH) != 0;
+    }
+    /**
+     * Take the latest published value as the front value if there is one that has not been read. Reader thread only.
+     * @return True if the front value is new.
+     */
+    bool acquire()
+    {
+        if ((m_middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+            return false;
+        }
+        unsigned old = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = old & INDEX;
+        return true;
+    }
+    /**
+     * Return the value the reader reads. Reader thread only.
+     * @return Front value.
+     */
+    const T& front() const
+    {
+        return m_values[m_front];
+    }
+
+private:
+    triple_buffer(const triple_buffer&) = delete;
+    triple_buffer& operator=(const triple_buffer&) = delete;
+
+    /**
+     * The middle index keeps the number of the value in the low bits and whether it is unread in FRESH.
+     */
+    constexpr static unsigned INDEX = 3;
+    constexpr static unsigned FRESH = 4;
+
+    T m_values[3];
+    /**
+     * Indices owned by the writer and the reader, and the shared middle index.
+     */
+    unsigned m_back;
+    std::atomic< unsigned > m_middle;
+    unsigned m_front;
+};
@@ -0,0 +1,149 @@
+#include "uniform_ring.h"
+#include "render_state.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+uniform_ring::uniform_ring(size_t frameSize, bool persistent)
+    : m_buffer(0)
+    , m_frameSize(0)
+    , m_alignment(1)
+    , m_mapped(nullptr)
+    , m_fences{}
+    , m_frame(FRAMES - 1)
+    , m_used(0)
+{
+    memset(&m_statistics, 0, sizeof(m_statistics));
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    m_alignment = size_t(std::max(alignment, 1));
+    // Each part starts at a multiple of the alignment as well.
+    m_frameSize = (frameSize + m_alignment - 1) / m_alignment * m_alignment;
+    GLsizeiptr size = GLsizeiptr(m_frameSize * FRAMES);
+
+    // The buffer is managed through the copy binding point, which the state cache does not track.
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    if (persistent && GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+        m_mapped = static_cast< uint8_t* >(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+    }
+    if (!m_mapped) {
+        // Buffer storage is immutable, a failed mapping needs a new buffer for the fallback.
+        if (persistent && GLEW_ARB_buffer_storage) {
+            glDeleteBuffers(1, &m_buffer);
+            glGenBuffers(1, &m_buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        }
+        glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        m_staging.resize(m_frameSize);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void uniform_ring::destroy()
+{
+    for (GLsync& fence : m_fences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+    if (m_mapped) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        m_mapped = nullptr;
+    }
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+}
+
+void uniform_ring::begin_frame()
+{
+    m_frame = (m_frame + 1) % FRAMES;
+    m_used = 0;
+    m_statistics.frames++;
+    GLsync& fence = m_fences[m_frame];
+    if (!fence) {
+        return;
+    }
+    // Only wait if the GPU has not finished the frame that last wrote this part yet.
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+        auto begin = std::chrono::steady_clock::now();
+        const GLuint64 TIMEOUT = 1000000000;
+        do {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, TIMEOUT);
+        } while (result == GL_TIMEOUT_EXPIRED);
+        m_statistics.waits++;
+        m_statistics.waitMilliseconds += std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - begin).count();
+    }
+    glDeleteSync(fence);
+    fence = 0;
+}
+
+bool uniform_ring::write(const void* data, size_t size, GLintptr& offset)
+{
+    size_t begin = (m_used + m_alignment - 1) / m_alignment * m_alignment;
+    if (begin + size > m_frameSize) {
+        return false;
+    }
+    uint8_t* target = m_mapped ? m_mapped + m_frame * m_frameSize + begin : m_staging.data() + begin;
+    memcpy(target, data, size);
+    offset = GLintptr(m_frame * m_frameSize + begin);
+    m_used = begin + size;
+    m_statistics.bytes += size;
+    return true;
+}
+
+void uniform_ring::flush(render_state& state)
+{
+    state.count_upload(m_used);
+    // The persistent mapping is coherent, the values are already visible.
+    if (m_mapped || m_used == 0) {
+        return;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    unsigned calls = 4;
+    if (m_frame == 0) {
+        // Frames before the wrap keep reading the old storage, the driver frees it when they are done.
+        glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(m_frameSize * FRAMES), nullptr, GL_STREAM_DRAW);
+        m_statistics.orphans++;
+        calls++;
+    }
+    // No draw reads this range of the current storage, so the map does not need to synchronize.
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+    void* target = glMapBufferRange(GL_COPY_WRITE_BUFFER, GLintptr(m_frame * m_frameSize), GLsizeiptr(m_used), flags);
+    if (target) {
+        memcpy(target, m_staging.data(), m_used);
+    }
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    state.count_calls(calls);
+}
+
+void uniform_ring::end_frame(render_state& state)
+{
+    if (m_mapped) {
+        m_fences[m_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        state.count_calls(1);
+    }
+}
+
+GLuint uniform_ring::buffer() const
+{
+    return m_buffer;
+}
+
+bool uniform_ring::persistent() const
+{
+    return m_mapped != nullptr;
+}
+
+const ring_statistics& uniform_ring::statistics() const
+{
+    return m_statistics;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+class render_state;
+
+/**
+ * Totals of a uniform_ring since it was created.
+ */
+struct ring_statistics
+{
+    uint64_t frames;
+    uint64_t bytes;
+    /**
+     * Frames that had to wait for the GPU to finish reading their part of the ring, and the time spent waiting
+     * in milliseconds.
+     */
+    uint64_t waits;
+    double waitMilliseconds;
+    /**
+     * Times the storage was replaced by the fallback.
+     */
+    uint64_t orphans;
+};
+
+/**
+ * Uniform buffer that the values of each frame are written into without waiting for the draws of earlier frames.
+ *
+ * The buffer is split into FRAMES parts that frames write in turn, and each frame binds the ranges it has written.
+ * With GL_ARB_buffer_storage the buffer is mapped once, persistently and coherently, so values are copied straight
+ * into it. A fence after the draws of a frame marks when the GPU is done with its part, a frame that comes back to
+ * a part that is still read waits for the fence, which is counted as a stall. With the GPU a frame or two behind,
+ * that does not happen.
+ *
+ * Without the extension, e.g. on plain OpenGL 3.3, values are collected in memory and copied by an unsynchronized
+ * map of the written range before the draws. The storage is orphaned each time the ring wraps, so parts written
+ * since then are never read by earlier frames and no fences are needed.
+ */
+class uniform_ring
+{
+public:
+    /**
+     * Number of frames that write their own part of the ring.
+     */
+    constexpr static unsigned FRAMES = 3;
+
+    /**
+     * Constructor. Needs a current GL context.
+     * @param frameSize Bytes one frame can write, including the padding of each range to the offset alignment.
+     * @param persistent Map the buffer persistently if the driver supports it.
+     */
+    uniform_ring(size_t frameSize, bool persistent);
+    /**
+     * Delete the buffer and the fences. Must be called while the GL context is current.
+     */
+    void destroy();
+    /**
+     * Move to the part of the next frame, waiting until the GPU no longer reads it.
+     */
+    void begin_frame();
+    /**
+     * Write a block of values into the part of the frame.
+     * @param data Values.
+     * @param size Size of the values in bytes.
+     * @param offset Receives the offset of the values in the buffer, to bind them with render_state::bind_uniform_range().
+     * @return False if the part of the frame is full.
+     */
+    bool write(const void* data, size_t size, GLintptr& offset);
+    /**
+     * Make the values written in this frame visible to the draws. Call it before the first draw that reads them.
+     * @param state GL state cache.
+     */
+    void flush(render_state& state);
+    /**
+     * Mark the end of the draws that read the part of the frame.
+     * @param state GL state cache.
+     */
+    void end_frame(render_state& state);
+    /**
+     * Return the buffer.
+     * @return Buffer.
+     */
+    GLuint buffer() const;
+    /**
+     * Return whether the buffer is persistently mapped.
+     * @return True if it is.
+     */
+    bool persistent() const;
+    /**
+     * Return the statistics since the ring was created.
+     * @return Statistics.
+     */
+    const ring_statistics& statistics() const;
+
+private:
+    uniform_ring(const uniform_ring&) = delete;
+    uniform_ring& operator=(const uniform_ring&) = delete;
+
+    GLuint m_buffer;
+    size_t m_frameSize;
+    /**
+     * GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, every block starts at a multiple of it.
+     */
+    size_t m_alignment;
+    /**
+     * Persistently mapped buffer, nullptr with the fallback.
+     */
+    uint8_t* m_mapped;
+    /**
+     * Fence after the draws of each part, 0 if there are none to wait for.
+     */
+    GLsync m_fences[FRAMES];
+    /**
+     * Part of the current frame and bytes written into it.
+     */
+    unsigned m_frame;
+    size_t m_used;
+    /**
+     * Values of the current frame of the fallback, copied into the buffer by flush().
+     */
+    std::vector< uint8_t > m_staging;
+    ring_statistics m_statistics;
+};
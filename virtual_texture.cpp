@@ -0,0 +1,396 @@
+#include "virtual_texture.h"
+#include "render_state.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <cmath>
+#include <cstring>
+
+virtual_texture::virtual_texture(unsigned slotCount, unsigned uploadBudget, GLuint pageTableUnit, GLuint tileCacheUnit)
+    : m_slotCount(slotCount)
+    , m_uploadBudget(std::max(uploadBudget, 1u))
+    , m_pageTableUnit(pageTableUnit)
+    , m_tileCacheUnit(tileCacheUnit)
+    , m_pageTable(0)
+    , m_tileCache(0)
+    , m_slotColumns(0)
+    , m_pageTableChanged(false)
+    , m_frame(0)
+    , m_start(std::chrono::steady_clock::now())
+    , m_reading(NONE)
+    , m_loads(0)
+    , m_bytesRead(0)
+    , m_readMilliseconds(0.0)
+    , m_stop(false)
+{
+    memset(&m_statistics, 0, sizeof(m_statistics));
+}
+
+virtual_texture::~virtual_texture()
+{
+    stop();
+}
+
+bool virtual_texture::open(const char* fileName, bool compressed, render_state& state)
+{
+    if (!m_file.open(fileName, compressed)) {
+        return false;
+    }
+    uint32_t levelCount = m_file.level_count();
+    uint32_t lastLevel = levelCount - 1;
+    uint32_t pinnedCount = m_file.tiles_x(lastLevel) * m_file.tiles_y(lastLevel);
+
+    // Lay the slots out in a square. Slot coordinates go into 8-bit page table entries.
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    unsigned maxColumns = std::min(unsigned(maxTextureSize) / tile_file::SLOT_SIZE, 255u);
+    m_slotCount = std::min(std::max(m_slotCount, pinnedCount + 1), maxColumns * maxColumns);
+    m_slotColumns = unsigned(std::ceil(std::sqrt(double(m_slotCount))));
+    unsigned slotRows = (m_slotCount + m_slotColumns - 1) / m_slotColumns;
+
+    // The tile cache has a single level, tiles of all levels sit side by side and are filtered bilinearly.
+    glGenTextures(1, &m_tileCache);
+    state.activate_texture(m_tileCacheUnit, m_tileCache);
+    GLenum internalFormat = m_file.format() == TEXTURE_FORMAT_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8;
+    glTexImage2D(GL_TEXTURE_2D, 0, GLint(internalFormat), GLsizei(m_slotColumns * tile_file::SLOT_SIZE),
+                 GLsizei(slotRows * tile_file::SLOT_SIZE), 0, GL_BGR, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    // The page table is read with texelFetch. Its levels halve exactly, so level 0 is rounded up to a power of two.
+    uint32_t tableWidth = 1;
+    uint32_t tableHeight = 1;
+    while (tableWidth < m_file.tiles_x(0)) {
+        tableWidth *= 2;
+    }
+    while (tableHeight < m_file.tiles_y(0)) {
+        tableHeight *= 2;
+    }
+    glGenTextures(1, &m_pageTable);
+    state.activate_texture(m_pageTableUnit, m_pageTable);
+    m_pageTableLevels.resize(levelCount);
+    for (uint32_t level = 0; level < levelCount; level++) {
+        glTexImage2D(GL_TEXTURE_2D, GLint(level), GL_RGBA8, GLsizei(std::max(tableWidth >> level, 1u)),
+                     GLsizei(std::max(tableHeight >> level, 1u)), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        m_pageTableLevels[level].assign(size_t(m_file.tiles_x(level)) * m_file.tiles_y(level) * 4, 0);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, GLint(lastLevel));
+
+    uint32_t tileCount = m_file.tile_count();
+    m_tileSlots.assign(tileCount, uint32_t(NONE));
+    m_requestTimes.assign(tileCount, -1.0);
+    m_requestFrames.assign(tileCount, 0);
+    m_missingFrames.assign(tileCount, 0);
+    m_slotTiles.assign(m_slotCount, uint32_t(NONE));
+    m_slotFrames.assign(m_slotCount, 0);
+    m_lruPositions.assign(m_slotCount, m_lru.end());
+
+    // The tiles of the last level are what every other tile falls back to, they stay in the first slots.
+    std::vector< uint8_t > data(m_file.tile_bytes());
+    for (uint32_t slot = 0; slot < pinnedCount; slot++) {
+        uint32_t tile = m_file.tile_index(lastLevel, slot % m_file.tiles_x(lastLevel), slot / m_file.tiles_x(lastLevel));
+        if (!m_file.read(tile, data.data())) {
+            return false;
+        }
+        upload(state, slot, data.data());
+        m_tileSlots[tile] = slot;
+        m_slotTiles[slot] = tile;
+    }
+    for (uint32_t slot = m_slotCount; slot-- > pinnedCount;) {
+        m_freeSlots.push_back(slot);
+    }
+    m_pageTableChanged = true;
+    update_page_table(state);
+
+    m_stop = false;
+    m_reader = std::thread(&virtual_texture::read_tiles, this);
+    return true;
+}
+
+void virtual_texture::destroy()
+{
+    stop();
+    GLuint textures[] = { m_pageTable, m_tileCache };
+    glDeleteTextures(sizeof(textures) / sizeof(textures[0]), textures);
+    m_pageTable = 0;
+    m_tileCache = 0;
+}
+
+void virtual_texture::set_uniforms(render_state& state, GLuint program) const
+{
+    state.use_program(program);
+    glUniform4f(glGetUniformLocation(program, "virtualTextureSize"), float(m_file.width()), float(m_file.height()),
+                float(m_file.level_count()), 1.0f);
+    glUniform1i(glGetUniformLocation(program, "pageTableTexture"), GLint(m_pageTableUnit));
+    glUniform1i(glGetUniformLocation(program, "tileCacheTexture"), GLint(m_tileCacheUnit));
+    state.count_calls(3);
+}
+
+void virtual_texture::update(render_state& state, const std::vector< tile_id >& tiles)
+{
+    m_frame++;
+    m_statistics.frames++;
+    double time = now();
+
+    // Keep the cached tiles and the tiles that missing ones fall back to, collect the missing ones.
+    m_missing.clear();
+    for (const tile_id& id : tiles) {
+        if (id.level >= m_file.level_count() || id.x >= m_file.tiles_x(id.level) || id.y >= m_file.tiles_y(id.level)) {
+            continue;
+        }
+        uint32_t tile = m_file.tile_index(id.level, id.x, id.y);
+        m_statistics.requested++;
+        if (m_tileSlots[tile] != NONE) {
+            m_statistics.hits++;
+            touch(m_tileSlots[tile]);
+            continue;
+        }
+        for (uint32_t level = id.level + 1; level < m_file.level_count(); level++) {
+            uint32_t parent = m_file.tile_index(level, id.x >> (level - id.level), id.y >> (level - id.level));
+            if (m_tileSlots[parent] != NONE) {
+                touch(m_tileSlots[parent]);
+                break;
+            }
+        }
+        if (m_requestTimes[tile] < 0.0) {
+            m_requestTimes[tile] = time;
+            m_requestFrames[tile] = m_frame;
+            m_requested.push_back(tile);
+        }
+        m_missingFrames[tile] = m_frame;
+        m_missing.push_back(tile);
+    }
+    // Levels are stored from the finest one, so the coarsest tiles have the largest numbers and are read first.
+    std::sort(m_missing.begin(), m_missing.end(), std::greater< uint32_t >());
+
+    // Count the slots a tile can go to in this frame. Used slots are at the front of the list, so the count stops at the
+    // first one. When the view needs more tiles than the cache holds, only as many are read as can be written.
+    size_t available = m_freeSlots.size();
+    for (std::list< uint32_t >::reverse_iterator i = m_lru.rbegin(); i != m_lru.rend() && m_slotFrames[*i] != m_frame; ++i) {
+        available++;
+    }
+
+    // Replace the requests of the last frame and take the tiles read since then.
+    std::vector< loaded_tile > uploads;
+    {
+        std::lock_guard< std::mutex > lock(m_mutex);
+        m_queue.clear();
+        for (uint32_t tile : m_missing) {
+            if (m_queue.size() >= available) {
+                break;
+            }
+            bool loaded = std::any_of(m_loaded.begin(), m_loaded.end(), [tile](const loaded_tile& l) { return l.tile == tile; });
+            if (tile != m_reading && !loaded) {
+                m_queue.push_back(tile);
+            }
+        }
+        size_t count = std::min(m_loaded.size(), std::min(size_t(m_uploadBudget), available));
+        std::move(m_loaded.begin(), m_loaded.begin() + count, std::back_inserter(uploads));
+        m_loaded.erase(m_loaded.begin(), m_loaded.begin() + count);
+    }
+    m_condition.notify_all();
+
+    // Write the read tiles into free slots or the slots of the least recently used tiles.
+    for (loaded_tile& loaded : uploads) {
+        uint32_t tile = loaded.tile;
+        if (m_tileSlots[tile] != NONE) {
+            continue;
+        }
+        uint32_t slot = NONE;
+        if (!m_freeSlots.empty()) {
+            slot = m_freeSlots.back();
+            m_freeSlots.pop_back();
+            m_lruPositions[slot] = m_lru.insert(m_lru.begin(), slot);
+        } else if (!m_lru.empty() && m_slotFrames[m_lru.back()] != m_frame) {
+            slot = m_lru.back();
+            m_tileSlots[m_slotTiles[slot]] = NONE;
+            m_statistics.evictions++;
+        }
+        if (slot == NONE) {
+            // Every slot holds a tile of this frame, the cache is too small for the view.
+            m_statistics.dropped++;
+            continue;
+        }
+        upload(state, slot, loaded.data.data());
+        m_tileSlots[tile] = slot;
+        m_slotTiles[slot] = tile;
+        touch(slot);
+        m_pageTableChanged = true;
+        m_statistics.uploads++;
+        if (m_requestTimes[tile] >= 0.0) {
+            double latency = time - m_requestTimes[tile];
+            uint64_t frames = m_frame - m_requestFrames[tile];
+            m_statistics.latencySum += latency;
+            m_statistics.latencyMax = std::max(m_statistics.latencyMax, latency);
+            m_statistics.latencyFrames += frames;
+            m_statistics.latencyMaxFrames = std::max(m_statistics.latencyMaxFrames, frames);
+            m_requestTimes[tile] = -1.0;
+        }
+    }
+    // Tiles that are cached or not asked for any more lose their request time.
+    m_requested.erase(std::remove_if(m_requested.begin(), m_requested.end(), [this](uint32_t tile) {
+        if (m_requestTimes[tile] >= 0.0 && m_missingFrames[tile] == m_frame) {
+            return false;
+        }
+        m_requestTimes[tile] = -1.0;
+        return true;
+    }), m_requested.end());
+    // Give the buffers back to the reader.
+    if (!uploads.empty()) {
+        {
+            std::lock_guard< std::mutex > lock(m_mutex);
+            for (loaded_tile& loaded : uploads) {
+                m_spareBuffers.push_back(std::move(loaded.data));
+            }
+        }
+        m_condition.notify_all();
+    }
+
+    update_page_table(state);
+}
+
+void virtual_texture::bind(render_state& state) const
+{
+    state.bind_texture(m_pageTableUnit, m_pageTable);
+    state.bind_texture(m_tileCacheUnit, m_tileCache);
+}
+
+const tile_file& virtual_texture::file() const
+{
+    return m_file;
+}
+
+unsigned virtual_texture::slot_count() const
+{
+    return m_slotCount;
+}
+
+unsigned virtual_texture::resident_tiles() const
+{
+    return m_slotCount - unsigned(m_freeSlots.size());
+}
+
+streaming_statistics virtual_texture::statistics() const
+{
+    streaming_statistics result = m_statistics;
+    std::lock_guard< std::mutex > lock(m_mutex);
+    result.loads = m_loads;
+    result.bytesRead = m_bytesRead;
+    result.readMilliseconds = m_readMilliseconds;
+    return result;
+}
+
+void virtual_texture::read_tiles()
+{
+    size_t capacity = size_t(m_uploadBudget) * LOADED_FRAMES;
+    std::unique_lock< std::mutex > lock(m_mutex);
+    while (true) {
+        m_condition.wait(lock, [&]() { return m_stop || (!m_queue.empty() && m_loaded.size() < capacity); });
+        if (m_stop) {
+            return;
+        }
+        loaded_tile result;
+        result.tile = m_queue.front();
+        m_queue.pop_front();
+        if (!m_spareBuffers.empty()) {
+            result.data = std::move(m_spareBuffers.back());
+            m_spareBuffers.pop_back();
+        }
+        m_reading = result.tile;
+        lock.unlock();
+
+        // The file is only read by this thread.
+        result.data.resize(m_file.tile_bytes());
+        auto begin = std::chrono::steady_clock::now();
+        bool read = m_file.read(result.tile, result.data.data());
+        double milliseconds = std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - begin).count();
+
+        lock.lock();
+        m_reading = NONE;
+        m_readMilliseconds += milliseconds;
+        if (read) {
+            m_loads++;
+            m_bytesRead += result.data.size();
+            m_loaded.push_back(std::move(result));
+        }
+    }
+}
+
+void virtual_texture::stop()
+{
+    {
+        std::lock_guard< std::mutex > lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    if (m_reader.joinable()) {
+        m_reader.join();
+    }
+}
+
+void virtual_texture::upload(render_state& state, uint32_t slot, const uint8_t* data)
+{
+    state.activate_texture(m_tileCacheUnit, m_tileCache);
+    GLint x = GLint(slot % m_slotColumns * tile_file::SLOT_SIZE);
+    GLint y = GLint(slot / m_slotColumns * tile_file::SLOT_SIZE);
+    GLsizei size = GLsizei(tile_file::SLOT_SIZE);
+    if (m_file.format() == TEXTURE_FORMAT_BC1) {
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, size, size, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GLsizei(m_file.tile_bytes()), data);
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, size, size, GL_BGR, GL_UNSIGNED_BYTE, data);
+    }
+    state.count_calls(1);
+}
+
+void virtual_texture::touch(uint32_t slot)
+{
+    m_slotFrames[slot] = m_frame;
+    // Tiles of the last level are not in the list, they are never evicted.
+    std::list< uint32_t >::iterator position = m_lruPositions[slot];
+    if (position != m_lru.end()) {
+        m_lru.splice(m_lru.begin(), m_lru, position);
+    }
+}
+
+void virtual_texture::update_page_table(render_state& state)
+{
+    if (!m_pageTableChanged) {
+        return;
+    }
+    m_pageTableChanged = false;
+    state.activate_texture(m_pageTableUnit, m_pageTable);
+    // Go from the coarsest level, a tile without a slot takes the entry of the tile that covers it one level up.
+    for (uint32_t level = m_file.level_count(); level-- > 0;) {
+        uint32_t tilesX = m_file.tiles_x(level);
+        uint32_t tilesY = m_file.tiles_y(level);
+        std::vector< uint8_t >& entries = m_pageTableLevels[level];
+        for (uint32_t y = 0; y < tilesY; y++) {
+            for (uint32_t x = 0; x < tilesX; x++) {
+                uint8_t* entry = &entries[(size_t(y) * tilesX + x) * 4];
+                uint32_t slot = m_tileSlots[m_file.tile_index(level, x, y)];
+                if (slot != NONE) {
+                    entry[0] = uint8_t(slot % m_slotColumns);
+                    entry[1] = uint8_t(slot / m_slotColumns);
+                    entry[2] = uint8_t(level);
+                    entry[3] = 255;
+                } else {
+                    const uint8_t* parent = &m_pageTableLevels[level + 1][(size_t(y / 2) * m_file.tiles_x(level + 1) + x / 2) * 4];
+                    memcpy(entry, parent, 4);
+                }
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, GLint(level), 0, 0, GLsizei(tilesX), GLsizei(tilesY), GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+        state.count_calls(1);
+    }
+}
+
+double virtual_texture::now() const
+{
+    return std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - m_start).count();
+}
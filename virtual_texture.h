@@ -0,0 +1,270 @@
+#pragma once
+
+#include "texture_feedback.h"
+#include "tile_file.h"
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <vector>
+#include <deque>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+class render_state;
+
+/**
+ * Totals of the streaming of a virtual_texture since it was opened.
+ */
+struct streaming_statistics
+{
+    uint64_t frames;
+    /**
+     * Tiles the feedback asked for over all frames, and how many of them were in the cache.
+     */
+    uint64_t requested;
+    uint64_t hits;
+    /**
+     * Tiles read from the file, the bytes read and the time spent reading in milliseconds.
+     */
+    uint64_t loads;
+    uint64_t bytesRead;
+    double readMilliseconds;
+    /**
+     * Tiles written into the cache, and tiles that replaced another one.
+     */
+    uint64_t uploads;
+    uint64_t evictions;
+    /**
+     * Loaded tiles thrown away because every slot held a tile used in the same frame.
+     */
+    uint64_t dropped;
+    /**
+     * Time from the first frame that asked for a tile to its upload, summed over the uploads and the largest one,
+     * in milliseconds and in frames.
+     */
+    double latencySum;
+    double latencyMax;
+    uint64_t latencyFrames;
+    uint64_t latencyMaxFrames;
+};
+
+/**
+ * Color texture that is streamed in tiles from a tile_file, so only the tiles that the scene samples are in memory.
+ *
+ * Tiles are kept in slots of the tile cache, a texture of SLOT_SIZE x SLOT_SIZE slots on the GPU. The page table is
+ * a texture with a mip level per level of the tile file and a texel per tile: the slot of the tile and the level of
+ * the tile in the slot. A tile that is not in the cache points to the nearest cached tile of a coarser level, so the
+ * shader always finds texels, only blurrier. The tiles of the last level are loaded when the texture is opened and
+ * are never evicted.
+ *
+ * Each frame update() takes the tiles that texture_feedback has seen. Cached ones and the tiles that missing ones
+ * fall back to are marked as used. Missing ones are handed to a reader thread, coarse levels first, which replaces
+ * the requests of the previous frame, so tiles that went out of view are not read any more. The reader reads tiles
+ * with plain file reads into buffers that are reused. Up to the upload budget of read tiles are written into the
+ * cache per frame, each into a free slot or the slot of the least recently used tile. A tile used in the current
+ * frame is never evicted. If the page table has changed, it is rebuilt and written once.
+ */
+class virtual_texture
+{
+public:
+    /**
+     * Number of frames of uploads that read tiles may wait for, the reader stops until they are uploaded.
+     */
+    constexpr static unsigned LOADED_FRAMES = 2;
+
+    /**
+     * Constructor.
+     * @param slotCount Number of tiles in the cache. Limited to what the largest texture can hold.
+     * @param uploadBudget Largest number of tiles written into the cache per frame.
+     * @param pageTableUnit Texture unit of the page table.
+     * @param tileCacheUnit Texture unit of the tile cache.
+     */
+    virtual_texture(unsigned slotCount, unsigned uploadBudget, GLuint pageTableUnit, GLuint tileCacheUnit);
+    /**
+     * Destructor. Stop the reader thread.
+     */
+    ~virtual_texture();
+    /**
+     * Open the tiles of a .bmp file, building them if needed, create the textures and load the last level.
+     * Needs a current GL context.
+     * @param fileName The .bmp file.
+     * @param compressed Store and cache tiles as BC1 blocks.
+     * @param state GL state cache.
+     * @return True if the texture is ready.
+     */
+    bool open(const char* fileName, bool compressed, render_state& state);
+    /**
+     * Delete the textures and stop the reader thread. Must be called while the GL context is current.
+     */
+    void destroy();
+    /**
+     * Set the uniforms of the virtual texture in a program: the size, the number of levels and the texture units.
+     * @param state GL state cache, the program is selected through it.
+     * @param program Program that samples the virtual texture or writes its feedback.
+     */
+    void set_uniforms(render_state& state, GLuint program) const;
+    /**
+     * Request the tiles the scene samples, upload read tiles and update the page table.
+     * @param state GL state cache.
+     * @param tiles Tiles seen by the feedback pass.
+     */
+    void update(render_state& state, const std::vector< tile_id >& tiles);
+    /**
+     * Bind the page table and the tile cache to their texture units.
+     * @param state GL state cache.
+     */
+    void bind(render_state& state) const;
+    /**
+     * Return the tile file.
+     * @return Tile file.
+     */
+    const tile_file& file() const;
+    /**
+     * Return number of slots of the cache and number of tiles in them.
+     * @return Number of tiles.
+     */
+    unsigned slot_count() const;
+    unsigned resident_tiles() const;
+    /**
+     * Return the statistics since the texture was opened.
+     * @return Statistics.
+     */
+    streaming_statistics statistics() const;
+
+private:
+    virtual_texture(const virtual_texture&) = delete;
+    virtual_texture& operator=(const virtual_texture&) = delete;
+
+    /**
+     * Value of a tile without a slot and of a slot without a tile.
+     */
+    constexpr static uint32_t NONE = ~uint32_t(0);
+
+    /**
+     * Tile read by the reader thread.
+     */
+    struct loaded_tile
+    {
+        uint32_t tile;
+        std::vector< uint8_t > data;
+    };
+
+    /**
+     * Main loop of the reader thread.
+     */
+    void read_tiles();
+    /**
+     * Stop the reader thread and wait for it.
+     */
+    void stop();
+    /**
+     * Write a tile into a slot of the cache.
+     * @param state GL state cache.
+     * @param slot Slot number.
+     * @param data Tile data.
+     */
+    void upload(render_state& state, uint32_t slot, const uint8_t* data);
+    /**
+     * Mark a slot as used in this frame and move it to the front of the LRU list.
+     * @param slot Slot number.
+     */
+    void touch(uint32_t slot);
+    /**
+     * Rebuild the page table and write it.
+     * @param state GL state cache.
+     */
+    void update_page_table(render_state& state);
+    /**
+     * Return time since the texture was created.
+     * @return Time in milliseconds.
+     */
+    double now() const;
+
+    tile_file m_file;
+    unsigned m_slotCount;
+    unsigned m_uploadBudget;
+    GLuint m_pageTableUnit;
+    GLuint m_tileCacheUnit;
+    GLuint m_pageTable;
+    GLuint m_tileCache;
+    /**
+     * Number of slot columns of the tile cache.
+     */
+    unsigned m_slotColumns;
+    /**
+     * Slot of each tile, NONE if the tile is not in the cache.
+     */
+    std::vector< uint32_t > m_tileSlots;
+    /**
+     * Tile in each slot, NONE if the slot is free.
+     */
+    std::vector< uint32_t > m_slotTiles;
+    /**
+     * Frame in which each slot was last used.
+     */
+    std::vector< uint64_t > m_slotFrames;
+    /**
+     * Slots of evictable tiles, the most recently used first, and the position of each slot in the list.
+     */
+    std::list< uint32_t > m_lru;
+    std::vector< std::list< uint32_t >::iterator > m_lruPositions;
+    std::vector< uint32_t > m_freeSlots;
+    /**
+     * Time and frame of the first request of each tile that is not in the cache, negative if it is not requested.
+     */
+    std::vector< double > m_requestTimes;
+    std::vector< uint64_t > m_requestFrames;
+    /**
+     * Tiles with a request time and the missing tiles of the current frame.
+     */
+    std::vector< uint32_t > m_requested;
+    std::vector< uint32_t > m_missing;
+    /**
+     * Frame in which each tile was last missing.
+     */
+    std::vector< uint64_t > m_missingFrames;
+    /**
+     * Page table entries of each level: slot column, slot row, level of the tile in the slot and 255.
+     */
+    std::vector< std::vector< uint8_t > > m_pageTableLevels;
+    bool m_pageTableChanged;
+    uint64_t m_frame;
+    streaming_statistics m_statistics;
+    std::chrono::steady_clock::time_point m_start;
+
+    /**
+     * Mutex that protects the members below, they are shared with the reader thread.
+     */
+    mutable std::mutex m_mutex;
+    /**
+     * Signaled when tiles are requested, uploaded tiles free up space or the reader is stopped.
+     */
+    std::condition_variable m_condition;
+    /**
+     * Tiles to read, the first one next.
+     */
+    std::deque< uint32_t > m_queue;
+    /**
+     * Tile being read, NONE if the reader waits.
+     */
+    uint32_t m_reading;
+    /**
+     * Read tiles waiting for upload.
+     */
+    std::vector< loaded_tile > m_loaded;
+    /**
+     * Buffers of uploaded tiles for the reader to reuse.
+     */
+    std::vector< std::vector< uint8_t > > m_spareBuffers;
+    uint64_t m_loads;
+    uint64_t m_bytesRead;
+    double m_readMilliseconds;
+    bool m_stop;
+    std::thread m_reader;
+};